@@ -0,0 +1,30 @@
+#ifndef SOTN_EDITOR_ALLOC_COUNTER
+#define SOTN_EDITOR_ALLOC_COUNTER
+
+#include <atomic>
+#include "common.h"
+
+
+
+// Heap allocations counted since counting was turned on
+typedef struct AllocCount {
+    uint64_t allocations = 0;                               // Number of allocations
+    uint64_t bytes = 0;                                     // Bytes requested by those allocations
+} AllocCount;
+
+
+
+// Class for counting heap allocations (C++ allocations always, C allocations when the linker wraps malloc)
+class AllocCounter {
+
+    public:
+
+        // Whether allocations of every thread are counted (see GetProcessCount)
+        static std::atomic<bool> enabled;
+
+        static void SetThreadEnabled(bool enable);
+        static AllocCount GetThreadCount();
+        static AllocCount GetProcessCount();
+};
+
+#endif //SOTN_EDITOR_ALLOC_COUNTER
@@ -0,0 +1,91 @@
+#ifndef SOTN_EDITOR_CACHE
+#define SOTN_EDITOR_CACHE
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include "common.h"
+
+
+
+// Bump this whenever the layout of any cached data changes
+const uint CACHE_FORMAT_VERSION = 1;
+
+// Key of entries whose inputs couldn't be hashed (never loaded or saved)
+const uint64_t CACHE_KEY_NONE = 0;
+
+// Magic identifier for processed map cache files ("SMAP")
+const uint MAP_CACHE_MAGIC = 0x50414D53;
+
+// Magic identifier for entity emulation cache files ("SENT")
+const uint ENTITY_CACHE_MAGIC = 0x544E4553;
+
+// Magic identifier for emulator snapshot files ("SSNP")
+const uint SNAPSHOT_CACHE_MAGIC = 0x504E5353;
+
+
+
+// Fully decoded map data that can be turned into textures without any further processing
+typedef struct MapCacheEntry {
+    double decode_time = 0;                                 // Milliseconds spent decoding when the entry was created
+    std::vector<byte> vram;                                 // 512x256 RGBA VRAM texels (F_*.BIN after deswizzling)
+    byte tile_cluts[256][16 * 2] = {};                      // Map tile CLUTs (256 16-color RGB1555 CLUTs)
+    std::vector<byte> tiles;                                // Unique decoded 16x16 RGBA tiles
+    std::vector<byte> tile_empty;                           // Whether each unique tile is fully transparent
+    std::vector<std::vector<uint>> layer_tiles;             // Unique tile index for each tile of each FG/BG layer
+    std::map<uint, std::vector<byte>> entity_graphics;      // Decompressed entity graphics keyed by map address
+} MapCacheEntry;
+
+
+
+// Span of bytes that changed in MIPS RAM
+typedef struct RamDelta {
+    uint offset;                                            // Offset of the span in MIPS RAM
+    std::vector<byte> data;                                 // New contents of the span
+} RamDelta;
+
+// Emulation results of a single room
+typedef struct RoomEntityCacheEntry {
+    uint64_t params_hash = 0;                               // Hash of the room parameters and entity layout
+    std::vector<RamDelta> ram_deltas;                       // RAM changes from the restored save state to the processed entities
+    std::vector<byte> framebuffer_cluts;                    // Indexed CLUT rows (768x16) read back from the framebuffer
+} RoomEntityCacheEntry;
+
+// Emulation results of every room in a map
+typedef struct EntityCacheEntry {
+    std::vector<RoomEntityCacheEntry> rooms;
+} EntityCacheEntry;
+
+
+
+// Class for the persistent on-disk cache of processed data
+class Cache {
+
+    public:
+
+        // Whether the cache should be used at all
+        static bool enabled;
+
+        // Directory where cache files are stored
+        static std::string directory;
+
+        static uint64_t GetKey(const std::vector<std::string>& filenames);
+        static bool LoadMap(uint64_t key, MapCacheEntry* entry);
+        static bool SaveMap(uint64_t key, const MapCacheEntry* entry);
+        static bool LoadEntities(uint64_t key, EntityCacheEntry* entry);
+        static bool SaveEntities(uint64_t key, const EntityCacheEntry* entry);
+        static std::vector<RamDelta> DiffRAM(const byte* base, const byte* cur, uint num_bytes);
+        static bool ApplyDeltas(byte* dst, uint num_bytes, const std::vector<RamDelta>& deltas);
+        static bool LoadSnapshot(uint64_t key);
+        static bool SaveSnapshot(uint64_t key);
+
+
+    private:
+
+        static std::string GetPath(const char* prefix, uint64_t key);
+        static FILE* OpenForWrite(const std::string& path);
+        static bool FinishWrite(FILE* fp, const std::string& path, bool ok);
+};
+
+#endif //SOTN_EDITOR_CACHE
@@ -1,14 +1,34 @@
 #ifndef SOTN_EDITOR_CLUTS
 #define SOTN_EDITOR_CLUTS
 
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
+#include <vector>
+#include <map>
+#include <set>
 #include "common.h"
 
 
 
+// CLUT banks (each bank is a list of 16-color RGB1555 CLUTs)
+const uint CLUT_BANK_GENERIC = 0;                           // Generic CLUTs from F_GAME.BIN (256)
+const uint CLUT_BANK_ITEM = 1;                              // Item CLUTs from DRA.BIN (320)
+const uint CLUT_BANK_MAP = 2;                               // Map tile CLUTs from the bottom of F_*.BIN (256)
+const uint CLUT_BANK_RAM = 3;                               // Emulated CLUT table at CLUT_BASE_ADDR (768)
+const uint CLUT_BANK_COUNT = 4;
+
+// RGBA expansions of a CLUT
+const uint CLUT_FORMAT_OPAQUE = 0;                          // Every color fully opaque (Utils::CLUT_to_RGBA)
+const uint CLUT_FORMAT_SEMI = 1;                            // Semi-transparent colors get an alpha of 0x80 (same as VRAM pixels)
+const uint CLUT_FORMAT_COUNT = 2;
+
+// Kinds of surfaces that reference a CLUT
+const uint CLUT_USER_TILE = 0;                              // Unique map tile (index into Map::unique_tile_keys)
+const uint CLUT_USER_SPRITE_PART = 1;                       // Decoded sprite part (index into Map::sprite_parts)
+
+// Offset of the entity CLUTs within the emulated CLUT table
+const uint CLUT_RAM_ENTITY_OFFSET = 0x200;
+
+
+
 typedef struct ClutEntry {
 	int offset;
 	int count;
@@ -17,13 +37,57 @@ typedef struct ClutEntry {
 
 
 
-// Class for general utilities
+// Surface drawn with a CLUT
+typedef struct ClutUser {
+    uint type;                                              // Kind of surface (CLUT_USER_*)
+    uint index;                                             // Index of the surface within its owner
+
+    bool operator<(const ClutUser& other) const {
+        return type != other.type ? type < other.type : index < other.index;
+    }
+} ClutUser;
+
+
+
+// Palette data and everything derived from it for one bank
+typedef struct ClutBank {
+    std::vector<ushort> colors;                             // 16 RGB1555 colors per CLUT
+    std::vector<uint> versions;                             // Incremented every time a CLUT changes
+    std::vector<byte> rgba[CLUT_FORMAT_COUNT];              // Cached RGBA expansions (16 colors per CLUT)
+    std::vector<uint> rgba_versions[CLUT_FORMAT_COUNT];     // Version each expansion was made from
+    TextureId textures[CLUT_FORMAT_COUNT] = {0};            // Whole bank as a (count x 16) texture
+    uint texture_counts[CLUT_FORMAT_COUNT] = {0};           // Number of CLUTs each texture was created for
+    std::vector<uint> texture_versions[CLUT_FORMAT_COUNT];  // Version each CLUT in the texture was made from
+    std::map<uint, std::set<ClutUser>> users;               // Surfaces that reference each CLUT
+} ClutBank;
+
+
+
+// Class for managing every CLUT the editor knows about
 class Clut {
 
 	public:
 
+        static void Reset(uint bank, uint count);
+        static uint Set(uint bank, uint first, uint count, const byte* data);
+        static uint GetCount(uint bank);
+        static uint GetVersion(uint bank, uint index);
+        static const ushort* GetColors(uint bank, uint index);
+        static const byte* GetRGBA(uint bank, uint index, uint format);
+        static void AddUser(uint bank, uint index, const ClutUser& user);
+        static void ClearUsers(uint type);
+        static std::vector<ClutUser> TakeDirtyUsers();
+
+        // Bank textures for display (cluts_gl.cpp, only available to the GL layer)
+        static TextureId GetTexture(uint bank, uint format);
+
 	private:
 
+        // Every CLUT bank
+        static ClutBank banks[CLUT_BANK_COUNT];
+
+        // Surfaces referencing a CLUT that changed since they were last collected
+        static std::set<ClutUser> dirty_users;
 };
 
-#endif //SOTN_EDITOR_CLUTS
\ No newline at end of file
+#endif //SOTN_EDITOR_CLUTS
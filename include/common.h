@@ -13,6 +13,9 @@ typedef unsigned char       byte;
 typedef int64_t int64;
 typedef uint8_t uint8;
 
+// Handle of a texture created by the GL layer (same as a GLuint, the core never dereferences it)
+typedef uint TextureId;
+
 // DRA.BIN address offsets
 const uint WEAPON_NAMES_DESC_ADDR = 0x000A4B04;
 const uint EQUIP_NAMES_DESC_ADDR = 0x000A7718;
@@ -23,6 +26,7 @@ const uint ENEMY_NAMES_ADDR = 0x000E05D8;
 const uint ENEMY_DATA_ADDR = 0x000A8900;
 const uint MAIN_FUNC_ADDR = 0x000E3988;                 // Main function in DRA.BIN
 const uint MAIN_FUNC_LOOP_ADDR = 0x000E4100;            // do...while(true) loop in main function
+const uint CLUT_SETUP_FUNC_ADDR = 0x000EAD7C;           // Populates the CLUTs in RAM before a room's entities run
 
 // Alucard entity address
 const uint ALUCARD_ENTITY_ADDR = 0x000733D8;
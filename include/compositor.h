@@ -0,0 +1,56 @@
+#ifndef SOTN_EDITOR_COMPOSITOR
+#define SOTN_EDITOR_COMPOSITOR
+
+#include <vector>
+#include "common.h"
+#include "gpu.h"
+
+
+
+// Forward declarations (map.h includes everything the compositor reads)
+class Map;
+class Room;
+struct EntitySpritePart;
+struct PolygonLayer;
+
+
+
+// RGBA image of a whole room
+typedef struct CompositeImage {
+    uint width = 0;
+    uint height = 0;
+    std::vector<uint> pixels;                               // RGBA pixels (red in the lowest byte)
+} CompositeImage;
+
+
+
+// Corner of a sprite part placed in a room
+typedef struct CompositeVertex {
+    float x = 0;                                            // Position within the room
+    float y = 0;
+    float u = 0;                                            // Position within the part's pixels (0-1)
+    float v = 0;
+} CompositeVertex;
+
+
+
+// Class for drawing rooms into RGBA images on the CPU
+class Compositor {
+
+    public:
+
+        static void BlendRow(uint* dst, const uint* src, uint count, uint blend_mode, bool blend_opaque);
+        static CompositeImage RenderRoom(const Map* map, const Room* room);
+        static std::vector<CompositeImage> RenderRooms(const Map* map, const std::vector<uint>& room_ids);
+
+
+    private:
+
+        static uint BlendPixel(uint back, uint front, uint blend_mode);
+        static void DrawLayer(CompositeImage* image, const Map* map, const Room* room, bool foreground);
+        static void DrawSprite(CompositeImage* image, const Map* map, const EntitySpritePart& sprite);
+        static void DrawPolygons(CompositeImage* image, const PolygonLayer& layer);
+        static void DrawQuad(CompositeImage* image, const CompositeVertex* vertices, const byte* pixels, uint width, uint height, uint blend_mode, bool blend_opaque);
+};
+
+#endif //SOTN_EDITOR_COMPOSITOR
@@ -1,23 +1,55 @@
+#include <vector>
+#include <string>
 #include "common.h"
 
 
 
+// Number of entries in the dictionary at the start of every compressed block
+const uint COMPRESSION_DICTIONARY_SIZE = 8;
+
+// Minimum number of nibbles that can be produced by each run opcode
+const uint COMPRESSION_SHORT_RUN_MIN = 3;
+const uint COMPRESSION_LONG_RUN_MIN = 19;
+
+
+
+// Opcodes of the compressed stream
+const byte COMPRESSION_OP_LONG_ZERO_RUN = 0x0;
+const byte COMPRESSION_OP_LITERAL_1 = 0x1;
+const byte COMPRESSION_OP_DOUBLE = 0x2;
+const byte COMPRESSION_OP_LITERAL_2 = 0x3;
+const byte COMPRESSION_OP_LITERAL_3 = 0x4;
+const byte COMPRESSION_OP_RUN = 0x5;
+const byte COMPRESSION_OP_ZERO_RUN = 0x6;
+const byte COMPRESSION_OP_DICTIONARY = 0x7;
+const byte COMPRESSION_OP_END = 0xF;
+
+
+
+// One opcode chosen by the encoder
+typedef struct CompressionToken {
+    byte opcode;                                            // Opcode nibble (0x0-0xE)
+    ushort length;                                          // Number of nibbles the opcode produces
+    uint position;                                          // Position of the first produced nibble
+} CompressionToken;
+
+
+
 // Class for compression utilities
 class Compression {
 	
     public:
 
-    	static uint Decompress(byte* dst, byte* src);
+        static bool Decompress(byte* dst, uint dst_size, const byte* src, uint src_size, uint* num_written = nullptr, uint* src_used = nullptr);
+        static std::vector<byte> Compress(const byte* src, uint num_bytes);
+        static std::vector<std::vector<byte>> CompressBlocks(const std::vector<std::vector<byte>>& blocks);
+        static bool VerifyRoundTrip(const std::string& filename, std::vector<uint>* failed_blocks);
 
 
 
 	private:
 
-		static bool read_high;
-		static bool write_high;
-		static byte* decompress_buffer;
-		static byte* offset;
-
-		static byte ReadFromCompressedBuffer();
-		static void AppendToDecompressedBuffer(byte new_char);
+        static bool Decode(byte* dst, uint dst_size, const byte* src, uint src_size, uint* num_nibbles, uint* src_used);
+        static uint Parse(const std::vector<byte>& nibbles, const byte* dictionary, std::vector<CompressionToken>* tokens);
+        static void ChooseDictionary(const std::vector<byte>& nibbles, byte* dictionary, std::vector<CompressionToken>* tokens);
 };
@@ -0,0 +1,99 @@
+#ifndef SOTN_EDITOR_DISC
+#define SOTN_EDITOR_DISC
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <filesystem>
+#include <mutex>
+#include <cstdio>
+#include "common.h"
+
+
+
+// Size of the user data in a Mode 1 / Mode 2 Form 1 sector
+const uint DISC_SECTOR_SIZE = 2048;
+
+// Size of a raw sector including sync, header and error correction data
+const uint DISC_RAW_SECTOR_SIZE = 2352;
+
+// Sector of the ISO9660 primary volume descriptor
+const uint DISC_PVD_SECTOR = 16;
+
+// Maximum number of sectors kept in the sector cache (8 MB of user data)
+const uint DISC_SECTOR_CACHE_SIZE = 4096;
+
+// Number of sectors read from the image at once when the cache misses
+const uint DISC_READ_AHEAD = 16;
+
+// Number of sectors processed at once when regenerating the EDC/ECC of the whole image
+const uint DISC_REBUILD_BATCH = 8192;
+
+
+
+// File or directory on the mounted disc
+typedef struct DiscEntry {
+    uint lba;                                               // First sector of the entry
+    uint size;                                              // Size of the entry in bytes
+    bool is_dir;                                            // Whether the entry is a directory
+    uint record_lba;                                        // Sector of the directory record describing the entry
+    uint record_offset;                                     // Offset of the directory record within that sector
+} DiscEntry;
+
+
+
+// Class for reading files straight out of a PSX disc image (BIN/CUE or ISO)
+class Disc {
+
+    public:
+
+        static bool Mount(const char* filename);
+        static void Unmount();
+        static bool IsMounted();
+        static std::string GetImagePath();
+        static std::string GetPath(const std::string& iso_path);
+        static bool Contains(const char* filename);
+        static bool Stat(const char* filename, size_t* size, std::filesystem::file_time_type* write_time);
+        static bool ReadFile(const char* filename, std::vector<byte>* out);
+        static std::vector<std::string> ListDirectory(const char* dirname);
+        static std::vector<std::string> FindMaps();
+        static std::string FindExecutable();
+        static bool PatchFiles(const std::map<std::string, std::vector<byte>>& files);
+        static bool RebuildECC();
+
+
+    private:
+
+        // Image file and how its sectors are laid out
+        static FILE* image;
+        static std::string image_path;
+        static std::string image_bin_path;
+        static bool image_writable;
+        static std::filesystem::file_time_type image_write_time;
+        static uint sector_size;
+        static uint data_offset;
+        static uint num_sectors;
+
+        // Every file and directory on the disc keyed by upper-case ISO path (e.g. "ST/NO0/NO0.BIN")
+        static std::map<std::string, DiscEntry> entries;
+
+        // Least recently used cache of sector user data
+        static std::list<uint> lru_sectors;
+        static std::unordered_map<uint, std::pair<std::vector<byte>, std::list<uint>::iterator>> sector_cache;
+
+        // Guards the image and the sector cache (maps are loaded from a worker thread)
+        static std::recursive_mutex mutex;
+
+        static bool ParseCue(const std::string& cue_path, std::string* bin_path, uint* track_sector_size, uint* track_data_offset);
+        static bool DetectLayout();
+        static bool ParseDirectory(const std::string& prefix, uint lba, uint size, uint depth);
+        static const byte* ReadSector(uint lba);
+        static bool ResolvePath(const char* filename, std::string* iso_path);
+        static bool OpenForWrite();
+        static byte ReadSubmode(uint lba);
+        static bool WriteSectors(uint lba, const byte* user_data, uint count, const std::vector<byte>& submodes);
+};
+
+#endif //SOTN_EDITOR_DISC
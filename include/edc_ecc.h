@@ -0,0 +1,43 @@
+#ifndef SOTN_EDITOR_EDC_ECC
+#define SOTN_EDITOR_EDC_ECC
+
+#include "common.h"
+
+
+
+// Offsets within a raw 2352-byte sector
+const uint SECTOR_HEADER_OFFSET = 0x00C;
+const uint SECTOR_SUBHEADER_OFFSET = 0x010;
+const uint SECTOR_MODE1_EDC_OFFSET = 0x810;
+const uint SECTOR_FORM1_EDC_OFFSET = 0x818;
+const uint SECTOR_FORM2_EDC_OFFSET = 0x92C;
+const uint SECTOR_ECC_P_OFFSET = 0x81C;
+const uint SECTOR_ECC_Q_OFFSET = 0x8C8;
+
+// Mode 2 subheader submode flags
+const byte SUBMODE_EOR = 0x01;
+const byte SUBMODE_DATA = 0x08;
+const byte SUBMODE_FORM2 = 0x20;
+const byte SUBMODE_EOF = 0x80;
+
+
+
+// Class for CD-ROM error detection / correction codes of raw sectors
+class EdcEcc {
+
+    public:
+
+        static uint ComputeEDC(const byte* data, uint num_bytes, uint edc = 0);
+        static void WriteHeader(byte* sector, uint lba, byte submode);
+        static void EncodeSector(byte* sector);
+        static void EncodeSectors(byte* sectors, uint count);
+
+
+    private:
+
+        static void InitTables();
+        static void ComputeECCBlock(const byte* src, uint major_count, uint minor_count, uint major_mult, uint minor_inc, byte* dst);
+        static void GenerateECC(byte* sector, bool zero_address);
+};
+
+#endif //SOTN_EDITOR_EDC_ECC
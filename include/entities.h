@@ -5,10 +5,6 @@
 #include <vector>
 #include <map>
 #include <variant>
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
 #include "common.h"
 
 
@@ -265,7 +261,7 @@ typedef struct EntitySpritePart {
     short offset_y = 0;
     ushort width = 0;
     ushort height = 0;
-    GLuint texture = 0;
+    TextureId texture = 0;
     bool flip_x = false;
     bool flip_y = false;
     bool blend = false;
@@ -334,7 +330,7 @@ class Entity {
         std::vector<EntitySpritePart> sprites;
 
         // Complete entity texture
-        GLuint texture = 0;
+        TextureId texture = 0;
         uint texture_width = 0;
         uint texture_height = 0;
 
@@ -0,0 +1,76 @@
+#ifndef SOTN_EDITOR_FRAME_PROFILER
+#define SOTN_EDITOR_FRAME_PROFILER
+
+#include <chrono>
+#include "common.h"
+#include "alloc_counter.h"
+
+
+
+// Parts of a frame that are timed on their own (in the order they're built)
+enum PROFILER_SECTION {
+    ProfilerSection_Properties = 0,
+    ProfilerSection_MainViewport = 1,
+    ProfilerSection_VRAMViewer = 2,
+    ProfilerSection_Render = 3,
+    ProfilerSection_Count = 4
+};
+
+// Number of frames kept for the history graphs
+const uint PROFILER_HISTORY_SIZE = 240;
+
+
+
+// Counters and timings of a single frame
+typedef struct FrameStats {
+    float frame_ms = 0;                                     // CPU time from the start of the frame until it was submitted
+    float interval_ms = 0;                                  // Time since the previous frame started (includes waiting on vsync)
+    float section_ms[ProfilerSection_Count] = {};           // Time spent building (or rendering) each section
+    uint draw_commands = 0;                                 // Draw commands submitted to the backend (callbacks included)
+    uint texture_binds = 0;                                 // Draw commands that bind a texture (every non-callback command)
+    uint texture_changes = 0;                               // Binds whose texture differs from the previous command's
+    uint callbacks = 0;                                     // Callback commands (blend mode changes)
+    uint vertices = 0;                                      // Vertices submitted
+    uint sprites_drawn = 0;                                 // Entity sprite parts inside the viewport
+    uint sprites_culled = 0;                                // Entity sprite parts outside the viewport (clipped by ImGui)
+    uint allocations = 0;                                   // Heap allocations the render thread made during the frame
+    uint64_t allocated_bytes = 0;                           // Bytes requested by those allocations
+} FrameStats;
+
+
+
+// Forward declarations
+struct ImDrawData;
+
+
+
+// Class for measuring where the time of each GUI frame goes and showing it in an overlay
+class FrameProfiler {
+
+    public:
+
+        // Whether the overlay is shown (counters are only collected while it is)
+        static bool enabled;
+
+        static void BeginFrame();
+        static void EndFrame(const ImDrawData* draw_data);
+        static void BeginSection(uint section);
+        static void EndSection(uint section);
+        static void CountSprite(bool visible);
+        static void DrawOverlay();
+
+
+    private:
+
+        static FrameStats current;
+        static FrameStats history[PROFILER_HISTORY_SIZE];
+        static uint history_pos;
+        static uint history_count;
+        static std::chrono::steady_clock::time_point frame_start;
+        static std::chrono::steady_clock::time_point section_start[ProfilerSection_Count];
+        static AllocCount frame_allocations;
+
+        static void CountDrawData(const ImDrawData* draw_data, FrameStats* stats);
+};
+
+#endif //SOTN_EDITOR_FRAME_PROFILER
@@ -0,0 +1,40 @@
+#ifndef SOTN_EDITOR_GAME_LOADER
+#define SOTN_EDITOR_GAME_LOADER
+
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "common.h"
+
+
+
+// Game files needed to load maps without the editor
+typedef struct GameFiles {
+    std::string disc_path;                                  // Disc image (empty when reading an extracted directory)
+    std::string psx_path;                                   // PSX executable (SLUS_000.67)
+    std::string bin_path;                                   // SotN binary (DRA.BIN)
+    std::string gfx_path;                                   // Common graphics (F_GAME.BIN)
+    std::vector<std::string> maps;                          // Map files that have an F_ graphics file next to them
+} GameFiles;
+
+
+
+// Class for locating the game files and preparing the emulator for the headless tools
+class GameLoader {
+
+    public:
+
+        static bool FindFiles(const char* input, GameFiles* files);
+        static std::string FindFile(const std::filesystem::path& dir, const std::string& relative_path);
+        static std::string FindMapGraphics(const std::string& map_path);
+        static bool BootEmulator(const GameFiles& files);
+        static bool LoadGenericGraphics(const GameFiles& files);
+
+
+    private:
+
+        static bool FindDiscFiles(const char* filename, GameFiles* files);
+        static bool FindDirectoryFiles(const char* dirname, GameFiles* files);
+};
+
+#endif //SOTN_EDITOR_GAME_LOADER
@@ -0,0 +1,163 @@
+#ifndef SOTN_EDITOR_GPU
+#define SOTN_EDITOR_GPU
+
+#include <vector>
+#include "common.h"
+
+
+
+// Size of VRAM (in 16-bit words)
+const uint GPU_VRAM_WIDTH = 1024;
+const uint GPU_VRAM_HEIGHT = 512;
+
+// Terminator of ordering tables and primitive lists
+const uint GPU_LIST_END = 0x00FFFFFF;
+
+// Most packets processed per list (guards against cyclic lists)
+const uint GPU_MAX_PACKETS = 0x10000;
+
+// Number of VRAM rows each worker thread rasterizes at a time
+const uint GPU_BAND_HEIGHT = 16;
+
+// Fewest pixels worth splitting between worker threads
+const uint GPU_MIN_THREADED_PIXELS = 0x8000;
+
+// Kinds of queued primitives
+const uint GPU_PRIM_TRIANGLE = 0;
+const uint GPU_PRIM_RECT = 1;
+const uint GPU_PRIM_LINE = 2;
+const uint GPU_PRIM_FILL = 3;
+
+// PSX semi-transparency modes (bits 5-6 of a texture page)
+const uint PSX_BLEND_AVERAGE = 0;                           // (0.5 * Back) + (0.5 * Forward)
+const uint PSX_BLEND_ADD = 1;                               // Back + Forward
+const uint PSX_BLEND_SUBTRACT = 2;                          // Back - Forward
+const uint PSX_BLEND_ADD_QUARTER = 3;                       // Back + (0.25 * Forward)
+
+// Alpha of offscreen target pixels that still have to be blended with what ends up behind the target (the blend mode
+// is kept in bits 0-1), fully drawn pixels have an alpha of 0xFF and pixels nothing was drawn to an alpha of 0
+const uint GPU_TARGET_BLEND = 0x80;
+
+// Draw mode flags of SotN primitives (SOTN_POLYGON::pad3)
+const ushort SOTN_DRAW_TRANSP = 0x01;                       // Semi-transparent
+const ushort SOTN_DRAW_COLORS = 0x04;                       // Textures are modulated by the vertex colors
+const ushort SOTN_DRAW_HIDE = 0x08;                         // Not drawn at all
+const ushort SOTN_DRAW_BLEND = 0x60;                        // Added to the texture page as its blend rate
+
+
+
+// Vertex of a queued primitive (the drawing offset is already applied)
+typedef struct GpuVertex {
+    int x = 0;
+    int y = 0;
+    byte r = 0;
+    byte g = 0;
+    byte b = 0;
+    byte u = 0;
+    byte v = 0;
+} GpuVertex;
+
+
+
+// Drawing environment (set by GP0 E1-E6, e.g. from a DR_ENV)
+typedef struct GpuDrawState {
+    ushort texpage = 0;                                     // Texture page (bits 0-4), blend rate (5-6), color mode (7-8)
+    bool flip_x = false;                                    // Rectangle texture flipping
+    bool flip_y = false;
+    uint tw_mask_x = 0;                                     // Texture window (in 8 pixel steps)
+    uint tw_mask_y = 0;
+    uint tw_offset_x = 0;
+    uint tw_offset_y = 0;
+    int clip_left = 0;                                      // Drawing area (inclusive)
+    int clip_top = 0;
+    int clip_right = GPU_VRAM_WIDTH - 1;
+    int clip_bottom = GPU_VRAM_HEIGHT - 1;
+    int offset_x = 0;                                       // Drawing offset
+    int offset_y = 0;
+    bool set_mask = false;                                  // Set bit 15 of every drawn pixel
+    bool check_mask = false;                                // Leave pixels with bit 15 set alone
+} GpuDrawState;
+
+
+
+// Primitive waiting to be rasterized
+typedef struct GpuPrimitive {
+    uint type = GPU_PRIM_TRIANGLE;                          // Kind of primitive (GPU_PRIM_*)
+    GpuVertex vertices[3];                                  // Triangle corners, line end points or top-left of a rectangle
+    uint width = 0;                                         // Size of rectangles and fills
+    uint height = 0;
+    bool textured = false;
+    bool gouraud = false;
+    bool semi_transparent = false;
+    bool raw_texture = false;                               // Texels aren't modulated by the vertex color
+    ushort clut = 0;                                        // CLUT attribute (X / 16 in bits 0-5, Y in bits 6-14)
+    ushort texpage = 0;                                     // Texture page attribute (same layout as GpuDrawState::texpage)
+    GpuDrawState state;                                     // Drawing environment the primitive was queued with
+} GpuPrimitive;
+
+
+
+// Offscreen image primitives can be drawn into instead of VRAM (e.g. a whole room)
+typedef struct GpuTarget {
+    uint width = 0;
+    uint height = 0;
+    std::vector<uint> pixels;                               // RGBA pixels (red in the lowest byte, see GPU_TARGET_BLEND)
+} GpuTarget;
+
+
+
+// Class for emulating the PSX GPU in software
+class GpuEmulator {
+
+    public:
+
+        // Contents of VRAM (RGB1555, bit 15 is the mask / semi-transparency bit)
+        std::vector<ushort> vram;
+
+        // Current drawing environment
+        GpuDrawState state;
+
+        // Number of primitives rasterized since the last reset
+        uint num_primitives = 0;
+
+        // Image primitives are drawn into instead of VRAM (nullptr to draw into VRAM), textures still come from VRAM
+        GpuTarget* target = nullptr;
+
+        GpuEmulator();
+        void Reset();
+        void LoadImage(const RECT* rect, const ushort* src);
+        void LoadRGBA(const RECT* rect, const byte* src);
+        void StoreImage(const RECT* rect, ushort* dst);
+        void GetRGBA(const RECT* rect, byte* dst);
+        uint WriteCommands(const uint* words, uint num_words);
+        uint DrawOTag(const byte* ram, uint num_bytes, uint addr);
+        uint DrawPrimitives(const byte* ram, uint num_bytes, uint addr, uint first_layer = 0, uint end_layer = UINT32_MAX);
+        void Flush();
+        static int BlendChannel(int back, int front, uint blend_mode, int max_value);
+
+
+    private:
+
+        // Primitives waiting to be rasterized (in drawing order)
+        std::vector<GpuPrimitive> pending;
+
+        uint GetCommandSize(const uint* words, uint num_words);
+        void ExecuteCommand(const uint* words, uint num_words);
+        void SetVertex(GpuVertex* vertex, uint color, uint position);
+        void QueuePolygon(const GpuVertex* vertices, uint num_vertices, bool textured, bool gouraud, bool semi_transparent, bool raw_texture, ushort clut, ushort texpage);
+        void QueueRect(const GpuVertex& vertex, uint width, uint height, bool textured, bool semi_transparent, bool raw_texture, ushort clut);
+        void QueueLine(const GpuVertex& start, const GpuVertex& end, bool gouraud, bool semi_transparent);
+        void QueueFill(uint color, uint x, uint y, uint width, uint height);
+        void CopyRect(uint src_x, uint src_y, uint dst_x, uint dst_y, uint width, uint height);
+        bool GetBounds(const GpuPrimitive& prim, int* left, int* top, int* right, int* bottom);
+        void Rasterize(const GpuPrimitive& prim, int band_top, int band_bottom);
+        void DrawTriangle(const GpuPrimitive& prim, int band_top, int band_bottom);
+        void DrawRect(const GpuPrimitive& prim, int band_top, int band_bottom);
+        void DrawLine(const GpuPrimitive& prim, int band_top, int band_bottom);
+        void DrawFill(const GpuPrimitive& prim, int band_top, int band_bottom);
+        ushort GetTexel(const GpuPrimitive& prim, uint u, uint v);
+        void ShadePixel(const GpuPrimitive& prim, int x, int y, uint r, uint g, uint b, uint u, uint v);
+        void WritePixel(const GpuPrimitive& prim, int x, int y, ushort color, bool blend);
+};
+
+#endif //SOTN_EDITOR_GPU
@@ -115,6 +115,9 @@ class GteEmulator {
         static void WriteDataRegister(uint num, uint value);
         static uint ReadControlRegister(uint num);
         static void WriteControlRegister(uint num, uint value);
+        static uint GetStateSize();
+        static void SaveState(byte* dst);
+        static void LoadState(const byte* src);
 
         // GTE helper functions
         static uint CountLeadingZeros(uint value, uint num_bits);
@@ -2,17 +2,18 @@
 #define SOTN_EDITOR_MAP
 
 #include <string>
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
 #include <vector>
+#include <map>
+#include <tuple>
 #include "common.h"
 #include "rooms.h"
 #include "entities.h"
 #include "sprites.h"
 #include "tiles.h"
 #include "cluts.h"
+#include "cache.h"
+#include "mapped_file.h"
+#include "map_writer.h"
 
 
 
@@ -27,6 +28,53 @@ const byte entity_create_search[] = {
 
 
 
+// Where the pixels of a decoded sprite part come from (everything that affects the decoded pixels)
+typedef struct SpriteSource {
+    TextureId source;                                       // Texture page the indexed pixels are read from
+    uint x;                                                 // Left edge within the source (in 16-bit VRAM words)
+    uint y;                                                 // Top edge within the source
+    uint width;                                             // Width of the part in pixels (4 per VRAM word)
+    uint height;                                            // Height of the part in pixels
+    uint clut_bank;                                         // Bank of the CLUT (CLUT_BANK_*)
+    uint clut_index;                                        // CLUT within the bank
+    uint clut_format;                                       // RGBA expansion of the CLUT (CLUT_FORMAT_*)
+    bool force_opaque;                                      // Whether semi-transparent pixels are drawn fully opaque
+    uint clut_version;                                      // Version of the CLUT (only set for the emulated CLUT table)
+
+    bool operator<(const SpriteSource& other) const {
+        return std::tie(source, x, y, width, height, clut_bank, clut_index, clut_format, force_opaque, clut_version) <
+               std::tie(other.source, other.x, other.y, other.width, other.height, other.clut_bank, other.clut_index, other.clut_format, other.force_opaque, other.clut_version);
+    }
+} SpriteSource;
+
+
+
+// Decoded sprite part shared by every entity sprite that draws the same pixels
+typedef struct SpritePartEntry {
+    SpriteSource source;                                    // Where the pixels come from
+    bool semi_transparent = false;                          // Whether any decoded pixel is semi-transparent
+    std::vector<byte> pixels;                               // Decoded RGBA pixels (kept for the room compositor)
+    TextureId texture = 0;                                  // Texture of the part (created on first use)
+    uint ref_count = 0;                                     // Number of entity sprite parts using the texture
+} SpritePartEntry;
+
+
+
+// Progress of emulating the entities of every room in a map (see Map::EmulateRoom)
+typedef struct EntityEmulationState {
+    EntityCacheEntry cache;                                 // Emulation results of every room (restored or being recorded)
+    bool cache_hit = false;                                 // Whether the results were read from the cache
+    std::vector<byte> base_ram;                             // RAM every room starts from (used to record what changed)
+    bool save_state_loaded = false;                         // Whether the save state was fully restored (by the first room)
+    bool setup_state_saved = false;                         // Whether the CLUT setup routine already ran
+    uint setup_instructions = 0;                            // Instructions the CLUT setup routine took
+    uint setup_pages_restored = 0;                          // RAM pages restored instead of running the setup again
+    uint state_pages_restored = 0;                          // RAM pages restored instead of reloading the whole save state
+    uint rooms_emulated = 0;                                // Rooms that weren't restored from the cache
+} EntityEmulationState;
+
+
+
 // Class for map data
 class Map {
 
@@ -41,6 +89,9 @@ class Map {
         // Name of the map
         std::string map_id;
 
+        // Filename the map was loaded from
+        std::string map_filename;
+
         // Function address definitions
         uint update_entities_func;
         uint process_entity_collision_func;
@@ -57,7 +108,6 @@ class Map {
 
         // List of entity CLUTs (256 16-color RGB1555 CLUTs)
         std::vector<ClutEntry> entity_cluts;
-        GLuint entity_cluts_texture;
 
         // List of entity layout data
         std::vector<std::vector<EntityInitData>> entity_layouts;
@@ -68,24 +118,34 @@ class Map {
         // List of entity graphic data
         std::vector<std::vector<EntityGraphicsData>> entity_graphics;
 
+        // Every distinct entity graphics block loaded by a room and its texture, keyed by map offset (shared between rooms)
+        std::map<uint, EntityGraphicsData> entity_graphics_blocks;
+        std::map<uint, TextureId> entity_graphics_textures;
 
 
-        // Textures for the map (located in ST/<X>/F_<X>.BIN)
-        std::vector<GLuint> map_textures;
-
 
+        // Map VRAM
+        TextureId map_vram;
+        TextureId expanded_map_vram;
 
-        // List of map tile CLUTs (256 16-color RGB1555 CLUTs)
-        byte map_tile_cluts[256][16 * 2];
+        // Distinct room VRAM pages (64 x 256) and full room VRAM chunks keyed by the patches they contain
+        std::map<std::vector<uint>, TextureId> room_page_textures;
+        std::map<std::vector<uint>, std::pair<TextureId, TextureId>> room_vram_textures;
 
+        // Map tilesets
+        std::vector<TextureId> map_tilesets;
 
+        // Key (see DecodeTile) and texture of each unique tile
+        std::vector<uint> unique_tile_keys;
+        std::vector<TextureId> unique_tile_textures;
 
-        // Map VRAM
-        GLuint map_vram;
-        GLuint expanded_map_vram;
+        // Unique tile of every position of every layer (FG/BG of each tile layer, same layout as the map cache)
+        std::vector<std::vector<uint>> layer_unique_tiles;
 
-        // Map tilesets
-        std::vector<GLuint> map_tilesets;
+        // Decoded sprite parts and where to find them by source or by texture
+        std::vector<SpritePartEntry> sprite_parts;
+        std::map<SpriteSource, uint> sprite_part_ids;
+        std::map<TextureId, uint> sprite_part_textures;
 
         // Entity functions
         std::vector<uint> entity_functions;
@@ -98,18 +158,63 @@ class Map {
         uint height;
 
         // Framebuffer object for OpenGL stuff
-        GLuint fbo;
+        uint fbo;
+
+        // Processed map cache entry (filled in while decoding on a miss, read from on a hit)
+        uint64_t cache_key;
+        bool cache_hit;
+        MapCacheEntry cache;
+
+        // Cache key for the entity emulation results (hash of every file the emulator reads)
+        uint64_t entity_cache_key;
 
+        // Read-only mapping of the map file (shared with the emulator)
+        std::shared_ptr<const MappedFile> map_file;
 
+        // Serialized copy of the map that edits are written to (created on the first save)
+        std::shared_ptr<MapWriter> writer;
 
+        // Deswizzled F_GAME.BIN VRAM (512x256 RGBA texels) holding tilesets 0x10 - 0x17 of every map
+        static std::vector<byte> fgame_vram;
+
+
+
+        // Parsing and entity emulation (map_data.cpp, part of the headless core)
+        bool ParseMapFile(const char* filename);
+        void ReadTileLayers(const byte* map_data, uint tile_layers_addr);
+        bool LoadIntoEmulator();
+        void BeginEntityEmulation(EntityEmulationState* state);
+        std::vector<Entity> EmulateRoom(uint room_id, EntityEmulationState* state);
+        void EndEntityEmulation(EntityEmulationState* state);
+
+        // Decoded graphics in CPU memory (map_graphics.cpp, part of the headless core)
+        void DecompressEntityGraphics();
+        bool BuildMapVRAM(const char* filename);
+        void DecodeTiles();
+        byte* ComposeLayer(const Room* room, bool foreground);
+        void RenderPolygons(uint room_id);
+
+        // Textures built from the parsed data (map.cpp, part of the GL layer)
         void LoadMapFile(const char* filename);
         void LoadMapGraphics(const char* filename);
         void LoadMapEntities();
+        bool SaveMapFile(const char* filename);
+        TextureId GetRoomVRAM(Room* room, bool expanded);
+        uint RefreshCluts();
+        uint UpdateComposites();
         void Cleanup();
 
 
     private:
-    
+
+        byte* DecodeTile(uint tile_key, uint* num_pixels);
+        void SelectPolygonClut(ushort clut, SpriteSource* source);
+        byte* DecodeSprite(const SpriteSource& source);
+        uint FindSpritePart(const SpriteSource& source);
+        TextureId AcquireSpritePart(uint part_id);
+        bool ReleaseSpritePart(TextureId texture);
+        std::vector<uint> GetPatchKey(const std::vector<VramPatch>& patches, uint x, uint width);
+        byte* ComposeRoomVRAM(const std::vector<VramPatch>& patches, uint x, uint width);
 };
 
 #endif //SOTN_EDITOR_MAP
\ No newline at end of file
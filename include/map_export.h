@@ -0,0 +1,65 @@
+#ifndef SOTN_EDITOR_MAP_EXPORT
+#define SOTN_EDITOR_MAP_EXPORT
+
+#include <string>
+#include <vector>
+#include "common.h"
+
+
+
+// Magic identifier for binary map exports ("SEXP")
+const uint MAP_EXPORT_MAGIC = 0x50584553;
+
+// Bump this whenever the layout of binary map exports changes
+const uint MAP_EXPORT_VERSION = 1;
+
+/*
+ * Binary export layout (little-endian, no padding):
+ *
+ *   uint magic, version, num_rooms, num_layer_pairs, num_layouts
+ *
+ *   Per room:
+ *     byte x_start, y_start, x_end, y_end, tile_layer_id, load_flags, entity_graphics_id, entity_layout_id
+ *     uint num_entities
+ *     Per entity: uint slot, uint address (0x80xxxxxx), EntityData data
+ *
+ *   Per layer pair (foreground, then background):
+ *     byte present (0 for null layers, nothing else follows)
+ *     uint tile_indices_addr, tile_data_addr
+ *     byte x_start, y_start, x_end, y_end, load_flags
+ *     ushort z_index, drawing_flags
+ *     uint width, height
+ *     ushort tile_indices[width * height]
+ *
+ *   Per entity layout:
+ *     uint num_entries
+ *     EntityInitData entries[num_entries]
+ */
+
+
+
+// Forward declarations
+class Map;
+class TileLayer;
+class Entity;
+
+
+
+// Class for writing the parsed and emulated contents of a map to files
+class MapExport {
+
+    public:
+
+        static std::string ToJSON(const Map* map);
+        static std::vector<byte> ToBinary(const Map* map);
+        static std::string EscapeJSON(const std::string& str);
+
+
+    private:
+
+        static void WriteLayerJSON(std::string* out, const TileLayer& layer);
+        static void WriteEntityJSON(std::string* out, const Entity& entity);
+        static void Append(std::vector<byte>* out, const void* data, size_t num_bytes);
+};
+
+#endif //SOTN_EDITOR_MAP_EXPORT
@@ -0,0 +1,86 @@
+#ifndef SOTN_EDITOR_MAP_GENERATOR
+#define SOTN_EDITOR_MAP_GENERATOR
+
+#include <string>
+#include <vector>
+#include "common.h"
+
+
+
+// Highest entity RAM slot a room can use (the emulator processes 0xC0 slots, slot 0 holds the layout's start marker)
+const uint MAPGEN_MAX_ENTITIES = 0xBF;
+
+// Entity graphics blocks are loaded into 128 x 128 pixel quarters of the room's VRAM chunks (32 of them)
+const uint MAPGEN_BLOCK_SIZE = 128;
+const uint MAPGEN_MAX_BLOCKS_PER_ROOM = 32;
+
+// Tileset ID of the first quarter chunk entity graphics are loaded into (see Map::LoadMapFile)
+const uint MAPGEN_ENTITY_TILESET = 0x40;
+
+// Entity CLUTs are stored after the 256 map tile CLUTs
+const uint MAPGEN_ENTITY_CLUT_BASE = 0x100;
+
+
+
+// Shape of a synthetic map (every count is deterministic for a given seed)
+typedef struct MapGenConfig {
+    uint seed = 1;                                          // Seed of every random choice
+    uint num_rooms = 48;                                    // Rooms in the map
+    uint room_width = 2;                                    // Width of every room (in 256 pixel cells)
+    uint room_height = 1;                                   // Height of every room (in 256 pixel cells)
+    uint num_layer_pairs = 48;                              // Distinct FG/BG layer pairs (rooms share them round-robin)
+    uint num_tile_data = 2;                                 // Distinct tile definition blocks (shared by the layers)
+    uint tile_variety = 1024;                               // Tile definitions used from each block (at most 4096)
+    uint num_tilesets = 8;                                  // Map tilesets (64 VRAM words wide) the tiles are drawn from
+    uint fg_empty_percent = 50;                             // Share of foreground tiles that are empty
+    uint entities_per_room = 16;                            // Entities in each room's layout
+    uint num_entity_types = 24;                             // Distinct entity update routines
+    uint routine_instructions = 300;                        // Approximate instructions each update routine runs per call
+    uint num_sprite_banks = 16;                             // Map sprite banks
+    uint sprites_per_bank = 12;                             // Sprites in each bank
+    uint parts_per_sprite = 3;                              // Parts in each sprite
+    uint num_graphics_blocks = 16;                          // Distinct compressed entity graphics blocks
+    uint num_graphics_lists = 8;                            // Entity graphics lists (rooms share them round-robin)
+    uint blocks_per_room = 4;                               // Entity graphics blocks each list loads
+    uint num_entity_cluts = 32;                             // Entity CLUTs loaded into the emulator
+} MapGenConfig;
+
+// What ended up in a synthetic map
+typedef struct MapGenStats {
+    uint map_size = 0;                                      // Size of the map overlay in bytes
+    uint gfx_size = 0;                                      // Size of the map graphics file in bytes
+    uint num_rooms = 0;                                     // Rooms in the map
+    uint num_entities = 0;                                  // Entities across every room
+    uint num_layouts = 0;                                   // Distinct entity layouts
+    uint compressed_bytes = 0;                              // Size of every compressed entity graphics block
+    uint routine_loops = 0;                                 // Loop count of the entity update routines
+} MapGenStats;
+
+
+
+// Class for generating structurally valid synthetic game data (benchmarks and scaling tests without a disc image)
+class MapGenerator {
+
+    public:
+
+        static MapGenConfig Scale(const MapGenConfig& config, uint factor);
+        static bool GenerateMap(const MapGenConfig& config, std::vector<byte>* map_data, std::vector<byte>* gfx_data, MapGenStats* stats = nullptr);
+        static std::vector<byte> GeneratePSXBinary();
+        static std::vector<byte> GenerateSotNBinary();
+        static std::vector<byte> GenerateGameGraphics(uint seed);
+        static bool WriteGameFiles(const char* dirname, uint seed);
+        static bool WriteMap(const char* dirname, const std::string& map_id, const MapGenConfig& config, MapGenStats* stats = nullptr);
+
+
+    private:
+
+        static uint NextRandom(uint* state);
+        static bool WriteFile(const std::string& filename, const std::vector<byte>& data);
+        static std::vector<byte> MakeTilesetVRAM(uint seed, uint num_tilesets);
+        static void MakeCLUTs(uint* seed, ushort* cluts, uint count);
+        static std::vector<byte> VRAM_to_Chunks(const std::vector<byte>& vram);
+        static std::vector<byte> MakeSpriteSheet(uint* seed);
+        static std::vector<uint> MakeEntityRoutine(uint sprite_bank, uint sprite_image, uint tileset, uint clut_index, uint num_loops);
+};
+
+#endif //SOTN_EDITOR_MAP_GENERATOR
@@ -0,0 +1,106 @@
+#ifndef SOTN_EDITOR_MAP_WRITER
+#define SOTN_EDITOR_MAP_WRITER
+
+#include <string>
+#include <vector>
+#include <map>
+#include "common.h"
+
+
+
+// Number of entries in the X-sorted entity layout table
+const uint ENTITY_LAYOUT_COUNT = 53;
+
+// Number of entries in the Y-sorted entity layout table (immediately follows the X-sorted table)
+const uint ENTITY_LAYOUT_Y_COUNT = 52;
+
+// Largest size a map overlay may grow to (it has to fit between its load address and the end of RAM)
+const uint MAP_FILE_MAX_SIZE = RAM_MAX_OFFSET - MAP_BIN_OFFSET;
+
+
+
+// One reference to a block of overlay data and the contents it should have
+typedef struct BlockUser {
+    std::vector<byte> bytes;                                // Contents the referencing object expects
+    std::vector<uint> slots;                                // Offsets of the pointers that reference the block
+    uint offset;                                            // Where the contents ended up
+} BlockUser;
+
+
+
+// Forward declaration (map.h holds a pointer to the writer)
+class Map;
+
+
+
+// Class for keeping track of free byte ranges within a file
+class IntervalAllocator {
+
+    public:
+
+        void Reset(uint file_end, uint file_limit);
+        bool Allocate(uint size, uint* offset);
+        void Free(uint offset, uint size);
+        uint GetEnd();
+        uint GetFreeBytes();
+
+
+    private:
+
+        // Free ranges keyed by start offset (value is the size of the range)
+        std::map<uint, uint> free_ranges;
+
+        // Current end of the file and the furthest it may grow to
+        uint end = 0;
+        uint limit = 0;
+};
+
+
+
+// Class for serializing edited map data back into a map overlay
+class MapWriter {
+
+    public:
+
+        // Current contents of the overlay (including every change written so far)
+        std::vector<byte> data;
+
+        bool Open(const char* filename, const byte* map_data, uint num_bytes);
+        bool Update(Map* map);
+        bool Save(const char* filename);
+        uint GetDirtyBytes();
+
+
+    private:
+
+        // File the overlay was read from and how large it currently is on disk
+        std::string saved_filename;
+        uint saved_size = 0;
+
+        // Reusable ranges of the overlay
+        IntervalAllocator allocator;
+
+        // Byte ranges that differ from the file on disk keyed by start offset (value is the end offset)
+        std::map<uint, uint> dirty_ranges;
+
+        // Data addresses from the overlay header (relative to the start of the file)
+        uint room_list_addr = 0;
+        uint cluts_addr = 0;
+        uint entity_layouts_addr = 0;
+        uint tile_layers_addr = 0;
+
+        uint ReadWord(uint offset);
+        uint ReadPointer(uint offset);
+        void WriteBytes(uint offset, const void* src, uint size);
+        void WritePointer(uint offset, uint target);
+        bool Place(uint old_offset, uint old_size, const std::vector<byte>& bytes, const std::vector<uint>& slots, uint* new_offset);
+        bool PlaceBlock(uint old_offset, uint old_size, std::vector<BlockUser>* users);
+        uint GetEntityListSize(uint offset);
+        void MarkDirty(uint start, uint end);
+        bool WriteRooms(Map* map);
+        bool WriteTileLayers(Map* map);
+        bool WriteCluts(Map* map);
+        bool WriteEntityLayouts(Map* map);
+};
+
+#endif //SOTN_EDITOR_MAP_WRITER
@@ -0,0 +1,48 @@
+#ifndef SOTN_EDITOR_MAPPED_FILE
+#define SOTN_EDITOR_MAPPED_FILE
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <filesystem>
+#include "common.h"
+
+
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+
+    public:
+
+        // Start of the mapped file contents (nullptr if nothing is mapped)
+        const byte* data = nullptr;
+
+        // Size of the mapped file in bytes
+        size_t size = 0;
+
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const char* filename);
+        void Close();
+        static std::shared_ptr<const MappedFile> Share(const char* filename);
+
+
+    private:
+
+        // Modification time of the file when it was mapped
+        std::filesystem::file_time_type write_time;
+
+        // Contents of files read from a disc image (these are copied instead of mapped)
+        std::vector<byte> buffer;
+
+        // Platform handles for the mapping
+#if defined(_WIN32)
+        void* file_handle = nullptr;
+        void* mapping_handle = nullptr;
+#endif
+};
+
+#endif //SOTN_EDITOR_MAPPED_FILE
@@ -4,8 +4,11 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <memory.h>
+#include <memory>
 #include "entities.h"
 #include "common.h"
+#include "mapped_file.h"
+#include "gpu.h"
 
 const char* const A0_FUNCS[192] = {
     "FileOpen(filename,accessmode)",
@@ -407,6 +410,10 @@ const uint DMA_CALLBACK_ADDR = 0x0001555C;
 // RAM bounds checking
 const uint MAX_RAM_ADDR = 0x00200000;
 
+// Emulator snapshots (RAM and VRAM are stored as 4 KB pages with all-zero pages omitted)
+const uint SNAPSHOT_PAGE_SIZE = 0x1000;
+const uint SNAPSHOT_VRAM_SIZE = 1024 * 512 * 4;
+
 // Class for general utilities
 class MipsEmulator {
 
@@ -446,13 +453,16 @@ class MipsEmulator {
         // Counter for number of instructions executed
         static uint num_executed;
 
-        // Framebuffer for LoadImage, StoreImage, MoveImage, and ClearImage
-        static GLuint framebuffer;
+        // Emulated VRAM for LoadImage, StoreImage, MoveImage, and ClearImage
+        static GpuEmulator gpu;
+
+        // Incremented every time the emulated VRAM changes (lets the GL layer know when to upload it again)
+        static uint vram_version;
 
         // MIPS emulator functions
-        static void SetPSXBinary(const char* filename);
-        static void SetSotNBinary(const char* filename);
-        static void LoadMapFile(const char* filename);
+        static bool SetPSXBinary(const char* filename);
+        static bool SetSotNBinary(const char* filename);
+        static bool LoadMapFile(const char* filename);
         static void StoreMapCLUT(uint offset, uint count, byte* data);
         static void ClearRegisters();
         static void Initialize();
@@ -460,6 +470,12 @@ class MipsEmulator {
         static void InitSotNBinary();
         static void SaveState();
         static void LoadState();
+        static uint LoadDirtyState(const byte* base_ram);
+        static bool SaveSnapshot(std::vector<byte>* out);
+        static bool LoadSnapshot(const byte* data, size_t num_bytes);
+        static void SaveSetupState();
+        static uint LoadSetupState();
+        static void ClearSetupState();
         //static void ClearRegisters();
         static void Cleanup();
         static void ProcessOpcode(uint opcode);
@@ -471,6 +487,7 @@ class MipsEmulator {
         static void CopyFromRAM(uint addr, void* dst, uint count);
         static std::vector<Entity> FindNewEntities(int exclude_addr);
         static std::vector<Entity> ProcessEntities();
+        static std::vector<Entity> CollectEntities();
         static void ClearEntities();
 
         // Used for framebuffer operations
@@ -723,10 +740,15 @@ class MipsEmulator {
         // 1 KB buffer for scratchpad memory
         static byte* scratchpad;
 
-        // Allocated buffers for PSX binary and SotN binary (SLUS_000.67 and DRA.BIN)
-        static byte* psx_bin;
-        static byte* sotn_bin;
-        static byte* map_data;
+        // Read-only views of the PSX binary, SotN binary and map file (SLUS_000.67, DRA.BIN and the map BIN)
+        static const byte* psx_bin;
+        static const byte* sotn_bin;
+        static const byte* map_data;
+
+        // Shared read-only mappings backing the binaries above
+        static std::shared_ptr<const MappedFile> psx_file;
+        static std::shared_ptr<const MappedFile> sotn_file;
+        static std::shared_ptr<const MappedFile> map_file;
 
         // 24 KB CLUT storage
         static byte* clut_data;
@@ -734,6 +756,15 @@ class MipsEmulator {
         // 2 MB buffer for save state
         static byte* save_state_ram;
 
+        // Machine state saved by SaveSetupState()
+        static byte* setup_state_ram;
+        static byte* setup_state_scratchpad;
+        static byte* setup_state_gte;
+        static byte* setup_state_vram;
+        static uint setup_state_registers[32];
+        static uint setup_state_hi;
+        static uint setup_state_lo;
+
         // Sizes of each binary
         static uint psx_bin_size;
         static uint sotn_bin_size;
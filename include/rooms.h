@@ -2,16 +2,39 @@
 #define SOTN_EDITOR_ROOMS
 
 #include <map>
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
 #include "common.h"
 #include "entities.h"
 #include "tiles.h"
 
 
 
+// Rectangle of entity graphics loaded into a room's 1/4 VRAM chunk (coordinates in 16-bit VRAM words)
+typedef struct VramPatch {
+    uint x;                                                 // Left edge within the chunk
+    uint y;                                                 // Top edge within the chunk
+    uint width;                                             // Width of the rectangle
+    uint height;                                            // Height of the rectangle
+    uint graphics_addr;                                     // Map offset of the compressed graphics
+} VramPatch;
+
+
+
+// Entity polygons drawn by the emulated GPU for one of a room's ordering tables (see Map::RenderPolygons)
+typedef struct PolygonLayer {
+    uint x = 0;                                             // Left edge within the room (in pixels)
+    uint y = 0;                                             // Top edge within the room (in pixels)
+    uint width = 0;                                         // Width of the drawn area
+    uint height = 0;                                        // Height of the drawn area
+    std::vector<uint> pixels;                               // RGBA pixels, alpha 0xFF when opaque (see GPU_TARGET_BLEND)
+} PolygonLayer;
+
+// Ordering tables of the polygon layers
+const uint ROOM_POLYGONS_BG = 0;                            // Behind the BG layer
+const uint ROOM_POLYGONS_MID = 1;                           // Between the BG and FG layers
+const uint ROOM_POLYGONS_FG = 2;                            // In front of the FG layer
+
+
+
 // Class for room data
 class Room {
 
@@ -33,18 +56,18 @@ class Room {
 		std::vector<Entity> entities;
 
 		// Entity graphics
-        std::map<uint, GLuint> entity_tilesets;
+        std::map<uint, TextureId> entity_tilesets;
 
         // Entity texture pages
-        std::vector<GLuint> texture_pages;
+        std::vector<TextureId> texture_pages;
 
 		// Tile layers
 		TileLayer fg_layer;
 		TileLayer bg_layer;
 
         // Layer textures
-        GLuint fg_texture;
-        GLuint bg_texture;
+        TextureId fg_texture;
+        TextureId bg_texture;
 
 		// Room dimensions (measured in cells)
 		uint width;
@@ -55,9 +78,19 @@ class Room {
         std::map<uint, std::vector<EntitySpritePart>> mid_ordering_table;
         std::map<uint, std::vector<EntitySpritePart>> fg_ordering_table;
 
-        // Dedicated 1/4 VRAM chunk for each room (512 x 256)
-        GLuint vram;
-        GLuint expanded_vram;
+        // Entity polygons drawn by the emulated GPU (indexed by ROOM_POLYGONS_*)
+        PolygonLayer polygon_layers[3];
+
+        // Entity graphics the room loads into its 1/4 VRAM chunk (the chunk is blank otherwise)
+        std::vector<VramPatch> vram_patches;
+
+        // Full 1/4 VRAM chunk textures (512 x 256), only built once the room's VRAM is viewed (see Map::GetRoomVRAM)
+        TextureId vram = 0;
+        TextureId expanded_vram = 0;
+
+        // Composite of the whole room (see Map::UpdateComposites), redrawn whenever composite_dirty is set
+        TextureId composite_texture = 0;
+        bool composite_dirty = true;
 
 
 		void LoadEntityTilesets();
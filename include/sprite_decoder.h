@@ -0,0 +1,47 @@
+#ifndef SOTN_EDITOR_SPRITE_DECODER
+#define SOTN_EDITOR_SPRITE_DECODER
+
+#include <map>
+#include <tuple>
+#include <vector>
+#include "common.h"
+
+
+
+// Sprite sources that aren't a tileset in VRAM are entity graphics blocks (flag | map offset)
+const uint SPRITE_SOURCE_BLOCK = 0x80000000;
+
+
+
+// Everything that affects the pixels of a decoded sprite part (source, x, y, width, height, CLUT bank, CLUT, CLUT version)
+typedef std::tuple<uint, uint, uint, uint, uint, uint, uint, uint> SpritePartKey;
+
+// Sprite parts decoded on the CPU (the editor decodes them from textures instead)
+typedef struct SpriteExtraction {
+    std::map<SpritePartKey, std::vector<byte>> parts;       // Decoded RGBA pixels of each unique part
+    std::map<uint, std::vector<byte>> block_texels;         // VRAM texels of each entity graphics block (expanded on first use)
+    uint num_part_refs = 0;                                 // Entity sprite parts that were extracted
+} SpriteExtraction;
+
+
+
+// Forward declarations (map.h includes everything the decoder reads)
+class Map;
+class Room;
+
+
+
+// Class for decoding the sprite parts of emulated entities on the CPU (used by the headless tools)
+class SpriteDecoder {
+
+    public:
+
+        static void DecodeRoom(const Map* map, const Room* room, SpriteExtraction* extraction);
+
+
+    private:
+
+        static std::vector<byte> ReadSource(const Map* map, SpriteExtraction* extraction, uint source, uint x, uint y, uint width, uint height);
+};
+
+#endif //SOTN_EDITOR_SPRITE_DECODER
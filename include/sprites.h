@@ -1,10 +1,6 @@
 #ifndef SOTN_EDITOR_SPRITES
 #define SOTN_EDITOR_SPRITES
 
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
 #include "common.h"
 #include <vector>
 
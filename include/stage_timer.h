@@ -0,0 +1,68 @@
+#ifndef SOTN_EDITOR_STAGE_TIMER
+#define SOTN_EDITOR_STAGE_TIMER
+
+#include <chrono>
+#include "common.h"
+
+
+
+// Stages of loading a map (in pipeline order)
+enum LOAD_STAGE {
+    LoadStage_FileRead = 0,
+    LoadStage_Header = 1,
+    LoadStage_SpriteBanks = 2,
+    LoadStage_Cluts = 3,
+    LoadStage_TileLayers = 4,
+    LoadStage_Decompress = 5,
+    LoadStage_VRAM = 6,
+    LoadStage_TileDecode = 7,
+    LoadStage_LayerCompose = 8,
+    LoadStage_EmulatorReset = 9,
+    LoadStage_Emulation = 10,
+    LoadStage_SpriteExtract = 11,
+    LoadStage_Count = 12
+};
+
+
+
+// Time spent in a load stage since the last reset
+typedef struct StageTotal {
+    double wall_ms = 0;                                     // Wall time
+    double cpu_ms = 0;                                      // CPU time of the whole process (includes worker threads)
+    uint count = 0;                                         // Number of times the stage was entered
+} StageTotal;
+
+
+
+// Class for timing the stages of a map load (adds to the stage's total while in scope, does nothing unless enabled)
+class StageTimer {
+
+    public:
+
+        // Whether stages are being timed
+        static bool enabled;
+
+        // Time spent in each stage
+        static StageTotal totals[LoadStage_Count];
+
+        // Name of each stage
+        static const char* const names[LoadStage_Count];
+
+        static void Reset();
+        static double GetCPUTime();
+
+        StageTimer(uint stage);
+        ~StageTimer();
+        void Switch(uint next_stage);
+
+
+    private:
+
+        void Stop();
+
+        uint stage;
+        std::chrono::steady_clock::time_point wall_start;
+        double cpu_start;
+};
+
+#endif //SOTN_EDITOR_STAGE_TIMER
@@ -1,10 +1,6 @@
 #ifndef SOTN_EDITOR_TILES
 #define SOTN_EDITOR_TILES
 
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
 #include "common.h"
 
 
@@ -15,7 +11,7 @@ class Tile {
     public:
 
         // Texture for the tile
-        GLuint texture = -1;
+        TextureId texture = -1;
 
         // Whether the tile is selected
         bool selected = false;
@@ -0,0 +1,70 @@
+#ifndef SOTN_EDITOR_TRACE
+#define SOTN_EDITOR_TRACE
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include "common.h"
+
+
+
+// A finished zone (a Chrome trace "complete" event)
+typedef struct TraceEvent {
+    const char* name;                                       // Name of the zone (string literal)
+    const char* arg_name;                                   // Name of the zone's argument (nullptr if it has none)
+    uint arg_value;                                         // Value of the zone's argument
+    int64_t start_ns;                                       // Start of the zone since tracing started
+    int64_t duration_ns;                                    // Time spent in the zone
+} TraceEvent;
+
+
+
+// Class for recording where the time of a load goes on each thread and writing it as a Chrome trace
+class Trace {
+
+    public:
+
+        // Whether zones are being recorded (zones cost a single load and branch while this is off)
+        static std::atomic<bool> enabled;
+
+        static void Start();
+        static void Stop();
+        static bool Write(const std::string& filename);
+        static int64_t GetTime();
+        static void Record(const TraceEvent& event);
+};
+
+
+
+// Records the time spent in a scope as a zone of the current thread's trace (does nothing unless tracing is enabled)
+class TraceZone {
+
+    public:
+
+        // Kept in the header so that disabled zones don't cost a call
+        TraceZone(const char* name, const char* arg_name = nullptr, uint arg_value = 0) : name(nullptr) {
+            if (Trace::enabled.load(std::memory_order_relaxed)) {
+                Begin(name, arg_name, arg_value);
+            }
+        }
+        ~TraceZone() {
+            if (name != nullptr) {
+                End();
+            }
+        }
+        TraceZone(const TraceZone&) = delete;
+        TraceZone& operator=(const TraceZone&) = delete;
+
+
+    private:
+
+        void Begin(const char* zone_name, const char* zone_arg_name, uint zone_arg_value);
+        void End();
+
+        const char* name;
+        const char* arg_name;
+        uint arg_value;
+        int64_t start_ns;
+};
+
+#endif //SOTN_EDITOR_TRACE
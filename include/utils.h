@@ -2,10 +2,7 @@
 #define SOTN_EDITOR_UTILS
 
 #include <map>
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
-#endif
-#include <GLFW/glfw3.h>
+#include <string>
 #include "common.h"
 
 
@@ -130,22 +127,30 @@ class Utils {
 	public:
 
         static std::string toLowerCase(std::string str);
+        static std::string toUpperCase(std::string str);
         static bool isLowerCase(const std::string& str);
 		static uint RGB1555_to_RGBA(ushort color);
 		static ushort RGBA_to_RGB1555(uint color);
-		static GLuint CreateTexture(void* data, int width, int height);
         static byte* Indexed_to_RGBA(const byte* data, uint num_bytes);
+        static void RGB1555_to_RGBA_Row(const byte* src, byte* dst, uint count);
+        static void Chunks_to_VRAM(const byte* data, uint num_bytes, byte* output);
         static byte* RGBA_to_Indexed(const byte* data, uint num_bytes);
         static void CLUT_to_RGBA(const byte* src, const byte* dst, int num_cluts, bool semi_opaque);
         static uint VRAM_to_RGBA(const byte* pixels, const byte* clut, uint width, uint height, byte* output);
         static void HexDump(const byte* buf, const uint num_bytes);
-        static byte* GetPixels(const GLuint texture, uint x, uint y, uint width, uint height);
-        static void SetPixels(const GLuint texture, uint x, uint y, uint width, uint height, byte* pixels);
         static std::string ReadSotnString(const byte* data);
         static void FindReplace(std::string* str, const std::string& find, const std::string& replace);
         static void SJIS_to_ASCII(std::string* str);
         static std::string FormatString(const char* fmt, ...);
         static std::string FormatStringArgs(const char* fmt, va_list args);
+        static uint64_t Hash(const void* data, size_t num_bytes, uint64_t seed = 0);
+        static uint64_t HashFile(const char* filename, uint64_t seed = 0);
+        static std::string QuoteArg(const std::string& arg);
+
+        // Texture helpers (utils_gl.cpp, only available to the GL layer)
+        static TextureId CreateTexture(void* data, int width, int height);
+        static byte* GetPixels(const TextureId texture, uint x, uint y, uint width, uint height);
+        static void SetPixels(const TextureId texture, uint x, uint y, uint width, uint height, byte* pixels);
 
 
 	private:
@@ -0,0 +1,147 @@
+#include <cstdlib>
+#include <new>
+#include "common.h"
+#include "alloc_counter.h"
+
+
+
+// Allocations of every thread are only counted while something asks for it (e.g. the load benchmark)
+std::atomic<bool> AllocCounter::enabled(false);
+
+// Allocations of every thread (while enabled)
+static std::atomic<uint64_t> process_allocations(0);
+static std::atomic<uint64_t> process_allocated_bytes(0);
+
+// Allocations of the current thread (while it has counting enabled, plain fields so the hot path stays uncontended)
+static thread_local bool thread_enabled = false;
+static thread_local AllocCount thread_count;
+
+
+
+/**
+ * Counts an allocation for the current thread and the process (whichever is enabled).
+ *
+ * @param size: Number of bytes requested
+ *
+ */
+static inline void record_allocation(size_t size) {
+    if (thread_enabled) {
+        thread_count.allocations++;
+        thread_count.bytes += size;
+    }
+    if (AllocCounter::enabled.load(std::memory_order_relaxed)) {
+        process_allocations.fetch_add(1, std::memory_order_relaxed);
+        process_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+
+
+
+// -- Allocation Hooks -----------------------------------------------------------------------------------------
+
+#ifdef SOTN_EDITOR_WRAP_MALLOC
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size) {
+    record_allocation(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    record_allocation(count * size);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    record_allocation(size);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr) {
+    __real_free(ptr);
+}
+
+}
+#define COUNTER_MALLOC __real_malloc
+#define COUNTER_FREE __real_free
+#else
+#define COUNTER_MALLOC malloc
+#define COUNTER_FREE free
+#endif
+
+void* operator new(size_t size) {
+    record_allocation(size);
+    void* ptr = COUNTER_MALLOC(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    COUNTER_FREE(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    COUNTER_FREE(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    COUNTER_FREE(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    COUNTER_FREE(ptr);
+}
+
+
+
+
+// -- Alloc Counter --------------------------------------------------------------------------------------------
+
+/**
+ * Turns counting the current thread's allocations on or off.
+ *
+ * @param enable: Whether the calling thread's allocations should be counted
+ *
+ */
+void AllocCounter::SetThreadEnabled(bool enable) {
+    thread_enabled = enable;
+}
+
+
+
+/**
+ * Gets the allocations the current thread made while it had counting enabled.
+ *
+ * @return Allocations of the calling thread
+ *
+ */
+AllocCount AllocCounter::GetThreadCount() {
+    return thread_count;
+}
+
+
+
+/**
+ * Gets the allocations every thread made while counting was enabled.
+ *
+ * @return Allocations of the process
+ *
+ */
+AllocCount AllocCounter::GetProcessCount() {
+    AllocCount count;
+    count.allocations = process_allocations.load(std::memory_order_relaxed);
+    count.bytes = process_allocated_bytes.load(std::memory_order_relaxed);
+    return count;
+}
@@ -0,0 +1,605 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include "common.h"
+#include "map.h"
+#include "mips.h"
+#include "gte.h"
+#include "compression.h"
+#include "sprites.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+// A single kernel to measure
+typedef struct Benchmark {
+    std::string name;                                       // Name used in the results and the baseline
+    std::string unit;                                       // What the throughput is measured in
+    std::function<uint64_t()> run;                          // Runs one iteration and returns the number of units processed
+} Benchmark;
+
+// Measurement of a single kernel
+typedef struct BenchmarkResult {
+    std::string name;
+    std::string unit;
+    uint64_t iterations = 0;                                // Iterations in each timed batch
+    double ns_per_iteration = 0;                            // Median time of one iteration
+    double per_second = 0;                                  // Units processed per second
+} BenchmarkResult;
+
+// Number of timed batches (the median is reported)
+const uint BENCH_BATCHES = 5;
+
+// Where the synthetic entity routine is placed in MIPS RAM
+const uint BENCH_ROUTINE_ADDR = 0x00100000;
+
+// MIPS register numbers used by the synthetic routine
+const uint BENCH_REG_ZERO = 0;
+const uint BENCH_REG_A0 = 4;
+const uint BENCH_REG_T0 = 8;
+const uint BENCH_REG_RA = 31;
+
+
+
+
+// -- Synthetic Data -------------------------------------------------------------------------------------------
+
+/**
+ * Small deterministic random number generator (xorshift32) so every run measures the same data.
+ *
+ * @param state: Generator state (must not be zero)
+ *
+ * @return Next random value
+ *
+ */
+static uint next_random(uint* state) {
+    uint x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+
+/**
+ * Creates 4-bit indexed pixels that look like tile graphics (runs of the same index with some noise).
+ *
+ * @param num_bytes: Number of bytes to create
+ *
+ * @return Indexed pixels
+ *
+ */
+static std::vector<byte> make_tile_pixels(uint num_bytes) {
+    std::vector<byte> pixels(num_bytes);
+    uint seed = 0x1234567;
+    byte value = 0;
+    for (uint i = 0; i < num_bytes; i++) {
+        uint r = next_random(&seed);
+        if ((r & 7) == 0) {
+            value = (r >> 8) & 0xFF;
+        }
+        pixels[i] = value;
+    }
+    return pixels;
+}
+
+
+
+/**
+ * Encodes an I-type MIPS instruction.
+ */
+static uint mips_i(uint op, uint rs, uint rt, int imm) {
+    return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF);
+}
+
+
+
+/**
+ * Encodes an R-type MIPS instruction.
+ */
+static uint mips_r(uint rs, uint rt, uint rd, uint shamt, uint funct) {
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+
+
+/**
+ * Writes a synthetic entity update routine into MIPS RAM.
+ *
+ * @param addr: Address of the routine in MIPS RAM
+ * @param num_loops: Number of times the body runs before returning
+ *
+ * @note The body reads the position and velocity of the entity in A0, integrates it,
+ *       branches on the result and writes it back, like most entity update functions do.
+ *
+ */
+static void write_entity_routine(uint addr, uint num_loops) {
+
+    const uint t1 = BENCH_REG_T0 + 1, t2 = BENCH_REG_T0 + 2, t3 = BENCH_REG_T0 + 3, t4 = BENCH_REG_T0 + 4, t5 = BENCH_REG_T0 + 5;
+    std::vector<uint> code = {
+        mips_i(0x09, BENCH_REG_ZERO, BENCH_REG_T0, num_loops),  // addiu t0, zero, num_loops
+        // loop:
+        mips_i(0x21, BENCH_REG_A0, t1, 0x02),               // lh    t1, pos_x(a0)
+        mips_i(0x21, BENCH_REG_A0, t2, 0x06),               // lh    t2, pos_y(a0)
+        mips_i(0x23, BENCH_REG_A0, t3, 0x08),               // lw    t3, acceleration_x(a0)
+        mips_r(0, t3, t3, 16, 0x03),                        // sra   t3, t3, 16
+        mips_r(t1, t3, t1, 0, 0x21),                        // addu  t1, t1, t3
+        mips_i(0x29, BENCH_REG_A0, t1, 0x02),               // sh    t1, pos_x(a0)
+        mips_i(0x0C, t1, t4, 0xFF),                         // andi  t4, t1, 0xFF
+        mips_i(0x0B, t4, t5, 0x80),                         // sltiu t5, t4, 0x80
+        mips_i(0x04, t5, BENCH_REG_ZERO, 2),                // beq   t5, zero, skip
+        0,                                                  // nop
+        mips_i(0x09, t2, t2, 1),                            // addiu t2, t2, 1
+        // skip:
+        mips_i(0x29, BENCH_REG_A0, t2, 0x06),               // sh    t2, pos_y(a0)
+        mips_i(0x09, BENCH_REG_T0, BENCH_REG_T0, -1),       // addiu t0, t0, -1
+        mips_i(0x05, BENCH_REG_T0, BENCH_REG_ZERO, -14),    // bne   t0, zero, loop
+        0,                                                  // nop
+        mips_r(BENCH_REG_RA, 0, 0, 0, 0x08),                // jr    ra
+        0                                                   // nop
+    };
+    MipsEmulator::CopyToRAM(addr, code.data(), code.size() * sizeof(uint));
+}
+
+
+
+/**
+ * Creates a buffer of sprite banks in the layout Sprite::ReadSpriteBanks expects.
+ *
+ * @param num_banks: Number of banks
+ * @param sprites_per_bank: Number of sprites in each bank
+ * @param parts_per_sprite: Number of parts in each sprite
+ *
+ * @return Buffer with the bank table at offset 0 (addresses relative to MAP_BIN_OFFSET)
+ *
+ */
+static std::vector<byte> make_sprite_banks(uint num_banks, uint sprites_per_bank, uint parts_per_sprite) {
+
+    uint sprite_size = 2 + parts_per_sprite * sizeof(SpritePart);
+    uint bank_size = (sprites_per_bank + 1) * 4 + sprites_per_bank * sprite_size;
+    std::vector<byte> buf((num_banks + 1) * 4 + num_banks * bank_size + 4);
+
+    uint cur = (num_banks + 1) * 4;
+    for (uint b = 0; b < num_banks; b++) {
+        *(uint*)(buf.data() + b * 4) = cur + MAP_BIN_OFFSET;
+        uint bank_addr = cur;
+        cur += (sprites_per_bank + 1) * 4;
+        for (uint s = 0; s < sprites_per_bank; s++) {
+            *(uint*)(buf.data() + bank_addr + s * 4) = cur + MAP_BIN_OFFSET;
+            *(ushort*)(buf.data() + cur) = parts_per_sprite;
+            for (uint p = 0; p < parts_per_sprite; p++) {
+                SpritePart part;
+                part.width = part.height = 16;
+                part.offset_x = p * 16;
+                memcpy(buf.data() + cur + 2 + p * sizeof(SpritePart), &part, sizeof(SpritePart));
+            }
+            cur += sprite_size;
+        }
+        *(uint*)(buf.data() + bank_addr + sprites_per_bank * 4) = 0xFFFFFFFF;
+    }
+    *(uint*)(buf.data() + num_banks * 4) = 0xFFFFFFFF;
+    return buf;
+}
+
+
+
+/**
+ * Creates a buffer of tile layers in the layout Map::ReadTileLayers expects.
+ *
+ * @param num_pairs: Number of FG/BG layer pairs
+ * @param rooms_wide: Width of every layer in rooms (16 tiles each)
+ * @param rooms_high: Height of every layer in rooms
+ * @param tile_layers_addr: Where the offset of the tile layer table is stored
+ *
+ * @return Buffer with the tile layer table at *tile_layers_addr
+ *
+ * @note Every layer shares a single tile data block, like most layers of a real map do.
+ *
+ */
+static std::vector<byte> make_tile_layers(uint num_pairs, uint rooms_wide, uint rooms_high, uint* tile_layers_addr) {
+
+    uint num_tiles = rooms_wide * 16 * rooms_high * 16;
+    uint tile_data_addr = 0;
+    uint layers_addr = tile_data_addr + 16 + 4 * 4096;
+    uint table_addr = layers_addr + num_pairs * 2 * (16 + num_tiles * 2);
+    std::vector<byte> buf(table_addr + (num_pairs + 1) * 8);
+    byte* data = buf.data();
+
+    // Shared tile data (tileset IDs, positions, CLUTs and collision)
+    uint seed = 0xC0FFEE;
+    for (uint i = 0; i < 4; i++) {
+        *(uint*)(data + tile_data_addr + i * 4) = tile_data_addr + 16 + i * 4096 + MAP_BIN_OFFSET;
+        for (uint j = 0; j < 4096; j++) {
+            data[tile_data_addr + 16 + i * 4096 + j] = next_random(&seed);
+        }
+    }
+
+    // Layers (header followed by the tile indices)
+    uint cur = layers_addr;
+    for (uint i = 0; i < num_pairs * 2; i++) {
+        uint header_addr = cur;
+        uint indices_addr = header_addr + 16;
+        *(uint*)(data + header_addr) = indices_addr + MAP_BIN_OFFSET;
+        *(uint*)(data + header_addr + 4) = tile_data_addr + MAP_BIN_OFFSET;
+        *(uint*)(data + header_addr + 8) = ((rooms_wide - 1) << 12) | ((rooms_high - 1) << 18);
+        *(ushort*)(data + header_addr + 12) = 0x20;
+        for (uint j = 0; j < num_tiles; j++) {
+            *(ushort*)(data + indices_addr + j * 2) = next_random(&seed) & 0xFFF;
+        }
+        *(uint*)(data + table_addr + i * 4) = header_addr + MAP_BIN_OFFSET;
+        cur = indices_addr + num_tiles * 2;
+    }
+
+    *tile_layers_addr = table_addr;
+    return buf;
+}
+
+
+
+
+// -- Benchmarks -----------------------------------------------------------------------------------------------
+
+/**
+ * Creates every benchmark along with the data it runs on.
+ *
+ * @return List of benchmarks
+ *
+ */
+static std::vector<Benchmark> create_benchmarks() {
+
+    std::vector<Benchmark> benchmarks;
+
+    // MIPS interpreter running a synthetic entity update routine
+    MipsEmulator::Initialize();
+    write_entity_routine(BENCH_ROUTINE_ADDR, 1000);
+    benchmarks.push_back({"mips_entity_routine", "instructions", [] {
+        MipsEmulator::registers[BENCH_REG_A0] = ENTITY_LIST_START + RAM_BASE_OFFSET;
+        MipsEmulator::registers[BENCH_REG_RA] = FUNCTION_RETURN;
+        MipsEmulator::num_executed = 0;
+        MipsEmulator::ProcessFunction(BENCH_ROUTINE_ADDR);
+        return (uint64_t)MipsEmulator::num_executed;
+    }});
+
+    // GTE commands (the opcode holds the command in bits 0-5 and sf in bit 19)
+    const uint gte_sf = 1 << 19;
+    const std::vector<std::pair<std::string, uint>> gte_ops = {
+        {"gte_rtps", 0x01 | gte_sf},
+        {"gte_rtpt", 0x30 | gte_sf},
+        {"gte_mvmva", 0x12 | gte_sf},
+        {"gte_ncds", 0x13 | gte_sf}
+    };
+    for (const auto& op : gte_ops) {
+        uint opcode = op.second;
+        benchmarks.push_back({op.first, "ops", [opcode] {
+            GteEmulator::Initialize();
+            for (int i = 0; i < 3; i++) {
+                GteEmulator::ROT_MTX[i][i] = 0x1000;
+                GteEmulator::LIGHT_MTX[i][i] = 0x800;
+                GteEmulator::LIGHT_COLOR_MTX[i][i] = 0x1000;
+                GteEmulator::VX[i][0] = 100 + i * 10;
+                GteEmulator::VX[i][1] = -50 + i * 20;
+                GteEmulator::VX[i][2] = 400 + i * 30;
+            }
+            GteEmulator::TRANS_VEC.z = 0x200;
+            GteEmulator::H = 0x100;
+            GteEmulator::OFX = 160 << 16;
+            GteEmulator::OFY = 120 << 16;
+            GteEmulator::RGBC.r = GteEmulator::RGBC.g = GteEmulator::RGBC.b = 0x80;
+            for (uint i = 0; i < 1000; i++) {
+                GteEmulator::ProcessOpcode(opcode);
+            }
+            return (uint64_t)1000;
+        }});
+    }
+
+    // Decompression of tile-like graphics
+    std::vector<byte> raw_pixels = make_tile_pixels(0x2000);
+    std::vector<byte> compressed = Compression::Compress(raw_pixels.data(), raw_pixels.size());
+    std::vector<byte> decompressed(raw_pixels.size());
+    benchmarks.push_back({"decompress", "bytes", [compressed, decompressed]() mutable {
+        uint num_written = 0;
+        Compression::Decompress(decompressed.data(), decompressed.size(), compressed.data(), compressed.size(), &num_written);
+        return (uint64_t)num_written;
+    }});
+
+    // RGB1555 to RGBA conversion of a full 256 x 256 texture page
+    std::vector<byte> rgb1555 = make_tile_pixels(256 * 256 * 2);
+    benchmarks.push_back({"indexed_to_rgba", "pixels", [rgb1555] {
+        byte* pixels = Utils::Indexed_to_RGBA(rgb1555.data(), rgb1555.size() / 2);
+        free(pixels);
+        return (uint64_t)(rgb1555.size() / 2);
+    }});
+
+    // CLUT expansion of a whole CLUT bank
+    std::vector<byte> cluts = make_tile_pixels(256 * 16 * 2);
+    std::vector<byte> rgba_cluts(256 * 16 * 4);
+    benchmarks.push_back({"clut_to_rgba", "pixels", [cluts, rgba_cluts]() mutable {
+        Utils::CLUT_to_RGBA(cluts.data(), rgba_cluts.data(), 256, true);
+        return (uint64_t)(256 * 16);
+    }});
+
+    // 4-bit VRAM lookup of a 64 x 256 texture page (4 pixels per VRAM word)
+    std::vector<byte> vram_rgba(64 * 256 * 4);
+    byte* vram_pixels = Utils::Indexed_to_RGBA(make_tile_pixels(64 * 256 * 2).data(), 64 * 256);
+    memcpy(vram_rgba.data(), vram_pixels, vram_rgba.size());
+    free(vram_pixels);
+    std::vector<byte> clut_rgba(rgba_cluts.begin(), rgba_cluts.begin() + 16 * 4);
+    std::vector<byte> vram_output(64 * 256 * 16);
+    benchmarks.push_back({"vram_to_rgba", "pixels", [vram_rgba, clut_rgba, vram_output]() mutable {
+        Utils::VRAM_to_RGBA(vram_rgba.data(), clut_rgba.data(), 64, 256, vram_output.data());
+        return (uint64_t)(64 * 256 * 4);
+    }});
+
+    // Sprite bank parsing
+    std::vector<byte> sprite_banks = make_sprite_banks(32, 64, 4);
+    benchmarks.push_back({"read_sprite_banks", "sprites", [sprite_banks] {
+        std::vector<std::vector<Sprite>> banks = Sprite::ReadSpriteBanks(sprite_banks.data(), 0, MAP_BIN_OFFSET);
+        return (uint64_t)(banks.size() * 64);
+    }});
+
+    // Tile layer parsing
+    uint tile_layers_addr = 0;
+    std::vector<byte> tile_layers = make_tile_layers(16, 4, 4, &tile_layers_addr);
+    benchmarks.push_back({"read_tile_layers", "tiles", [tile_layers, tile_layers_addr] {
+        Map map;
+        map.ReadTileLayers(tile_layers.data(), tile_layers_addr);
+        uint64_t num_tiles = 0;
+        for (auto& pair : map.tile_layers) {
+            num_tiles += pair.first.width * pair.first.height + pair.second.width * pair.second.height;
+            free(pair.first.tile_indices);
+            free(pair.second.tile_indices);
+        }
+        for (auto& entry : map.tile_data_pointers) {
+            free(entry.second.tileset_ids);
+            free(entry.second.tile_positions);
+            free(entry.second.clut_ids);
+            free(entry.second.collision_ids);
+        }
+        return num_tiles;
+    }});
+
+    return benchmarks;
+}
+
+
+
+/**
+ * Times a benchmark.
+ *
+ * @param benchmark: Benchmark to run
+ * @param min_time: Minimum time of each batch in seconds
+ *
+ * @return Median of the timed batches
+ *
+ */
+static BenchmarkResult run_benchmark(const Benchmark& benchmark, double min_time) {
+
+    using clock = std::chrono::steady_clock;
+
+    BenchmarkResult result;
+    result.name = benchmark.name;
+    result.unit = benchmark.unit;
+
+    // Warm up and find how many iterations fill a batch
+    uint64_t units = 0;
+    uint64_t iterations = 1;
+    while (true) {
+        auto start = clock::now();
+        units = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            units += benchmark.run();
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if (seconds >= min_time) {
+            break;
+        }
+        iterations = seconds > 0 ? std::max<uint64_t>(iterations * 2, (uint64_t)(iterations * min_time * 1.2 / seconds)) : iterations * 10;
+    }
+    double units_per_iteration = (double)units / iterations;
+
+    // Time the batches
+    std::vector<double> batch_ns;
+    for (uint b = 0; b < BENCH_BATCHES; b++) {
+        auto start = clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            benchmark.run();
+        }
+        batch_ns.push_back(std::chrono::duration<double, std::nano>(clock::now() - start).count() / iterations);
+    }
+    std::sort(batch_ns.begin(), batch_ns.end());
+
+    result.iterations = iterations;
+    result.ns_per_iteration = batch_ns[BENCH_BATCHES / 2];
+    result.per_second = units_per_iteration * 1e9 / result.ns_per_iteration;
+    return result;
+}
+
+
+
+
+// -- Results --------------------------------------------------------------------------------------------------
+
+/**
+ * Converts benchmark results into JSON (one benchmark per line).
+ *
+ * @param results: Results to convert
+ *
+ * @return JSON document
+ *
+ */
+static std::string results_to_json(const std::vector<BenchmarkResult>& results) {
+    std::string out = "{\n    \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append(Utils::FormatString(
+            "        {\"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %llu, \"ns_per_iteration\": %.3f, \"per_second\": %.3f}",
+            result.name.c_str(), result.unit.c_str(), (unsigned long long)result.iterations, result.ns_per_iteration, result.per_second
+        ));
+    }
+    out.append(results.empty() ? "]\n}\n" : "\n    ]\n}\n");
+    return out;
+}
+
+
+
+/**
+ * Reads the throughput of every benchmark from a results file written by results_to_json.
+ *
+ * @param filename: Results file
+ * @param baseline: Where to store the throughput keyed by benchmark name
+ *
+ * @return True if the file could be read
+ *
+ */
+static bool load_baseline(const char* filename, std::map<std::string, double>* baseline) {
+
+    FILE* fp = fopen(filename, "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    size_t num_read;
+    while ((num_read = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text.append(buf, num_read);
+    }
+    fclose(fp);
+
+    // Pull the name and throughput out of every benchmark object
+    const std::string name_key = "\"name\": \"";
+    const std::string rate_key = "\"per_second\": ";
+    size_t pos = 0;
+    while ((pos = text.find(name_key, pos)) != std::string::npos) {
+        size_t name_start = pos + name_key.size();
+        size_t name_end = text.find('"', name_start);
+        size_t rate_pos = text.find(rate_key, name_end);
+        size_t next_pos = text.find(name_key, name_end);
+        if (name_end == std::string::npos || rate_pos == std::string::npos || (next_pos != std::string::npos && rate_pos > next_pos)) {
+            pos = name_start;
+            continue;
+        }
+        (*baseline)[text.substr(name_start, name_end - name_start)] = strtod(text.c_str() + rate_pos + rate_key.size(), nullptr);
+        pos = name_end;
+    }
+    return true;
+}
+
+
+
+/**
+ * Prints the usage of the benchmark runner.
+ */
+static void print_usage() {
+    printf(
+        "Usage: sotn_bench [options]\n"
+        "\n"
+        "Measures the throughput of the kernels that dominate map loading.\n"
+        "\n"
+        "Options:\n"
+        "    -o <file>           Write the results as JSON\n"
+        "    --baseline <file>   Compare against the results of a previous run\n"
+        "    --threshold <pct>   Slowdown that counts as a regression (default: 5)\n"
+        "    --filter <text>     Only run benchmarks whose name contains the text\n"
+        "    --min-time <sec>    Minimum time of each timed batch (default: 0.1)\n"
+    );
+}
+
+
+
+/**
+ * Runs every benchmark, writes the results and compares them against a baseline.
+ */
+int main(int argc, char** argv) {
+
+    const char* output_path = nullptr;
+    const char* baseline_path = nullptr;
+    std::string filter;
+    double threshold = 5.0;
+    double min_time = 0.1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-o") == 0 && has_value) {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threshold") == 0 && has_value) {
+            threshold = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && has_value) {
+            min_time = std::max(atof(argv[++i]), 0.001);
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    // Keep the output limited to the results
+    Log::level = LOG_ERROR;
+
+    // Read the baseline first so that a bad path fails before anything runs
+    std::map<std::string, double> baseline;
+    if (baseline_path != nullptr && !load_baseline(baseline_path, &baseline)) {
+        Log::Error("Could not read baseline: %s\n", baseline_path);
+        return 1;
+    }
+
+    // Run the benchmarks
+    std::vector<BenchmarkResult> results;
+    uint num_regressions = 0;
+    printf("%-24s %16s %25s %20s\n", "benchmark", "ns/iteration", "per second", "vs. baseline");
+    for (const Benchmark& benchmark : create_benchmarks()) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        BenchmarkResult result = run_benchmark(benchmark, min_time);
+        results.push_back(result);
+
+        // Compare the throughput against the baseline
+        std::string comparison = "-";
+        if (baseline.count(result.name) > 0 && baseline[result.name] > 0) {
+            double change = (result.per_second / baseline[result.name] - 1.0) * 100.0;
+            bool regressed = change < -threshold;
+            num_regressions += regressed;
+            comparison = Utils::FormatString("%+.1f%%%s", change, regressed ? " REGRESSED" : "");
+        }
+        printf(
+            "%-24s %16.1f %12.3e %-12s %20s\n",
+            result.name.c_str(), result.ns_per_iteration, result.per_second, result.unit.c_str(), comparison.c_str()
+        );
+        fflush(stdout);
+    }
+
+    // Write the results
+    if (output_path != nullptr) {
+        std::string json = results_to_json(results);
+        FILE* fp = fopen(output_path, "wb");
+        bool written = fp != nullptr && fwrite(json.data(), 1, json.size(), fp) == json.size();
+        written = fp != nullptr && fclose(fp) == 0 && written;
+        if (!written) {
+            Log::Error("Could not write %s\n", output_path);
+            return 1;
+        }
+    }
+
+    if (num_regressions > 0) {
+        printf("%u benchmark(s) regressed by more than %.1f%%\n", num_regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
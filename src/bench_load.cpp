@@ -0,0 +1,693 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/resource.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include "common.h"
+#include "map.h"
+#include "map_export.h"
+#include "game_loader.h"
+#include "stage_timer.h"
+#include "alloc_counter.h"
+#include "sprite_decoder.h"
+#include "trace.h"
+#include "mips.h"
+#include "cache.h"
+#include "cluts.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+// Outcome of loading one map in a worker process
+typedef struct LoadResult {
+    std::string map_path;                                   // Map file that was loaded
+    bool ok = false;                                        // Whether every stage ran
+    std::string error;                                      // Last error the worker reported
+    uint num_rooms = 0;                                     // Rooms in the map
+    uint num_entities = 0;                                  // Entities across every room
+    uint num_tiles = 0;                                     // Unique tiles decoded
+    uint num_sprite_parts = 0;                              // Unique sprite parts decoded
+    bool cache_hit = false;                                 // Whether the decoded graphics came from the cache
+    bool entity_cache_hit = false;                          // Whether the entities were restored from the cache
+    double boot_ms = 0;                                     // Time taken to boot the emulator and read F_GAME.BIN
+    double wall_ms = 0;                                     // Wall time of the whole load
+    double cpu_ms = 0;                                      // CPU time of the whole load
+    StageTotal stages[LoadStage_Count];                     // Time spent in each stage
+    uint64_t boot_rss_kb = 0;                               // Peak resident memory before the map was loaded
+    uint64_t peak_rss_kb = 0;                               // Peak resident memory after the map was loaded
+    uint64_t allocations = 0;                               // Heap allocations made during the load
+    uint64_t allocated_bytes = 0;                           // Bytes requested by those allocations
+} LoadResult;
+
+// Prefix of the line a worker prints its result on
+const char* const BENCH_RESULT_PREFIX = "RESULT ";
+
+
+
+
+// -- Helpers --------------------------------------------------------------------------------------------------
+
+/**
+ * Milliseconds elapsed since a given point in time.
+ *
+ * @param start: Point in time to measure from
+ *
+ * @return Elapsed milliseconds
+ *
+ */
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+/**
+ * Gets the peak resident memory of the process.
+ *
+ * @return Peak resident set size (peak working set on Windows) in KiB
+ *
+ */
+static uint64_t get_peak_rss_kb() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+
+
+/**
+ * Gets the median of a list of values.
+ *
+ * @param values: Values to get the median of
+ *
+ * @return Median value (0 for an empty list)
+ *
+ */
+static double median(std::vector<double> values) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+
+
+
+// -- Worker ---------------------------------------------------------------------------------------------------
+
+/**
+ * Loads a map through every stage of the headless pipeline and times each stage.
+ *
+ * @param files: Game files to load
+ * @param map_path: Map file to load
+ * @param cold_cache_dir: Empty cache directory to load the map with (empty to use the regular cache)
+ * @param result: Where to store counts, timings and memory usage
+ *
+ * @return True if every stage ran
+ *
+ * @note This runs once per worker process, so the peak memory and the emulator state only belong to this map.
+ *
+ */
+static bool load_map(const GameFiles& files, const std::string& map_path, const std::string& cold_cache_dir, LoadResult* result) {
+
+    // Boot the emulator and read the graphics shared by every map (not part of the map load)
+    auto start = std::chrono::steady_clock::now();
+    if (!GameLoader::BootEmulator(files) || !GameLoader::LoadGenericGraphics(files)) {
+        return false;
+    }
+    std::string gfx_path = GameLoader::FindMapGraphics(map_path);
+    if (gfx_path.empty()) {
+        Log::Error("Could not find the graphics file of %s\n", map_path.c_str());
+        return false;
+    }
+    result->boot_ms = elapsed_ms(start);
+    result->boot_rss_kb = get_peak_rss_kb();
+
+    // Start from an empty cache
+    if (!cold_cache_dir.empty()) {
+        Cache::directory = cold_cache_dir;
+    }
+
+    // Time everything from here on
+    StageTimer::Reset();
+    StageTimer::enabled = true;
+    AllocCounter::enabled = true;
+    AllocCount start_allocations = AllocCounter::GetProcessCount();
+    double cpu_start = StageTimer::GetCPUTime();
+    start = std::chrono::steady_clock::now();
+
+    // Check whether the decoded graphics are already in the cache (same key as the editor)
+    Map map;
+    {
+        StageTimer timer(LoadStage_FileRead);
+        map.cache_key = Cache::GetKey({map_path, gfx_path, files.gfx_path});
+        map.cache_hit = Cache::LoadMap(map.cache_key, &map.cache);
+    }
+
+    // Parse the map and decode its graphics
+    if (!map.ParseMapFile(map_path.c_str())) {
+        return false;
+    }
+    map.DecompressEntityGraphics();
+    if (!map.BuildMapVRAM(gfx_path.c_str())) {
+        return false;
+    }
+    map.DecodeTiles();
+    for (const Room& room : map.rooms) {
+        free(map.ComposeLayer(&room, false));
+        free(map.ComposeLayer(&room, true));
+    }
+
+    // Store newly decoded maps (counted towards the total, not a stage)
+    if (!map.cache_hit) {
+        Cache::SaveMap(map.cache_key, &map.cache);
+    }
+
+    // Emulate every room and extract the sprites of its entities
+    if (!map.LoadIntoEmulator()) {
+        return false;
+    }
+    map.entity_cache_key = Cache::GetKey({files.psx_path, files.bin_path, map_path, gfx_path, files.gfx_path});
+    EntityEmulationState emulation;
+    SpriteExtraction extraction;
+    {
+        StageTimer timer(LoadStage_Emulation);
+        map.BeginEntityEmulation(&emulation);
+        Clut::Reset(CLUT_BANK_RAM, CLUT_DATA_SIZE / 32);
+    }
+    for (uint i = 0; i < map.rooms.size(); i++) {
+        map.rooms[i].entities = map.EmulateRoom(i, &emulation);
+        SpriteDecoder::DecodeRoom(&map, &map.rooms[i], &extraction);
+        map.RenderPolygons(i);
+        result->num_entities += map.rooms[i].entities.size();
+    }
+    {
+        StageTimer timer(LoadStage_Emulation);
+        map.EndEntityEmulation(&emulation);
+    }
+
+    // Collect the results
+    result->wall_ms = elapsed_ms(start);
+    result->cpu_ms = StageTimer::GetCPUTime() - cpu_start;
+    AllocCounter::enabled = false;
+    AllocCount end_allocations = AllocCounter::GetProcessCount();
+    result->allocations = end_allocations.allocations - start_allocations.allocations;
+    result->allocated_bytes = end_allocations.bytes - start_allocations.bytes;
+    result->peak_rss_kb = get_peak_rss_kb();
+    StageTimer::enabled = false;
+    std::copy(std::begin(StageTimer::totals), std::end(StageTimer::totals), std::begin(result->stages));
+    result->num_rooms = map.rooms.size();
+    result->num_tiles = map.cache.tile_empty.size();
+    result->num_sprite_parts = extraction.parts.size();
+    result->cache_hit = map.cache_hit;
+    result->entity_cache_hit = emulation.cache_hit;
+    return true;
+}
+
+
+
+/**
+ * Prints a worker's result on a single line.
+ *
+ * @param ok: Whether every stage ran
+ * @param result: Result of the worker
+ *
+ */
+static void print_result(bool ok, const LoadResult& result) {
+    printf(
+        "%s%d %u %u %u %u %d %d %f %f %f %llu %llu %llu %llu",
+        BENCH_RESULT_PREFIX, ok ? 1 : 0, result.num_rooms, result.num_entities, result.num_tiles, result.num_sprite_parts,
+        result.cache_hit ? 1 : 0, result.entity_cache_hit ? 1 : 0, result.boot_ms, result.wall_ms, result.cpu_ms,
+        (unsigned long long)result.boot_rss_kb, (unsigned long long)result.peak_rss_kb,
+        (unsigned long long)result.allocations, (unsigned long long)result.allocated_bytes
+    );
+    for (const StageTotal& stage : result.stages) {
+        printf(" %f %f", stage.wall_ms, stage.cpu_ms);
+    }
+    printf("\n");
+}
+
+
+
+/**
+ * Reads a result line printed by print_result().
+ *
+ * @param line: Line without the result prefix
+ * @param result: Where to store the result
+ *
+ * @return True if the line held a complete result
+ *
+ */
+static bool parse_result(const char* line, LoadResult* result) {
+
+    int ok, cache_hit, entity_cache_hit, num_read;
+    unsigned long long boot_rss_kb, peak_rss_kb, allocations, allocated_bytes;
+    if (sscanf(
+        line, "%d %u %u %u %u %d %d %lf %lf %lf %llu %llu %llu %llu%n",
+        &ok, &result->num_rooms, &result->num_entities, &result->num_tiles, &result->num_sprite_parts,
+        &cache_hit, &entity_cache_hit, &result->boot_ms, &result->wall_ms, &result->cpu_ms,
+        &boot_rss_kb, &peak_rss_kb, &allocations, &allocated_bytes, &num_read
+    ) != 14) {
+        return false;
+    }
+    line += num_read;
+    for (StageTotal& stage : result->stages) {
+        if (sscanf(line, " %lf %lf%n", &stage.wall_ms, &stage.cpu_ms, &num_read) != 2) {
+            return false;
+        }
+        line += num_read;
+    }
+    result->ok = ok != 0;
+    result->cache_hit = cache_hit != 0;
+    result->entity_cache_hit = entity_cache_hit != 0;
+    result->boot_rss_kb = boot_rss_kb;
+    result->peak_rss_kb = peak_rss_kb;
+    result->allocations = allocations;
+    result->allocated_bytes = allocated_bytes;
+    return true;
+}
+
+
+
+
+// -- Runner ---------------------------------------------------------------------------------------------------
+
+/**
+ * Runs a worker process for a map and collects its result.
+ *
+ * @param command: Command line of the worker (without the map argument)
+ * @param map_path: Map file to load
+ * @param cold_cache_dir: Empty cache directory to load the map with (empty to use the regular cache)
+ *
+ * @return Result reported by the worker (or the reason it failed)
+ *
+ */
+static LoadResult run_worker(const std::string& command, const std::string& map_path, const std::string& cold_cache_dir) {
+
+    LoadResult result;
+    result.map_path = map_path;
+
+    std::string full_command = command + " --worker " + Utils::QuoteArg(map_path);
+    if (!cold_cache_dir.empty()) {
+        full_command.append(" --cache-dir " + Utils::QuoteArg(cold_cache_dir));
+    }
+    full_command.append(" 2>&1");
+#ifdef _WIN32
+    // cmd.exe strips the outermost quotes
+    full_command = "\"" + full_command + "\"";
+#endif
+    FILE* pipe = popen(full_command.c_str(), "r");
+    if (pipe == nullptr) {
+        result.error = "Could not start worker process";
+        return result;
+    }
+
+    // Keep the result line and the last error the worker logged
+    bool reported = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), pipe) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, BENCH_RESULT_PREFIX, strlen(BENCH_RESULT_PREFIX)) == 0) {
+            reported = parse_result(line + strlen(BENCH_RESULT_PREFIX), &result);
+        }
+        else if (strncmp(line, "[ERROR]", 7) == 0) {
+            result.error = line + 7 + strspn(line + 7, " ");
+        }
+    }
+    int status = pclose(pipe);
+
+    // Workers that crash never report a result
+    if (!reported || status != 0) {
+        result.ok = false;
+        if (result.error.empty()) {
+            result.error = reported ? Utils::FormatString("Worker exited with status %d", status) : Utils::FormatString("Worker crashed (status %d)", status);
+        }
+    }
+    return result;
+}
+
+
+
+/**
+ * Combines the runs of a map into a single result (the median of each timing, the maximum peak memory).
+ *
+ * @param runs: Results of every run of the map (all of which succeeded)
+ *
+ * @return Combined result
+ *
+ */
+static LoadResult combine_runs(const std::vector<LoadResult>& runs) {
+
+    LoadResult combined = runs[0];
+    auto median_of = [&runs](auto get) {
+        std::vector<double> values;
+        for (const LoadResult& run : runs) {
+            values.push_back(get(run));
+        }
+        return median(values);
+    };
+    combined.boot_ms = median_of([](const LoadResult& run) { return run.boot_ms; });
+    combined.wall_ms = median_of([](const LoadResult& run) { return run.wall_ms; });
+    combined.cpu_ms = median_of([](const LoadResult& run) { return run.cpu_ms; });
+    combined.allocations = (uint64_t)median_of([](const LoadResult& run) { return (double)run.allocations; });
+    combined.allocated_bytes = (uint64_t)median_of([](const LoadResult& run) { return (double)run.allocated_bytes; });
+    for (uint i = 0; i < LoadStage_Count; i++) {
+        combined.stages[i].wall_ms = median_of([i](const LoadResult& run) { return run.stages[i].wall_ms; });
+        combined.stages[i].cpu_ms = median_of([i](const LoadResult& run) { return run.stages[i].cpu_ms; });
+    }
+    for (const LoadResult& run : runs) {
+        combined.boot_rss_kb = std::max(combined.boot_rss_kb, run.boot_rss_kb);
+        combined.peak_rss_kb = std::max(combined.peak_rss_kb, run.peak_rss_kb);
+    }
+    return combined;
+}
+
+
+
+/**
+ * Prints the stage breakdown of a map (or of every map together).
+ *
+ * @param title: Heading of the breakdown
+ * @param result: Result to print
+ *
+ */
+static void print_breakdown(const std::string& title, const LoadResult& result) {
+
+    printf("%-32s %12s %12s\n", title.c_str(), "wall ms", "cpu ms");
+    double stage_wall_ms = 0;
+    double stage_cpu_ms = 0;
+    for (uint i = 0; i < LoadStage_Count; i++) {
+        printf("    %-28s %12.2f %12.2f\n", StageTimer::names[i], result.stages[i].wall_ms, result.stages[i].cpu_ms);
+        stage_wall_ms += result.stages[i].wall_ms;
+        stage_cpu_ms += result.stages[i].cpu_ms;
+    }
+    printf("    %-28s %12.2f %12.2f\n", "other", std::max(result.wall_ms - stage_wall_ms, 0.0), std::max(result.cpu_ms - stage_cpu_ms, 0.0));
+    printf("    %-28s %12.2f %12.2f\n", "total", result.wall_ms, result.cpu_ms);
+    printf(
+        "    peak RSS %.1f MiB (%.1f MiB after boot), %llu allocations (%.1f MiB)\n\n",
+        result.peak_rss_kb / 1024.0, result.boot_rss_kb / 1024.0,
+        (unsigned long long)result.allocations, result.allocated_bytes / (1024.0 * 1024.0)
+    );
+}
+
+
+
+/**
+ * Writes the combined result of every map as JSON.
+ *
+ * @param filename: File to write
+ * @param results: Combined result of every map
+ * @param cold: Whether the maps were loaded with empty caches
+ * @param num_runs: Number of runs each result was combined from
+ *
+ * @return True if the file was written
+ *
+ */
+static bool write_results(const std::string& filename, const std::vector<LoadResult>& results, bool cold, uint num_runs) {
+
+    std::string out = Utils::FormatString("{\n    \"cache\": \"%s\",\n    \"runs\": %u,\n    \"maps\": [", cold ? "cold" : "warm", num_runs);
+    for (size_t i = 0; i < results.size(); i++) {
+        const LoadResult& result = results[i];
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append(Utils::FormatString(
+            "        {\"map\": \"%s\", \"ok\": %s, \"error\": \"%s\", \"rooms\": %u, \"entities\": %u, \"unique_tiles\": %u, \"sprite_parts\": %u, "
+            "\"cache_hit\": %s, \"entity_cache_hit\": %s, \"boot_ms\": %.3f, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+            "\"boot_rss_kb\": %llu, \"peak_rss_kb\": %llu, \"allocations\": %llu, \"allocated_bytes\": %llu, \"stages\": {",
+            MapExport::EscapeJSON(result.map_path).c_str(), result.ok ? "true" : "false", MapExport::EscapeJSON(result.error).c_str(),
+            result.num_rooms, result.num_entities, result.num_tiles, result.num_sprite_parts,
+            result.cache_hit ? "true" : "false", result.entity_cache_hit ? "true" : "false", result.boot_ms, result.wall_ms, result.cpu_ms,
+            (unsigned long long)result.boot_rss_kb, (unsigned long long)result.peak_rss_kb,
+            (unsigned long long)result.allocations, (unsigned long long)result.allocated_bytes
+        ));
+        for (uint k = 0; k < LoadStage_Count; k++) {
+            out.append(Utils::FormatString(
+                "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}",
+                k > 0 ? ", " : "", StageTimer::names[k], result.stages[k].wall_ms, result.stages[k].cpu_ms
+            ));
+        }
+        out.append("}}");
+    }
+    out.append(results.empty() ? "]\n}\n" : "\n    ]\n}\n");
+
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool written = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    return (fclose(fp) == 0) && written;
+}
+
+
+
+/**
+ * Prints the command-line usage.
+ */
+static void print_usage() {
+    printf(
+        "Usage: sotn_bench_load <disc image or directory> [options] [map ...]\n"
+        "\n"
+        "Loads maps through the headless pipeline and reports the time spent in each stage.\n"
+        "Maps are given by ID (e.g. NO0) or path, every map is loaded if none are given.\n"
+        "\n"
+        "Options:\n"
+        "    --cold          Load every map with empty caches (default: warm, caches are filled by an untimed load)\n"
+        "    -r <runs>       Number of timed loads of each map, the median is reported (default: 3)\n"
+        "    -o <file>       Write the results as JSON\n"
+        "    --trace <dir>   Write a Chrome trace of the last load of each map to <dir>/<map>.json\n"
+        "    -v              Show the log output of the workers\n"
+    );
+}
+
+
+
+/**
+ * Loads every requested map in its own worker process and reports the stage breakdown.
+ */
+int main(int argc, char** argv) {
+
+    // Parse arguments
+    std::string input;
+    std::string output_path;
+    std::string worker_map;
+    std::string worker_cache_dir;
+    std::string trace_dir;
+    std::vector<std::string> map_names;
+    bool cold = false;
+    uint num_runs = 3;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--cold") {
+            cold = true;
+        }
+        else if (arg == "-r" && has_value) {
+            num_runs = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "-o" && has_value) {
+            output_path = argv[++i];
+        }
+        else if (arg == "--trace" && has_value) {
+            trace_dir = argv[++i];
+        }
+        else if (arg == "-v") {
+            verbose = true;
+        }
+        else if (arg == "--worker" && has_value) {
+            worker_map = argv[++i];
+        }
+        else if (arg == "--cache-dir" && has_value) {
+            worker_cache_dir = argv[++i];
+        }
+        else if (arg[0] != '-') {
+            if (input.empty()) {
+                input = arg;
+            }
+            else {
+                map_names.push_back(arg);
+            }
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (input.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    // Only errors are needed to fill in the results
+    if (!verbose) {
+        Log::level = LOG_ERROR;
+    }
+
+    // Locate the game files
+    GameFiles files;
+    if (!GameLoader::FindFiles(input.c_str(), &files)) {
+        return 1;
+    }
+
+    // Worker: load a single map and report the result
+    if (!worker_map.empty()) {
+
+        // Flush every line so that errors reach the runner even if the worker crashes
+        setvbuf(stdout, nullptr, _IOLBF, 0);
+
+        // Trace the load (the runner only keeps the last run's trace of each map)
+        if (!trace_dir.empty()) {
+            Trace::Start();
+        }
+
+        LoadResult result;
+        bool ok = load_map(files, worker_map, worker_cache_dir, &result);
+        if (!trace_dir.empty()) {
+            Trace::Stop();
+            std::string map_id = Utils::toUpperCase(std::filesystem::path(worker_map).stem().string());
+            Trace::Write((std::filesystem::path(trace_dir) / (map_id + ".json")).string());
+        }
+        print_result(ok, result);
+        return ok ? 0 : 1;
+    }
+
+    // Pick out the requested maps
+    std::vector<std::string> maps;
+    for (const std::string& name : map_names) {
+        auto match = std::find_if(files.maps.begin(), files.maps.end(), [&name](const std::string& map_path) {
+            return map_path == name || Utils::toUpperCase(std::filesystem::path(map_path).stem().string()) == Utils::toUpperCase(name);
+        });
+        if (match == files.maps.end()) {
+            Log::Error("Map not found: %s\n", name.c_str());
+            return 1;
+        }
+        maps.push_back(*match);
+    }
+    if (map_names.empty()) {
+        maps = files.maps;
+    }
+    if (maps.empty()) {
+        Log::Error("No maps found in %s\n", input.c_str());
+        return 1;
+    }
+
+    // Boot once up front so every worker can restore the snapshot instead of booting on its own
+    if (!GameLoader::BootEmulator(files)) {
+        return 1;
+    }
+
+    // Everything but the map is the same for every worker
+    std::error_code ec;
+    std::string self = argv[0];
+    if (self.find_first_of("/\\") != std::string::npos) {
+        self = std::filesystem::absolute(self, ec).string();
+    }
+    std::string command = Utils::QuoteArg(self) + " " + Utils::QuoteArg(input) + (verbose ? " -v" : "");
+    if (!trace_dir.empty()) {
+        std::filesystem::create_directories(trace_dir, ec);
+        command.append(" --trace " + Utils::QuoteArg(std::filesystem::absolute(trace_dir, ec).string()));
+    }
+
+    // Cold loads get a fresh cache directory every time
+    std::string cold_cache_dir;
+    if (cold) {
+        auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+        cold_cache_dir = (std::filesystem::temp_directory_path(ec) / Utils::FormatString("sotn_bench_load_%llx", (unsigned long long)stamp)).string();
+    }
+
+    // Load the maps one at a time so that they don't compete for cores or memory bandwidth
+    std::vector<LoadResult> results;
+    LoadResult overall;
+    uint num_failed = 0;
+    for (size_t i = 0; i < maps.size(); i++) {
+
+        // Fill the caches without timing anything
+        if (!cold) {
+            run_worker(command, maps[i], "");
+        }
+
+        std::vector<LoadResult> runs;
+        LoadResult failure;
+        for (uint run = 0; run < num_runs; run++) {
+            if (cold) {
+                std::filesystem::remove_all(cold_cache_dir, ec);
+                std::filesystem::create_directories(cold_cache_dir, ec);
+            }
+            LoadResult result = run_worker(command, maps[i], cold_cache_dir);
+            if (!result.ok) {
+                failure = result;
+                break;
+            }
+            runs.push_back(result);
+        }
+
+        // Report the map
+        if (runs.size() < num_runs) {
+            num_failed++;
+            results.push_back(failure);
+            printf("[%3zu/%zu] %s FAILED: %s\n\n", i + 1, maps.size(), maps[i].c_str(), failure.error.c_str());
+            fflush(stdout);
+            continue;
+        }
+        LoadResult result = combine_runs(runs);
+        results.push_back(result);
+        print_breakdown(Utils::FormatString(
+            "[%3zu/%zu] %s (%u rooms, %u entities)", i + 1, maps.size(), std::filesystem::path(maps[i]).stem().string().c_str(), result.num_rooms, result.num_entities
+        ), result);
+        fflush(stdout);
+
+        // Add the map to the overall totals
+        for (uint k = 0; k < LoadStage_Count; k++) {
+            overall.stages[k].wall_ms += result.stages[k].wall_ms;
+            overall.stages[k].cpu_ms += result.stages[k].cpu_ms;
+        }
+        overall.wall_ms += result.wall_ms;
+        overall.cpu_ms += result.cpu_ms;
+        overall.boot_rss_kb = std::max(overall.boot_rss_kb, result.boot_rss_kb);
+        overall.peak_rss_kb = std::max(overall.peak_rss_kb, result.peak_rss_kb);
+        overall.allocations += result.allocations;
+        overall.allocated_bytes += result.allocated_bytes;
+    }
+    if (cold) {
+        std::filesystem::remove_all(cold_cache_dir, ec);
+    }
+    if (results.size() - num_failed > 1) {
+        print_breakdown(Utils::FormatString("All %zu maps (%s cache, median of %u runs)", results.size() - num_failed, cold ? "cold" : "warm", num_runs), overall);
+    }
+
+    // Write the results
+    if (!output_path.empty() && !write_results(output_path, results, cold, num_runs)) {
+        Log::Error("Could not write %s\n", output_path.c_str());
+        return 1;
+    }
+
+    return num_failed == 0 ? 0 : 1;
+}
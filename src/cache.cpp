@@ -0,0 +1,592 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include "common.h"
+#include "cache.h"
+#include "mapped_file.h"
+#include "mips.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+// Variables
+bool Cache::enabled = true;
+std::string Cache::directory = "cache";
+
+
+
+/**
+ * Writes a block of data to a cache file.
+ *
+ * @param fp: Cache file to write to
+ * @param data: Data to write
+ * @param num_bytes: Number of bytes to write
+ *
+ * @return True if all of the bytes were written
+ *
+ */
+static bool write_data(FILE* fp, const void* data, size_t num_bytes) {
+    return num_bytes == 0 || fwrite(data, sizeof(byte), num_bytes, fp) == num_bytes;
+}
+
+/**
+ * Reads a block of data from a cache file.
+ *
+ * @param fp: Cache file to read from
+ * @param data: Buffer where the data should be stored
+ * @param num_bytes: Number of bytes to read
+ *
+ * @return True if all of the bytes were read
+ *
+ */
+static bool read_data(FILE* fp, void* data, size_t num_bytes) {
+    return num_bytes == 0 || fread(data, sizeof(byte), num_bytes, fp) == num_bytes;
+}
+
+/**
+ * Writes a size-prefixed vector to a cache file.
+ *
+ * @param fp: Cache file to write to
+ * @param vec: Vector to write
+ *
+ * @return True if the vector was written
+ *
+ */
+template <typename T>
+static bool write_vector(FILE* fp, const std::vector<T>& vec) {
+    uint count = vec.size();
+    return write_data(fp, &count, sizeof(uint)) && write_data(fp, vec.data(), count * sizeof(T));
+}
+
+/**
+ * Reads a size-prefixed vector from a cache file.
+ *
+ * @param fp: Cache file to read from
+ * @param vec: Vector where the data should be stored
+ * @param max_count: Upper bound on the number of elements (guards against corrupt files)
+ *
+ * @return True if the vector was read
+ *
+ */
+template <typename T>
+static bool read_vector(FILE* fp, std::vector<T>* vec, uint max_count) {
+    uint count = 0;
+    if (!read_data(fp, &count, sizeof(uint)) || count > max_count) {
+        return false;
+    }
+    vec->resize(count);
+    return read_data(fp, vec->data(), count * sizeof(T));
+}
+
+
+
+/**
+ * Computes a cache key from the contents of a list of input files.
+ *
+ * @param filenames: Files whose contents determine the cached data
+ *
+ * @return 64-bit key identifying the inputs and the cache format version (CACHE_KEY_NONE if any file couldn't be read)
+ *
+ * @note Entries are never loaded or saved under CACHE_KEY_NONE, so a missing input always means a cache miss.
+ *
+ */
+uint64_t Cache::GetKey(const std::vector<std::string>& filenames) {
+
+    // Seed with the format version so stale layouts are never read back
+    uint64_t key = CACHE_FORMAT_VERSION;
+    for (const auto& filename : filenames) {
+        key = Utils::HashFile(filename.c_str(), key);
+
+        // Files that can't be read hash to 0
+        if (key == 0) {
+            return CACHE_KEY_NONE;
+        }
+    }
+    return key;
+}
+
+
+
+/**
+ * Gets the path of a cache file.
+ *
+ * @param prefix: Prefix identifying the type of cached data
+ * @param key: Cache key of the entry
+ *
+ * @return Path of the cache file
+ *
+ */
+std::string Cache::GetPath(const char* prefix, uint64_t key) {
+    return directory + "/" + Utils::FormatString("%s_%016llX.bin", prefix, (unsigned long long)key);
+}
+
+
+
+/**
+ * Opens a temporary file for writing a cache entry.
+ *
+ * @param path: Final path of the cache file
+ *
+ * @return Handle of the temporary file, or nullptr if it could not be created
+ *
+ * @note Entries are written to a temporary file first so a partial write never looks like a valid entry.
+ *
+ */
+FILE* Cache::OpenForWrite(const std::string& path) {
+
+    // Make sure the cache directory exists
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    // Create the temporary file
+    std::string tmp_path = path + ".tmp";
+    FILE* fp = fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr) {
+        Log::Warn("Could not create cache file: %s\n", tmp_path.c_str());
+    }
+    return fp;
+}
+
+
+
+/**
+ * Closes a temporary cache file and moves it into place.
+ *
+ * @param fp: Handle returned by OpenForWrite()
+ * @param path: Final path of the cache file
+ * @param ok: Whether all of the data was written successfully
+ *
+ * @return True if the cache file is now in place
+ *
+ */
+bool Cache::FinishWrite(FILE* fp, const std::string& path, bool ok) {
+
+    std::string tmp_path = path + ".tmp";
+    std::error_code ec;
+
+    // Flush everything to disk
+    ok = (fclose(fp) == 0) && ok;
+
+    // Move the finished file into place
+    if (ok) {
+        std::filesystem::rename(tmp_path, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        Log::Warn("Could not write cache file: %s\n", path.c_str());
+        std::filesystem::remove(tmp_path, ec);
+    }
+    return ok;
+}
+
+
+
+/**
+ * Loads a processed map from the cache.
+ *
+ * @param key: Cache key of the map (see GetKey())
+ * @param entry: Entry where the cached data should be stored
+ *
+ * @return True if the map was found in the cache and read successfully
+ *
+ */
+bool Cache::LoadMap(uint64_t key, MapCacheEntry* entry) {
+
+    // Bail if caching is disabled or the inputs couldn't be hashed
+    if (!enabled || key == CACHE_KEY_NONE) {
+        return false;
+    }
+
+    // Open the cache file
+    std::string path = GetPath("map", key);
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+
+    // Verify the header
+    uint magic = 0;
+    uint version = 0;
+    uint64_t file_key = 0;
+    bool ok = read_data(fp, &magic, sizeof(uint)) &&
+              read_data(fp, &version, sizeof(uint)) &&
+              read_data(fp, &file_key, sizeof(uint64_t));
+    ok = ok && magic == MAP_CACHE_MAGIC && version == CACHE_FORMAT_VERSION && file_key == key;
+
+    // Read the decoded data
+    ok = ok && read_data(fp, &entry->decode_time, sizeof(double));
+    ok = ok && read_vector(fp, &entry->vram, 512 * 256 * 4);
+    ok = ok && entry->vram.size() == 512 * 256 * 4;
+    ok = ok && read_data(fp, entry->tile_cluts, sizeof(entry->tile_cluts));
+    ok = ok && read_vector(fp, &entry->tiles, 0x10000 * 16 * 16 * 4);
+    ok = ok && read_vector(fp, &entry->tile_empty, 0x10000);
+    ok = ok && entry->tile_empty.size() * 16 * 16 * 4 == entry->tiles.size();
+
+    // Read the tile references of each layer
+    uint num_layers = 0;
+    ok = ok && read_data(fp, &num_layers, sizeof(uint)) && num_layers <= 0x1000;
+    if (ok) {
+        entry->layer_tiles.resize(num_layers);
+        for (auto& layer : entry->layer_tiles) {
+            ok = ok && read_vector(fp, &layer, 0x100000);
+            for (uint i = 0; ok && i < layer.size(); i++) {
+                ok = layer[i] < entry->tile_empty.size();
+            }
+        }
+    }
+
+    // Read the decompressed entity graphics
+    uint num_graphics = 0;
+    ok = ok && read_data(fp, &num_graphics, sizeof(uint)) && num_graphics <= 0x1000;
+    for (uint i = 0; ok && i < num_graphics; i++) {
+        uint addr = 0;
+        ok = read_data(fp, &addr, sizeof(uint)) && read_vector(fp, &entry->entity_graphics[addr], 0x100000);
+    }
+    fclose(fp);
+
+    // Discard anything that was partially read
+    if (!ok) {
+        Log::Warn("Ignoring invalid map cache file: %s\n", path.c_str());
+        *entry = MapCacheEntry();
+        return false;
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Saves a processed map to the cache.
+ *
+ * @param key: Cache key of the map (see GetKey())
+ * @param entry: Decoded map data to store
+ *
+ * @return True if the entry was written successfully
+ *
+ */
+bool Cache::SaveMap(uint64_t key, const MapCacheEntry* entry) {
+
+    // Bail if caching is disabled or the inputs couldn't be hashed
+    if (!enabled || key == CACHE_KEY_NONE) {
+        return false;
+    }
+
+    // Create the cache file
+    std::string path = GetPath("map", key);
+    FILE* fp = OpenForWrite(path);
+    if (fp == nullptr) {
+        return false;
+    }
+
+    // Write the header
+    uint magic = MAP_CACHE_MAGIC;
+    uint version = CACHE_FORMAT_VERSION;
+    bool ok = write_data(fp, &magic, sizeof(uint)) &&
+              write_data(fp, &version, sizeof(uint)) &&
+              write_data(fp, &key, sizeof(uint64_t));
+
+    // Write the decoded data
+    ok = ok && write_data(fp, &entry->decode_time, sizeof(double));
+    ok = ok && write_vector(fp, entry->vram);
+    ok = ok && write_data(fp, entry->tile_cluts, sizeof(entry->tile_cluts));
+    ok = ok && write_vector(fp, entry->tiles);
+    ok = ok && write_vector(fp, entry->tile_empty);
+
+    // Write the tile references of each layer
+    uint num_layers = entry->layer_tiles.size();
+    ok = ok && write_data(fp, &num_layers, sizeof(uint));
+    for (const auto& layer : entry->layer_tiles) {
+        ok = ok && write_vector(fp, layer);
+    }
+
+    // Write the decompressed entity graphics
+    uint num_graphics = entry->entity_graphics.size();
+    ok = ok && write_data(fp, &num_graphics, sizeof(uint));
+    for (const auto& graphics : entry->entity_graphics) {
+        ok = ok && write_data(fp, &graphics.first, sizeof(uint)) && write_vector(fp, graphics.second);
+    }
+
+    // Move the finished file into place
+    return FinishWrite(fp, path, ok);
+}
+
+
+
+
+/**
+ * Loads the entity emulation results of a map from the cache.
+ *
+ * @param key: Cache key of the emulator inputs (see GetKey())
+ * @param entry: Entry where the cached results should be stored
+ *
+ * @return True if the results were found in the cache and read successfully
+ *
+ */
+bool Cache::LoadEntities(uint64_t key, EntityCacheEntry* entry) {
+
+    // Bail if caching is disabled or the inputs couldn't be hashed
+    if (!enabled || key == CACHE_KEY_NONE) {
+        return false;
+    }
+
+    // Open the cache file
+    std::string path = GetPath("entities", key);
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+
+    // Verify the header
+    uint magic = 0;
+    uint version = 0;
+    uint64_t file_key = 0;
+    bool ok = read_data(fp, &magic, sizeof(uint)) &&
+              read_data(fp, &version, sizeof(uint)) &&
+              read_data(fp, &file_key, sizeof(uint64_t));
+    ok = ok && magic == ENTITY_CACHE_MAGIC && version == CACHE_FORMAT_VERSION && file_key == key;
+
+    // Read each room
+    uint num_rooms = 0;
+    ok = ok && read_data(fp, &num_rooms, sizeof(uint)) && num_rooms <= 0x400;
+    if (ok) {
+        entry->rooms.resize(num_rooms);
+    }
+    for (uint i = 0; ok && i < num_rooms; i++) {
+        RoomEntityCacheEntry* room = &entry->rooms[i];
+
+        // Read the RAM changes
+        uint num_deltas = 0;
+        ok = read_data(fp, &room->params_hash, sizeof(uint64_t)) &&
+             read_data(fp, &num_deltas, sizeof(uint)) && num_deltas <= 0x100000;
+        if (ok) {
+            room->ram_deltas.resize(num_deltas);
+        }
+        for (uint k = 0; ok && k < num_deltas; k++) {
+            RamDelta* delta = &room->ram_deltas[k];
+            ok = read_data(fp, &delta->offset, sizeof(uint)) &&
+                 read_vector(fp, &delta->data, 0x200000) &&
+                 delta->offset + delta->data.size() <= 0x200000;
+        }
+
+        // Read the framebuffer CLUT rows
+        ok = ok && read_vector(fp, &room->framebuffer_cluts, 768 * 16 * 2);
+        ok = ok && room->framebuffer_cluts.size() == 768 * 16 * 2;
+    }
+    fclose(fp);
+
+    // Discard anything that was partially read
+    if (!ok) {
+        Log::Warn("Ignoring invalid entity cache file: %s\n", path.c_str());
+        *entry = EntityCacheEntry();
+        return false;
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Saves the entity emulation results of a map to the cache.
+ *
+ * @param key: Cache key of the emulator inputs (see GetKey())
+ * @param entry: Emulation results to store
+ *
+ * @return True if the entry was written successfully
+ *
+ */
+bool Cache::SaveEntities(uint64_t key, const EntityCacheEntry* entry) {
+
+    // Bail if caching is disabled or the inputs couldn't be hashed
+    if (!enabled || key == CACHE_KEY_NONE) {
+        return false;
+    }
+
+    // Create the cache file
+    std::string path = GetPath("entities", key);
+    FILE* fp = OpenForWrite(path);
+    if (fp == nullptr) {
+        return false;
+    }
+
+    // Write the header
+    uint magic = ENTITY_CACHE_MAGIC;
+    uint version = CACHE_FORMAT_VERSION;
+    bool ok = write_data(fp, &magic, sizeof(uint)) &&
+              write_data(fp, &version, sizeof(uint)) &&
+              write_data(fp, &key, sizeof(uint64_t));
+
+    // Write each room
+    uint num_rooms = entry->rooms.size();
+    ok = ok && write_data(fp, &num_rooms, sizeof(uint));
+    for (const auto& room : entry->rooms) {
+        uint num_deltas = room.ram_deltas.size();
+        ok = ok && write_data(fp, &room.params_hash, sizeof(uint64_t)) && write_data(fp, &num_deltas, sizeof(uint));
+        for (const auto& delta : room.ram_deltas) {
+            ok = ok && write_data(fp, &delta.offset, sizeof(uint)) && write_vector(fp, delta.data);
+        }
+        ok = ok && write_vector(fp, room.framebuffer_cluts);
+    }
+
+    // Move the finished file into place
+    return FinishWrite(fp, path, ok);
+}
+
+
+
+/**
+ * Collects every span of bytes that differs between two buffers.
+ *
+ * @param base: Original contents
+ * @param cur: Current contents
+ * @param num_bytes: Size of both buffers
+ *
+ * @return List of changed spans (spans separated by fewer than 16 unchanged bytes are merged)
+ *
+ */
+std::vector<RamDelta> Cache::DiffRAM(const byte* base, const byte* cur, uint num_bytes) {
+
+    std::vector<RamDelta> deltas;
+    uint i = 0;
+    while (i < num_bytes) {
+
+        // Skip unchanged blocks quickly
+        if (i + 64 <= num_bytes && memcmp(base + i, cur + i, 64) == 0) {
+            i += 64;
+            continue;
+        }
+        if (base[i] == cur[i]) {
+            i++;
+            continue;
+        }
+
+        // Extend the span until 16 bytes in a row are unchanged
+        uint start = i;
+        uint unchanged = 0;
+        while (i < num_bytes && unchanged < 16) {
+            unchanged = (base[i] == cur[i]) ? unchanged + 1 : 0;
+            i++;
+        }
+
+        // Record the changed bytes
+        RamDelta delta;
+        delta.offset = start;
+        delta.data.assign(cur + start, cur + i - unchanged);
+        deltas.push_back(delta);
+    }
+
+    return deltas;
+}
+
+
+
+/**
+ * Writes a list of changed spans into a buffer.
+ *
+ * @param dst: Buffer to update
+ * @param num_bytes: Size of the buffer
+ * @param deltas: Changed spans (see DiffRAM())
+ *
+ * @return False if any span was out of bounds (nothing is written past the end of the buffer)
+ *
+ */
+bool Cache::ApplyDeltas(byte* dst, uint num_bytes, const std::vector<RamDelta>& deltas) {
+
+    bool ok = true;
+    for (const auto& delta : deltas) {
+        if (delta.offset > num_bytes || delta.data.size() > num_bytes - delta.offset) {
+            ok = false;
+            continue;
+        }
+        memcpy(dst + delta.offset, delta.data.data(), delta.data.size());
+    }
+    return ok;
+}
+
+
+
+
+/**
+ * Restores the post-initialization emulator state from the cache.
+ *
+ * @param key: Cache key of the PSX and SotN binaries (see GetKey())
+ *
+ * @return True if the snapshot was found and restored
+ *
+ * @note The snapshot file is memory-mapped and copied straight into the emulator.
+ *
+ */
+bool Cache::LoadSnapshot(uint64_t key) {
+
+    // Bail if caching is disabled or the inputs couldn't be hashed
+    if (!enabled || key == CACHE_KEY_NONE) {
+        return false;
+    }
+
+    // Map the snapshot file
+    std::string path = GetPath("snapshot", key);
+    if (!std::filesystem::exists(path)) {
+        return false;
+    }
+    MappedFile file;
+    if (!file.Open(path.c_str())) {
+        return false;
+    }
+
+    // Verify the header
+    uint header[4] = {};
+    if (file.size < sizeof(header)) {
+        Log::Warn("Ignoring invalid snapshot file: %s\n", path.c_str());
+        return false;
+    }
+    memcpy(header, file.data, sizeof(header));
+    uint64_t file_key = ((uint64_t)header[3] << 32) | header[2];
+    if (header[0] != SNAPSHOT_CACHE_MAGIC || header[1] != CACHE_FORMAT_VERSION || file_key != key) {
+        Log::Warn("Ignoring invalid snapshot file: %s\n", path.c_str());
+        return false;
+    }
+
+    // Restore the emulator state
+    return MipsEmulator::LoadSnapshot(file.data + sizeof(header), file.size - sizeof(header));
+}
+
+
+
+/**
+ * Saves the post-initialization emulator state to the cache.
+ *
+ * @param key: Cache key of the PSX and SotN binaries (see GetKey())
+ *
+ * @return True if the snapshot was written successfully
+ *
+ */
+bool Cache::SaveSnapshot(uint64_t key) {
+
+    // Bail if caching is disabled or the inputs couldn't be hashed
+    if (!enabled || key == CACHE_KEY_NONE) {
+        return false;
+    }
+
+    // Serialize the emulator state
+    std::vector<byte> snapshot;
+    if (!MipsEmulator::SaveSnapshot(&snapshot)) {
+        return false;
+    }
+
+    // Create the cache file
+    std::string path = GetPath("snapshot", key);
+    FILE* fp = OpenForWrite(path);
+    if (fp == nullptr) {
+        return false;
+    }
+
+    // Write the header followed by the snapshot
+    uint header[4] = {SNAPSHOT_CACHE_MAGIC, CACHE_FORMAT_VERSION, (uint)key, (uint)(key >> 32)};
+    bool ok = write_data(fp, header, sizeof(header)) && write_data(fp, snapshot.data(), snapshot.size());
+
+    // Move the finished file into place
+    return FinishWrite(fp, path, ok);
+}
@@ -0,0 +1,451 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include "common.h"
+#include "map.h"
+#include "map_export.h"
+#include "game_loader.h"
+#include "mips.h"
+#include "cache.h"
+#include "cluts.h"
+#include "mapped_file.h"
+#include "utils.h"
+#include "log.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+
+
+// Output formats
+enum CLI_FORMAT {
+    CliFormat_JSON = 0,
+    CliFormat_Binary = 1
+};
+
+// Outcome of processing one map (filled in by the worker and the pool thread that launched it)
+typedef struct MapResult {
+    std::string map_path;                                   // Map file that was processed
+    bool ok = false;                                        // Whether the export was written
+    std::string error;                                      // Last error the worker reported
+    uint num_rooms = 0;                                     // Rooms in the map
+    uint num_entities = 0;                                  // Entities across every room
+    bool entity_cache_hit = false;                          // Whether the entities were restored from the cache
+    double boot_ms = 0;                                     // Time taken to boot (or restore) the emulator
+    double parse_ms = 0;                                    // Time taken to parse the map and prepare emulator RAM
+    double emulate_ms = 0;                                  // Time taken to emulate every room
+    double write_ms = 0;                                    // Time taken to write the export
+    double total_ms = 0;                                    // Wall time of the worker process
+} MapResult;
+
+// Prefix of the line a worker prints its result on
+const char* const CLI_RESULT_PREFIX = "RESULT ";
+
+
+
+
+// -- Helpers --------------------------------------------------------------------------------------------------
+
+/**
+ * Milliseconds elapsed since a given point in time.
+ *
+ * @param start: Point in time to measure from
+ *
+ * @return Elapsed milliseconds
+ *
+ */
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+
+// -- Worker ---------------------------------------------------------------------------------------------------
+
+/**
+ * Parses a map, emulates the entities of every room and writes the export.
+ *
+ * @param files: Game files to load
+ * @param map_path: Map file to process
+ * @param output_dir: Directory to write the export to
+ * @param format: Format of the export (CliFormat_*)
+ * @param result: Where to store counts and timings
+ *
+ * @return True if the export was written
+ *
+ * @note This runs once per worker process, as the emulator state is shared by the whole process.
+ *
+ */
+static bool process_map(const GameFiles& files, const std::string& map_path, const std::string& output_dir, uint format, MapResult* result) {
+
+    // Boot the emulator
+    auto start = std::chrono::steady_clock::now();
+    if (!GameLoader::BootEmulator(files)) {
+        return false;
+    }
+    result->boot_ms = elapsed_ms(start);
+
+    // Parse the map
+    start = std::chrono::steady_clock::now();
+    std::string gfx_path = GameLoader::FindMapGraphics(map_path);
+    if (gfx_path.empty()) {
+        Log::Error("Could not find the graphics file of %s\n", map_path.c_str());
+        return false;
+    }
+    Map map;
+    if (!map.ParseMapFile(map_path.c_str()) || !MipsEmulator::LoadMapFile(map_path.c_str())) {
+        return false;
+    }
+
+    // Read the map tile CLUTs from the bottom 16 rows of the map's VRAM
+    std::shared_ptr<const MappedFile> gfx_file = MappedFile::Share(gfx_path.c_str());
+    if (gfx_file == nullptr) {
+        Log::Error("Could not read map graphics file: %s\n", gfx_path.c_str());
+        return false;
+    }
+    byte* vram_data = (byte*)calloc(512 * 256 * 4, sizeof(byte));
+    Utils::Chunks_to_VRAM(gfx_file->data, gfx_file->size, vram_data);
+    gfx_file.reset();
+    byte* map_rgba_cluts = (byte*)calloc(256 * 16 * 4, sizeof(byte));
+    for (int y = 0; y < 16; y++) {
+        memcpy(map_rgba_cluts + (y * 256 * 4), vram_data + (((240 + y) * 512) * 4), 256 * 4);
+    }
+    byte* indexed_cluts = Utils::RGBA_to_Indexed(map_rgba_cluts, 256 * 16);
+    free(map_rgba_cluts);
+    free(vram_data);
+
+    // Store map tile and entity CLUTs in MIPS RAM
+    for (int i = 0; i < 256; i++) {
+        MipsEmulator::StoreMapCLUT(i * 32, 32, indexed_cluts + (i * 32));
+    }
+    free(indexed_cluts);
+    for (const ClutEntry& clut : map.entity_cluts) {
+        MipsEmulator::StoreMapCLUT(clut.offset, clut.count, clut.clut_data);
+    }
+    MipsEmulator::SaveState();
+    result->parse_ms = elapsed_ms(start);
+
+    // Emulate every room (same cache key as the editor)
+    start = std::chrono::steady_clock::now();
+    map.entity_cache_key = Cache::GetKey({files.psx_path, files.bin_path, map_path, gfx_path, files.gfx_path});
+    EntityEmulationState emulation;
+    map.BeginEntityEmulation(&emulation);
+    for (uint i = 0; i < map.rooms.size(); i++) {
+        map.rooms[i].entities = map.EmulateRoom(i, &emulation);
+        result->num_entities += map.rooms[i].entities.size();
+    }
+    map.EndEntityEmulation(&emulation);
+    result->num_rooms = map.rooms.size();
+    result->entity_cache_hit = emulation.cache_hit;
+    result->emulate_ms = elapsed_ms(start);
+
+    // Write the export
+    start = std::chrono::steady_clock::now();
+    std::string output_path = output_dir + "/" + map.map_id + (format == CliFormat_JSON ? ".json" : ".bin");
+    FILE* fp = fopen(output_path.c_str(), "wb");
+    if (fp == nullptr) {
+        Log::Error("Could not write %s\n", output_path.c_str());
+        return false;
+    }
+    bool written;
+    if (format == CliFormat_JSON) {
+        std::string json = MapExport::ToJSON(&map);
+        written = fwrite(json.data(), 1, json.size(), fp) == json.size();
+    }
+    else {
+        std::vector<byte> bin = MapExport::ToBinary(&map);
+        written = fwrite(bin.data(), 1, bin.size(), fp) == bin.size();
+    }
+    written = (fclose(fp) == 0) && written;
+    if (!written) {
+        Log::Error("Could not write %s\n", output_path.c_str());
+        return false;
+    }
+    result->write_ms = elapsed_ms(start);
+
+    return true;
+}
+
+
+
+
+// -- Pool -----------------------------------------------------------------------------------------------------
+
+/**
+ * Runs a worker process for a map and collects its result.
+ *
+ * @param command: Command line of the worker (without the map argument)
+ * @param map_path: Map file to process
+ *
+ * @return Result reported by the worker (or the reason it failed)
+ *
+ */
+static MapResult run_worker(const std::string& command, const std::string& map_path) {
+
+    MapResult result;
+    result.map_path = map_path;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string full_command = command + " --worker " + Utils::QuoteArg(map_path) + " 2>&1";
+#ifdef _WIN32
+    // cmd.exe strips the outermost quotes
+    full_command = "\"" + full_command + "\"";
+#endif
+    FILE* pipe = popen(full_command.c_str(), "r");
+    if (pipe == nullptr) {
+        result.error = "Could not start worker process";
+        return result;
+    }
+
+    // Keep the result line and the last error the worker logged
+    bool reported = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), pipe) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+        int ok = 0;
+        int cache_hit = 0;
+        if (strncmp(line, CLI_RESULT_PREFIX, strlen(CLI_RESULT_PREFIX)) == 0 && sscanf(
+            line + strlen(CLI_RESULT_PREFIX), "%d %u %u %d %lf %lf %lf %lf",
+            &ok, &result.num_rooms, &result.num_entities, &cache_hit,
+            &result.boot_ms, &result.parse_ms, &result.emulate_ms, &result.write_ms
+        ) == 8) {
+            result.ok = ok != 0;
+            result.entity_cache_hit = cache_hit != 0;
+            reported = true;
+        }
+        else if (strncmp(line, "[ERROR]", 7) == 0) {
+            result.error = line + 7 + strspn(line + 7, " ");
+        }
+    }
+    int status = pclose(pipe);
+    result.total_ms = elapsed_ms(start);
+
+    // Workers that crash never report a result
+    if (!reported || status != 0) {
+        result.ok = false;
+        if (result.error.empty()) {
+            result.error = reported ? Utils::FormatString("Worker exited with status %d", status) : Utils::FormatString("Worker crashed (status %d)", status);
+        }
+    }
+    return result;
+}
+
+
+
+/**
+ * Writes the per-map results and totals as JSON.
+ *
+ * @param filename: File to write
+ * @param results: Result of every map
+ * @param wall_ms: Wall time of the whole run
+ * @param num_workers: Number of workers that ran in parallel
+ *
+ * @return True if the summary was written
+ *
+ */
+static bool write_summary(const std::string& filename, const std::vector<MapResult>& results, double wall_ms, uint num_workers) {
+
+    uint num_ok = 0;
+    std::string out = "{\n    \"maps\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const MapResult& result = results[i];
+        num_ok += result.ok;
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append(Utils::FormatString(
+            "        {\"map\": \"%s\", \"ok\": %s, \"error\": \"%s\", \"rooms\": %u, \"entities\": %u, \"entity_cache_hit\": %s, "
+            "\"boot_ms\": %.3f, \"parse_ms\": %.3f, \"emulate_ms\": %.3f, \"write_ms\": %.3f, \"total_ms\": %.3f}",
+            MapExport::EscapeJSON(result.map_path).c_str(), result.ok ? "true" : "false", MapExport::EscapeJSON(result.error).c_str(),
+            result.num_rooms, result.num_entities, result.entity_cache_hit ? "true" : "false",
+            result.boot_ms, result.parse_ms, result.emulate_ms, result.write_ms, result.total_ms
+        ));
+    }
+    out.append(results.empty() ? "],\n" : "\n    ],\n");
+    out.append(Utils::FormatString(
+        "    \"workers\": %u,\n    \"succeeded\": %u,\n    \"failed\": %zu,\n    \"wall_ms\": %.3f\n}\n",
+        num_workers, num_ok, results.size() - num_ok, wall_ms
+    ));
+
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool written = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    return (fclose(fp) == 0) && written;
+}
+
+
+
+/**
+ * Prints the command-line usage.
+ */
+static void print_usage() {
+    printf(
+        "Usage: sotn-cli <disc image or directory> [options]\n"
+        "\n"
+        "Exports the rooms, tile layers, entity layouts and emulated entities of every map.\n"
+        "\n"
+        "Options:\n"
+        "    -o <dir>        Output directory (default: export)\n"
+        "    -f <format>     Output format: json or bin (default: json)\n"
+        "    -j <count>      Number of maps processed in parallel (default: number of cores)\n"
+        "    --no-cache      Don't read or write the emulator caches\n"
+        "    -v              Show the log output of the workers\n"
+    );
+}
+
+
+
+/**
+ * Processes every map of a disc in parallel, one worker process per map.
+ */
+int main(int argc, char** argv) {
+
+    // Parse arguments
+    std::string input;
+    std::string output_dir = "export";
+    std::string worker_map;
+    uint format = CliFormat_JSON;
+    uint num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value) {
+            output_dir = argv[++i];
+        }
+        else if (arg == "-f" && has_value) {
+            std::string value = Utils::toLowerCase(argv[++i]);
+            if (value != "json" && value != "bin") {
+                print_usage();
+                return 1;
+            }
+            format = value == "json" ? CliFormat_JSON : CliFormat_Binary;
+        }
+        else if (arg == "-j" && has_value) {
+            num_workers = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--no-cache") {
+            Cache::enabled = false;
+        }
+        else if (arg == "-v") {
+            verbose = true;
+        }
+        else if (arg == "--worker" && has_value) {
+            worker_map = argv[++i];
+        }
+        else if (input.empty() && arg[0] != '-') {
+            input = arg;
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (input.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    // Only errors are needed to fill in the summary
+    if (!verbose) {
+        Log::level = LOG_ERROR;
+    }
+
+    // Locate the game files
+    GameFiles files;
+    if (!GameLoader::FindFiles(input.c_str(), &files)) {
+        return 1;
+    }
+
+    // Worker: process a single map and report the result
+    if (!worker_map.empty()) {
+
+        // Flush every line so that errors reach the pool even if the worker crashes
+        setvbuf(stdout, nullptr, _IOLBF, 0);
+
+        MapResult result;
+        bool ok = process_map(files, worker_map, output_dir, format, &result);
+        printf(
+            "%s%d %u %u %d %f %f %f %f\n",
+            CLI_RESULT_PREFIX, ok ? 1 : 0, result.num_rooms, result.num_entities, result.entity_cache_hit ? 1 : 0,
+            result.boot_ms, result.parse_ms, result.emulate_ms, result.write_ms
+        );
+        return ok ? 0 : 1;
+    }
+
+    if (files.maps.empty()) {
+        Log::Error("No maps found in %s\n", input.c_str());
+        return 1;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(output_dir, ec);
+    if (!std::filesystem::is_directory(output_dir, ec)) {
+        Log::Error("Could not create output directory: %s\n", output_dir.c_str());
+        return 1;
+    }
+
+    // Boot once up front so every worker can restore the snapshot instead of booting on its own
+    auto run_start = std::chrono::steady_clock::now();
+    if (Cache::enabled && !GameLoader::BootEmulator(files)) {
+        return 1;
+    }
+
+    // Everything but the map is the same for every worker
+    std::string self = argv[0];
+    if (self.find_first_of("/\\") != std::string::npos) {
+        self = std::filesystem::absolute(self, ec).string();
+    }
+    std::string command = Utils::QuoteArg(self) + " " + Utils::QuoteArg(input) + " -o " + Utils::QuoteArg(output_dir);
+    command.append(format == CliFormat_JSON ? " -f json" : " -f bin");
+    command.append(Cache::enabled ? "" : " --no-cache");
+    command.append(verbose ? " -v" : "");
+
+    // Hand out maps to the workers in order
+    num_workers = std::min<uint>(num_workers, files.maps.size());
+    std::vector<MapResult> results(files.maps.size());
+    std::atomic<size_t> next_map(0);
+    std::mutex print_mutex;
+    std::vector<std::thread> workers;
+    for (uint w = 0; w < num_workers; w++) {
+        workers.emplace_back([&] {
+            for (size_t i = next_map++; i < files.maps.size(); i = next_map++) {
+                results[i] = run_worker(command, files.maps[i]);
+                std::lock_guard<std::mutex> lock(print_mutex);
+                const MapResult& result = results[i];
+                if (result.ok) {
+                    printf("[%3zu/%zu] %-40s %4u rooms %5u entities %9.1f ms%s\n", i + 1, files.maps.size(), result.map_path.c_str(), result.num_rooms, result.num_entities, result.total_ms, result.entity_cache_hit ? " (cached)" : "");
+                }
+                else {
+                    printf("[%3zu/%zu] %-40s FAILED: %s\n", i + 1, files.maps.size(), result.map_path.c_str(), result.error.c_str());
+                }
+                fflush(stdout);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double wall_ms = elapsed_ms(run_start);
+
+    // Write the summary
+    uint num_failed = std::count_if(results.begin(), results.end(), [](const MapResult& result) { return !result.ok; });
+    std::string summary_path = output_dir + "/summary.json";
+    if (!write_summary(summary_path, results, wall_ms, num_workers)) {
+        Log::Error("Could not write %s\n", summary_path.c_str());
+        return 1;
+    }
+    printf("%zu maps exported, %u failed in %.1f ms (%u workers), summary written to %s\n", results.size() - num_failed, num_failed, wall_ms, num_workers, summary_path.c_str());
+
+    return num_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+#include <cstring>
+#include "common.h"
+#include "cluts.h"
+#include "utils.h"
+
+
+
+// Variables
+ClutBank Clut::banks[CLUT_BANK_COUNT];
+std::set<ClutUser> Clut::dirty_users;
+
+
+
+/**
+ * Clears a bank and resizes it to hold a number of blank CLUTs.
+ *
+ * @param bank: Bank to reset (CLUT_BANK_*)
+ * @param count: Number of CLUTs the bank holds
+ *
+ * @note Users of the bank are forgotten and its textures are uploaded again the next time they're requested.
+ *
+ */
+void Clut::Reset(uint bank, uint count) {
+
+    ClutBank* cur_bank = &banks[bank];
+    cur_bank->colors.assign(count * 16, 0);
+    cur_bank->versions.assign(count, 1);
+    for (uint format = 0; format < CLUT_FORMAT_COUNT; format++) {
+        cur_bank->rgba[format].assign(count * 16 * 4, 0);
+        cur_bank->rgba_versions[format].assign(count, 0);
+        cur_bank->texture_versions[format].assign(count, 0);
+    }
+    cur_bank->users.clear();
+}
+
+
+
+/**
+ * Overwrites consecutive CLUTs of a bank, invalidating the ones that actually changed.
+ *
+ * @param bank: Bank to write to (CLUT_BANK_*)
+ * @param first: Index of the first CLUT to write
+ * @param count: Number of CLUTs to write
+ * @param data: RGB1555 colors to write (32 bytes per CLUT)
+ *
+ * @return Number of CLUTs that changed
+ *
+ * @note Every surface using a changed CLUT is queued for TakeDirtyUsers.
+ *
+ */
+uint Clut::Set(uint bank, uint first, uint count, const byte* data) {
+
+    ClutBank* cur_bank = &banks[bank];
+    uint num_changed = 0;
+    for (uint i = 0; i < count && first + i < cur_bank->versions.size(); i++) {
+
+        // Skip CLUTs that are already up to date
+        ushort* colors = cur_bank->colors.data() + ((first + i) * 16);
+        if (memcmp(colors, data + (i * 32), 32) == 0) {
+            continue;
+        }
+        memcpy(colors, data + (i * 32), 32);
+        cur_bank->versions[first + i]++;
+        num_changed++;
+
+        // Queue everything drawn with the CLUT
+        auto users = cur_bank->users.find(first + i);
+        if (users != cur_bank->users.end()) {
+            dirty_users.insert(users->second.begin(), users->second.end());
+        }
+    }
+    return num_changed;
+}
+
+
+
+/**
+ * Gets the number of CLUTs in a bank.
+ *
+ * @param bank: Bank to check (CLUT_BANK_*)
+ *
+ * @return Number of CLUTs in the bank
+ *
+ */
+uint Clut::GetCount(uint bank) {
+    return banks[bank].versions.size();
+}
+
+
+
+/**
+ * Gets the version of a CLUT (incremented every time its colors change).
+ *
+ * @param bank: Bank of the CLUT (CLUT_BANK_*)
+ * @param index: Index of the CLUT within the bank
+ *
+ * @return Version of the CLUT, or 0 if it doesn't exist
+ *
+ */
+uint Clut::GetVersion(uint bank, uint index) {
+    return index < banks[bank].versions.size() ? banks[bank].versions[index] : 0;
+}
+
+
+
+/**
+ * Gets the RGB1555 colors of a CLUT.
+ *
+ * @param bank: Bank of the CLUT (CLUT_BANK_*)
+ * @param index: Index of the CLUT within the bank (wraps around the bank)
+ *
+ * @return 16 RGB1555 colors
+ *
+ */
+const ushort* Clut::GetColors(uint bank, uint index) {
+
+    static const ushort blank_colors[16] = {0};
+    ClutBank* cur_bank = &banks[bank];
+    if (cur_bank->versions.empty()) {
+        return blank_colors;
+    }
+    return cur_bank->colors.data() + ((index % cur_bank->versions.size()) * 16);
+}
+
+
+
+/**
+ * Gets the RGBA expansion of a CLUT, converting it only if it changed since the last call.
+ *
+ * @param bank: Bank of the CLUT (CLUT_BANK_*)
+ * @param index: Index of the CLUT within the bank (wraps around the bank)
+ * @param format: Expansion to get (CLUT_FORMAT_*)
+ *
+ * @return 16 RGBA colors (valid until the bank is reset)
+ *
+ */
+const byte* Clut::GetRGBA(uint bank, uint index, uint format) {
+
+    static const byte blank_rgba[16 * 4] = {0};
+    ClutBank* cur_bank = &banks[bank];
+    if (cur_bank->versions.empty()) {
+        return blank_rgba;
+    }
+    index %= cur_bank->versions.size();
+
+    // Expand the CLUT again if its colors changed
+    byte* rgba = cur_bank->rgba[format].data() + (index * 16 * 4);
+    if (cur_bank->rgba_versions[format][index] != cur_bank->versions[index]) {
+        Utils::CLUT_to_RGBA((const byte*)(cur_bank->colors.data() + (index * 16)), rgba, 1, format == CLUT_FORMAT_SEMI);
+        cur_bank->rgba_versions[format][index] = cur_bank->versions[index];
+    }
+    return rgba;
+}
+
+
+
+/**
+ * Records that a surface was drawn with a CLUT.
+ *
+ * @param bank: Bank of the CLUT (CLUT_BANK_*)
+ * @param index: Index of the CLUT within the bank
+ * @param user: Surface that uses the CLUT
+ *
+ */
+void Clut::AddUser(uint bank, uint index, const ClutUser& user) {
+    ClutBank* cur_bank = &banks[bank];
+    if (!cur_bank->versions.empty()) {
+        cur_bank->users[index % cur_bank->versions.size()].insert(user);
+    }
+}
+
+
+
+/**
+ * Forgets every surface of a given kind (e.g. when the map they belong to is unloaded).
+ *
+ * @param type: Kind of surface to forget (CLUT_USER_*)
+ *
+ */
+void Clut::ClearUsers(uint type) {
+
+    for (auto& bank : banks) {
+        for (auto it = bank.users.begin(); it != bank.users.end();) {
+            for (auto user = it->second.begin(); user != it->second.end();) {
+                user = (user->type == type ? it->second.erase(user) : std::next(user));
+            }
+            it = (it->second.empty() ? bank.users.erase(it) : std::next(it));
+        }
+    }
+    for (auto user = dirty_users.begin(); user != dirty_users.end();) {
+        user = (user->type == type ? dirty_users.erase(user) : std::next(user));
+    }
+}
+
+
+
+/**
+ * Collects every surface whose CLUT changed since the last call.
+ *
+ * @return Surfaces that need to be redrawn
+ *
+ */
+std::vector<ClutUser> Clut::TakeDirtyUsers() {
+    std::vector<ClutUser> users(dirty_users.begin(), dirty_users.end());
+    dirty_users.clear();
+    return users;
+}
@@ -0,0 +1,54 @@
+#include <cstring>
+#include <GL/glew.h>
+#include "common.h"
+#include "cluts.h"
+#include "utils.h"
+
+
+
+/**
+ * Gets a texture of a whole bank (one 16-pixel CLUT after another, 16 rows tall) for display.
+ *
+ * @param bank: Bank to get the texture of (CLUT_BANK_*)
+ * @param format: Expansion to use (CLUT_FORMAT_*)
+ *
+ * @return Texture of the bank (only the CLUTs that changed since the last call are uploaded again)
+ *
+ */
+TextureId Clut::GetTexture(uint bank, uint format) {
+
+    ClutBank* cur_bank = &banks[bank];
+    uint count = cur_bank->versions.size();
+    if (count == 0) {
+        return 0;
+    }
+
+    // Drop the texture if the bank was resized since it was created
+    if (cur_bank->textures[format] != 0 && cur_bank->texture_counts[format] != count) {
+        glDeleteTextures(1, &cur_bank->textures[format]);
+        cur_bank->textures[format] = 0;
+    }
+
+    // Create the texture the first time it's requested
+    if (cur_bank->textures[format] == 0) {
+        byte* rgba_pixels = (byte*)calloc(count * 16 * 4, sizeof(byte));
+        for (uint i = 0; i < count; i++) {
+            memcpy(rgba_pixels + (i * 16 * 4), GetRGBA(bank, i, format), 16 * 4);
+            cur_bank->texture_versions[format][i] = cur_bank->versions[i];
+        }
+        cur_bank->textures[format] = Utils::CreateTexture(rgba_pixels, count, 16);
+        cur_bank->texture_counts[format] = count;
+        free(rgba_pixels);
+    }
+
+    // Otherwise only upload the CLUTs that changed
+    else {
+        for (uint i = 0; i < count; i++) {
+            if (cur_bank->texture_versions[format][i] != cur_bank->versions[i]) {
+                Utils::SetPixels(cur_bank->textures[format], (i * 16) % count, (i * 16) / count, 16, 1, (byte*)GetRGBA(bank, i, format));
+                cur_bank->texture_versions[format][i] = cur_bank->versions[i];
+            }
+        }
+    }
+    return cur_bank->textures[format];
+}
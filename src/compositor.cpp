@@ -0,0 +1,423 @@
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOTN_EDITOR_SSE2
+#endif
+#include "common.h"
+#include "compositor.h"
+#include "map.h"
+
+
+
+/**
+ * Blends a row of RGBA pixels onto another the way the PSX GPU blends semi-transparent pixels.
+ *
+ * @param dst: Pixels to draw onto (Back)
+ * @param src: Pixels to draw (Forward)
+ * @param count: Number of pixels
+ * @param blend_mode: Equation for blended pixels (PSX_BLEND_*)
+ * @param blend_opaque: Whether fully opaque pixels are blended too (otherwise only pixels with an alpha between 0
+ *                      and 0xFF are, i.e. semi-transparent texels)
+ *
+ * @note Pixels with an alpha of 0 are skipped. Every written pixel ends up fully opaque.
+ *
+ */
+void Compositor::BlendRow(uint* dst, const uint* src, uint count, uint blend_mode, bool blend_opaque) {
+
+    uint i = 0;
+
+#ifdef SOTN_EDITOR_SSE2
+    // Blend 4 pixels at a time
+    const __m128i alpha_mask = _mm_set1_epi32(0xFF000000);
+    const __m128i half_mask = _mm_set1_epi8(0x7F);
+    const __m128i quarter_mask = _mm_set1_epi8(0x3F);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i back = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i front = _mm_loadu_si128((const __m128i*)(src + i));
+
+        // Apply the equation to every channel (the vector form of GpuEmulator::BlendChannel(), saturating the same way)
+        __m128i blended;
+        switch (blend_mode) {
+            case PSX_BLEND_ADD:
+                blended = _mm_adds_epu8(back, front);
+                break;
+            case PSX_BLEND_SUBTRACT:
+                blended = _mm_subs_epu8(back, front);
+                break;
+            case PSX_BLEND_ADD_QUARTER:
+                blended = _mm_adds_epu8(back, _mm_and_si128(_mm_srli_epi16(front, 2), quarter_mask));
+                break;
+            default:
+                blended = _mm_add_epi8(_mm_and_si128(back, front), _mm_and_si128(_mm_srli_epi16(_mm_xor_si128(back, front), 1), half_mask));
+                break;
+        }
+        blended = _mm_or_si128(blended, alpha_mask);
+
+        // Opaque pixels replace the back, transparent pixels leave it alone
+        __m128i front_alpha = _mm_and_si128(front, alpha_mask);
+        __m128i transparent = _mm_cmpeq_epi32(front_alpha, zero);
+        __m128i opaque = (blend_opaque ? zero : _mm_cmpeq_epi32(front_alpha, alpha_mask));
+        __m128i result = _mm_or_si128(_mm_and_si128(opaque, front), _mm_andnot_si128(opaque, blended));
+        result = _mm_or_si128(_mm_and_si128(transparent, back), _mm_andnot_si128(transparent, result));
+        _mm_storeu_si128((__m128i*)(dst + i), result);
+    }
+#endif
+
+    // Blend the remaining pixels one at a time
+    for (; i < count; i++) {
+        uint alpha = src[i] >> 24;
+        if (alpha == 0) {
+            continue;
+        }
+        dst[i] = (alpha == 0xFF && !blend_opaque ? src[i] : BlendPixel(dst[i], src[i], blend_mode));
+    }
+}
+
+
+
+/**
+ * Draws a room the same way the main viewport does (BG ordering table, BG layer, middle ordering table, FG layer,
+ * FG ordering table). The entity polygons the emulated GPU drew for each ordering table go on top of its sprites.
+ *
+ * @param map: Map the room belongs to
+ * @param room: Room to draw
+ *
+ * @return Image of the room (the size of its FG layer, pixels nothing was drawn to are left fully transparent)
+ *
+ * @note Only reads the decoded tiles and sprite parts kept in CPU memory, so any number of rooms can be drawn at once.
+ *
+ */
+CompositeImage Compositor::RenderRoom(const Map* map, const Room* room) {
+
+    CompositeImage image;
+    image.width = room->fg_layer.width * 16;
+    image.height = room->fg_layer.height * 16;
+    image.pixels.assign(image.width * image.height, 0);
+    if (room->load_flags == 0xFF) {
+        return image;
+    }
+
+    // Ordering table entries are drawn in ascending order, entries of the same layer in list order
+    for (const auto& layer : room->bg_ordering_table) {
+        for (const auto& sprite : layer.second) {
+            DrawSprite(&image, map, sprite);
+        }
+    }
+    DrawPolygons(&image, room->polygon_layers[ROOM_POLYGONS_BG]);
+    DrawLayer(&image, map, room, false);
+    for (const auto& layer : room->mid_ordering_table) {
+        for (const auto& sprite : layer.second) {
+            DrawSprite(&image, map, sprite);
+        }
+    }
+    DrawPolygons(&image, room->polygon_layers[ROOM_POLYGONS_MID]);
+    DrawLayer(&image, map, room, true);
+    for (const auto& layer : room->fg_ordering_table) {
+        for (const auto& sprite : layer.second) {
+            DrawSprite(&image, map, sprite);
+        }
+    }
+    DrawPolygons(&image, room->polygon_layers[ROOM_POLYGONS_FG]);
+    return image;
+}
+
+
+
+/**
+ * Draws several rooms in parallel.
+ *
+ * @param map: Map the rooms belong to
+ * @param room_ids: Indices of the rooms to draw
+ *
+ * @return Image of each room (in the same order as room_ids)
+ *
+ */
+std::vector<CompositeImage> Compositor::RenderRooms(const Map* map, const std::vector<uint>& room_ids) {
+
+    std::vector<CompositeImage> images(room_ids.size());
+    std::atomic<uint> next_room(0);
+    auto render_worker = [&] {
+        for (uint i = next_room++; i < room_ids.size(); i = next_room++) {
+            images[i] = RenderRoom(map, &map->rooms[room_ids[i]]);
+        }
+    };
+    uint num_threads = std::min<uint>(std::max(1u, std::thread::hardware_concurrency()), room_ids.size());
+    std::vector<std::thread> render_threads;
+    for (uint i = 1; i < num_threads; i++) {
+        render_threads.emplace_back(render_worker);
+    }
+    render_worker();
+    for (auto& thread : render_threads) {
+        thread.join();
+    }
+    return images;
+}
+
+
+
+/**
+ * Blends a single RGBA pixel onto another.
+ *
+ * @param back: Pixel being drawn onto
+ * @param front: Pixel being drawn
+ * @param blend_mode: Equation to use (PSX_BLEND_*)
+ *
+ * @return Blended pixel (fully opaque)
+ *
+ */
+uint Compositor::BlendPixel(uint back, uint front, uint blend_mode) {
+
+    uint result = 0xFF000000;
+    for (uint shift = 0; shift < 24; shift += 8) {
+        result |= GpuEmulator::BlendChannel((back >> shift) & 0xFF, (front >> shift) & 0xFF, blend_mode, 0xFF) << shift;
+    }
+    return result;
+}
+
+
+
+/**
+ * Draws one of a room's tile layers.
+ *
+ * @param image: Image to draw onto
+ * @param map: Map the room belongs to
+ * @param room: Room the layer belongs to
+ * @param foreground: Whether to draw the FG layer (otherwise the BG layer)
+ *
+ */
+void Compositor::DrawLayer(CompositeImage* image, const Map* map, const Room* room, bool foreground) {
+
+    // Make sure the layer exists
+    const TileLayer* layer = (foreground ? &room->fg_layer : &room->bg_layer);
+    uint layer_idx = (room->tile_layer_id * 2) + (foreground ? 0 : 1);
+    if (layer->tiles.size() == 0 || layer_idx >= map->layer_unique_tiles.size()) {
+        return;
+    }
+
+    // Layers are drawn with plain alpha blending (semi-transparent tiles are averaged with what's behind them)
+    const std::vector<uint>& tiles = map->layer_unique_tiles[layer_idx];
+    uint tile_row[16];
+    for (uint idx = 0; idx < tiles.size() && idx < layer->width * layer->height; idx++) {
+        uint x = (idx % layer->width) * 16;
+        uint y = (idx / layer->width) * 16;
+        if (x >= image->width || (tiles[idx] + 1) * 16 * 16 * 4 > map->cache.tiles.size()) {
+            continue;
+        }
+        const byte* tile_pixels = map->cache.tiles.data() + (tiles[idx] * 16 * 16 * 4);
+        uint row_width = std::min(16u, image->width - x);
+        for (uint row = 0; row < 16 && y + row < image->height; row++) {
+            memcpy(tile_row, tile_pixels + (row * 16 * 4), 16 * 4);
+            BlendRow(image->pixels.data() + ((y + row) * image->width) + x, tile_row, row_width, PSX_BLEND_AVERAGE, false);
+        }
+    }
+}
+
+
+
+/**
+ * Draws an entity sprite part, placing it the same way the main viewport does.
+ *
+ * @param image: Image to draw onto
+ * @param map: Map the sprite's room belongs to
+ * @param sprite: Sprite part to draw
+ *
+ * @note Parts made from polygons are skipped, the emulated GPU draws those (see DrawPolygons()).
+ *
+ */
+void Compositor::DrawSprite(CompositeImage* image, const Map* map, const EntitySpritePart& sprite) {
+
+    // Skip polygon sprites
+    if (SOTN_PRIM_TYPES.count(sprite.polygon.code) > 0) {
+        return;
+    }
+
+    // Get the decoded pixels of the sprite part
+    const byte* pixels = nullptr;
+    uint tex_width = 0;
+    uint tex_height = 0;
+    auto part = map->sprite_part_textures.find(sprite.texture);
+    if (part != map->sprite_part_textures.end()) {
+        const SpritePartEntry& entry = map->sprite_parts[part->second];
+        pixels = entry.pixels.data();
+        tex_width = entry.source.width;
+        tex_height = entry.source.height;
+    }
+    if (pixels == nullptr || tex_width == 0 || tex_height == 0) {
+        return;
+    }
+
+    // Pick the blend equation
+    uint blend_mode = PSX_BLEND_AVERAGE;
+    bool blend_opaque = false;
+    if (sprite.blend) {
+        switch (sprite.blend_mode & 0x60) {
+            case BlendMode_Light:
+                blend_mode = PSX_BLEND_ADD;
+                blend_opaque = true;
+                break;
+            case BlendMode_Reverse:
+                blend_mode = PSX_BLEND_SUBTRACT;
+                blend_opaque = true;
+                break;
+            case BlendMode_Pale:
+                blend_mode = PSX_BLEND_ADD_QUARTER;
+                blend_opaque = true;
+                break;
+        }
+    }
+
+    // Place the corners (top-left, top-right, bottom-right, bottom-left)
+    float left = sprite.x;
+    float top = sprite.y;
+    float right = left + sprite.width;
+    float bottom = top + sprite.height;
+    float u0 = sprite.flip_x ? 1.0f : 0.0f;
+    float v0 = sprite.flip_y ? 1.0f : 0.0f;
+    CompositeVertex corners[4];
+    corners[0].x = left;
+    corners[0].y = top;
+    corners[0].u = u0;
+    corners[0].v = v0;
+    corners[1].x = right;
+    corners[1].y = top;
+    corners[1].u = 1.0f - u0;
+    corners[1].v = v0;
+    corners[2].x = right;
+    corners[2].y = bottom;
+    corners[2].u = 1.0f - u0;
+    corners[2].v = 1.0f - v0;
+    corners[3].x = left;
+    corners[3].y = bottom;
+    corners[3].u = u0;
+    corners[3].v = 1.0f - v0;
+
+    // Rotate around the sprite's origin
+    if (sprite.rotate) {
+        float rad = ((float)sprite.rotate / 4096.0f) * 2.0f * (float)M_PI;
+        float rot_sin = sinf(rad);
+        float rot_cos = cosf(rad);
+        float pivot_x = corners[0].x - sprite.offset_x;
+        float pivot_y = corners[0].y - sprite.offset_y;
+        for (auto& corner : corners) {
+            float rel_x = corner.x - pivot_x;
+            float rel_y = corner.y - pivot_y;
+            corner.x = pivot_x + (rel_x * rot_cos) - (rel_y * rot_sin);
+            corner.y = pivot_y + (rel_x * rot_sin) + (rel_y * rot_cos);
+        }
+    }
+
+    DrawQuad(image, corners, pixels, tex_width, tex_height, blend_mode, blend_opaque);
+}
+
+
+
+/**
+ * Draws the entity polygons the emulated GPU drew for one of a room's ordering tables.
+ *
+ * @param image: Image to draw onto
+ * @param layer: Polygons to draw (see Map::RenderPolygons)
+ *
+ * @note Pixels the GPU left to be blended (see GPU_TARGET_BLEND) are blended with the room here, with their own blend
+ *       mode.
+ *
+ */
+void Compositor::DrawPolygons(CompositeImage* image, const PolygonLayer& layer) {
+
+    for (uint y = 0; y < layer.height && layer.y + y < image->height; y++) {
+        const uint* src = layer.pixels.data() + (y * layer.width);
+        uint* dst = image->pixels.data() + ((layer.y + y) * image->width) + layer.x;
+        for (uint x = 0; x < layer.width && layer.x + x < image->width; x++) {
+            uint alpha = src[x] >> 24;
+            if (alpha == 0xFF) {
+                dst[x] = src[x];
+            }
+            else if (alpha != 0) {
+                dst[x] = BlendPixel(dst[x], src[x], alpha & 3);
+            }
+        }
+    }
+}
+
+
+
+/**
+ * Draws a quad (as two triangles) with nearest-neighbor sampling.
+ *
+ * @param image: Image to draw onto
+ * @param vertices: Corners of the quad (top-left, top-right, bottom-right, bottom-left)
+ * @param pixels: RGBA pixels to sample
+ * @param width: Width of the pixels
+ * @param height: Height of the pixels
+ * @param blend_mode: Equation for blended pixels (PSX_BLEND_*)
+ * @param blend_opaque: Whether fully opaque pixels are blended too
+ *
+ * @note Each row is built into a temporary buffer (pixels outside the quad are fully transparent) and blended in one
+ *       go.
+ *
+ */
+void Compositor::DrawQuad(CompositeImage* image, const CompositeVertex* vertices, const byte* pixels, uint width, uint height, uint blend_mode, bool blend_opaque) {
+
+    // Get the pixels covered by the quad
+    float min_x = std::min({vertices[0].x, vertices[1].x, vertices[2].x, vertices[3].x});
+    float max_x = std::max({vertices[0].x, vertices[1].x, vertices[2].x, vertices[3].x});
+    float min_y = std::min({vertices[0].y, vertices[1].y, vertices[2].y, vertices[3].y});
+    float max_y = std::max({vertices[0].y, vertices[1].y, vertices[2].y, vertices[3].y});
+    int left = std::max(0, (int)floorf(min_x));
+    int right = std::min((int)image->width - 1, (int)ceilf(max_x) - 1);
+    int top = std::max(0, (int)floorf(min_y));
+    int bottom = std::min((int)image->height - 1, (int)ceilf(max_y) - 1);
+    if (left > right || top > bottom) {
+        return;
+    }
+
+    // Barycentric weights of a point within a triangle
+    auto get_weights = [](const CompositeVertex& a, const CompositeVertex& b, const CompositeVertex& c, float px, float py, float* weights) {
+        float area = ((b.x - a.x) * (c.y - a.y)) - ((c.x - a.x) * (b.y - a.y));
+        if (fabsf(area) < 1e-6f) {
+            return false;
+        }
+        weights[1] = (((px - a.x) * (c.y - a.y)) - ((c.x - a.x) * (py - a.y))) / area;
+        weights[2] = (((b.x - a.x) * (py - a.y)) - ((px - a.x) * (b.y - a.y))) / area;
+        weights[0] = 1.0f - weights[1] - weights[2];
+        return weights[0] >= 0 && weights[1] >= 0 && weights[2] >= 0;
+    };
+    const int triangles[2][3] = {{0, 1, 2}, {0, 2, 3}};
+
+    std::vector<uint> row(right - left + 1);
+    for (int y = top; y <= bottom; y++) {
+        for (int x = left; x <= right; x++) {
+
+            // Find the triangle the pixel center is in
+            float px = x + 0.5f;
+            float py = y + 0.5f;
+            float weights[3];
+            const int* corners = nullptr;
+            for (const auto& triangle : triangles) {
+                if (get_weights(vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]], px, py, weights)) {
+                    corners = triangle;
+                    break;
+                }
+            }
+            if (corners == nullptr) {
+                row[x - left] = 0;
+                continue;
+            }
+
+            // Sample the part
+            const CompositeVertex& a = vertices[corners[0]];
+            const CompositeVertex& b = vertices[corners[1]];
+            const CompositeVertex& c = vertices[corners[2]];
+            float u = (weights[0] * a.u) + (weights[1] * b.u) + (weights[2] * c.u);
+            float v = (weights[0] * a.v) + (weights[1] * b.v) + (weights[2] * c.v);
+            uint tex_x = std::min((uint)std::max(0.0f, u * width), width - 1);
+            uint tex_y = std::min((uint)std::max(0.0f, v * height), height - 1);
+            memcpy(&row[x - left], pixels + (((tex_y * width) + tex_x) * 4), sizeof(uint));
+        }
+        BlendRow(image->pixels.data() + (y * image->width) + left, row.data(), row.size(), blend_mode, blend_opaque);
+    }
+}
@@ -1,164 +1,610 @@
+#include <cstring>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 #include "compression.h"
+#include "entities.h"
+#include "mapped_file.h"
+#include "log.h"
 
 
 
 
 // -------------------------------------------------- Decompression --------------------------------------------------
 
-// Variables
-bool Compression::read_high;
-bool Compression::write_high;
-byte* Compression::decompress_buffer;
-byte* Compression::offset;
+// Run produced by a dictionary opcode
+typedef struct DecodeAction {
+    byte value;                                             // Nibble to write
+    ushort count;                                           // Number of times to write it (zero for unused entries)
+} DecodeAction;
 
 
 
-byte Compression::ReadFromCompressedBuffer() {
+/**
+ * Decodes a compressed stream into a buffer.
+ *
+ * @param dst: Buffer to decode into
+ * @param dst_size: Size of the buffer in bytes
+ * @param src: Compressed data
+ * @param src_size: Number of bytes of compressed data available
+ * @param num_nibbles: Where the number of nibbles written should be stored
+ * @param src_used: Where the number of compressed bytes consumed should be stored
+ *
+ * @return True if the end marker was reached without running out of source data or destination space
+ *
+ */
+bool Compression::Decode(byte* dst, uint dst_size, const byte* src, uint src_size, uint* num_nibbles, uint* src_used) {
 
-    byte ret_val;
-    
-    if (read_high) {
-        ret_val = *offset;
-        offset += 1;
-        ret_val = ret_val & 0xF;
+    *num_nibbles = 0;
+    *src_used = 0;
+    if (src_size < COMPRESSION_DICTIONARY_SIZE) {
+        return false;
     }
-    else {
-        ret_val = *offset >> 4;
+
+    // Dictionary entries at the start of the stream become opcodes 7-E
+    DecodeAction actions[16] = {};
+    for (uint k = 0; k < COMPRESSION_DICTIONARY_SIZE; k++) {
+        byte entry = src[k];
+        byte value = entry & 0xF;
+        switch (entry & 0xF0) {
+            case 0x10:
+                actions[COMPRESSION_OP_DICTIONARY + k] = {value, 1};
+                break;
+            case 0x20:
+                actions[COMPRESSION_OP_DICTIONARY + k] = {value, 2};
+                break;
+            case 0x60:
+                actions[COMPRESSION_OP_DICTIONARY + k] = {0, (ushort)(value + COMPRESSION_SHORT_RUN_MIN)};
+                break;
+            default:
+                actions[COMPRESSION_OP_DICTIONARY + k] = {0, 0};
+                break;
+        }
     }
-    read_high = !read_high;
-    return ret_val;
+
+    // Source position in nibbles (high nibble of each byte first)
+    const byte* in = src + COMPRESSION_DICTIONARY_SIZE;
+    uint in_nibbles = (src_size - COMPRESSION_DICTIONARY_SIZE) * 2;
+    uint in_pos = 0;
+
+    // Destination position (low nibble of each byte first)
+    uint x = 0;
+    bool high = false;
+
+    // Reads are unchecked, the last few bytes are swapped for a copy padded with end markers instead
+    byte tail[4];
+    uint tail_base = 0;
+    auto read = [&]() -> byte {
+        byte value = in[in_pos >> 1];
+        return (in_pos++ & 1) ? (value & 0xF) : (value >> 4);
+    };
+
+    // A high nibble always lands in the byte its low nibble started
+    auto put = [&](byte value) -> bool {
+        if (high) {
+            dst[x++] |= value << 4;
+        }
+        else {
+            if (x >= dst_size) {
+                return false;
+            }
+            dst[x] = value;
+        }
+        high = !high;
+        return true;
+    };
+
+    // Whole bytes of a run are filled in one go
+    auto put_run = [&](byte value, uint count) -> bool {
+        if (count > 0 && high) {
+            dst[x++] |= value << 4;
+            high = false;
+            count--;
+        }
+        uint num_bytes = std::min(count / 2, dst_size - x);
+        memset(dst + x, value | (value << 4), num_bytes);
+        x += num_bytes;
+        count -= num_bytes * 2;
+        if (count >= 2) {
+            return false;
+        }
+        return (count == 0 || put(value));
+    };
+
+    bool ok = true;
+    bool done = false;
+    while (ok && !done) {
+
+        // Switch to the padded tail once fewer nibbles remain than the longest opcode needs
+        if (in != tail && in_pos + 4 > in_nibbles) {
+            uint byte_pos = in_pos >> 1;
+            uint remaining = (in_nibbles >> 1) - byte_pos;
+            memset(tail, 0xFF, sizeof(tail));
+            memcpy(tail, in + byte_pos, remaining);
+            tail_base = byte_pos;
+            in = tail;
+            in_pos &= 1;
+            in_nibbles = remaining * 2;
+        }
+
+        // Literals are written directly, everything else becomes a run
+        byte opcode = read();
+        byte run_value = 0;
+        uint run_count = 0;
+        switch (opcode) {
+            case COMPRESSION_OP_LITERAL_3:
+                ok = put(read());
+                [[fallthrough]];
+            case COMPRESSION_OP_LITERAL_2:
+
+                // Two nibbles starting on a byte boundary fill the byte in one go
+                if (ok && !high && x < dst_size) {
+                    byte low = read();
+                    dst[x++] = low | (read() << 4);
+                    break;
+                }
+                ok = ok && put(read());
+                [[fallthrough]];
+            case COMPRESSION_OP_LITERAL_1:
+                ok = ok && put(read());
+                break;
+            case COMPRESSION_OP_DOUBLE:
+                run_value = read();
+                run_count = 2;
+                break;
+            case COMPRESSION_OP_RUN:
+                run_value = read();
+                run_count = read() + COMPRESSION_SHORT_RUN_MIN;
+                break;
+            case COMPRESSION_OP_ZERO_RUN:
+                run_count = read() + COMPRESSION_SHORT_RUN_MIN;
+                break;
+            case COMPRESSION_OP_LONG_ZERO_RUN:
+                run_count = read() << 4;
+                run_count += read() + COMPRESSION_LONG_RUN_MIN;
+                break;
+            case COMPRESSION_OP_END:
+                done = true;
+                break;
+            default:
+                run_value = actions[opcode].value;
+                run_count = actions[opcode].count;
+                break;
+        }
+        if (run_count > 0) {
+            ok = put_run(run_value, run_count);
+        }
+
+        // Anything read from the padding means the source ran out
+        if (in == tail && in_pos > in_nibbles) {
+            ok = false;
+        }
+    }
+
+    *num_nibbles = (x * 2) + (high ? 1 : 0);
+    *src_used = COMPRESSION_DICTIONARY_SIZE + tail_base + std::min((in_pos + 1) / 2, in_nibbles / 2);
+    return ok;
 }
 
 
 
-void Compression::AppendToDecompressedBuffer(byte new_char) {
-    if (!write_high) {
-        *decompress_buffer = new_char;
+/**
+ * Decompresses data into a buffer.
+ *
+ * @param dst: Buffer to decompress into
+ * @param dst_size: Size of the buffer in bytes (nothing is written past it)
+ * @param src: Compressed data
+ * @param src_size: Number of bytes of compressed data available (nothing is read past it)
+ * @param num_written: (Optional) Where the number of bytes written should be stored
+ * @param src_used: (Optional) Where the number of compressed bytes consumed should be stored
+ *
+ * @return True if the whole stream was decoded
+ *
+ * @note Safe to call from several threads at once.
+ *
+ */
+bool Compression::Decompress(byte* dst, uint dst_size, const byte* src, uint src_size, uint* num_written, uint* src_used) {
+
+    uint num_nibbles;
+    uint num_used;
+    bool ok = Decode(dst, dst_size, src, src_size, &num_nibbles, &num_used);
+    if (num_written != nullptr) {
+        *num_written = (num_nibbles + 1) / 2;
     }
-    else {
-        *decompress_buffer += (new_char << 4);
-        decompress_buffer++;
+    if (src_used != nullptr) {
+        *src_used = num_used;
     }
-    write_high = !write_high;
+    return ok;
 }
 
 
 
-// Thank you based Ghidra
-uint Compression::Decompress(byte* dst, byte* src) {
-    byte bVar1;
-    byte cVar2;
-    uint uVar3;
-    uint iVar4;
-    uint *puVar5;
-    int iVar6;
-    uint uVar7;
-    uint auStack116 [23];
-    
-    puVar5 = auStack116 + 7;
-    iVar4 = 0;
-    do {
-        bVar1 = *src;
-        src++;
-        iVar4++;
-        *puVar5 = (uint)bVar1;
-        puVar5++;
-    } while (iVar4 < 8);
-    read_high = false;
-    write_high = false;
-    offset = src;
-    decompress_buffer = dst;
-    do {
-        uVar3 = ReadFromCompressedBuffer();
-        switch(uVar3 & 0xFF) {
-        case 0:
-            iVar6 = 0;
-            uVar3 = ReadFromCompressedBuffer();
-            uVar7 = ReadFromCompressedBuffer();
-            iVar4 = (uVar3 & 0xFF) * 0x10 + (uVar7 & 0xFF);
-            if (iVar4 != -0x13) {
-                do {
-                    AppendToDecompressedBuffer(0x00);
-                    iVar6++;
-                } while (iVar6 < iVar4 + 0x13);
+
+// -------------------------------------------------- Compression ----------------------------------------------------
+
+/**
+ * Finds the cheapest sequence of opcodes for a nibble stream using a given dictionary.
+ *
+ * @param nibbles: Nibbles to encode (in the order the decompressor writes them)
+ * @param dictionary: Dictionary entries available to opcodes 7-E
+ * @param tokens: Where the chosen opcodes should be stored
+ *
+ * @return Number of nibbles needed for the opcodes and their operands
+ *
+ * @note This is an exact shortest-path search over nibble positions, so the result is optimal for the dictionary.
+ *
+ */
+uint Compression::Parse(const std::vector<byte>& nibbles, const byte* dictionary, std::vector<CompressionToken>* tokens) {
+
+    uint num_nibbles = nibbles.size();
+
+    // Length of the run of identical nibbles starting at each position (capped at the longest zero run)
+    const uint max_run = COMPRESSION_LONG_RUN_MIN + 0xFF;
+    std::vector<ushort> run(num_nibbles + 1, 0);
+    for (int i = (int)num_nibbles - 1; i >= 0; i--) {
+        bool same = (i + 1 < (int)num_nibbles && nibbles[i + 1] == nibbles[i]);
+        run[i] = same ? std::min<uint>(run[i + 1] + 1, max_run) : 1;
+    }
+
+    // Cheapest cost from each position to the end and the opcode that achieves it
+    std::vector<uint> cost(num_nibbles + 1, 0);
+    std::vector<byte> best_opcode(num_nibbles, COMPRESSION_OP_LITERAL_1);
+    std::vector<ushort> best_length(num_nibbles, 1);
+    for (int i = (int)num_nibbles - 1; i >= 0; i--) {
+
+        uint remaining = num_nibbles - i;
+        byte value = nibbles[i];
+        uint best = UINT32_MAX;
+        auto consider = [&](byte opcode, uint length, uint opcode_cost) {
+            if (opcode_cost + cost[i + length] < best) {
+                best = opcode_cost + cost[i + length];
+                best_opcode[i] = opcode;
+                best_length[i] = length;
             }
-            break;
-        case 1:
-            cVar2 = ReadFromCompressedBuffer();
-            AppendToDecompressedBuffer(cVar2);
-            break;
-        case 2:
-            cVar2 = ReadFromCompressedBuffer();
-            AppendToDecompressedBuffer(cVar2);
-            AppendToDecompressedBuffer(cVar2);
-            break;
-        case 4:
-            cVar2 = ReadFromCompressedBuffer();
-            AppendToDecompressedBuffer(cVar2);
-        case 3:
-            cVar2 = ReadFromCompressedBuffer();
-            AppendToDecompressedBuffer(cVar2);
-            cVar2 = ReadFromCompressedBuffer();
-            AppendToDecompressedBuffer(cVar2);
-            break;
-        case 5:
-            iVar4 = 0;
-            cVar2 = ReadFromCompressedBuffer();
-            uVar3 = ReadFromCompressedBuffer();
-            if ((uVar3 & 0xFF) != 0xFFFFFFFD) {
-                do {
-                    AppendToDecompressedBuffer(cVar2);
-                    iVar4++;
-                } while (iVar4 < (int)((uVar3 & 0xFF) + 3));
+        };
+
+        // Dictionary entries (1 nibble)
+        for (uint k = 0; k < COMPRESSION_DICTIONARY_SIZE; k++) {
+            byte type = dictionary[k] & 0xF0;
+            byte entry_value = dictionary[k] & 0x0F;
+            if (type == 0x10 && value == entry_value) {
+                consider(COMPRESSION_OP_DICTIONARY + k, 1, 1);
             }
-            break;
-        case 6:
-            iVar4 = 0;
-            uVar3 = ReadFromCompressedBuffer();
-            if ((uVar3 & 0xFF) != 0xFFFFFFFD) {
-                do {
-                    AppendToDecompressedBuffer(0x00);
-                    iVar4++;
-                } while (iVar4 < (int)((uVar3 & 0xFF) + 3));
+            else if (type == 0x20 && value == entry_value && run[i] >= 2) {
+                consider(COMPRESSION_OP_DICTIONARY + k, 2, 1);
             }
-            break;
-        case 7:
-        case 8:
-        case 9:
-        case 0xA:
-        case 0xB:
-        case 0xC:
-        case 0xD:
-        case 0xE:
-            uVar7 = auStack116[uVar3 & 0xFF];
-            uVar3 = uVar7 & 0xF0;
-            if (uVar3 == 0x20) {
-                AppendToDecompressedBuffer((byte)uVar7 & 0xF);
-                AppendToDecompressedBuffer((byte)uVar7 & 0xF);
+            else if (type == 0x60 && value == 0 && run[i] >= entry_value + COMPRESSION_SHORT_RUN_MIN) {
+                consider(COMPRESSION_OP_DICTIONARY + k, entry_value + COMPRESSION_SHORT_RUN_MIN, 1);
             }
-            else if (uVar3 < 0x21) {
-                if (uVar3 == 0x10) {
-                    AppendToDecompressedBuffer((byte)uVar7 & 0xF);
-                }
+        }
+
+        // Literals
+        consider(COMPRESSION_OP_LITERAL_1, 1, 2);
+        if (remaining >= 2) {
+            consider(COMPRESSION_OP_LITERAL_2, 2, 3);
+            if (run[i] >= 2) {
+                consider(COMPRESSION_OP_DOUBLE, 2, 2);
             }
-            else if (uVar3 == 0x60) {
-                iVar4 = 0;
-                if ((uVar7 & 0xF) != 0xFFFFFFFD) {
-                    do {
-                        AppendToDecompressedBuffer(0x00);
-                        iVar4++;
-                    } while (iVar4 < (int)((uVar7 & 0xF) + 3));
-                }
+        }
+        if (remaining >= 3) {
+            consider(COMPRESSION_OP_LITERAL_3, 3, 4);
+        }
+
+        // Short runs (zeros have their own opcode without a value operand)
+        for (uint length = COMPRESSION_SHORT_RUN_MIN; length <= std::min<uint>(run[i], COMPRESSION_SHORT_RUN_MIN + 0xF); length++) {
+            if (value == 0) {
+                consider(COMPRESSION_OP_ZERO_RUN, length, 2);
+            }
+            else {
+                consider(COMPRESSION_OP_RUN, length, 3);
+            }
+        }
+
+        // Long zero runs
+        if (value == 0) {
+            for (uint length = COMPRESSION_LONG_RUN_MIN; length <= run[i]; length++) {
+                consider(COMPRESSION_OP_LONG_ZERO_RUN, length, 3);
+            }
+        }
+
+        cost[i] = best;
+    }
+
+    // Walk the chosen path
+    tokens->clear();
+    for (uint i = 0; i < num_nibbles; i += best_length[i]) {
+        tokens->push_back({best_opcode[i], best_length[i], i});
+    }
+
+    return cost[0];
+}
+
+
+
+/**
+ * Picks the dictionary entries that save the most nibbles.
+ *
+ * @param nibbles: Nibbles to encode
+ * @param dictionary: Where the 8 dictionary entries should be stored
+ * @param tokens: Where the opcodes for the chosen dictionary should be stored
+ *
+ * @note Starting from an empty dictionary, the entries that would have replaced the most opcodes of the
+ *       previous parse are swapped in until the encoded size stops shrinking.
+ *
+ */
+void Compression::ChooseDictionary(const std::vector<byte>& nibbles, byte* dictionary, std::vector<CompressionToken>* tokens) {
+
+    memset(dictionary, 0, COMPRESSION_DICTIONARY_SIZE);
+    uint best_cost = Parse(nibbles, dictionary, tokens);
+
+    std::vector<CompressionToken> candidate_tokens;
+    for (uint iteration = 0; iteration < 8; iteration++) {
+
+        // Estimate how many nibbles each possible entry would save (indexed by the entry byte itself)
+        double gain[0x100] = {};
+        for (const auto& token : *tokens) {
+            byte value = nibbles[token.position];
+            switch (token.opcode) {
+                case COMPRESSION_OP_LITERAL_1:
+                    gain[0x10 | value] += 1;
+                    break;
+                case COMPRESSION_OP_DOUBLE:
+                    gain[0x20 | value] += 1;
+                    break;
+                case COMPRESSION_OP_LITERAL_2:
+                    gain[0x10 | value] += 1.0 / 2;
+                    gain[0x10 | nibbles[token.position + 1]] += 1.0 / 2;
+                    break;
+                case COMPRESSION_OP_LITERAL_3:
+                    gain[0x10 | value] += 1.0 / 3;
+                    gain[0x10 | nibbles[token.position + 1]] += 1.0 / 3;
+                    gain[0x10 | nibbles[token.position + 2]] += 1.0 / 3;
+                    break;
+                case COMPRESSION_OP_ZERO_RUN:
+                    gain[0x60 | (token.length - COMPRESSION_SHORT_RUN_MIN)] += 1;
+                    break;
+                case COMPRESSION_OP_LONG_ZERO_RUN:
+                case COMPRESSION_OP_RUN:
+                case COMPRESSION_OP_END:
+                    break;
+                default:
+                    gain[dictionary[token.opcode - COMPRESSION_OP_DICTIONARY]] += 1;
+                    break;
             }
+        }
+
+        // Keep the 8 entries with the largest gain
+        std::vector<uint> entries;
+        for (uint entry = 0x10; entry < 0x70; entry++) {
+            if (gain[entry] > 0) {
+                entries.push_back(entry);
+            }
+        }
+        std::stable_sort(entries.begin(), entries.end(), [&gain](uint a, uint b) { return gain[a] > gain[b]; });
+        entries.resize(std::min<size_t>(entries.size(), COMPRESSION_DICTIONARY_SIZE));
+
+        byte candidate[COMPRESSION_DICTIONARY_SIZE] = {};
+        for (uint k = 0; k < entries.size(); k++) {
+            candidate[k] = entries[k];
+        }
+        if (memcmp(candidate, dictionary, COMPRESSION_DICTIONARY_SIZE) == 0) {
+            break;
+        }
+
+        // Stop as soon as the new dictionary doesn't help
+        uint candidate_cost = Parse(nibbles, candidate, &candidate_tokens);
+        if (candidate_cost >= best_cost) {
             break;
-        case 0xF:
-            if (dst + 0x2000 < decompress_buffer) {
-                iVar4 = (decompress_buffer - dst) + 0x2000;
+        }
+        best_cost = candidate_cost;
+        memcpy(dictionary, candidate, COMPRESSION_DICTIONARY_SIZE);
+        tokens->swap(candidate_tokens);
+    }
+}
+
+
+
+/**
+ * Compresses data into the format read by Decompress() (and the game).
+ *
+ * @param src: Data to compress
+ * @param num_bytes: Number of bytes to compress
+ *
+ * @return Compressed data (8-byte dictionary, opcode stream and end marker)
+ *
+ */
+std::vector<byte> Compression::Compress(const byte* src, uint num_bytes) {
+
+    // The decompressor writes the low nibble of each byte first
+    std::vector<byte> nibbles(num_bytes * 2);
+    for (uint i = 0; i < num_bytes; i++) {
+        nibbles[(i * 2)] = src[i] & 0xF;
+        nibbles[(i * 2) + 1] = src[i] >> 4;
+    }
+
+    byte dictionary[COMPRESSION_DICTIONARY_SIZE];
+    std::vector<CompressionToken> tokens;
+    ChooseDictionary(nibbles, dictionary, &tokens);
+
+    // Emit each opcode followed by its operands
+    std::vector<byte> stream;
+    for (const auto& token : tokens) {
+        const byte* values = nibbles.data() + token.position;
+        stream.push_back(token.opcode);
+        switch (token.opcode) {
+            case COMPRESSION_OP_LONG_ZERO_RUN:
+                stream.push_back((token.length - COMPRESSION_LONG_RUN_MIN) >> 4);
+                stream.push_back((token.length - COMPRESSION_LONG_RUN_MIN) & 0xF);
+                break;
+            case COMPRESSION_OP_LITERAL_1:
+            case COMPRESSION_OP_DOUBLE:
+                stream.push_back(values[0]);
+                break;
+            case COMPRESSION_OP_LITERAL_2:
+                stream.insert(stream.end(), values, values + 2);
+                break;
+            case COMPRESSION_OP_LITERAL_3:
+                stream.insert(stream.end(), values, values + 3);
+                break;
+            case COMPRESSION_OP_RUN:
+                stream.push_back(values[0]);
+                stream.push_back(token.length - COMPRESSION_SHORT_RUN_MIN);
+                break;
+            case COMPRESSION_OP_ZERO_RUN:
+                stream.push_back(token.length - COMPRESSION_SHORT_RUN_MIN);
+                break;
+        }
+    }
+    stream.push_back(COMPRESSION_OP_END);
+
+    // Pack the stream (the decompressor reads the high nibble of each byte first)
+    std::vector<byte> compressed(dictionary, dictionary + COMPRESSION_DICTIONARY_SIZE);
+    for (uint i = 0; i < stream.size(); i += 2) {
+        byte high = stream[i];
+        byte low = (i + 1 < stream.size()) ? stream[i + 1] : 0;
+        compressed.push_back((high << 4) | low);
+    }
+    return compressed;
+}
+
+
+
+/**
+ * Compresses several blocks of data using every available core.
+ *
+ * @param blocks: Data to compress
+ *
+ * @return Compressed data for each block
+ *
+ */
+std::vector<std::vector<byte>> Compression::CompressBlocks(const std::vector<std::vector<byte>>& blocks) {
+
+    std::vector<std::vector<byte>> compressed(blocks.size());
+
+    // Blocks vary a lot in size, so workers take the next block as they finish
+    std::atomic<uint> next_block(0);
+    auto worker = [&] {
+        for (uint i = next_block++; i < blocks.size(); i = next_block++) {
+            compressed[i] = Compress(blocks[i].data(), blocks[i].size());
+        }
+    };
+
+    uint num_threads = std::min<uint>(std::max(1u, std::thread::hardware_concurrency()), blocks.size());
+    std::vector<std::thread> threads;
+    for (uint i = 1; i < num_threads; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return compressed;
+}
+
+
+
+
+// -------------------------------------------------- Round-Trip Check -----------------------------------------------
+
+/**
+ * Recompresses every entity graphics block of a map and checks that the decompressor gives back the same data.
+ *
+ * @param filename: Map file to check
+ * @param failed_blocks: Where to store the map offset of every block that didn't survive the round trip
+ *
+ * @return True if the map could be read (whether or not every block survived)
+ *
+ * @note Also reports how many recompressed blocks still fit in the space of the original data.
+ *
+ */
+bool Compression::VerifyRoundTrip(const std::string& filename, std::vector<uint>* failed_blocks) {
+
+    std::shared_ptr<const MappedFile> map_file = MappedFile::Share(filename.c_str());
+    if (map_file == nullptr || map_file->size < 0x40) {
+        Log::Error("Invalid map file: %s\n", filename.c_str());
+        return false;
+    }
+    const byte* map_data = map_file->data;
+    uint num_bytes = map_file->size;
+
+    // The entity graphics lists run up to the entity layouts
+    uint entity_layouts_addr = *(uint*)(map_data + 0x1C);
+    uint entity_graphics_addr = *(uint*)(map_data + 0x24);
+    if (entity_graphics_addr <= MAP_BIN_OFFSET || entity_layouts_addr <= entity_graphics_addr || entity_layouts_addr - MAP_BIN_OFFSET > num_bytes) {
+        Log::Info("%s: no entity graphics\n", filename.c_str());
+        return true;
+    }
+    entity_graphics_addr -= MAP_BIN_OFFSET;
+    entity_layouts_addr -= MAP_BIN_OFFSET;
+
+    // Decompress every distinct block with the existing decoder (only keeping what it actually wrote)
+    std::map<uint, uint> original_sizes;
+    std::vector<uint> addresses;
+    std::vector<std::vector<byte>> blocks;
+    for (uint list_ptr = entity_graphics_addr; list_ptr + 4 <= entity_layouts_addr; list_ptr += 4) {
+        uint list_addr = *(uint*)(map_data + list_ptr);
+        if (list_addr <= MAP_BIN_OFFSET || list_addr - MAP_BIN_OFFSET + 4 > num_bytes) {
+            continue;
+        }
+        list_addr -= MAP_BIN_OFFSET;
+        if (*(int*)(map_data + list_addr) <= 0) {
+            continue;
+        }
+        for (uint entry = list_addr + 4; entry + sizeof(EntityGraphicsData) <= num_bytes && *(int*)(map_data + entry) != -1; entry += sizeof(EntityGraphicsData)) {
+            EntityGraphicsData graphics_data = *(EntityGraphicsData*)(map_data + entry);
+            if (graphics_data.compressed_graphics_addr <= MAP_BIN_OFFSET || graphics_data.compressed_graphics_addr - MAP_BIN_OFFSET >= num_bytes) {
+                continue;
             }
-            else {
-                iVar4 = 0;
+            uint graphics_addr = graphics_data.compressed_graphics_addr - MAP_BIN_OFFSET;
+            if (original_sizes.count(graphics_addr) > 0) {
+                continue;
+            }
+
+            uint data_size = graphics_data.width * graphics_data.height;
+            std::vector<byte> block(data_size);
+            uint num_written = 0;
+            uint src_used = 0;
+            if (!Decompress(block.data(), data_size, map_data + graphics_addr, num_bytes - graphics_addr, &num_written, &src_used)) {
+                Log::Warn("%s: block at 0x%X does not decode cleanly\n", filename.c_str(), graphics_addr);
             }
-            return iVar4;
+            block.resize(num_written);
+            original_sizes[graphics_addr] = src_used;
+            addresses.push_back(graphics_addr);
+            blocks.push_back(std::move(block));
         }
-    } while (true);
-}
\ No newline at end of file
+    }
+
+    // Recompress everything in parallel
+    auto encode_start = std::chrono::steady_clock::now();
+    std::vector<std::vector<byte>> compressed = CompressBlocks(blocks);
+    double encode_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encode_start).count();
+
+    // Decode each block again and compare
+    uint num_failed = 0;
+    uint num_fit = 0;
+    size_t original_total = 0;
+    size_t compressed_total = 0;
+    for (uint i = 0; i < blocks.size(); i++) {
+        std::vector<byte> decoded(blocks[i].size());
+        uint decoded_size;
+        bool decoded_ok = Decompress(decoded.data(), decoded.size(), compressed[i].data(), compressed[i].size(), &decoded_size);
+        if (!decoded_ok || decoded_size != blocks[i].size() || decoded != blocks[i]) {
+            Log::Error("%s: block at 0x%X did not survive the round trip\n", filename.c_str(), addresses[i]);
+            failed_blocks->push_back(addresses[i]);
+            num_failed++;
+        }
+        uint original_size = original_sizes[addresses[i]];
+        num_fit += (compressed[i].size() <= original_size);
+        original_total += original_size;
+        compressed_total += compressed[i].size();
+    }
+
+    Log::Info(
+        "%s: %zu blocks, %u failed, %u fit the original space, %zu -> %zu bytes, encoded in %.1f ms\n",
+        filename.c_str(), blocks.size(), num_failed, num_fit, original_total, compressed_total, encode_time
+    );
+    return true;
+}
@@ -0,0 +1,933 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "common.h"
+#include "disc.h"
+#include "edc_ecc.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+// Variables
+FILE* Disc::image;
+std::string Disc::image_path;
+std::string Disc::image_bin_path;
+bool Disc::image_writable;
+std::filesystem::file_time_type Disc::image_write_time;
+uint Disc::sector_size;
+uint Disc::data_offset;
+uint Disc::num_sectors;
+std::map<std::string, DiscEntry> Disc::entries;
+std::list<uint> Disc::lru_sectors;
+std::unordered_map<uint, std::pair<std::vector<byte>, std::list<uint>::iterator>> Disc::sector_cache;
+std::recursive_mutex Disc::mutex;
+
+
+
+/**
+ * Reads a little-endian 32-bit value (ISO9660 stores both-endian values, the LE half comes first).
+ *
+ * @param data: Location of the value
+ *
+ * @return Value that was read
+ *
+ */
+static uint read_le32(const byte* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint)data[3] << 24);
+}
+
+
+
+/**
+ * Writes a value in ISO9660 both-endian format (little-endian followed by big-endian).
+ *
+ * @param data: Location of the value
+ * @param value: Value to write
+ *
+ */
+static void write_both32(byte* data, uint value) {
+    for (int i = 0; i < 4; i++) {
+        data[i] = value >> (i * 8);
+        data[7 - i] = value >> (i * 8);
+    }
+}
+
+
+
+/**
+ * Opens a disc image so files can be read from it.
+ *
+ * @param filename: Filename of the image (.cue sheet, or the raw .bin / .iso itself)
+ *
+ * @return True if the image contains a readable ISO9660 file system
+ *
+ * @note Files on the disc are addressed as "<filename>/<ISO path>", e.g. "SotN.cue/ST/NO0/NO0.BIN".
+ *
+ */
+bool Disc::Mount(const char* filename) {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Release any previously mounted image
+    Unmount();
+
+    // Find the track data and its sector layout
+    std::string bin_path = filename;
+    uint track_sector_size = 0;
+    uint track_data_offset = 0;
+    if (Utils::toLowerCase(std::filesystem::path(filename).extension().string()) == ".cue") {
+        if (!ParseCue(filename, &bin_path, &track_sector_size, &track_data_offset)) {
+            Log::Error("Could not parse cue sheet: %s\n", filename);
+            return false;
+        }
+    }
+
+    // Open the image
+    image = fopen(bin_path.c_str(), "rb");
+    if (image == nullptr) {
+        Log::Error("Could not open disc image: %s\n", bin_path.c_str());
+        return false;
+    }
+    fseek(image, 0, SEEK_END);
+    long image_size = ftell(image);
+    fseek(image, 0, SEEK_SET);
+
+    // Use the layout from the cue sheet if it is valid, otherwise try every known layout
+    sector_size = track_sector_size;
+    data_offset = track_data_offset;
+    num_sectors = sector_size > 0 ? image_size / sector_size : 0;
+    if (!DetectLayout()) {
+        Log::Error("No ISO9660 file system found in disc image: %s\n", bin_path.c_str());
+        Unmount();
+        return false;
+    }
+
+    // Parse the whole directory tree starting at the root directory record
+    const byte* pvd = ReadSector(DISC_PVD_SECTOR);
+    uint root_lba = read_le32(pvd + 156 + 2);
+    uint root_size = read_le32(pvd + 156 + 10);
+    if (!ParseDirectory("", root_lba, root_size, 0)) {
+        Log::Error("Invalid root directory in disc image: %s\n", bin_path.c_str());
+        Unmount();
+        return false;
+    }
+
+    // Remember where the image lives so virtual paths can be resolved
+    std::error_code ec;
+    image_path = std::filesystem::absolute(filename, ec).lexically_normal().generic_string();
+    image_write_time = std::filesystem::last_write_time(bin_path, ec);
+    image_bin_path = bin_path;
+    image_writable = false;
+
+    Log::Info(
+        "Mounted disc image %s (%u byte sectors, %zu entries)\n",
+        image_path.c_str(),
+        sector_size,
+        entries.size()
+    );
+    return true;
+}
+
+
+
+/**
+ * Closes the mounted disc image.
+ */
+void Disc::Unmount() {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Close the image
+    if (image != nullptr) {
+        fclose(image);
+        image = nullptr;
+    }
+
+    // Forget everything about it
+    image_path.clear();
+    image_bin_path.clear();
+    image_writable = false;
+    entries.clear();
+    lru_sectors.clear();
+    sector_cache.clear();
+    sector_size = 0;
+    data_offset = 0;
+    num_sectors = 0;
+}
+
+
+
+/**
+ * Checks whether a disc image is mounted.
+ *
+ * @return True if a disc image is mounted
+ *
+ */
+bool Disc::IsMounted() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return image != nullptr;
+}
+
+
+
+/**
+ * Gets the filename of the mounted disc image.
+ *
+ * @return Absolute filename of the image (empty if nothing is mounted)
+ *
+ */
+std::string Disc::GetImagePath() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return image_path;
+}
+
+
+
+/**
+ * Gets the virtual filename of a file on the mounted disc.
+ *
+ * @param iso_path: Path of the file on the disc (e.g. "ST/NO0/NO0.BIN")
+ *
+ * @return Virtual filename that can be passed to any of the file loaders
+ *
+ */
+std::string Disc::GetPath(const std::string& iso_path) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return image_path + "/" + iso_path;
+}
+
+
+
+/**
+ * Checks whether a filename refers to a file or directory on the mounted disc.
+ *
+ * @param filename: Filename to check
+ *
+ * @return True if the file or directory exists on the disc
+ *
+ */
+bool Disc::Contains(const char* filename) {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    std::string iso_path;
+    return ResolvePath(filename, &iso_path) && (iso_path.empty() || entries.count(iso_path) > 0);
+}
+
+
+
+/**
+ * Gets the size and modification time of a file on the mounted disc.
+ *
+ * @param filename: Virtual filename of the file
+ * @param size: Where the file size should be stored
+ * @param write_time: Where the modification time should be stored (that of the image itself)
+ *
+ * @return True if the file exists
+ *
+ */
+bool Disc::Stat(const char* filename, size_t* size, std::filesystem::file_time_type* write_time) {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Find the file
+    std::string iso_path;
+    if (!ResolvePath(filename, &iso_path)) {
+        return false;
+    }
+    auto entry = entries.find(iso_path);
+    if (entry == entries.end() || entry->second.is_dir) {
+        return false;
+    }
+
+    *size = entry->second.size;
+    *write_time = image_write_time;
+    return true;
+}
+
+
+
+/**
+ * Reads a whole file from the mounted disc.
+ *
+ * @param filename: Virtual filename of the file
+ * @param out: Buffer that receives the file contents
+ *
+ * @return True if the file was read successfully
+ *
+ */
+bool Disc::ReadFile(const char* filename, std::vector<byte>* out) {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Find the file
+    std::string iso_path;
+    if (!ResolvePath(filename, &iso_path)) {
+        return false;
+    }
+    auto entry = entries.find(iso_path);
+    if (entry == entries.end() || entry->second.is_dir) {
+        Log::Error("File not found on disc: %s\n", filename);
+        return false;
+    }
+
+    // Copy the user data of each sector
+    out->resize(entry->second.size);
+    for (uint offset = 0; offset < entry->second.size; offset += DISC_SECTOR_SIZE) {
+        const byte* sector = ReadSector(entry->second.lba + (offset / DISC_SECTOR_SIZE));
+        if (sector == nullptr) {
+            Log::Error("Could not read disc file: %s\n", filename);
+            out->clear();
+            return false;
+        }
+        memcpy(out->data() + offset, sector, std::min(DISC_SECTOR_SIZE, entry->second.size - offset));
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Lists the contents of a directory on the mounted disc.
+ *
+ * @param dirname: Virtual filename of the directory
+ *
+ * @return Virtual filenames of every file and directory inside it
+ *
+ */
+std::vector<std::string> Disc::ListDirectory(const char* dirname) {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    std::vector<std::string> list;
+    std::string iso_dir;
+    if (!ResolvePath(dirname, &iso_dir)) {
+        return list;
+    }
+
+    // Collect every entry whose parent is the directory
+    for (const auto& entry : entries) {
+        size_t separator = entry.first.rfind('/');
+        std::string parent = separator == std::string::npos ? "" : entry.first.substr(0, separator);
+        if (parent == iso_dir) {
+            list.push_back(image_path + "/" + entry.first);
+        }
+    }
+
+    return list;
+}
+
+
+
+/**
+ * Finds every map on the mounted disc.
+ *
+ * @return Virtual filenames of each map file that has a matching graphics file (F_*.BIN)
+ *
+ */
+std::vector<std::string> Disc::FindMaps() {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    std::vector<std::string> maps;
+    for (const auto& entry : entries) {
+
+        // Maps live in ST/<ID>/<ID>.BIN and BOSS/<ID>/<ID>.BIN
+        const std::string& path = entry.first;
+        if (entry.second.is_dir || (path.rfind("ST/", 0) != 0 && path.rfind("BOSS/", 0) != 0)) {
+            continue;
+        }
+        std::string dir = path.substr(0, path.rfind('/'));
+        std::string name = path.substr(path.rfind('/') + 1);
+        if (name.size() < 4 || name.substr(name.size() - 4) != ".BIN" || name.rfind("F_", 0) == 0) {
+            continue;
+        }
+
+        // Only count it if the graphics file is there too
+        if (entries.count(dir + "/F_" + name) > 0) {
+            maps.push_back(image_path + "/" + path);
+        }
+    }
+
+    return maps;
+}
+
+
+
+/**
+ * Finds the main executable of the mounted disc by reading SYSTEM.CNF.
+ *
+ * @return Virtual filename of the executable (empty if it could not be found)
+ *
+ */
+std::string Disc::FindExecutable() {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Read the boot configuration
+    std::vector<byte> system_cnf;
+    if (entries.count("SYSTEM.CNF") > 0 && ReadFile((image_path + "/SYSTEM.CNF").c_str(), &system_cnf)) {
+
+        // Find the "BOOT = cdrom:\SLUS_000.67;1" line
+        std::string text(system_cnf.begin(), system_cnf.end());
+        size_t start = text.find("cdrom:");
+        if (start != std::string::npos) {
+            start += 6;
+            size_t end = text.find_first_of(";\r\n", start);
+            std::string iso_path = Utils::toUpperCase(text.substr(start, end - start));
+            std::replace(iso_path.begin(), iso_path.end(), '\\', '/');
+            iso_path.erase(0, iso_path.find_first_not_of('/'));
+            if (entries.count(iso_path) > 0) {
+                return image_path + "/" + iso_path;
+            }
+        }
+    }
+
+    // Fall back to the US executable name
+    if (entries.count("SLUS_000.67") > 0) {
+        return image_path + "/SLUS_000.67";
+    }
+    return "";
+}
+
+
+
+/**
+ * Writes modified files back into the mounted disc image.
+ *
+ * @param files: New contents of each file keyed by virtual filename (see GetPath())
+ *
+ * @return True if every file was written
+ *
+ * @note Files that still fit in their sectors are rewritten in place, larger files are moved to the end of the image.
+ * @note Only the touched sectors get new EDC/ECC data, use RebuildECC() to regenerate the whole image.
+ * @note The game locates some files through its own sector tables, which are not updated when a file is moved.
+ *
+ */
+bool Disc::PatchFiles(const std::map<std::string, std::vector<byte>>& files) {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Reopen the image for writing
+    if (!OpenForWrite()) {
+        return false;
+    }
+
+    bool ok = true;
+    bool image_grew = false;
+    for (const auto& file : files) {
+
+        // Find the file
+        std::string iso_path;
+        auto entry = entries.end();
+        if (ResolvePath(file.first.c_str(), &iso_path)) {
+            entry = entries.find(iso_path);
+        }
+        if (entry == entries.end() || entry->second.is_dir) {
+            Log::Error("File not found on disc: %s\n", file.first.c_str());
+            ok = false;
+            continue;
+        }
+        DiscEntry* disc_entry = &entry->second;
+
+        // Keep the file where it is if it still fits, otherwise move it to the end of the image
+        uint size = file.second.size();
+        uint num_sectors_new = std::max(1u, (size + DISC_SECTOR_SIZE - 1) / DISC_SECTOR_SIZE);
+        uint num_sectors_old = std::max(1u, (disc_entry->size + DISC_SECTOR_SIZE - 1) / DISC_SECTOR_SIZE);
+        uint lba = disc_entry->lba;
+        if (num_sectors_new > num_sectors_old) {
+            lba = num_sectors;
+            num_sectors += num_sectors_new;
+            image_grew = true;
+            Log::Info("Moving %s to sector %u (%u -> %u sectors)\n", iso_path.c_str(), lba, num_sectors_old, num_sectors_new);
+        }
+
+        // Write the file data (the last sector marks the end of the file)
+        std::vector<byte> user_data(num_sectors_new * DISC_SECTOR_SIZE, 0);
+        memcpy(user_data.data(), file.second.data(), size);
+        std::vector<byte> submodes(num_sectors_new, SUBMODE_DATA);
+        submodes.back() |= SUBMODE_EOR | SUBMODE_EOF;
+        if (!WriteSectors(lba, user_data.data(), num_sectors_new, submodes)) {
+            ok = false;
+            continue;
+        }
+
+        // Point the directory record at the new data
+        const byte* record_sector = ReadSector(disc_entry->record_lba);
+        if (record_sector == nullptr) {
+            ok = false;
+            continue;
+        }
+        byte records[DISC_SECTOR_SIZE];
+        memcpy(records, record_sector, DISC_SECTOR_SIZE);
+        write_both32(records + disc_entry->record_offset + 2, lba);
+        write_both32(records + disc_entry->record_offset + 10, size);
+        ok = WriteSectors(disc_entry->record_lba, records, 1, {ReadSubmode(disc_entry->record_lba)}) && ok;
+
+        // Update the index
+        disc_entry->lba = lba;
+        disc_entry->size = size;
+    }
+
+    // Update the volume size in the primary volume descriptor
+    if (image_grew) {
+        const byte* pvd_sector = ReadSector(DISC_PVD_SECTOR);
+        if (pvd_sector != nullptr) {
+            byte pvd[DISC_SECTOR_SIZE];
+            memcpy(pvd, pvd_sector, DISC_SECTOR_SIZE);
+            write_both32(pvd + 80, num_sectors);
+            ok = WriteSectors(DISC_PVD_SECTOR, pvd, 1, {ReadSubmode(DISC_PVD_SECTOR)}) && ok;
+        }
+    }
+
+    // Let shared mappings know the image changed
+    fflush(image);
+    std::error_code ec;
+    image_write_time = std::filesystem::last_write_time(image_bin_path, ec);
+
+    Log::Info("Patched %zu files in %s\n", files.size(), image_bin_path.c_str());
+    return ok;
+}
+
+
+
+/**
+ * Regenerates the EDC/ECC data of every sector in the mounted disc image.
+ *
+ * @return True if the whole image was processed
+ *
+ * @note Sectors are processed in large batches that are split across every available core.
+ *
+ */
+bool Disc::RebuildECC() {
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    // Plain ISO images don't have any error correction data
+    if (!OpenForWrite()) {
+        return false;
+    }
+    if (sector_size != DISC_RAW_SECTOR_SIZE) {
+        return true;
+    }
+
+    std::vector<byte> batch(DISC_REBUILD_BATCH * DISC_RAW_SECTOR_SIZE);
+    for (uint lba = 0; lba < num_sectors; lba += DISC_REBUILD_BATCH) {
+
+        // Read the next batch of sectors
+        uint count = std::min(DISC_REBUILD_BATCH, num_sectors - lba);
+        if (fseek(image, (long)lba * DISC_RAW_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fread(batch.data(), DISC_RAW_SECTOR_SIZE, count, image) != count) {
+            Log::Error("Could not read sectors %u - %u of the disc image\n", lba, lba + count - 1);
+            return false;
+        }
+
+        // Regenerate and write them back
+        EdcEcc::EncodeSectors(batch.data(), count);
+        if (fseek(image, (long)lba * DISC_RAW_SECTOR_SIZE, SEEK_SET) != 0 ||
+            fwrite(batch.data(), DISC_RAW_SECTOR_SIZE, count, image) != count) {
+            Log::Error("Could not write sectors %u - %u of the disc image\n", lba, lba + count - 1);
+            return false;
+        }
+    }
+
+    // Let shared mappings know the image changed
+    fflush(image);
+    std::error_code ec;
+    image_write_time = std::filesystem::last_write_time(image_bin_path, ec);
+    return true;
+}
+
+
+
+/**
+ * Parses the data track of a cue sheet.
+ *
+ * @param cue_path: Filename of the cue sheet
+ * @param bin_path: Where the filename of the track data should be stored
+ * @param track_sector_size: Where the sector size of the track should be stored
+ * @param track_data_offset: Where the offset of the user data within a sector should be stored
+ *
+ * @return True if a data track was found
+ *
+ */
+bool Disc::ParseCue(const std::string& cue_path, std::string* bin_path, uint* track_sector_size, uint* track_data_offset) {
+
+    // Open the cue sheet
+    FILE* fp = fopen(cue_path.c_str(), "r");
+    if (fp == nullptr) {
+        return false;
+    }
+
+    // Only the first FILE and TRACK entries are needed (the data track always comes first)
+    char line[1024];
+    bool found_file = false;
+    bool found_track = false;
+    while (fgets(line, sizeof(line), fp) != nullptr && !found_track) {
+        char value[1024] = {0};
+        if (!found_file && sscanf(line, " FILE \"%1023[^\"]\"", value) == 1) {
+            *bin_path = (std::filesystem::path(cue_path).parent_path() / value).string();
+            found_file = true;
+        }
+        else if (found_file && sscanf(line, " TRACK %*d %1023s", value) == 1) {
+            std::string mode = Utils::toUpperCase(value);
+            if (mode == "MODE2/2352") {
+                *track_sector_size = DISC_RAW_SECTOR_SIZE;
+                *track_data_offset = 24;
+            }
+            else if (mode == "MODE1/2352") {
+                *track_sector_size = DISC_RAW_SECTOR_SIZE;
+                *track_data_offset = 16;
+            }
+            else if (mode == "MODE2/2336") {
+                *track_sector_size = 2336;
+                *track_data_offset = 8;
+            }
+            else {
+                *track_sector_size = DISC_SECTOR_SIZE;
+                *track_data_offset = 0;
+            }
+            found_track = true;
+        }
+    }
+    fclose(fp);
+
+    return found_file && found_track;
+}
+
+
+
+/**
+ * Determines the sector layout of the image by looking for the primary volume descriptor.
+ *
+ * @return True if the volume descriptor was found
+ *
+ * @note The current layout (from a cue sheet) is tried first, followed by every common layout.
+ *
+ */
+bool Disc::DetectLayout() {
+
+    // Sector size and user data offset of Mode 2/XA raw, Mode 1 raw, Mode 2 without sync and plain ISO images
+    uint layouts[][2] = {
+        {sector_size, data_offset},
+        {DISC_RAW_SECTOR_SIZE, 24},
+        {DISC_RAW_SECTOR_SIZE, 16},
+        {2336, 8},
+        {DISC_SECTOR_SIZE, 0}
+    };
+
+    // Get the image size
+    fseek(image, 0, SEEK_END);
+    long image_size = ftell(image);
+
+    for (auto& layout : layouts) {
+
+        // Skip the unset cue layout
+        if (layout[0] == 0) {
+            continue;
+        }
+
+        // Read the volume descriptor identifier
+        byte identifier[6] = {};
+        if (fseek(image, (long)(DISC_PVD_SECTOR * layout[0] + layout[1]), SEEK_SET) != 0 ||
+            fread(identifier, sizeof(byte), 6, image) != 6) {
+            continue;
+        }
+
+        // Primary volume descriptor: type 1 followed by "CD001"
+        if (identifier[0] == 1 && memcmp(identifier + 1, "CD001", 5) == 0) {
+            sector_size = layout[0];
+            data_offset = layout[1];
+            num_sectors = image_size / sector_size;
+            lru_sectors.clear();
+            sector_cache.clear();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+/**
+ * Adds every entry of a directory (and its subdirectories) to the index.
+ *
+ * @param prefix: ISO path of the directory ("" for the root)
+ * @param lba: First sector of the directory
+ * @param size: Size of the directory in bytes
+ * @param depth: Current nesting depth (guards against malformed images)
+ *
+ * @return True if every sector of the directory could be read
+ *
+ */
+bool Disc::ParseDirectory(const std::string& prefix, uint lba, uint size, uint depth) {
+
+    // Bail on runaway recursion
+    if (depth > 8) {
+        return false;
+    }
+
+    for (uint offset = 0; offset < size; offset += DISC_SECTOR_SIZE) {
+
+        // Read the next directory sector
+        const byte* sector = ReadSector(lba + (offset / DISC_SECTOR_SIZE));
+        if (sector == nullptr) {
+            return false;
+        }
+
+        // Copy it since parsing subdirectories can evict it from the cache
+        byte records[DISC_SECTOR_SIZE];
+        memcpy(records, sector, DISC_SECTOR_SIZE);
+
+        // Directory records never cross sector boundaries (a zero length marks the end of the sector)
+        uint pos = 0;
+        while (pos + 33 < DISC_SECTOR_SIZE && records[pos] != 0) {
+
+            // Get the record fields
+            uint record_size = records[pos];
+            uint entry_lba = read_le32(records + pos + 2);
+            uint entry_size = read_le32(records + pos + 10);
+            byte flags = records[pos + 25];
+            byte name_size = records[pos + 32];
+            if (pos + record_size > DISC_SECTOR_SIZE || 33 + name_size > record_size) {
+                break;
+            }
+            const char* name_data = (const char*)(records + pos + 33);
+            pos += record_size;
+
+            // Skip the "." and ".." entries
+            if (name_size == 1 && (name_data[0] == 0 || name_data[0] == 1)) {
+                continue;
+            }
+
+            // Strip the version suffix (";1") and any trailing dot from the name
+            std::string name = Utils::toUpperCase(std::string(name_data, name_size));
+            name = name.substr(0, name.find(';'));
+            if (!name.empty() && name.back() == '.') {
+                name.pop_back();
+            }
+            std::string path = prefix.empty() ? name : prefix + "/" + name;
+
+            // Add the entry
+            DiscEntry entry;
+            entry.lba = entry_lba;
+            entry.size = entry_size;
+            entry.is_dir = (flags & 2) != 0;
+            entry.record_lba = lba + (offset / DISC_SECTOR_SIZE);
+            entry.record_offset = pos - record_size;
+            entries[path] = entry;
+
+            // Parse subdirectories
+            if (entry.is_dir && entry_lba < num_sectors && entry_lba != lba) {
+                ParseDirectory(path, entry_lba, entry_size, depth + 1);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Gets the user data of a sector through the sector cache.
+ *
+ * @param lba: Sector to read
+ *
+ * @return Pointer to 2048 bytes of user data (only valid until the next read), or nullptr on failure
+ *
+ */
+const byte* Disc::ReadSector(uint lba) {
+
+    // Bail if the sector doesn't exist
+    if (image == nullptr || lba >= num_sectors) {
+        return nullptr;
+    }
+
+    // Check the cache first and mark the sector as most recently used
+    auto cached = sector_cache.find(lba);
+    if (cached != sector_cache.end()) {
+        lru_sectors.splice(lru_sectors.begin(), lru_sectors, cached->second.second);
+        return cached->second.first.data();
+    }
+
+    // Read a run of sectors at once since files are laid out contiguously
+    uint count = std::min(DISC_READ_AHEAD, num_sectors - lba);
+    std::vector<byte> raw(count * sector_size);
+    if (fseek(image, (long)lba * sector_size, SEEK_SET) != 0) {
+        return nullptr;
+    }
+    count = fread(raw.data(), sector_size, count, image);
+    if (count == 0) {
+        return nullptr;
+    }
+
+    // Add the sectors to the cache (in reverse so the requested sector ends up most recently used)
+    for (int i = count - 1; i >= 0; i--) {
+
+        // Only add sectors that are not cached yet
+        if (sector_cache.count(lba + i) > 0) {
+            continue;
+        }
+
+        // Evict the least recently used sector if the cache is full
+        if (sector_cache.size() >= DISC_SECTOR_CACHE_SIZE) {
+            sector_cache.erase(lru_sectors.back());
+            lru_sectors.pop_back();
+        }
+
+        // Keep only the user data
+        lru_sectors.push_front(lba + i);
+        const byte* user_data = raw.data() + (i * sector_size) + data_offset;
+        sector_cache[lba + i] = {std::vector<byte>(user_data, user_data + DISC_SECTOR_SIZE), lru_sectors.begin()};
+    }
+
+    return sector_cache[lba].first.data();
+}
+
+
+
+/**
+ * Converts a virtual filename into a path on the mounted disc.
+ *
+ * @param filename: Virtual filename ("<image filename>/<ISO path>")
+ * @param iso_path: Where the upper-case ISO path should be stored ("" for the root)
+ *
+ * @return True if the filename points inside the mounted image
+ *
+ */
+bool Disc::ResolvePath(const char* filename, std::string* iso_path) {
+
+    // Bail if nothing is mounted
+    if (image == nullptr || filename == nullptr) {
+        return false;
+    }
+
+    // Check whether the path starts with the image filename
+    std::error_code ec;
+    std::string path = std::filesystem::absolute(filename, ec).lexically_normal().generic_string();
+    if (path == image_path) {
+        iso_path->clear();
+        return true;
+    }
+    if (path.size() <= image_path.size() || path.compare(0, image_path.size(), image_path) != 0 || path[image_path.size()] != '/') {
+        return false;
+    }
+
+    // Everything after it is the ISO path
+    *iso_path = Utils::toUpperCase(path.substr(image_path.size() + 1));
+    if (!iso_path->empty() && iso_path->back() == '/') {
+        iso_path->pop_back();
+    }
+    return true;
+}
+
+
+
+/**
+ * Reopens the image so that sectors can be written.
+ *
+ * @return True if the image is writable
+ *
+ */
+bool Disc::OpenForWrite() {
+
+    // Bail if nothing is mounted
+    if (image == nullptr) {
+        Log::Error("No disc image is mounted\n");
+        return false;
+    }
+
+    // Sectors without sync and header can't be rebuilt
+    if (sector_size != DISC_SECTOR_SIZE && sector_size != DISC_RAW_SECTOR_SIZE) {
+        Log::Error("Writing to %u byte sector images is not supported\n", sector_size);
+        return false;
+    }
+
+    // Reopen the image in read/write mode
+    if (!image_writable) {
+        FILE* fp = fopen(image_bin_path.c_str(), "r+b");
+        if (fp == nullptr) {
+            Log::Error("Could not open disc image for writing: %s\n", image_bin_path.c_str());
+            return false;
+        }
+        fclose(image);
+        image = fp;
+        image_writable = true;
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Reads the subheader submode of a raw Mode 2 sector.
+ *
+ * @param lba: Sector to read
+ *
+ * @return Submode flags of the sector (plain data if they could not be read)
+ *
+ */
+byte Disc::ReadSubmode(uint lba) {
+
+    byte submode = SUBMODE_DATA;
+    if (sector_size == DISC_RAW_SECTOR_SIZE && fseek(image, (long)lba * DISC_RAW_SECTOR_SIZE + SECTOR_SUBHEADER_OFFSET + 2, SEEK_SET) == 0) {
+        fread(&submode, sizeof(byte), 1, image);
+    }
+    return submode;
+}
+
+
+
+/**
+ * Writes the user data of consecutive sectors and regenerates their EDC/ECC.
+ *
+ * @param lba: First sector to write
+ * @param user_data: 2048 bytes of user data for each sector
+ * @param count: Number of sectors to write
+ * @param submodes: Subheader submode flags of each sector (only used by Mode 2 images)
+ *
+ * @return True if the sectors were written
+ *
+ */
+bool Disc::WriteSectors(uint lba, const byte* user_data, uint count, const std::vector<byte>& submodes) {
+
+    // Build the raw sectors
+    std::vector<byte> sectors(count * sector_size, 0);
+    for (uint i = 0; i < count; i++) {
+        byte* sector = sectors.data() + (i * sector_size);
+        if (sector_size == DISC_RAW_SECTOR_SIZE) {
+            EdcEcc::WriteHeader(sector, lba + i, submodes[i]);
+            sector[SECTOR_HEADER_OFFSET + 3] = data_offset == 16 ? 1 : 2;
+        }
+        memcpy(sector + data_offset, user_data + (i * DISC_SECTOR_SIZE), DISC_SECTOR_SIZE);
+    }
+
+    // Regenerate the error correction data of the touched sectors only
+    if (sector_size == DISC_RAW_SECTOR_SIZE) {
+        EdcEcc::EncodeSectors(sectors.data(), count);
+    }
+
+    // Write the sectors
+    if (fseek(image, (long)lba * sector_size, SEEK_SET) != 0 ||
+        fwrite(sectors.data(), sector_size, count, image) != count) {
+        Log::Error("Could not write sectors %u - %u of the disc image\n", lba, lba + count - 1);
+        return false;
+    }
+
+    // Drop any stale copies from the sector cache
+    for (uint i = 0; i < count; i++) {
+        auto cached = sector_cache.find(lba + i);
+        if (cached != sector_cache.end()) {
+            lru_sectors.erase(cached->second.second);
+            sector_cache.erase(cached);
+        }
+    }
+
+    return true;
+}
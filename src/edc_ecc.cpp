@@ -0,0 +1,248 @@
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "common.h"
+#include "edc_ecc.h"
+
+
+
+// Lookup tables (built once on first use)
+static uint edc_table[256];
+static byte ecc_f_table[256];
+static byte ecc_b_table[256];
+static std::once_flag tables_initialized;
+
+// Minimum number of sectors handed to each worker thread
+static const uint SECTORS_PER_THREAD = 256;
+
+
+
+/**
+ * Builds the EDC and ECC lookup tables.
+ */
+void EdcEcc::InitTables() {
+
+    for (uint i = 0; i < 256; i++) {
+
+        // Reed-Solomon multiply-by-two in GF(2^8) and its inverse
+        uint j = (i << 1) ^ ((i & 0x80) ? 0x11D : 0);
+        ecc_f_table[i] = j;
+        ecc_b_table[i ^ j] = i;
+
+        // CRC-32 with the CD-ROM polynomial (x^32 + x^31 + x^16 + x^15 + x^4 + x^3 + x + 1, reflected)
+        uint edc = i;
+        for (int k = 0; k < 8; k++) {
+            edc = (edc >> 1) ^ ((edc & 1) ? 0xD8018001 : 0);
+        }
+        edc_table[i] = edc;
+    }
+}
+
+
+
+/**
+ * Computes the error detection code of a block of data.
+ *
+ * @param data: Data to compute the EDC for
+ * @param num_bytes: Number of bytes of data
+ * @param edc: (Optional) EDC of any preceding data
+ *
+ * @return EDC of the data
+ *
+ */
+uint EdcEcc::ComputeEDC(const byte* data, uint num_bytes, uint edc) {
+
+    std::call_once(tables_initialized, InitTables);
+
+    for (uint i = 0; i < num_bytes; i++) {
+        edc = (edc >> 8) ^ edc_table[(edc ^ data[i]) & 0xFF];
+    }
+    return edc;
+}
+
+
+
+/**
+ * Writes the sync pattern, header and subheader of a Mode 2 sector.
+ *
+ * @param sector: Raw 2352-byte sector
+ * @param lba: Logical block address of the sector
+ * @param submode: Subheader submode flags (SUBMODE_*)
+ *
+ */
+void EdcEcc::WriteHeader(byte* sector, uint lba, byte submode) {
+
+    // Sync pattern
+    sector[0] = 0x00;
+    memset(sector + 1, 0xFF, 10);
+    sector[11] = 0x00;
+
+    // Absolute MSF address in BCD (the first 2 seconds are the lead-in)
+    uint address = lba + 150;
+    uint minutes = address / (60 * 75);
+    uint seconds = (address / 75) % 60;
+    uint frames = address % 75;
+    sector[SECTOR_HEADER_OFFSET + 0] = ((minutes / 10) << 4) | (minutes % 10);
+    sector[SECTOR_HEADER_OFFSET + 1] = ((seconds / 10) << 4) | (seconds % 10);
+    sector[SECTOR_HEADER_OFFSET + 2] = ((frames / 10) << 4) | (frames % 10);
+    sector[SECTOR_HEADER_OFFSET + 3] = 2;
+
+    // Subheader (file, channel, submode, coding info), stored twice
+    byte subheader[4] = {0, 0, submode, 0};
+    memcpy(sector + SECTOR_SUBHEADER_OFFSET, subheader, 4);
+    memcpy(sector + SECTOR_SUBHEADER_OFFSET + 4, subheader, 4);
+}
+
+
+
+/**
+ * Computes one set of Reed-Solomon product code parity bytes (P or Q).
+ *
+ * @param src: Start of the protected data (the sector header)
+ * @param major_count: Number of parity columns / diagonals
+ * @param minor_count: Number of bytes in each column / diagonal
+ * @param major_mult: Distance between consecutive columns / diagonals
+ * @param minor_inc: Distance between consecutive bytes of a column / diagonal
+ * @param dst: Where the parity bytes should be stored
+ *
+ */
+void EdcEcc::ComputeECCBlock(const byte* src, uint major_count, uint minor_count, uint major_mult, uint minor_inc, byte* dst) {
+
+    uint size = major_count * minor_count;
+    for (uint major = 0; major < major_count; major++) {
+
+        uint index = (major >> 1) * major_mult + (major & 1);
+        byte ecc_a = 0;
+        byte ecc_b = 0;
+        for (uint minor = 0; minor < minor_count; minor++) {
+            byte value = src[index];
+            index += minor_inc;
+            if (index >= size) {
+                index -= size;
+            }
+            ecc_a ^= value;
+            ecc_b ^= value;
+            ecc_a = ecc_f_table[ecc_a];
+        }
+
+        ecc_a = ecc_b_table[ecc_f_table[ecc_a] ^ ecc_b];
+        dst[major] = ecc_a;
+        dst[major + major_count] = ecc_a ^ ecc_b;
+    }
+}
+
+
+
+/**
+ * Generates the P and Q parity of a sector.
+ *
+ * @param sector: Raw 2352-byte sector
+ * @param zero_address: Whether the header should be treated as zero (Mode 2)
+ *
+ */
+void EdcEcc::GenerateECC(byte* sector, bool zero_address) {
+
+    // Mode 2 sectors don't protect the header
+    byte header[4];
+    memcpy(header, sector + SECTOR_HEADER_OFFSET, 4);
+    if (zero_address) {
+        memset(sector + SECTOR_HEADER_OFFSET, 0, 4);
+    }
+
+    // P parity covers the header and data, Q parity covers the same plus P
+    ComputeECCBlock(sector + SECTOR_HEADER_OFFSET, 86, 24, 2, 86, sector + SECTOR_ECC_P_OFFSET);
+    ComputeECCBlock(sector + SECTOR_HEADER_OFFSET, 52, 43, 86, 88, sector + SECTOR_ECC_Q_OFFSET);
+
+    memcpy(sector + SECTOR_HEADER_OFFSET, header, 4);
+}
+
+
+
+/**
+ * Regenerates the EDC and ECC of a raw sector from its header and user data.
+ *
+ * @param sector: Raw 2352-byte sector
+ *
+ * @note Mode 1, Mode 2 Form 1 and Mode 2 Form 2 sectors are supported, anything else (including audio) is left untouched.
+ *
+ */
+void EdcEcc::EncodeSector(byte* sector) {
+
+    std::call_once(tables_initialized, InitTables);
+
+    // Leave anything without a sync pattern alone (e.g. audio sectors)
+    static const byte sync[12] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
+    if (memcmp(sector, sync, sizeof(sync)) != 0) {
+        return;
+    }
+
+    byte mode = sector[SECTOR_HEADER_OFFSET + 3];
+
+    // Mode 1: EDC over sync, header and data followed by 8 zero bytes and ECC
+    if (mode == 1) {
+        uint edc = ComputeEDC(sector, SECTOR_MODE1_EDC_OFFSET);
+        for (int i = 0; i < 4; i++) {
+            sector[SECTOR_MODE1_EDC_OFFSET + i] = edc >> (i * 8);
+        }
+        memset(sector + SECTOR_MODE1_EDC_OFFSET + 4, 0, 8);
+        GenerateECC(sector, false);
+    }
+
+    // Mode 2 Form 2: EDC only
+    else if (mode == 2 && (sector[SECTOR_SUBHEADER_OFFSET + 2] & SUBMODE_FORM2) != 0) {
+        uint edc = ComputeEDC(sector + SECTOR_SUBHEADER_OFFSET, SECTOR_FORM2_EDC_OFFSET - SECTOR_SUBHEADER_OFFSET);
+        for (int i = 0; i < 4; i++) {
+            sector[SECTOR_FORM2_EDC_OFFSET + i] = edc >> (i * 8);
+        }
+    }
+
+    // Mode 2 Form 1: EDC over subheader and data followed by ECC
+    else if (mode == 2) {
+        uint edc = ComputeEDC(sector + SECTOR_SUBHEADER_OFFSET, SECTOR_FORM1_EDC_OFFSET - SECTOR_SUBHEADER_OFFSET);
+        for (int i = 0; i < 4; i++) {
+            sector[SECTOR_FORM1_EDC_OFFSET + i] = edc >> (i * 8);
+        }
+        GenerateECC(sector, true);
+    }
+}
+
+
+
+/**
+ * Regenerates the EDC and ECC of consecutive raw sectors using every available core.
+ *
+ * @param sectors: Raw 2352-byte sectors
+ * @param count: Number of sectors
+ *
+ */
+void EdcEcc::EncodeSectors(byte* sectors, uint count) {
+
+    std::call_once(tables_initialized, InitTables);
+
+    // Split the sectors into one contiguous range per thread
+    uint max_threads = std::max(1u, std::thread::hardware_concurrency());
+    uint num_threads = std::min(max_threads, (count + SECTORS_PER_THREAD - 1) / SECTORS_PER_THREAD);
+    if (num_threads <= 1) {
+        for (uint i = 0; i < count; i++) {
+            EncodeSector(sectors + (i * 2352));
+        }
+        return;
+    }
+
+    // Encode each range on its own thread
+    std::vector<std::thread> threads;
+    uint per_thread = (count + num_threads - 1) / num_threads;
+    for (uint start = 0; start < count; start += per_thread) {
+        uint end = std::min(count, start + per_thread);
+        threads.emplace_back([sectors, start, end] {
+            for (uint i = start; i < end; i++) {
+                EncodeSector(sectors + (i * 2352));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
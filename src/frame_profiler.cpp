@@ -0,0 +1,264 @@
+#include "imgui.h"
+#include <cstdio>
+#include <cfloat>
+#include <string>
+#include <algorithm>
+#include "common.h"
+#include "frame_profiler.h"
+#include "alloc_counter.h"
+#include "utils.h"
+
+
+
+// Static members
+bool FrameProfiler::enabled = false;
+FrameStats FrameProfiler::current;
+FrameStats FrameProfiler::history[PROFILER_HISTORY_SIZE];
+uint FrameProfiler::history_pos = 0;
+uint FrameProfiler::history_count = 0;
+std::chrono::steady_clock::time_point FrameProfiler::frame_start;
+std::chrono::steady_clock::time_point FrameProfiler::section_start[ProfilerSection_Count];
+AllocCount FrameProfiler::frame_allocations;
+
+// Names shown in the overlay
+static const char* const section_names[ProfilerSection_Count] = {
+    "Properties",
+    "Main Viewport",
+    "VRAM Viewer",
+    "Render"
+};
+
+
+
+
+// -- Measurement ----------------------------------------------------------------------------------------------
+
+/**
+ * Milliseconds elapsed since a given point in time.
+ *
+ * @param start: Point in time to measure from
+ *
+ * @return Elapsed milliseconds
+ *
+ */
+static float elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+/**
+ * Starts measuring a frame (call before polling events).
+ */
+void FrameProfiler::BeginFrame() {
+    auto now = std::chrono::steady_clock::now();
+    float interval_ms = std::chrono::duration<float, std::milli>(now - frame_start).count();
+    frame_start = now;
+    current = FrameStats();
+    current.interval_ms = interval_ms;
+
+    // Only the render thread's allocations are counted, and only while the overlay is shown
+    AllocCounter::SetThreadEnabled(enabled);
+    frame_allocations = AllocCounter::GetThreadCount();
+}
+
+
+
+/**
+ * Finishes measuring a frame and adds it to the history (call once the frame was rendered, before swapping buffers).
+ *
+ * @param draw_data: Draw data that was rendered
+ *
+ * @note Waiting on vsync isn't part of the frame time, only of the interval between frames.
+ *
+ */
+void FrameProfiler::EndFrame(const ImDrawData* draw_data) {
+    if (!enabled) {
+        return;
+    }
+    current.frame_ms = elapsed_ms(frame_start);
+    AllocCount allocations = AllocCounter::GetThreadCount();
+    current.allocations = allocations.allocations - frame_allocations.allocations;
+    current.allocated_bytes = allocations.bytes - frame_allocations.bytes;
+    CountDrawData(draw_data, &current);
+    history[history_pos] = current;
+    history_pos = (history_pos + 1) % PROFILER_HISTORY_SIZE;
+    history_count = std::min(history_count + 1, PROFILER_HISTORY_SIZE);
+}
+
+
+
+/**
+ * Starts timing a section of the frame.
+ *
+ * @param section: Section being built (ProfilerSection_*)
+ *
+ */
+void FrameProfiler::BeginSection(uint section) {
+    if (enabled) {
+        section_start[section] = std::chrono::steady_clock::now();
+    }
+}
+
+
+
+/**
+ * Stops timing a section of the frame.
+ *
+ * @param section: Section that was built (ProfilerSection_*)
+ *
+ */
+void FrameProfiler::EndSection(uint section) {
+    if (enabled) {
+        current.section_ms[section] += elapsed_ms(section_start[section]);
+    }
+}
+
+
+
+/**
+ * Counts an entity sprite part the main viewport submitted.
+ *
+ * @param visible: Whether the part lies within the viewport (ImGui drops parts outside of it)
+ *
+ */
+void FrameProfiler::CountSprite(bool visible) {
+    if (enabled) {
+        (visible ? current.sprites_drawn : current.sprites_culled)++;
+    }
+}
+
+
+
+/**
+ * Counts the commands the renderer backend issues for a frame.
+ *
+ * @param draw_data: Draw data of the main viewport
+ * @param stats: Where to store the counts
+ *
+ * @note The OpenGL backend binds the texture of every non-callback command, even if it didn't change.
+ *
+ */
+void FrameProfiler::CountDrawData(const ImDrawData* draw_data, FrameStats* stats) {
+    if (draw_data == nullptr) {
+        return;
+    }
+    ImTextureID last_texture = nullptr;
+    for (int i = 0; i < draw_data->CmdListsCount; i++) {
+        const ImDrawList* cmd_list = draw_data->CmdLists[i];
+        stats->vertices += cmd_list->VtxBuffer.Size;
+        for (const ImDrawCmd& cmd : cmd_list->CmdBuffer) {
+            stats->draw_commands++;
+            if (cmd.UserCallback != nullptr) {
+                stats->callbacks++;
+                continue;
+            }
+            stats->texture_binds++;
+            stats->texture_changes += (cmd.GetTexID() != last_texture);
+            last_texture = cmd.GetTexID();
+        }
+    }
+}
+
+
+
+
+// -- Overlay --------------------------------------------------------------------------------------------------
+
+/**
+ * Draws the profiler overlay in the top-right corner of the main viewport.
+ *
+ * @note Shows the last finished frame along with the average and maximum over the history.
+ *
+ */
+void FrameProfiler::DrawOverlay() {
+
+    if (!enabled) {
+        return;
+    }
+
+    // Pin the overlay to the corner of the work area (below the menu bar)
+    const ImGuiViewport* viewport = ImGui::GetMainViewport();
+    ImGui::SetNextWindowPos(ImVec2(viewport->WorkPos.x + viewport->WorkSize.x - 10, viewport->WorkPos.y + 10), ImGuiCond_Always, ImVec2(1, 0));
+    ImGui::SetNextWindowViewport(viewport->ID);
+    ImGui::SetNextWindowBgAlpha(0.85f);
+    ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoDocking | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav;
+    if (!ImGui::Begin("Frame Profiler", &enabled, flags)) {
+        ImGui::End();
+        return;
+    }
+    if (history_count == 0) {
+        ImGui::Text("Collecting frames ...");
+        ImGui::End();
+        return;
+    }
+
+    // Averages and maximums over the history
+    const FrameStats& last = history[(history_pos + PROFILER_HISTORY_SIZE - 1) % PROFILER_HISTORY_SIZE];
+    FrameStats average;
+    FrameStats maximum;
+    float average_section[ProfilerSection_Count] = {};
+    float frame_ms[PROFILER_HISTORY_SIZE];
+    float allocations[PROFILER_HISTORY_SIZE];
+    for (uint i = 0; i < history_count; i++) {
+        const FrameStats& frame = history[(history_pos + PROFILER_HISTORY_SIZE - history_count + i) % PROFILER_HISTORY_SIZE];
+        frame_ms[i] = frame.frame_ms;
+        allocations[i] = frame.allocations;
+        average.frame_ms += frame.frame_ms / history_count;
+        average.interval_ms += frame.interval_ms / history_count;
+        maximum.frame_ms = std::max(maximum.frame_ms, frame.frame_ms);
+        for (uint k = 0; k < ProfilerSection_Count; k++) {
+            average_section[k] += frame.section_ms[k] / history_count;
+            maximum.section_ms[k] = std::max(maximum.section_ms[k], frame.section_ms[k]);
+        }
+    }
+
+    ImGui::Text("Frame Profiler (F3)");
+    ImGui::Separator();
+    ImGui::Text("CPU frame   %6.2f ms  (avg %6.2f, max %6.2f)", last.frame_ms, average.frame_ms, maximum.frame_ms);
+    ImGui::Text("Interval    %6.2f ms  (%.0f FPS)", last.interval_ms, average.interval_ms > 0 ? 1000.0f / average.interval_ms : 0.0f);
+
+    // Time spent in each section (the rest goes to the menus, popups and event handling)
+    if (ImGui::BeginTable("##ProfilerSections", 4, ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Section");
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("avg");
+        ImGui::TableSetupColumn("max");
+        ImGui::TableHeadersRow();
+        float other_ms = last.frame_ms;
+        for (uint k = 0; k < ProfilerSection_Count; k++) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", section_names[k]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%6.2f", last.section_ms[k]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%6.2f", average_section[k]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%6.2f", maximum.section_ms[k]);
+            other_ms -= last.section_ms[k];
+        }
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("Other");
+        ImGui::TableNextColumn();
+        ImGui::Text("%6.2f", std::max(other_ms, 0.0f));
+        ImGui::EndTable();
+    }
+
+    // Draw data and viewport counters
+    ImGui::Separator();
+    ImGui::Text("Draw commands  %6u  (%u callbacks)", last.draw_commands, last.callbacks);
+    ImGui::Text("Texture binds  %6u  (%u changes)", last.texture_binds, last.texture_changes);
+    ImGui::Text("Vertices       %6u", last.vertices);
+    ImGui::Text("Sprites        %6u drawn, %u culled", last.sprites_drawn, last.sprites_culled);
+    ImGui::Text("Allocations    %6u  (%s)", last.allocations, Utils::FormatString("%.1f KiB", last.allocated_bytes / 1024.0).c_str());
+
+    // Rolling history
+    ImGui::Separator();
+    std::string frame_label = Utils::FormatString("max %.2f ms", maximum.frame_ms);
+    ImGui::PlotLines("CPU ms", frame_ms, history_count, 0, frame_label.c_str(), 0.0f, std::max(maximum.frame_ms, 16.7f), ImVec2(PROFILER_HISTORY_SIZE, 60));
+    ImGui::PlotHistogram("Allocs", allocations, history_count, 0, nullptr, 0.0f, FLT_MAX, ImVec2(PROFILER_HISTORY_SIZE, 40));
+
+    ImGui::End();
+}
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "common.h"
+#include "game_loader.h"
+#include "map.h"
+#include "mips.h"
+#include "cache.h"
+#include "cluts.h"
+#include "disc.h"
+#include "mapped_file.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+
+// -- Files ----------------------------------------------------------------------------------------------------
+
+/**
+ * Locates the game binaries and every map on a disc image or in an extracted copy of the disc.
+ *
+ * @param input: Disc image (.cue, .bin or .iso) or directory containing the extracted disc files
+ * @param files: Where to store the located files
+ *
+ * @return True if the game files were found
+ *
+ */
+bool GameLoader::FindFiles(const char* input, GameFiles* files) {
+    std::error_code ec;
+    return std::filesystem::is_directory(input, ec) ? FindDirectoryFiles(input, files) : FindDiscFiles(input, files);
+}
+
+
+
+/**
+ * Finds a file within a directory while ignoring the case of each path component.
+ *
+ * @param dir: Directory to search in
+ * @param relative_path: Path of the file within the directory (components separated by '/')
+ *
+ * @return Path of the file on disk (empty if it doesn't exist)
+ *
+ */
+std::string GameLoader::FindFile(const std::filesystem::path& dir, const std::string& relative_path) {
+
+    std::filesystem::path cur = dir;
+    size_t start = 0;
+    while (start <= relative_path.size()) {
+        size_t end = relative_path.find('/', start);
+        std::string component = Utils::toLowerCase(relative_path.substr(start, end - start));
+
+        // Look for a matching entry in the current directory
+        std::error_code ec;
+        bool found = false;
+        for (const auto& entry : std::filesystem::directory_iterator(cur, ec)) {
+            if (Utils::toLowerCase(entry.path().filename().string()) == component) {
+                cur = entry.path();
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return "";
+        }
+
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    return cur.string();
+}
+
+
+
+/**
+ * Locates the game binaries and every map on a disc image.
+ *
+ * @param filename: Disc image (.cue, .bin or .iso)
+ * @param files: Where to store the located files
+ *
+ * @return True if the image contains the SotN game files
+ *
+ */
+bool GameLoader::FindDiscFiles(const char* filename, GameFiles* files) {
+
+    if (!Disc::Mount(filename)) {
+        Log::Error("Could not read disc image: %s\n", filename);
+        return false;
+    }
+
+    files->disc_path = filename;
+    files->psx_path = Disc::FindExecutable();
+    files->bin_path = Disc::GetPath("DRA.BIN");
+    files->gfx_path = Disc::GetPath("F_GAME.BIN");
+    if (!Disc::Contains(files->gfx_path.c_str())) {
+        files->gfx_path = Disc::GetPath("BIN/F_GAME.BIN");
+    }
+    if (files->psx_path.empty() || !Disc::Contains(files->bin_path.c_str()) || !Disc::Contains(files->gfx_path.c_str())) {
+        Log::Error("Disc image does not contain the SotN game files: %s\n", filename);
+        return false;
+    }
+
+    files->maps = Disc::FindMaps();
+    return true;
+}
+
+
+
+/**
+ * Locates the game binaries and every map in an extracted copy of the disc.
+ *
+ * @param dirname: Directory containing the extracted disc files
+ * @param files: Where to store the located files
+ *
+ * @return True if the directory contains the SotN game files
+ *
+ */
+bool GameLoader::FindDirectoryFiles(const char* dirname, GameFiles* files) {
+
+    std::filesystem::path dir(dirname);
+
+    // Find the executable through the boot configuration (e.g. "BOOT = cdrom:\SLUS_000.67;1")
+    std::string system_cnf = FindFile(dir, "SYSTEM.CNF");
+    std::shared_ptr<const MappedFile> cnf = system_cnf.empty() ? nullptr : MappedFile::Share(system_cnf.c_str());
+    if (cnf != nullptr) {
+        std::string text((const char*)cnf->data, cnf->size);
+        size_t boot = text.find("BOOT");
+        size_t name_start = boot == std::string::npos ? std::string::npos : text.find_first_of(":\\", boot);
+        if (name_start != std::string::npos) {
+            name_start = text.find_first_not_of(":\\", name_start);
+            size_t name_end = text.find_first_of(";\r\n", name_start);
+            std::string name = text.substr(name_start, name_end - name_start);
+            std::replace(name.begin(), name.end(), '\\', '/');
+            files->psx_path = FindFile(dir, name);
+        }
+    }
+    if (files->psx_path.empty()) {
+        files->psx_path = FindFile(dir, "SLUS_000.67");
+    }
+
+    files->bin_path = FindFile(dir, "DRA.BIN");
+    files->gfx_path = FindFile(dir, "F_GAME.BIN");
+    if (files->gfx_path.empty()) {
+        files->gfx_path = FindFile(dir, "BIN/F_GAME.BIN");
+    }
+    if (files->psx_path.empty() || files->bin_path.empty() || files->gfx_path.empty()) {
+        Log::Error("Directory does not contain the SotN game files: %s\n", dirname);
+        return false;
+    }
+
+    // Maps live in ST/<ID>/<ID>.BIN and BOSS/<ID>/<ID>.BIN
+    for (const char* area : {"ST", "BOSS"}) {
+        std::string area_dir = FindFile(dir, area);
+        std::error_code ec;
+        if (area_dir.empty() || !std::filesystem::is_directory(area_dir, ec)) {
+            continue;
+        }
+        for (const auto& map_dir : std::filesystem::directory_iterator(area_dir, ec)) {
+            if (!map_dir.is_directory()) {
+                continue;
+            }
+            std::string id = map_dir.path().filename().string();
+            std::string map_path = FindFile(map_dir.path(), id + ".BIN");
+            std::string gfx_path = FindFile(map_dir.path(), "F_" + id + ".BIN");
+            if (!map_path.empty() && !gfx_path.empty()) {
+                files->maps.push_back(map_path);
+            }
+        }
+    }
+
+    std::sort(files->maps.begin(), files->maps.end());
+    return true;
+}
+
+
+
+/**
+ * Finds the graphics file (F_<ID>.BIN) that belongs to a map.
+ *
+ * @param map_path: Map file
+ *
+ * @return Graphics file (empty if it doesn't exist)
+ *
+ */
+std::string GameLoader::FindMapGraphics(const std::string& map_path) {
+
+    std::filesystem::path path(map_path);
+    std::string gfx_name = "F_" + Utils::toUpperCase(path.filename().string());
+
+    // Disc paths are always upper case
+    if (Disc::Contains(map_path.c_str())) {
+        std::string gfx_path = path.parent_path().generic_string() + "/" + gfx_name;
+        return Disc::Contains(gfx_path.c_str()) ? gfx_path : "";
+    }
+    return FindFile(path.parent_path(), gfx_name);
+}
+
+
+
+
+// -- Emulator -------------------------------------------------------------------------------------------------
+
+/**
+ * Loads the binaries into the emulator and restores (or creates) the post-boot snapshot.
+ *
+ * @param files: Game files to load
+ *
+ * @return True if the emulator is ready to load maps
+ *
+ */
+bool GameLoader::BootEmulator(const GameFiles& files) {
+
+    MipsEmulator::Initialize();
+    if (!MipsEmulator::SetPSXBinary(files.psx_path.c_str()) || !MipsEmulator::SetSotNBinary(files.bin_path.c_str())) {
+        Log::Error("Could not load the game binaries\n");
+        return false;
+    }
+
+    // Restore the post-initialization state if these binaries were booted before
+    auto boot_start = std::chrono::steady_clock::now();
+    uint64_t snapshot_key = Cache::GetKey({files.psx_path, files.bin_path});
+    if (Cache::LoadSnapshot(snapshot_key)) {
+        double boot_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - boot_start).count();
+        Log::Info("Emulator snapshot restored [%016llX] in %.1f ms\n", (unsigned long long)snapshot_key, boot_time);
+    }
+
+    // Otherwise do the initial reset and keep the result for next time
+    else {
+        MipsEmulator::Reset();
+        Cache::SaveSnapshot(snapshot_key);
+        double boot_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - boot_start).count();
+        Log::Info("Emulator booted [%016llX] in %.1f ms\n", (unsigned long long)snapshot_key, boot_time);
+    }
+    return true;
+}
+
+
+
+/**
+ * Reads the common graphics (F_GAME.BIN) into the generic VRAM and CLUTs shared by every map.
+ *
+ * @param files: Game files to load
+ *
+ * @return True if the graphics file was read
+ *
+ * @note Tiles using tilesets 0x10 - 0x17 or generic CLUTs are blank until this is called.
+ *
+ */
+bool GameLoader::LoadGenericGraphics(const GameFiles& files) {
+
+    std::shared_ptr<const MappedFile> f_game = MappedFile::Share(files.gfx_path.c_str());
+    if (f_game == nullptr || f_game->size < (256 * 512 * 2) + (256 * 16 * 2)) {
+        Log::Error("Invalid F_GAME.BIN file: %s\n", files.gfx_path.c_str());
+        return false;
+    }
+
+    // Convert the pixels straight from the mapping into VRAM
+    Map::fgame_vram.assign(512 * 256 * 4, 0);
+    Utils::Chunks_to_VRAM(f_game->data, 256 * 512 * 2, Map::fgame_vram.data());
+
+    // Hand the generic CLUTs to the CLUT manager
+    Clut::Reset(CLUT_BANK_GENERIC, 256);
+    Clut::Set(CLUT_BANK_GENERIC, 0, 256, f_game->data + (256 * 512 * 2));
+    return true;
+}
@@ -0,0 +1,1065 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include "common.h"
+#include "map.h"
+#include "map_export.h"
+#include "game_loader.h"
+#include "compositor.h"
+#include "sprite_decoder.h"
+#include "mips.h"
+#include "cache.h"
+#include "cluts.h"
+#include "compression.h"
+#include "utils.h"
+#include "log.h"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+
+
+// Output of a decoding stage compared against its golden
+typedef struct GoldenArtifact {
+    std::string name;                                       // Name of the artifact (unique within a map)
+    uint width = 0;                                         // Width in pixels (size in bytes for data artifacts)
+    uint height = 0;                                        // Height in pixels (0 for data artifacts)
+    std::vector<byte> data;                                 // RGBA pixels (red in the lowest byte) or raw bytes
+    uint64_t hash = 0;                                      // Hash of the data
+} GoldenArtifact;
+
+// Outcome of checking one map (filled in by the worker and the pool thread that launched it)
+typedef struct GoldenResult {
+    std::string map_path;                                   // Map file that was checked
+    bool ok = false;                                        // Whether every artifact matched its golden
+    std::string error;                                      // Last error the worker reported
+    uint num_artifacts = 0;                                 // Artifacts produced for the map
+    uint num_failed = 0;                                    // Artifacts that didn't match (or had no golden)
+    uint num_updated = 0;                                   // Goldens that were written or changed
+    std::vector<std::string> failures;                      // Description of every mismatch
+    double total_ms = 0;                                    // Wall time of the worker process
+} GoldenResult;
+
+// Options shared by every worker
+typedef struct GoldenOptions {
+    std::string golden_dir;                                 // Directory holding a folder of goldens for each map
+    std::string diff_dir;                                   // Directory the actual and diff images of mismatches go to
+    bool update = false;                                    // Whether to write the goldens instead of checking them
+    bool images = false;                                    // Whether to store the golden images next to the hashes
+} GoldenOptions;
+
+// Prefixes of the lines a worker reports on
+const char* const GOLDEN_RESULT_PREFIX = "RESULT ";
+const char* const GOLDEN_FAIL_PREFIX = "FAIL ";
+
+// Width of the tile and sprite atlases
+const uint GOLDEN_TILES_PER_ROW = 32;
+const uint GOLDEN_ATLAS_WIDTH = 512;
+
+// Colors of the diff images (mismatched pixels, and the scale applied to the rest)
+const uint GOLDEN_DIFF_COLOR = 0xFF0000FF;
+const uint GOLDEN_DIFF_DIM = 4;
+
+
+
+
+// -- Helpers --------------------------------------------------------------------------------------------------
+
+/**
+ * Milliseconds elapsed since a given point in time.
+ *
+ * @param start: Point in time to measure from
+ *
+ * @return Elapsed milliseconds
+ *
+ */
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+/**
+ * Reads a whole file.
+ *
+ * @param filename: File to read
+ * @param data: Where to store the contents
+ *
+ * @return True if the file was read
+ *
+ */
+static bool read_file(const std::string& filename, std::vector<byte>* data) {
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    data->clear();
+    byte buf[65536];
+    size_t num_read;
+    while ((num_read = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data->insert(data->end(), buf, buf + num_read);
+    }
+    fclose(fp);
+    return true;
+}
+
+
+
+/**
+ * Writes a whole file, creating its directory if needed.
+ *
+ * @param filename: File to write
+ * @param data: Contents of the file
+ * @param num_bytes: Size of the contents
+ *
+ * @return True if the whole file was written
+ *
+ */
+static bool write_file(const std::string& filename, const void* data, size_t num_bytes) {
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(filename).parent_path(), ec);
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool written = fwrite(data, 1, num_bytes, fp) == num_bytes;
+    return (fclose(fp) == 0) && written;
+}
+
+
+
+/**
+ * Writes RGBA pixels as an uncompressed 32-bit TGA image (readable by most image viewers).
+ *
+ * @param filename: File to write
+ * @param pixels: RGBA pixels (red in the lowest byte)
+ * @param width: Width of the image
+ * @param height: Height of the image
+ *
+ * @return True if the image was written
+ *
+ */
+static bool write_tga(const std::string& filename, const byte* pixels, uint width, uint height) {
+
+    if (width > 0xFFFF || height > 0xFFFF) {
+        return false;
+    }
+
+    // Uncompressed true color, 8 alpha bits, top-left origin
+    std::vector<byte> out(18 + (width * height * 4));
+    out[2] = 2;
+    out[12] = width & 0xFF;
+    out[13] = width >> 8;
+    out[14] = height & 0xFF;
+    out[15] = height >> 8;
+    out[16] = 32;
+    out[17] = 0x28;
+
+    // TGA stores BGRA
+    byte* dst = out.data() + 18;
+    for (uint i = 0; i < width * height; i++) {
+        dst[(i * 4) + 0] = pixels[(i * 4) + 2];
+        dst[(i * 4) + 1] = pixels[(i * 4) + 1];
+        dst[(i * 4) + 2] = pixels[(i * 4) + 0];
+        dst[(i * 4) + 3] = pixels[(i * 4) + 3];
+    }
+    return write_file(filename, out.data(), out.size());
+}
+
+
+
+/**
+ * Reads a TGA image written by write_tga().
+ *
+ * @param filename: File to read
+ * @param pixels: Where to store the RGBA pixels
+ * @param width: Where to store the width of the image
+ * @param height: Where to store the height of the image
+ *
+ * @return True if the file is an uncompressed 32-bit top-left TGA image
+ *
+ */
+static bool read_tga(const std::string& filename, std::vector<byte>* pixels, uint* width, uint* height) {
+
+    std::vector<byte> data;
+    if (!read_file(filename, &data) || data.size() < 18 || data[2] != 2 || data[16] != 32 || (data[17] & 0x20) == 0) {
+        return false;
+    }
+    *width = data[12] | (data[13] << 8);
+    *height = data[14] | (data[15] << 8);
+    const byte* src = data.data() + 18 + data[0];
+    if (data.size() < 18 + data[0] + ((size_t)*width * *height * 4)) {
+        return false;
+    }
+    pixels->resize(*width * *height * 4);
+    for (uint i = 0; i < *width * *height; i++) {
+        (*pixels)[(i * 4) + 0] = src[(i * 4) + 2];
+        (*pixels)[(i * 4) + 1] = src[(i * 4) + 1];
+        (*pixels)[(i * 4) + 2] = src[(i * 4) + 0];
+        (*pixels)[(i * 4) + 3] = src[(i * 4) + 3];
+    }
+    return true;
+}
+
+
+
+
+// -- Artifacts ------------------------------------------------------------------------------------------------
+
+/**
+ * Adds an artifact to a map's list and hashes it.
+ *
+ * @param artifacts: Artifacts of the map
+ * @param name: Name of the artifact
+ * @param width: Width in pixels (size in bytes for data artifacts)
+ * @param height: Height in pixels (0 for data artifacts)
+ * @param data: Pixels or bytes of the artifact
+ *
+ */
+static void add_artifact(std::vector<GoldenArtifact>* artifacts, const std::string& name, uint width, uint height, std::vector<byte> data) {
+    GoldenArtifact artifact;
+    artifact.name = name;
+    artifact.width = width;
+    artifact.height = height;
+    artifact.data = std::move(data);
+    artifact.hash = Utils::Hash(artifact.data.data(), artifact.data.size());
+    artifacts->push_back(std::move(artifact));
+}
+
+
+
+/**
+ * Lays out the unique decoded tiles of a map in a grid.
+ *
+ * @param map: Map whose tiles were decoded
+ *
+ * @return RGBA pixels of the atlas (GOLDEN_TILES_PER_ROW tiles wide)
+ *
+ */
+static std::vector<byte> make_tile_atlas(const Map* map) {
+    uint num_tiles = map->cache.tiles.size() / (16 * 16 * 4);
+    uint num_rows = (num_tiles + GOLDEN_TILES_PER_ROW - 1) / GOLDEN_TILES_PER_ROW;
+    uint stride = GOLDEN_TILES_PER_ROW * 16 * 4;
+    std::vector<byte> atlas(num_rows * 16 * stride, 0);
+    for (uint i = 0; i < num_tiles; i++) {
+        byte* dst = atlas.data() + ((i / GOLDEN_TILES_PER_ROW) * 16 * stride) + ((i % GOLDEN_TILES_PER_ROW) * 16 * 4);
+        for (uint row = 0; row < 16; row++) {
+            memcpy(dst + (row * stride), map->cache.tiles.data() + (((i * 16) + row) * 16 * 4), 16 * 4);
+        }
+    }
+    return atlas;
+}
+
+
+
+/**
+ * Packs the decoded sprite parts of a map into rows (in the order of their keys).
+ *
+ * @param extraction: Sprite parts decoded for every room
+ * @param width: Where to store the width of the atlas
+ * @param height: Where to store the height of the atlas
+ *
+ * @return RGBA pixels of the atlas
+ *
+ */
+static std::vector<byte> make_sprite_atlas(const SpriteExtraction& extraction, uint* width, uint* height) {
+
+    // Place the parts left to right, starting a new row when one doesn't fit
+    *width = GOLDEN_ATLAS_WIDTH;
+    for (const auto& part : extraction.parts) {
+        *width = std::max(*width, std::get<3>(part.first));
+    }
+    std::vector<std::pair<uint, uint>> positions;
+    uint x = 0;
+    uint y = 0;
+    uint row_height = 0;
+    for (const auto& part : extraction.parts) {
+        uint part_width = std::get<3>(part.first);
+        uint part_height = std::get<4>(part.first);
+        if (x + part_width > *width) {
+            x = 0;
+            y += row_height;
+            row_height = 0;
+        }
+        positions.push_back({x, y});
+        x += part_width;
+        row_height = std::max(row_height, part_height);
+    }
+    *height = y + row_height;
+
+    // Copy the pixels of every part
+    std::vector<byte> atlas((size_t)*width * *height * 4, 0);
+    uint i = 0;
+    for (const auto& part : extraction.parts) {
+        uint part_width = std::get<3>(part.first);
+        uint part_height = std::get<4>(part.first);
+        for (uint row = 0; row < part_height && (row + 1) * part_width * 4 <= part.second.size(); row++) {
+            memcpy(atlas.data() + ((((positions[i].second + row) * *width) + positions[i].first) * 4), part.second.data() + (row * part_width * 4), part_width * 4);
+        }
+        i++;
+    }
+    return atlas;
+}
+
+
+
+/**
+ * Runs a map through the headless decoding pipeline and collects the output of every stage.
+ *
+ * @param files: Game files to load
+ * @param map_path: Map file to load
+ * @param map: Where to load the map (left loaded in the emulator)
+ * @param artifacts: Where to store the artifacts
+ *
+ * @return True if every stage ran
+ *
+ * @note The caches are bypassed so that every stage decodes from the game files.
+ *
+ */
+static bool produce_artifacts(const GameFiles& files, const std::string& map_path, Map* map, std::vector<GoldenArtifact>* artifacts) {
+
+    // Boot the emulator (restored from the snapshot the runner saved) and read the shared graphics
+    if (!GameLoader::BootEmulator(files) || !GameLoader::LoadGenericGraphics(files)) {
+        return false;
+    }
+    std::string gfx_path = GameLoader::FindMapGraphics(map_path);
+    if (gfx_path.empty()) {
+        Log::Error("Could not find the graphics file of %s\n", map_path.c_str());
+        return false;
+    }
+    Cache::enabled = false;
+
+    // Parse the map and decode its graphics
+    map->cache_key = CACHE_KEY_NONE;
+    map->cache_hit = false;
+    if (!map->ParseMapFile(map_path.c_str())) {
+        return false;
+    }
+    map->DecompressEntityGraphics();
+    if (!map->BuildMapVRAM(gfx_path.c_str())) {
+        return false;
+    }
+    map->DecodeTiles();
+
+    // Emulate every room and decode the sprites of its entities
+    if (!map->LoadIntoEmulator()) {
+        return false;
+    }
+    map->entity_cache_key = CACHE_KEY_NONE;
+    EntityEmulationState emulation;
+    SpriteExtraction extraction;
+    map->BeginEntityEmulation(&emulation);
+    Clut::Reset(CLUT_BANK_RAM, CLUT_DATA_SIZE / 32);
+    for (uint i = 0; i < map->rooms.size(); i++) {
+        map->rooms[i].entities = map->EmulateRoom(i, &emulation);
+        SpriteDecoder::DecodeRoom(map, &map->rooms[i], &extraction);
+        map->RenderPolygons(i);
+    }
+    map->EndEntityEmulation(&emulation);
+
+    // VRAM (tilesets and tile CLUTs) and the decompressed entity graphics
+    add_artifact(artifacts, "vram", 512, 256, map->cache.vram);
+    std::vector<byte> entity_graphics;
+    for (const auto& graphics : map->cache.entity_graphics) {
+        entity_graphics.insert(entity_graphics.end(), (const byte*)&graphics.first, (const byte*)&graphics.first + sizeof(uint));
+        entity_graphics.insert(entity_graphics.end(), graphics.second.begin(), graphics.second.end());
+    }
+    uint entity_graphics_size = entity_graphics.size();
+    add_artifact(artifacts, "entity_graphics", entity_graphics_size, 0, std::move(entity_graphics));
+
+    // Decoded tiles and sprite parts
+    std::vector<byte> tiles = make_tile_atlas(map);
+    uint tiles_height = tiles.size() / (GOLDEN_TILES_PER_ROW * 16 * 4);
+    add_artifact(artifacts, "tiles", GOLDEN_TILES_PER_ROW * 16, tiles_height, std::move(tiles));
+    uint atlas_width;
+    uint atlas_height;
+    std::vector<byte> sprites = make_sprite_atlas(extraction, &atlas_width, &atlas_height);
+    add_artifact(artifacts, "sprites", atlas_width, atlas_height, std::move(sprites));
+
+    // Emulated entities (everything the exporter writes)
+    std::vector<byte> entities = MapExport::ToBinary(map);
+    uint entities_size = entities.size();
+    add_artifact(artifacts, "entities", entities_size, 0, std::move(entities));
+
+    // Room composites (tile layers, the GL layer adds the entity sprites)
+    std::vector<uint> room_ids(map->rooms.size());
+    for (uint i = 0; i < room_ids.size(); i++) {
+        room_ids[i] = i;
+    }
+    std::vector<CompositeImage> images = Compositor::RenderRooms(map, room_ids);
+    for (uint i = 0; i < images.size(); i++) {
+        std::vector<byte> pixels(images[i].pixels.size() * 4);
+        memcpy(pixels.data(), images[i].pixels.data(), pixels.size());
+        add_artifact(artifacts, Utils::FormatString("room_%03u", i), images[i].width, images[i].height, std::move(pixels));
+    }
+
+    return true;
+}
+
+
+
+
+// -- Consistency checks ---------------------------------------------------------------------------------------
+
+/**
+ * Emulates every room of a map and records what each room leaves behind.
+ *
+ * @param map: Map loaded into the emulator
+ * @param miss_rooms: Rooms that have to be emulated even if they are cached (every room if the cache is empty)
+ * @param room_entities: Where to store the slot, address and data of the entities of each room
+ * @param room_cluts: Where to store the framebuffer CLUT rows (CLUT_BASE_ADDR) each room ends with
+ * @param room_ram: Where to store the hash of the whole RAM each room ends with
+ *
+ */
+static void emulate_rooms(Map* map, const std::vector<bool>& miss_rooms, std::vector<std::vector<byte>>* room_entities, std::vector<std::vector<byte>>* room_cluts, std::vector<uint64_t>* room_ram) {
+
+    EntityEmulationState emulation;
+    map->BeginEntityEmulation(&emulation);
+    for (uint i = 0; i < map->rooms.size(); i++) {
+        if (miss_rooms[i]) {
+            emulation.cache.rooms[i].params_hash = 0;
+        }
+    }
+    room_entities->assign(map->rooms.size(), std::vector<byte>());
+    room_cluts->assign(map->rooms.size(), std::vector<byte>());
+    room_ram->assign(map->rooms.size(), 0);
+    for (uint i = 0; i < map->rooms.size(); i++) {
+        for (const Entity& entity : map->EmulateRoom(i, &emulation)) {
+            std::vector<byte>& entities = (*room_entities)[i];
+            entities.insert(entities.end(), (const byte*)&entity.slot, (const byte*)&entity.slot + sizeof(uint));
+            entities.insert(entities.end(), (const byte*)&entity.address, (const byte*)&entity.address + sizeof(uint));
+            entities.insert(entities.end(), (const byte*)&entity.data, (const byte*)&entity.data + sizeof(EntityData));
+        }
+        (*room_cluts)[i].assign(MipsEmulator::ram + CLUT_BASE_ADDR, MipsEmulator::ram + CLUT_BASE_ADDR + CLUT_DATA_SIZE);
+        (*room_ram)[i] = Utils::Hash(MipsEmulator::ram, RAM_SIZE);
+    }
+    map->EndEntityEmulation(&emulation);
+}
+
+
+
+/**
+ * Checks that rooms restored from the entity cache match rooms that were emulated.
+ *
+ * @param map: Map loaded into the emulator
+ * @param failures: Where to add a description of every room that differs
+ *
+ * @note The map is emulated cold (filling a scratch cache) and then warm, with every other room forced to be emulated
+ *       again, so that cached rooms follow emulated rooms and the other way around.
+ *
+ */
+static void check_entity_cache(Map* map, std::vector<std::string>* failures) {
+
+    // Keep the entries away from the user's cache
+    std::error_code ec;
+    std::string map_id = Utils::toUpperCase(map->map_id);
+    std::filesystem::path cache_dir = std::filesystem::temp_directory_path(ec) / Utils::FormatString(
+        "sotn_golden_%s_%llX", map_id.c_str(), (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count()
+    );
+    bool cache_enabled = Cache::enabled;
+    std::string cache_directory = Cache::directory;
+    Cache::enabled = true;
+    Cache::directory = cache_dir.string();
+    map->entity_cache_key = Utils::Hash(map_id.data(), map_id.size());
+
+    // Cold (every room is emulated and saved) and then warm (odd rooms are restored from the cache)
+    std::vector<std::vector<byte>> cold_entities;
+    std::vector<std::vector<byte>> cold_cluts;
+    std::vector<std::vector<byte>> warm_entities;
+    std::vector<std::vector<byte>> warm_cluts;
+    std::vector<uint64_t> cold_ram;
+    std::vector<uint64_t> warm_ram;
+    std::vector<bool> miss_rooms(map->rooms.size());
+    emulate_rooms(map, miss_rooms, &cold_entities, &cold_cluts, &cold_ram);
+    for (uint i = 0; i < miss_rooms.size(); i++) {
+        miss_rooms[i] = (i % 2) == 0;
+    }
+    emulate_rooms(map, miss_rooms, &warm_entities, &warm_cluts, &warm_ram);
+
+    Cache::enabled = cache_enabled;
+    Cache::directory = cache_directory;
+    std::filesystem::remove_all(cache_dir, ec);
+
+    // Every room has to come out the same either way
+    for (uint i = 0; i < map->rooms.size(); i++) {
+        const char* state = miss_rooms[i] ? "emulated" : "cached";
+        if (cold_entities[i] != warm_entities[i]) {
+            failures->push_back(Utils::FormatString("%s/room_%03u: %s entities differ from the cold load", map_id.c_str(), i, state));
+        }
+        if (cold_cluts[i] != warm_cluts[i]) {
+            failures->push_back(Utils::FormatString("%s/room_%03u: %s framebuffer CLUTs differ from the cold load", map_id.c_str(), i, state));
+        }
+        if (cold_ram[i] != warm_ram[i]) {
+            failures->push_back(Utils::FormatString("%s/room_%03u: %s RAM differs from the cold load", map_id.c_str(), i, state));
+        }
+    }
+}
+
+
+
+/**
+ * Checks that every entity graphics block of a map survives recompression.
+ *
+ * @param map_path: Map file to check
+ * @param map_id: ID of the map (to describe failures)
+ * @param failures: Where to add a description of every block that didn't survive
+ *
+ */
+static void check_compression(const std::string& map_path, const std::string& map_id, std::vector<std::string>* failures) {
+    std::vector<uint> failed_blocks;
+    if (!Compression::VerifyRoundTrip(map_path, &failed_blocks)) {
+        failures->push_back(Utils::FormatString("%s/compression: could not read the map", map_id.c_str()));
+    }
+    for (uint address : failed_blocks) {
+        failures->push_back(Utils::FormatString("%s/compression: block at 0x%X did not survive the round trip", map_id.c_str(), address));
+    }
+}
+
+
+
+
+// -- Goldens --------------------------------------------------------------------------------------------------
+
+/**
+ * Reads the golden hashes of a map.
+ *
+ * @param filename: Manifest to read
+ * @param goldens: Where to store the goldens (without their data)
+ *
+ * @return True if the manifest was read
+ *
+ */
+static bool load_manifest(const std::string& filename, std::map<std::string, GoldenArtifact>* goldens) {
+
+    std::vector<byte> data;
+    if (!read_file(filename, &data)) {
+        return false;
+    }
+    std::string text(data.begin(), data.end());
+
+    // Pull the fields out of every artifact object
+    const std::string name_key = "\"name\": \"";
+    size_t pos = 0;
+    while ((pos = text.find(name_key, pos)) != std::string::npos) {
+        size_t name_start = pos + name_key.size();
+        size_t name_end = text.find('"', name_start);
+        size_t object_end = text.find('}', name_start);
+        if (name_end == std::string::npos || object_end == std::string::npos) {
+            break;
+        }
+        std::string object = text.substr(name_end, object_end - name_end);
+        size_t width_pos = object.find("\"width\": ");
+        size_t height_pos = object.find("\"height\": ");
+        size_t hash_pos = object.find("\"hash\": \"");
+        if (width_pos != std::string::npos && height_pos != std::string::npos && hash_pos != std::string::npos) {
+            GoldenArtifact golden;
+            golden.name = text.substr(name_start, name_end - name_start);
+            golden.width = strtoul(object.c_str() + width_pos + 9, nullptr, 10);
+            golden.height = strtoul(object.c_str() + height_pos + 10, nullptr, 10);
+            golden.hash = strtoull(object.c_str() + hash_pos + 9, nullptr, 16);
+            (*goldens)[golden.name] = golden;
+        }
+        pos = object_end;
+    }
+    return true;
+}
+
+
+
+/**
+ * Writes the golden hashes of a map.
+ *
+ * @param filename: Manifest to write
+ * @param map_id: ID of the map
+ * @param artifacts: Artifacts of the map
+ *
+ * @return True if the manifest was written
+ *
+ */
+static bool save_manifest(const std::string& filename, const std::string& map_id, const std::vector<GoldenArtifact>& artifacts) {
+    std::string out = Utils::FormatString("{\n    \"map\": \"%s\",\n    \"artifacts\": [", MapExport::EscapeJSON(map_id).c_str());
+    for (size_t i = 0; i < artifacts.size(); i++) {
+        const GoldenArtifact& artifact = artifacts[i];
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append(Utils::FormatString(
+            "        {\"name\": \"%s\", \"width\": %u, \"height\": %u, \"hash\": \"%016llx\"}",
+            artifact.name.c_str(), artifact.width, artifact.height, (unsigned long long)artifact.hash
+        ));
+    }
+    out.append(artifacts.empty() ? "]\n}\n" : "\n    ]\n}\n");
+    return write_file(filename, out.data(), out.size());
+}
+
+
+
+/**
+ * Path of the file an artifact is stored in.
+ *
+ * @param dir: Directory of the map's goldens (or diffs)
+ * @param artifact: Artifact to store
+ * @param suffix: Text added after the name (e.g. ".diff")
+ *
+ * @return Path of the image (.tga) or data (.bin) file
+ *
+ */
+static std::string artifact_path(const std::filesystem::path& dir, const GoldenArtifact& artifact, const std::string& suffix) {
+    return (dir / (artifact.name + suffix + (artifact.height > 0 ? ".tga" : ".bin"))).string();
+}
+
+
+
+/**
+ * Writes an artifact as an image (or raw data).
+ *
+ * @param filename: File to write
+ * @param artifact: Artifact to write
+ *
+ * @return True if the file was written
+ *
+ */
+static bool write_artifact(const std::string& filename, const GoldenArtifact& artifact) {
+    if (artifact.height > 0) {
+        return write_tga(filename, artifact.data.data(), artifact.width, artifact.height);
+    }
+    return write_file(filename, artifact.data.data(), artifact.data.size());
+}
+
+
+
+/**
+ * Describes how an artifact differs from its stored golden and writes a diff image.
+ *
+ * @param artifact: Artifact that didn't match its golden hash
+ * @param golden_file: Stored golden data of the artifact (if goldens were written with images)
+ * @param diff_dir: Directory to write the diff image to
+ *
+ * @return Description of the mismatch
+ *
+ * @note Diff images show the golden dimmed, with every pixel that changed in solid red.
+ *
+ */
+static std::string describe_mismatch(const GoldenArtifact& artifact, const std::string& golden_file, const std::filesystem::path& diff_dir) {
+
+    // Without the golden's data only the hash can be compared
+    std::vector<byte> golden;
+    uint golden_width = artifact.width;
+    uint golden_height = artifact.height;
+    bool have_golden = (artifact.height > 0 ? read_tga(golden_file, &golden, &golden_width, &golden_height) : read_file(golden_file, &golden));
+    if (!have_golden) {
+        return "hash differs (no golden data stored, rerun --update with --images to get diffs)";
+    }
+    if (golden_width != artifact.width || golden_height != artifact.height || golden.size() != artifact.data.size()) {
+        return Utils::FormatString("size changed from %ux%u to %ux%u", golden_width, golden_height, artifact.width, artifact.height);
+    }
+
+    // Data artifacts report the first byte that changed
+    if (artifact.height == 0) {
+        auto mismatch = std::mismatch(golden.begin(), golden.end(), artifact.data.begin());
+        uint num_bytes = 0;
+        for (size_t i = 0; i < golden.size(); i++) {
+            num_bytes += golden[i] != artifact.data[i];
+        }
+        return Utils::FormatString("%u bytes differ (first at offset 0x%zX)", num_bytes, (size_t)(mismatch.first - golden.begin()));
+    }
+
+    // Images mark every pixel that changed
+    const uint* golden_pixels = (const uint*)golden.data();
+    const uint* actual_pixels = (const uint*)artifact.data.data();
+    std::vector<uint> diff(artifact.width * artifact.height);
+    uint num_pixels = 0;
+    uint first_x = 0;
+    uint first_y = 0;
+    for (uint i = 0; i < diff.size(); i++) {
+        if (golden_pixels[i] != actual_pixels[i]) {
+            if (num_pixels == 0) {
+                first_x = i % artifact.width;
+                first_y = i / artifact.width;
+            }
+            num_pixels++;
+            diff[i] = GOLDEN_DIFF_COLOR;
+            continue;
+        }
+        uint dimmed = 0xFF000000;
+        for (uint shift = 0; shift < 24; shift += 8) {
+            dimmed |= (((golden_pixels[i] >> shift) & 0xFF) / GOLDEN_DIFF_DIM) << shift;
+        }
+        diff[i] = dimmed;
+    }
+    write_tga(artifact_path(diff_dir, artifact, ".diff"), (const byte*)diff.data(), artifact.width, artifact.height);
+    return Utils::FormatString("%u pixels differ (first at %u, %u)", num_pixels, first_x, first_y);
+}
+
+
+
+/**
+ * Produces the artifacts of a map and checks them against its goldens (or writes the goldens).
+ * When checking, the consistency checks (which have no goldens) run as well.
+ *
+ * @param files: Game files to load
+ * @param map_path: Map file to check
+ * @param options: Golden and diff directories, update mode
+ * @param result: Where to store the counts and the description of every mismatch
+ *
+ * @return True if the artifacts were produced (whether or not they matched)
+ *
+ * @note This runs once per worker process, as the emulator state is shared by the whole process.
+ *
+ */
+static bool check_map(const GameFiles& files, const std::string& map_path, const GoldenOptions& options, GoldenResult* result) {
+
+    Map map;
+    std::vector<GoldenArtifact> artifacts;
+    if (!produce_artifacts(files, map_path, &map, &artifacts)) {
+        return false;
+    }
+    std::string map_id = Utils::toUpperCase(map.map_id);
+    result->num_artifacts = artifacts.size();
+    std::filesystem::path golden_dir = std::filesystem::path(options.golden_dir) / map_id;
+    std::filesystem::path diff_dir = std::filesystem::path(options.diff_dir) / map_id;
+    std::string manifest_path = (golden_dir / "manifest.json").string();
+    std::map<std::string, GoldenArtifact> goldens;
+    bool have_manifest = load_manifest(manifest_path, &goldens);
+
+    // Write the goldens (counting the ones that changed)
+    if (options.update) {
+        for (const GoldenArtifact& artifact : artifacts) {
+            auto golden = goldens.find(artifact.name);
+            bool changed = (golden == goldens.end() || golden->second.hash != artifact.hash || golden->second.width != artifact.width || golden->second.height != artifact.height);
+            result->num_updated += changed;
+            // Stale images would be diffed against the new hashes, so they go when images aren't stored
+            std::string golden_file = artifact_path(golden_dir, artifact, "");
+            if (!options.images) {
+                std::error_code ec;
+                std::filesystem::remove(golden_file, ec);
+            }
+            else if (!write_artifact(golden_file, artifact)) {
+                Log::Error("Could not write the golden %s of %s\n", artifact.name.c_str(), map_id.c_str());
+                return false;
+            }
+        }
+        result->num_updated += std::count_if(goldens.begin(), goldens.end(), [&artifacts](const auto& golden) {
+            return std::none_of(artifacts.begin(), artifacts.end(), [&golden](const GoldenArtifact& artifact) { return artifact.name == golden.first; });
+        });
+        if (!save_manifest(manifest_path, map_id, artifacts)) {
+            Log::Error("Could not write %s\n", manifest_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Checks that don't need goldens
+    std::vector<std::string> check_failures;
+    check_entity_cache(&map, &check_failures);
+    check_compression(map_path, map_id, &check_failures);
+    result->num_failed += check_failures.size();
+    result->failures.insert(result->failures.end(), check_failures.begin(), check_failures.end());
+
+    if (!have_manifest) {
+        result->num_failed += artifacts.size();
+        result->failures.push_back(Utils::FormatString("%s: no goldens (run with --update first)", map_id.c_str()));
+        return true;
+    }
+
+    // Compare every artifact against its golden
+    for (const GoldenArtifact& artifact : artifacts) {
+        auto golden = goldens.find(artifact.name);
+        std::string failure;
+        if (golden == goldens.end()) {
+            failure = "no golden";
+        }
+        else if (golden->second.width != artifact.width || golden->second.height != artifact.height) {
+            failure = Utils::FormatString("size changed from %ux%u to %ux%u", golden->second.width, golden->second.height, artifact.width, artifact.height);
+        }
+        else if (golden->second.hash != artifact.hash) {
+            failure = describe_mismatch(artifact, artifact_path(golden_dir, artifact, ""), diff_dir);
+        }
+        if (!failure.empty()) {
+            write_artifact(artifact_path(diff_dir, artifact, ""), artifact);
+            result->num_failed++;
+            result->failures.push_back(Utils::FormatString("%s/%s: %s", map_id.c_str(), artifact.name.c_str(), failure.c_str()));
+        }
+        goldens.erase(artifact.name);
+    }
+
+    // Goldens that are no longer produced (e.g. a room went missing)
+    for (const auto& golden : goldens) {
+        result->num_failed++;
+        result->failures.push_back(Utils::FormatString("%s/%s: not produced", map_id.c_str(), golden.first.c_str()));
+    }
+    return true;
+}
+
+
+
+
+// -- Pool -----------------------------------------------------------------------------------------------------
+
+/**
+ * Runs a worker process for a map and collects its result.
+ *
+ * @param command: Command line of the worker (without the map argument)
+ * @param map_path: Map file to check
+ *
+ * @return Result reported by the worker (or the reason it failed)
+ *
+ */
+static GoldenResult run_worker(const std::string& command, const std::string& map_path) {
+
+    GoldenResult result;
+    result.map_path = map_path;
+
+    auto start = std::chrono::steady_clock::now();
+    std::string full_command = command + " --worker " + Utils::QuoteArg(map_path) + " 2>&1";
+#ifdef _WIN32
+    // cmd.exe strips the outermost quotes
+    full_command = "\"" + full_command + "\"";
+#endif
+    FILE* pipe = popen(full_command.c_str(), "r");
+    if (pipe == nullptr) {
+        result.error = "Could not start worker process";
+        return result;
+    }
+
+    // Keep the result line, every mismatch and the last error the worker logged
+    bool reported = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), pipe) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+        int ok = 0;
+        if (strncmp(line, GOLDEN_RESULT_PREFIX, strlen(GOLDEN_RESULT_PREFIX)) == 0 && sscanf(
+            line + strlen(GOLDEN_RESULT_PREFIX), "%d %u %u %u",
+            &ok, &result.num_artifacts, &result.num_failed, &result.num_updated
+        ) == 4) {
+            result.ok = ok != 0;
+            reported = true;
+        }
+        else if (strncmp(line, GOLDEN_FAIL_PREFIX, strlen(GOLDEN_FAIL_PREFIX)) == 0) {
+            result.failures.push_back(line + strlen(GOLDEN_FAIL_PREFIX));
+        }
+        else if (strncmp(line, "[ERROR]", 7) == 0) {
+            result.error = line + 7 + strspn(line + 7, " ");
+        }
+    }
+    int status = pclose(pipe);
+    result.total_ms = elapsed_ms(start);
+
+    // Workers that crash never report a result
+    if (!reported || (status != 0 && result.ok)) {
+        result.ok = false;
+        if (result.error.empty()) {
+            result.error = reported ? Utils::FormatString("Worker exited with status %d", status) : Utils::FormatString("Worker crashed (status %d)", status);
+        }
+    }
+    return result;
+}
+
+
+
+/**
+ * Prints the command-line usage.
+ */
+static void print_usage() {
+    printf(
+        "Usage: sotn_golden <disc image or directory> -g <golden dir> [options] [map ...]\n"
+        "\n"
+        "Decodes maps through the headless pipeline (VRAM, entity graphics, tiles, sprite parts, emulated entities\n"
+        "and room composites) and checks that the output is bit-exact with the stored goldens.\n"
+        "Also checks that rooms restored from the entity cache match rooms that were emulated, and that the entity\n"
+        "graphics survive recompression.\n"
+        "Maps are given by ID (e.g. NO0) or path, every map is checked if none are given.\n"
+        "\n"
+        "Options:\n"
+        "    -g <dir>        Directory holding the goldens\n"
+        "    --update        Write the goldens instead of checking them\n"
+        "    --images        Store the golden images too (needed for diff images, only with --update)\n"
+        "    -d <dir>        Where the actual and diff images of mismatches go (default: golden_diff)\n"
+        "    -j <count>      Number of maps checked in parallel (default: number of cores)\n"
+        "    -v              Show the log output of the workers\n"
+    );
+}
+
+
+
+/**
+ * Checks every requested map in its own worker process.
+ */
+int main(int argc, char** argv) {
+
+    // Parse arguments
+    std::string input;
+    std::string worker_map;
+    std::vector<std::string> map_names;
+    GoldenOptions options;
+    options.diff_dir = "golden_diff";
+    uint num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-g" && has_value) {
+            options.golden_dir = argv[++i];
+        }
+        else if (arg == "-d" && has_value) {
+            options.diff_dir = argv[++i];
+        }
+        else if (arg == "--update") {
+            options.update = true;
+        }
+        else if (arg == "--images") {
+            options.images = true;
+        }
+        else if (arg == "-j" && has_value) {
+            num_workers = std::max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "-v") {
+            verbose = true;
+        }
+        else if (arg == "--worker" && has_value) {
+            worker_map = argv[++i];
+        }
+        else if (arg[0] != '-') {
+            if (input.empty()) {
+                input = arg;
+            }
+            else {
+                map_names.push_back(arg);
+            }
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (input.empty() || options.golden_dir.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    // Only errors are needed to fill in the results
+    if (!verbose) {
+        Log::level = LOG_ERROR;
+    }
+
+    // Locate the game files
+    GameFiles files;
+    if (!GameLoader::FindFiles(input.c_str(), &files)) {
+        return 1;
+    }
+
+    // Worker: check a single map and report the result
+    if (!worker_map.empty()) {
+
+        // Flush every line so that errors reach the runner even if the worker crashes
+        setvbuf(stdout, nullptr, _IOLBF, 0);
+
+        GoldenResult result;
+        bool ok = check_map(files, worker_map, options, &result);
+        for (const std::string& failure : result.failures) {
+            printf("%s%s\n", GOLDEN_FAIL_PREFIX, failure.c_str());
+        }
+        printf("%s%d %u %u %u\n", GOLDEN_RESULT_PREFIX, ok ? 1 : 0, result.num_artifacts, result.num_failed, result.num_updated);
+        return ok ? 0 : 1;
+    }
+
+    // Pick out the requested maps
+    std::vector<std::string> maps;
+    for (const std::string& name : map_names) {
+        auto match = std::find_if(files.maps.begin(), files.maps.end(), [&name](const std::string& map_path) {
+            return map_path == name || Utils::toUpperCase(std::filesystem::path(map_path).stem().string()) == Utils::toUpperCase(name);
+        });
+        if (match == files.maps.end()) {
+            Log::Error("Map not found: %s\n", name.c_str());
+            return 1;
+        }
+        maps.push_back(*match);
+    }
+    if (map_names.empty()) {
+        maps = files.maps;
+    }
+    if (maps.empty()) {
+        Log::Error("No maps found in %s\n", input.c_str());
+        return 1;
+    }
+
+    // Boot once up front so every worker can restore the snapshot instead of booting on its own
+    auto run_start = std::chrono::steady_clock::now();
+    if (!GameLoader::BootEmulator(files)) {
+        return 1;
+    }
+
+    // Everything but the map is the same for every worker
+    std::error_code ec;
+    std::string self = argv[0];
+    if (self.find_first_of("/\\") != std::string::npos) {
+        self = std::filesystem::absolute(self, ec).string();
+    }
+    std::string command = Utils::QuoteArg(self) + " " + Utils::QuoteArg(input);
+    command.append(" -g " + Utils::QuoteArg(options.golden_dir) + " -d " + Utils::QuoteArg(options.diff_dir));
+    command.append(options.update ? " --update" : "");
+    command.append(options.images ? " --images" : "");
+    command.append(verbose ? " -v" : "");
+
+    // Hand out maps to the workers in order
+    num_workers = std::min<uint>(num_workers, maps.size());
+    std::vector<GoldenResult> results(maps.size());
+    std::atomic<size_t> next_map(0);
+    std::mutex print_mutex;
+    std::vector<std::thread> workers;
+    for (uint w = 0; w < num_workers; w++) {
+        workers.emplace_back([&] {
+            for (size_t i = next_map++; i < maps.size(); i = next_map++) {
+                results[i] = run_worker(command, maps[i]);
+                std::lock_guard<std::mutex> lock(print_mutex);
+                const GoldenResult& result = results[i];
+                if (!result.ok) {
+                    printf("[%3zu/%zu] %-40s FAILED: %s\n", i + 1, maps.size(), result.map_path.c_str(), result.error.c_str());
+                }
+                else if (options.update) {
+                    printf("[%3zu/%zu] %-40s %5u artifacts %5u updated %9.1f ms\n", i + 1, maps.size(), result.map_path.c_str(), result.num_artifacts, result.num_updated, result.total_ms);
+                }
+                else {
+                    printf("[%3zu/%zu] %-40s %5u artifacts %5u mismatched %9.1f ms\n", i + 1, maps.size(), result.map_path.c_str(), result.num_artifacts, result.num_failed, result.total_ms);
+                }
+                for (const std::string& failure : result.failures) {
+                    printf("    %s\n", failure.c_str());
+                }
+                fflush(stdout);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // Summarize
+    uint num_errors = 0;
+    uint num_mismatched = 0;
+    uint num_artifacts = 0;
+    for (const GoldenResult& result : results) {
+        num_errors += !result.ok;
+        num_mismatched += (result.ok && result.num_failed > 0);
+        num_artifacts += result.num_artifacts;
+    }
+    if (options.update) {
+        printf("Goldens of %zu maps written to %s (%u artifacts, %u failed) in %.1f ms\n", maps.size() - num_errors, options.golden_dir.c_str(), num_artifacts, num_errors, elapsed_ms(run_start));
+    }
+    else {
+        printf("%zu maps match, %u mismatched, %u failed (%u artifacts) in %.1f ms\n", maps.size() - num_errors - num_mismatched, num_mismatched, num_errors, num_artifacts, elapsed_ms(run_start));
+        if (num_mismatched > 0) {
+            printf("Actual and diff images written to %s\n", options.diff_dir.c_str());
+        }
+    }
+
+    return (num_errors == 0 && num_mismatched == 0) ? 0 : 1;
+}
@@ -0,0 +1,1273 @@
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "common.h"
+#include "gpu.h"
+#include "log.h"
+#include "utils.h"
+
+
+
+/**
+ * Creates an emulated GPU with blank VRAM.
+ *
+ */
+GpuEmulator::GpuEmulator() {
+    Reset();
+}
+
+
+
+/**
+ * Clears VRAM, the drawing environment and any queued primitives.
+ *
+ */
+void GpuEmulator::Reset() {
+    vram.assign(GPU_VRAM_WIDTH * GPU_VRAM_HEIGHT, 0);
+    state = GpuDrawState();
+    pending.clear();
+    num_primitives = 0;
+}
+
+
+
+/**
+ * Copies RGB1555 values into VRAM (same as LoadImage() from libgpu).
+ *
+ * @param rect: Area of VRAM to write (wraps around the edges of VRAM)
+ * @param src: RGB1555 values to write (rect->w * rect->h)
+ *
+ */
+void GpuEmulator::LoadImage(const RECT* rect, const ushort* src) {
+
+    Flush();
+    for (int y = 0; y < rect->h; y++) {
+        for (int x = 0; x < rect->w; x++) {
+            vram[(((rect->y + y) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH) + ((rect->x + x) & (GPU_VRAM_WIDTH - 1))] = src[(y * rect->w) + x];
+        }
+    }
+}
+
+
+
+/**
+ * Copies pixels in the editor's VRAM texture format (one RGBA pixel per VRAM word) into VRAM.
+ *
+ * @param rect: Area of VRAM to write (wraps around the edges of VRAM)
+ * @param src: RGBA pixels to write (rect->w * rect->h)
+ *
+ */
+void GpuEmulator::LoadRGBA(const RECT* rect, const byte* src) {
+
+    Flush();
+    for (int y = 0; y < rect->h; y++) {
+        for (int x = 0; x < rect->w; x++) {
+            uint color;
+            memcpy(&color, src + (((y * rect->w) + x) * 4), sizeof(uint));
+            vram[(((rect->y + y) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH) + ((rect->x + x) & (GPU_VRAM_WIDTH - 1))] = Utils::RGBA_to_RGB1555(color);
+        }
+    }
+}
+
+
+
+/**
+ * Copies RGB1555 values out of VRAM (same as StoreImage() from libgpu).
+ *
+ * @param rect: Area of VRAM to read (wraps around the edges of VRAM)
+ * @param dst: Buffer where the RGB1555 values should be written (rect->w * rect->h)
+ *
+ * @note Queued primitives are rasterized first.
+ *
+ */
+void GpuEmulator::StoreImage(const RECT* rect, ushort* dst) {
+
+    Flush();
+    for (int y = 0; y < rect->h; y++) {
+        for (int x = 0; x < rect->w; x++) {
+            dst[(y * rect->w) + x] = vram[(((rect->y + y) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH) + ((rect->x + x) & (GPU_VRAM_WIDTH - 1))];
+        }
+    }
+}
+
+
+
+/**
+ * Copies pixels out of VRAM in the editor's VRAM texture format (one RGBA pixel per VRAM word).
+ *
+ * @param rect: Area of VRAM to read (wraps around the edges of VRAM)
+ * @param dst: Buffer where the RGBA pixels should be written (rect->w * rect->h * 4 bytes)
+ *
+ * @note Queued primitives are rasterized first.
+ *
+ */
+void GpuEmulator::GetRGBA(const RECT* rect, byte* dst) {
+
+    Flush();
+    for (int y = 0; y < rect->h; y++) {
+        for (int x = 0; x < rect->w; x++) {
+            uint color = Utils::RGB1555_to_RGBA(vram[(((rect->y + y) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH) + ((rect->x + x) & (GPU_VRAM_WIDTH - 1))]);
+            byte* pixel = dst + (((y * rect->w) + x) * 4);
+            pixel[0] = (byte)(color >> 24);
+            pixel[1] = (byte)(color >> 16);
+            pixel[2] = (byte)(color >> 8);
+            pixel[3] = (byte)(color);
+        }
+    }
+}
+
+
+
+/**
+ * Processes a series of GP0 commands (primitives, VRAM transfers and drawing environment changes).
+ *
+ * @param words: Command words
+ * @param num_words: Number of command words
+ *
+ * @return Number of words processed (a command cut off by the end of the buffer is dropped)
+ *
+ * @note Primitives are only queued, call Flush() to rasterize them.
+ *
+ */
+uint GpuEmulator::WriteCommands(const uint* words, uint num_words) {
+
+    uint pos = 0;
+    while (pos < num_words) {
+        uint size = GetCommandSize(words + pos, num_words - pos);
+        if (size == 0 || pos + size > num_words) {
+            break;
+        }
+        ExecuteCommand(words + pos, size);
+        pos += size;
+    }
+    return pos;
+}
+
+
+
+/**
+ * Walks an ordering table or any other linked packet list and draws every packet in it (same as DrawOTag() from libgpu).
+ *
+ * @param ram: Contents of main RAM
+ * @param num_bytes: Size of main RAM
+ * @param addr: Address of the first packet (24-bit physical or KSEG0)
+ *
+ * @return Number of packets processed
+ *
+ * @note Each packet starts with a tag holding the number of command words (bits 24-31) and the address of the next
+ *       packet (bits 0-23). The list ends at a tag pointing to GPU_LIST_END.
+ *
+ */
+uint GpuEmulator::DrawOTag(const byte* ram, uint num_bytes, uint addr) {
+
+    uint words[256];
+    uint num_packets = 0;
+    addr &= GPU_LIST_END;
+    while (addr != GPU_LIST_END) {
+
+        // Make sure the packet is within RAM
+        uint tag;
+        if (addr + sizeof(uint) > num_bytes) {
+            Log::Warn("GPU packet list points outside of RAM (0x%06X)\n", addr);
+            break;
+        }
+        memcpy(&tag, ram + addr, sizeof(uint));
+        uint num_words = tag >> 24;
+        if (addr + sizeof(uint) + (num_words * sizeof(uint)) > num_bytes) {
+            Log::Warn("GPU packet at 0x%06X runs past the end of RAM\n", addr);
+            break;
+        }
+
+        // Process the packet's commands
+        if (num_words > 0) {
+            memcpy(words, ram + addr + sizeof(uint), num_words * sizeof(uint));
+            WriteCommands(words, num_words);
+        }
+
+        // Bail if the list loops back on itself
+        if (++num_packets >= GPU_MAX_PACKETS) {
+            Log::Warn("GPU packet list at 0x%06X did not end after %u packets\n", addr, num_packets);
+            break;
+        }
+        addr = tag & GPU_LIST_END;
+    }
+    Flush();
+    return num_packets;
+}
+
+
+
+/**
+ * Draws a chain of SotN polygons the way the game's renderer turns them into GPU packets.
+ *
+ * @param ram: Contents of main RAM
+ * @param num_bytes: Size of main RAM
+ * @param addr: KSEG0 address of the first polygon (e.g. an entity's polygon pointer)
+ * @param first_layer: Lowest ordering table layer (SOTN_POLYGON::ot_layer) of the polygons to draw
+ * @param end_layer: Ordering table layer past the highest one to draw
+ *
+ * @return Number of polygons drawn
+ *
+ * @note Hidden polygons (SOTN_DRAW_HIDE) are skipped, DR_ENV polygons update the drawing environment whatever their
+ *       layer. CLUT indices are translated through the CLUT table at CLUT_INDEX_ADDR.
+ *
+ */
+uint GpuEmulator::DrawPrimitives(const byte* ram, uint num_bytes, uint addr, uint first_layer, uint end_layer) {
+
+    // Vertex of a polygon (position relative to the drawing offset)
+    auto make_vertex = [&](byte r, byte g, byte b, short x, short y, byte u, byte v) {
+        GpuVertex vertex;
+        SetVertex(&vertex, r | (g << 8) | (b << 16), (ushort)x | ((uint)(ushort)y << 16));
+        vertex.u = u;
+        vertex.v = v;
+        return vertex;
+    };
+
+    uint num_drawn = 0;
+    for (uint i = 0; i < GPU_MAX_PACKETS; i++) {
+
+        // Bail if the polygon address is invalid
+        if (addr < RAM_BASE_OFFSET || addr - RAM_BASE_OFFSET + sizeof(SOTN_POLYGON) > num_bytes) {
+            break;
+        }
+        SOTN_POLYGON polygon;
+        memcpy(&polygon, ram + (addr - RAM_BASE_OFFSET), sizeof(SOTN_POLYGON));
+
+        // Skip polygons that aren't drawn (or belong to other layers)
+        auto polygon_type = SOTN_PRIM_TYPES.find(polygon.code);
+        bool drawn = (polygon_type != SOTN_PRIM_TYPES.end() && (polygon.pad3 & SOTN_DRAW_HIDE) == 0);
+        if (drawn && (polygon_type->second == PRIM_TYPE_DRENV || (polygon.ot_layer >= first_layer && polygon.ot_layer < end_layer))) {
+
+            bool semi_transparent = (polygon.pad3 & SOTN_DRAW_TRANSP) != 0;
+            bool raw_texture = (polygon.pad3 & SOTN_DRAW_COLORS) == 0;
+            ushort texpage = polygon.tpage | (polygon.pad3 & SOTN_DRAW_BLEND);
+
+            // Get the CLUT attribute the polygon's CLUT index refers to
+            ushort clut = 0;
+            if (CLUT_INDEX_ADDR + (polygon.clut * 2) + sizeof(ushort) <= num_bytes) {
+                memcpy(&clut, ram + CLUT_INDEX_ADDR + (polygon.clut * 2), sizeof(ushort));
+            }
+
+            GpuVertex vertices[4] = {
+                make_vertex(polygon.r0, polygon.g0, polygon.b0, polygon.x0, polygon.y0, polygon.u0, polygon.v0),
+                make_vertex(polygon.r1, polygon.g1, polygon.b1, polygon.x1, polygon.y1, polygon.u1, polygon.v1),
+                make_vertex(polygon.r2, polygon.g2, polygon.b2, polygon.x2, polygon.y2, polygon.u2, polygon.v2),
+                make_vertex(polygon.r3, polygon.g3, polygon.b3, polygon.x3, polygon.y3, polygon.u3, polygon.v3)
+            };
+
+            switch (polygon_type->second) {
+
+                case PRIM_TYPE_TILE:
+                    state.texpage = (state.texpage & ~SOTN_DRAW_BLEND) | (polygon.pad3 & SOTN_DRAW_BLEND);
+                    QueueRect(vertices[0], polygon.tile_width, polygon.tile_height, false, semi_transparent, false, 0);
+                    break;
+
+                case PRIM_TYPE_SPRT:
+                    state.texpage = (state.texpage & ~0x1FF) | (texpage & 0x1FF);
+                    QueueRect(vertices[0], polygon.sprt_width, polygon.sprt_height, true, semi_transparent, raw_texture, clut);
+                    break;
+
+                case PRIM_TYPE_LINEG2:
+                    state.texpage = (state.texpage & ~SOTN_DRAW_BLEND) | (polygon.pad3 & SOTN_DRAW_BLEND);
+                    QueueLine(vertices[0], vertices[1], true, semi_transparent);
+                    break;
+
+                case PRIM_TYPE_POLYG4:
+                    state.texpage = (state.texpage & ~SOTN_DRAW_BLEND) | (polygon.pad3 & SOTN_DRAW_BLEND);
+                    QueuePolygon(vertices, 4, false, true, semi_transparent, false, 0, state.texpage);
+                    break;
+
+                case PRIM_TYPE_POLYGT4:
+                    state.texpage = (state.texpage & ~0x1FF) | (texpage & 0x1FF);
+                    QueuePolygon(vertices, 4, true, true, semi_transparent, raw_texture, clut, texpage);
+                    break;
+
+                case PRIM_TYPE_POLYGT3:
+                    state.texpage = (state.texpage & ~0x1FF) | (texpage & 0x1FF);
+                    QueuePolygon(vertices, 3, true, true, semi_transparent, raw_texture, clut, texpage);
+                    break;
+
+                case PRIM_TYPE_DRENV:
+                    if (polygon.drenv_addr >= RAM_BASE_OFFSET && polygon.drenv_addr - RAM_BASE_OFFSET + sizeof(DR_ENV) <= num_bytes) {
+                        DR_ENV dr_env;
+                        memcpy(&dr_env, ram + (polygon.drenv_addr - RAM_BASE_OFFSET), sizeof(DR_ENV));
+                        WriteCommands(dr_env.code, std::min<uint>(dr_env.tag >> 24, 15));
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            num_drawn++;
+        }
+
+        // Bail if tag is zero
+        if (polygon.tag == 0) {
+            break;
+        }
+        addr = polygon.tag;
+    }
+    Flush();
+    return num_drawn;
+}
+
+
+
+/**
+ * Rasterizes every queued primitive into VRAM (or the offscreen target).
+ *
+ * @note Large batches are split into bands of rows that are rasterized on worker threads. Every band draws the whole
+ *       batch in order (clipped to its rows), so the result matches a single pass unless a primitive samples a
+ *       texture or CLUT from an area the batch draws to. Such batches are rasterized in a single pass.
+ *
+ */
+void GpuEmulator::Flush() {
+
+    if (pending.empty()) {
+        return;
+    }
+
+    // Find the area the batch draws to
+    int surface_height = (target != nullptr ? target->height : GPU_VRAM_HEIGHT);
+    int draw_left = (target != nullptr ? target->width : GPU_VRAM_WIDTH);
+    int draw_top = surface_height;
+    int draw_right = -1;
+    int draw_bottom = -1;
+    uint num_pixels = 0;
+    for (const auto& prim : pending) {
+        int left, top, right, bottom;
+        if (GetBounds(prim, &left, &top, &right, &bottom)) {
+            draw_left = std::min(draw_left, left);
+            draw_top = std::min(draw_top, top);
+            draw_right = std::max(draw_right, right);
+            draw_bottom = std::max(draw_bottom, bottom);
+            num_pixels += (right - left + 1) * (bottom - top + 1);
+        }
+    }
+
+    // Check whether any primitive reads from the area being drawn to (never the case for offscreen targets)
+    bool overlaps = false;
+    for (const auto& prim : pending) {
+        if (!prim.textured || target != nullptr) {
+            continue;
+        }
+        uint tex_mode = (prim.texpage >> 7) & 3;
+        int page_left = (prim.texpage & 0xF) * 64;
+        int page_top = ((prim.texpage >> 4) & 1) * 256;
+        int page_right = page_left + (tex_mode == 0 ? 64 : (tex_mode == 1 ? 128 : 256)) - 1;
+        int clut_left = (prim.clut & 0x3F) * 16;
+        int clut_top = (prim.clut >> 6) & 0x1FF;
+        int clut_right = clut_left + (tex_mode == 0 ? 16 : 256) - 1;
+        if ((page_left <= draw_right && page_right >= draw_left && page_top <= draw_bottom && page_top + 255 >= draw_top) ||
+            (tex_mode < 2 && clut_left <= draw_right && clut_right >= draw_left && clut_top <= draw_bottom && clut_top >= draw_top)) {
+            overlaps = true;
+            break;
+        }
+    }
+
+    // Rasterize small or self-referencing batches in a single pass
+    if (overlaps || num_pixels < GPU_MIN_THREADED_PIXELS) {
+        for (const auto& prim : pending) {
+            Rasterize(prim, 0, surface_height - 1);
+        }
+    }
+
+    // Otherwise split the rows between worker threads
+    else {
+        uint first_band = draw_top / GPU_BAND_HEIGHT;
+        uint num_bands = (draw_bottom / GPU_BAND_HEIGHT) - first_band + 1;
+        std::atomic<uint> next_band(0);
+        auto raster_worker = [&] {
+            for (uint i = next_band++; i < num_bands; i = next_band++) {
+                int band_top = (first_band + i) * GPU_BAND_HEIGHT;
+                for (const auto& prim : pending) {
+                    Rasterize(prim, band_top, band_top + GPU_BAND_HEIGHT - 1);
+                }
+            }
+        };
+        uint num_threads = std::min<uint>(std::max(1u, std::thread::hardware_concurrency()), num_bands);
+        std::vector<std::thread> raster_threads;
+        for (uint i = 1; i < num_threads; i++) {
+            raster_threads.emplace_back(raster_worker);
+        }
+        raster_worker();
+        for (auto& thread : raster_threads) {
+            thread.join();
+        }
+    }
+    num_primitives += pending.size();
+    pending.clear();
+}
+
+
+
+/**
+ * Gets the number of words a GP0 command takes up.
+ *
+ * @param words: Command words (starting with the command)
+ * @param num_words: Number of words available
+ *
+ * @return Number of words in the command
+ *
+ */
+uint GpuEmulator::GetCommandSize(const uint* words, uint num_words) {
+
+    uint cmd = words[0] >> 24;
+
+    // Polygons (color, then position, UV and color per vertex)
+    if (cmd >= 0x20 && cmd < 0x40) {
+        uint num_vertices = (cmd & 0x08) ? 4 : 3;
+        uint size = 1 + (num_vertices * ((cmd & 0x04) ? 2 : 1));
+        if (cmd & 0x10) {
+            size += num_vertices - 1;
+        }
+        return size;
+    }
+
+    // Lines (polylines end at a 0x5XXX5XXX terminator)
+    if (cmd >= 0x40 && cmd < 0x60) {
+        if ((cmd & 0x08) == 0) {
+            return (cmd & 0x10) ? 4 : 3;
+        }
+        for (uint i = 3; i < num_words; i++) {
+            if ((words[i] & 0xF000F000) == 0x50005000) {
+                return i + 1;
+            }
+        }
+        return num_words;
+    }
+
+    // Rectangles (color, position, UV and size if variable)
+    if (cmd >= 0x60 && cmd < 0x80) {
+        return 2 + ((cmd & 0x04) ? 1 : 0) + (((cmd >> 3) & 3) == 0 ? 1 : 0);
+    }
+
+    // VRAM transfers
+    if (cmd >= 0x80 && cmd < 0xA0) {
+        return 4;
+    }
+    if (cmd >= 0xA0 && cmd < 0xC0) {
+        if (num_words < 3) {
+            return 3;
+        }
+        uint width = (((words[2] & 0xFFFF) - 1) & (GPU_VRAM_WIDTH - 1)) + 1;
+        uint height = (((words[2] >> 16) - 1) & (GPU_VRAM_HEIGHT - 1)) + 1;
+        return 3 + (((width * height) + 1) / 2);
+    }
+    if (cmd >= 0xC0 && cmd < 0xE0) {
+        return 3;
+    }
+
+    // Fill rectangle
+    if (cmd == 0x02) {
+        return 3;
+    }
+
+    // Environment commands and NOPs
+    return 1;
+}
+
+
+
+/**
+ * Executes a single GP0 command.
+ *
+ * @param words: Command words (as many as GetCommandSize() returned)
+ * @param num_words: Number of command words
+ *
+ */
+void GpuEmulator::ExecuteCommand(const uint* words, uint num_words) {
+
+    uint cmd = words[0] >> 24;
+
+    // Fill rectangle
+    if (cmd == 0x02) {
+        QueueFill(words[0] & 0xFFFFFF, words[1] & 0xFFFF, words[1] >> 16, words[2] & 0xFFFF, words[2] >> 16);
+    }
+
+    // Polygons
+    else if (cmd >= 0x20 && cmd < 0x40) {
+
+        bool gouraud = (cmd & 0x10) != 0;
+        bool textured = (cmd & 0x04) != 0;
+        uint num_vertices = (cmd & 0x08) ? 4 : 3;
+        GpuVertex vertices[4];
+        ushort clut = 0;
+        ushort texpage = state.texpage;
+        uint color = words[0];
+        uint pos = 1;
+        for (uint i = 0; i < num_vertices; i++) {
+            if (gouraud && i > 0) {
+                color = words[pos++];
+            }
+            SetVertex(&vertices[i], color, words[pos++]);
+            if (textured) {
+                uint uv = words[pos++];
+                vertices[i].u = uv & 0xFF;
+                vertices[i].v = (uv >> 8) & 0xFF;
+                if (i == 0) {
+                    clut = uv >> 16;
+                }
+                else if (i == 1) {
+                    texpage = uv >> 16;
+                }
+            }
+        }
+
+        // Textured polygons also change the current texture page
+        if (textured) {
+            state.texpage = (state.texpage & ~0x1FF) | (texpage & 0x1FF);
+        }
+        QueuePolygon(vertices, num_vertices, textured, gouraud, (cmd & 0x02) != 0, (cmd & 0x01) != 0, clut, state.texpage);
+    }
+
+    // Lines
+    else if (cmd >= 0x40 && cmd < 0x60) {
+
+        bool gouraud = (cmd & 0x10) != 0;
+        bool polyline = (cmd & 0x08) != 0;
+        uint color = words[0];
+        GpuVertex start;
+        SetVertex(&start, color, words[1]);
+        uint pos = 2;
+        while (pos < num_words && !(polyline && (words[pos] & 0xF000F000) == 0x50005000)) {
+            if (gouraud) {
+                color = words[pos++];
+                if (pos >= num_words || (polyline && (words[pos] & 0xF000F000) == 0x50005000)) {
+                    break;
+                }
+            }
+            GpuVertex end;
+            SetVertex(&end, color, words[pos++]);
+            QueueLine(start, end, gouraud, (cmd & 0x02) != 0);
+            if (!polyline) {
+                break;
+            }
+            start = end;
+        }
+    }
+
+    // Rectangles
+    else if (cmd >= 0x60 && cmd < 0x80) {
+
+        bool textured = (cmd & 0x04) != 0;
+        GpuVertex vertex;
+        SetVertex(&vertex, words[0], words[1]);
+        ushort clut = 0;
+        uint pos = 2;
+        if (textured) {
+            uint uv = words[pos++];
+            vertex.u = uv & 0xFF;
+            vertex.v = (uv >> 8) & 0xFF;
+            clut = uv >> 16;
+        }
+        uint width = 0;
+        uint height = 0;
+        switch ((cmd >> 3) & 3) {
+            case 0:
+                width = words[pos] & 0x3FF;
+                height = (words[pos] >> 16) & 0x1FF;
+                break;
+            case 1:
+                width = height = 1;
+                break;
+            case 2:
+                width = height = 8;
+                break;
+            case 3:
+                width = height = 16;
+                break;
+        }
+        QueueRect(vertex, width, height, textured, (cmd & 0x02) != 0, (cmd & 0x01) != 0, clut);
+    }
+
+    // VRAM to VRAM copy
+    else if (cmd >= 0x80 && cmd < 0xA0) {
+        CopyRect(words[1] & 0xFFFF, words[1] >> 16, words[2] & 0xFFFF, words[2] >> 16, words[3] & 0xFFFF, words[3] >> 16);
+    }
+
+    // CPU to VRAM transfer
+    else if (cmd >= 0xA0 && cmd < 0xC0) {
+        Flush();
+        uint x = words[1] & (GPU_VRAM_WIDTH - 1);
+        uint y = (words[1] >> 16) & (GPU_VRAM_HEIGHT - 1);
+        uint width = (((words[2] & 0xFFFF) - 1) & (GPU_VRAM_WIDTH - 1)) + 1;
+        uint height = (((words[2] >> 16) - 1) & (GPU_VRAM_HEIGHT - 1)) + 1;
+        for (uint i = 0; i < width * height && 3 + (i / 2) < num_words; i++) {
+            ushort* dst = &vram[(((y + (i / width)) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH) + ((x + (i % width)) & (GPU_VRAM_WIDTH - 1))];
+            if (state.check_mask && (*dst & 0x8000)) {
+                continue;
+            }
+            *dst = (ushort)(words[3 + (i / 2)] >> ((i & 1) * 16)) | (state.set_mask ? 0x8000 : 0);
+        }
+    }
+
+    // Draw mode (texture page and rectangle flipping)
+    else if (cmd == 0xE1) {
+        state.texpage = words[0] & 0x7FF;
+        state.flip_x = (words[0] & 0x1000) != 0;
+        state.flip_y = (words[0] & 0x2000) != 0;
+    }
+
+    // Texture window
+    else if (cmd == 0xE2) {
+        state.tw_mask_x = words[0] & 0x1F;
+        state.tw_mask_y = (words[0] >> 5) & 0x1F;
+        state.tw_offset_x = (words[0] >> 10) & 0x1F;
+        state.tw_offset_y = (words[0] >> 15) & 0x1F;
+    }
+
+    // Drawing area
+    else if (cmd == 0xE3) {
+        state.clip_left = words[0] & 0x3FF;
+        state.clip_top = (words[0] >> 10) & 0x1FF;
+    }
+    else if (cmd == 0xE4) {
+        state.clip_right = words[0] & 0x3FF;
+        state.clip_bottom = (words[0] >> 10) & 0x1FF;
+    }
+
+    // Drawing offset (signed 11-bit values)
+    else if (cmd == 0xE5) {
+        state.offset_x = ((int)(words[0] << 21)) >> 21;
+        state.offset_y = ((int)(words[0] << 10)) >> 21;
+    }
+
+    // Mask bit settings
+    else if (cmd == 0xE6) {
+        state.set_mask = (words[0] & 1) != 0;
+        state.check_mask = (words[0] & 2) != 0;
+    }
+}
+
+
+
+/**
+ * Fills in a vertex from GP0 color and position words.
+ *
+ * @param vertex: Vertex to fill in
+ * @param color: 24-bit color (red in bits 0-7)
+ * @param position: Signed 11-bit X (bits 0-10) and Y (bits 16-26) relative to the drawing offset
+ *
+ * @note The drawing offset only applies to VRAM, positions are used as they are when drawing into a target.
+ *
+ */
+void GpuEmulator::SetVertex(GpuVertex* vertex, uint color, uint position) {
+    vertex->r = color & 0xFF;
+    vertex->g = (color >> 8) & 0xFF;
+    vertex->b = (color >> 16) & 0xFF;
+    vertex->x = (((int)(position << 21)) >> 21) + (target != nullptr ? 0 : state.offset_x);
+    vertex->y = (((int)(position << 5)) >> 21) + (target != nullptr ? 0 : state.offset_y);
+}
+
+
+
+/**
+ * Queues a triangle or a quad (split into two triangles).
+ *
+ * @param vertices: Corners of the polygon (quads are ordered top-left, top-right, bottom-left, bottom-right)
+ * @param num_vertices: 3 or 4
+ * @param textured: Whether the polygon samples a texture
+ * @param gouraud: Whether colors are interpolated between the vertices
+ * @param semi_transparent: Whether the polygon is blended with VRAM
+ * @param raw_texture: Whether texels are drawn without being modulated by the vertex colors
+ * @param clut: CLUT attribute of the texture
+ * @param texpage: Texture page attribute (also holds the blend rate)
+ *
+ * @note Triangles wider than 1023 or taller than 511 pixels are dropped, same as on hardware.
+ *
+ */
+void GpuEmulator::QueuePolygon(const GpuVertex* vertices, uint num_vertices, bool textured, bool gouraud, bool semi_transparent, bool raw_texture, ushort clut, ushort texpage) {
+
+    for (uint i = 0; i + 2 < num_vertices; i++) {
+
+        const GpuVertex* corners = vertices + i;
+        int min_x = std::min({corners[0].x, corners[1].x, corners[2].x});
+        int max_x = std::max({corners[0].x, corners[1].x, corners[2].x});
+        int min_y = std::min({corners[0].y, corners[1].y, corners[2].y});
+        int max_y = std::max({corners[0].y, corners[1].y, corners[2].y});
+        if (max_x - min_x > 1023 || max_y - min_y > 511) {
+            continue;
+        }
+
+        GpuPrimitive prim;
+        prim.type = GPU_PRIM_TRIANGLE;
+        prim.vertices[0] = corners[0];
+        prim.vertices[1] = corners[1];
+        prim.vertices[2] = corners[2];
+        prim.textured = textured;
+        prim.gouraud = gouraud;
+        prim.semi_transparent = semi_transparent;
+        prim.raw_texture = raw_texture;
+        prim.clut = clut;
+        prim.texpage = texpage;
+        prim.state = state;
+        pending.push_back(prim);
+    }
+}
+
+
+
+/**
+ * Queues a rectangle (sprite or tile) drawn with the current texture page and flipping.
+ *
+ * @param vertex: Top-left corner (UV is the texture coordinate of that corner)
+ * @param width: Width of the rectangle
+ * @param height: Height of the rectangle
+ * @param textured: Whether the rectangle samples a texture
+ * @param semi_transparent: Whether the rectangle is blended with VRAM
+ * @param raw_texture: Whether texels are drawn without being modulated by the color
+ * @param clut: CLUT attribute of the texture
+ *
+ */
+void GpuEmulator::QueueRect(const GpuVertex& vertex, uint width, uint height, bool textured, bool semi_transparent, bool raw_texture, ushort clut) {
+
+    if (width == 0 || height == 0) {
+        return;
+    }
+    GpuPrimitive prim;
+    prim.type = GPU_PRIM_RECT;
+    prim.vertices[0] = vertex;
+    prim.width = width;
+    prim.height = height;
+    prim.textured = textured;
+    prim.semi_transparent = semi_transparent;
+    prim.raw_texture = raw_texture;
+    prim.clut = clut;
+    prim.texpage = state.texpage;
+    prim.state = state;
+    pending.push_back(prim);
+}
+
+
+
+/**
+ * Queues a line (both end points are drawn).
+ *
+ * @param start: First end point
+ * @param end: Second end point
+ * @param gouraud: Whether colors are interpolated between the end points
+ * @param semi_transparent: Whether the line is blended with VRAM
+ *
+ */
+void GpuEmulator::QueueLine(const GpuVertex& start, const GpuVertex& end, bool gouraud, bool semi_transparent) {
+
+    if (abs(end.x - start.x) > 1023 || abs(end.y - start.y) > 511) {
+        return;
+    }
+    GpuPrimitive prim;
+    prim.type = GPU_PRIM_LINE;
+    prim.vertices[0] = start;
+    prim.vertices[1] = end;
+    prim.gouraud = gouraud;
+    prim.semi_transparent = semi_transparent;
+    prim.texpage = state.texpage;
+    prim.state = state;
+    pending.push_back(prim);
+}
+
+
+
+/**
+ * Queues a fill of a VRAM area (ignores the drawing area, offset and mask settings).
+ *
+ * @param color: 24-bit fill color (red in bits 0-7)
+ * @param x: Left edge of the area (rounded down to 16 pixels)
+ * @param y: Top edge of the area
+ * @param width: Width of the area (rounded up to 16 pixels)
+ * @param height: Height of the area
+ *
+ */
+void GpuEmulator::QueueFill(uint color, uint x, uint y, uint width, uint height) {
+
+    GpuPrimitive prim;
+    prim.type = GPU_PRIM_FILL;
+    SetVertex(&prim.vertices[0], color, 0);
+    prim.vertices[0].x = x & 0x3F0;
+    prim.vertices[0].y = y & (GPU_VRAM_HEIGHT - 1);
+    prim.width = ((width & 0x3FF) + 15) & ~15;
+    prim.height = height & (GPU_VRAM_HEIGHT - 1);
+    prim.state = state;
+    if (prim.width > 0 && prim.height > 0) {
+        pending.push_back(prim);
+    }
+}
+
+
+
+/**
+ * Copies an area of VRAM to another (queued primitives are rasterized first).
+ *
+ * @param src_x: Left edge of the source area
+ * @param src_y: Top edge of the source area
+ * @param dst_x: Left edge of the destination area
+ * @param dst_y: Top edge of the destination area
+ * @param width: Width of the area (0 means 1024)
+ * @param height: Height of the area (0 means 512)
+ *
+ */
+void GpuEmulator::CopyRect(uint src_x, uint src_y, uint dst_x, uint dst_y, uint width, uint height) {
+
+    Flush();
+    width = ((width - 1) & (GPU_VRAM_WIDTH - 1)) + 1;
+    height = ((height - 1) & (GPU_VRAM_HEIGHT - 1)) + 1;
+    std::vector<ushort> row(width);
+    for (uint y = 0; y < height; y++) {
+        uint src_row = ((src_y + y) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH;
+        uint dst_row = ((dst_y + y) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH;
+        for (uint x = 0; x < width; x++) {
+            row[x] = vram[src_row + ((src_x + x) & (GPU_VRAM_WIDTH - 1))];
+        }
+        for (uint x = 0; x < width; x++) {
+            ushort* dst = &vram[dst_row + ((dst_x + x) & (GPU_VRAM_WIDTH - 1))];
+            if (!(state.check_mask && (*dst & 0x8000))) {
+                *dst = row[x] | (state.set_mask ? 0x8000 : 0);
+            }
+        }
+    }
+}
+
+
+
+/**
+ * Gets the area of VRAM a primitive draws to.
+ *
+ * @param prim: Primitive to check
+ * @param left: Where the left edge should be written (inclusive)
+ * @param top: Where the top edge should be written (inclusive)
+ * @param right: Where the right edge should be written (inclusive)
+ * @param bottom: Where the bottom edge should be written (inclusive)
+ *
+ * @return Whether the primitive draws anything within the drawing area
+ *
+ * @note Offscreen targets are drawn to as a whole (ignoring the drawing area) and never filled.
+ *
+ */
+bool GpuEmulator::GetBounds(const GpuPrimitive& prim, int* left, int* top, int* right, int* bottom) {
+
+    const GpuVertex* vertices = prim.vertices;
+    switch (prim.type) {
+        case GPU_PRIM_TRIANGLE:
+            *left = std::min({vertices[0].x, vertices[1].x, vertices[2].x});
+            *top = std::min({vertices[0].y, vertices[1].y, vertices[2].y});
+            *right = std::max({vertices[0].x, vertices[1].x, vertices[2].x});
+            *bottom = std::max({vertices[0].y, vertices[1].y, vertices[2].y});
+            break;
+        case GPU_PRIM_LINE:
+            *left = std::min(vertices[0].x, vertices[1].x);
+            *top = std::min(vertices[0].y, vertices[1].y);
+            *right = std::max(vertices[0].x, vertices[1].x);
+            *bottom = std::max(vertices[0].y, vertices[1].y);
+            break;
+        default:
+            *left = vertices[0].x;
+            *top = vertices[0].y;
+            *right = vertices[0].x + prim.width - 1;
+            *bottom = vertices[0].y + prim.height - 1;
+            break;
+    }
+
+    // Targets only stop at their edges
+    if (target != nullptr) {
+        if (prim.type == GPU_PRIM_FILL) {
+            return false;
+        }
+        *left = std::max(*left, 0);
+        *top = std::max(*top, 0);
+        *right = std::min(*right, (int)target->width - 1);
+        *bottom = std::min(*bottom, (int)target->height - 1);
+    }
+
+    // Fills only stop at the edges of VRAM, everything else stops at the drawing area
+    else if (prim.type == GPU_PRIM_FILL) {
+        *right = std::min(*right, (int)GPU_VRAM_WIDTH - 1);
+        *bottom = std::min(*bottom, (int)GPU_VRAM_HEIGHT - 1);
+    }
+    else {
+        *left = std::max(*left, prim.state.clip_left);
+        *top = std::max(*top, prim.state.clip_top);
+        *right = std::min({*right, prim.state.clip_right, (int)GPU_VRAM_WIDTH - 1});
+        *bottom = std::min({*bottom, prim.state.clip_bottom, (int)GPU_VRAM_HEIGHT - 1});
+        *left = std::max(*left, 0);
+        *top = std::max(*top, 0);
+    }
+    return *left <= *right && *top <= *bottom;
+}
+
+
+
+/**
+ * Rasterizes a primitive within a range of rows.
+ *
+ * @param prim: Primitive to draw
+ * @param band_top: First row that may be written
+ * @param band_bottom: Last row that may be written
+ *
+ */
+void GpuEmulator::Rasterize(const GpuPrimitive& prim, int band_top, int band_bottom) {
+
+    switch (prim.type) {
+        case GPU_PRIM_TRIANGLE:
+            DrawTriangle(prim, band_top, band_bottom);
+            break;
+        case GPU_PRIM_RECT:
+            DrawRect(prim, band_top, band_bottom);
+            break;
+        case GPU_PRIM_LINE:
+            DrawLine(prim, band_top, band_bottom);
+            break;
+        case GPU_PRIM_FILL:
+            DrawFill(prim, band_top, band_bottom);
+            break;
+    }
+}
+
+
+
+/**
+ * Rasterizes a triangle within a range of rows.
+ *
+ * @param prim: Triangle to draw
+ * @param band_top: First row that may be written
+ * @param band_bottom: Last row that may be written
+ *
+ * @note Pixels on a shared edge are only drawn by one triangle (top-left fill rule), so the two halves of a quad
+ *       don't overlap. Dithering isn't emulated.
+ *
+ */
+void GpuEmulator::DrawTriangle(const GpuPrimitive& prim, int band_top, int band_bottom) {
+
+    // Wind the corners clockwise (on screen)
+    const GpuVertex* v0 = &prim.vertices[0];
+    const GpuVertex* v1 = &prim.vertices[1];
+    const GpuVertex* v2 = &prim.vertices[2];
+    int area = ((v1->x - v0->x) * (v2->y - v0->y)) - ((v2->x - v0->x) * (v1->y - v0->y));
+    if (area == 0) {
+        return;
+    }
+    if (area < 0) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    // Get the rows and columns to scan
+    int left, top, right, bottom;
+    if (!GetBounds(prim, &left, &top, &right, &bottom)) {
+        return;
+    }
+    top = std::max(top, band_top);
+    bottom = std::min(bottom, band_bottom);
+
+    // Edge functions are positive inside the triangle, pixels exactly on an edge only belong to top and left edges
+    auto edge = [](const GpuVertex* a, const GpuVertex* b, int x, int y) {
+        return ((b->x - a->x) * (y - a->y)) - ((b->y - a->y) * (x - a->x));
+    };
+    auto edge_bias = [](const GpuVertex* a, const GpuVertex* b) {
+        int dx = b->x - a->x;
+        int dy = b->y - a->y;
+        return ((dy == 0 && dx > 0) || dy < 0) ? 0 : -1;
+    };
+    int bias0 = edge_bias(v1, v2);
+    int bias1 = edge_bias(v2, v0);
+    int bias2 = edge_bias(v0, v1);
+
+    // Interpolate attributes with barycentric weights (texture coordinates are nudged so exact texels don't round down)
+    float inv_area = 1.0f / area;
+    for (int y = top; y <= bottom; y++) {
+        for (int x = left; x <= right; x++) {
+            int w0 = edge(v1, v2, x, y);
+            int w1 = edge(v2, v0, x, y);
+            int w2 = edge(v0, v1, x, y);
+            if (w0 + bias0 < 0 || w1 + bias1 < 0 || w2 + bias2 < 0) {
+                continue;
+            }
+            float l0 = w0 * inv_area;
+            float l1 = w1 * inv_area;
+            float l2 = w2 * inv_area;
+            uint r = v0->r;
+            uint g = v0->g;
+            uint b = v0->b;
+            if (prim.gouraud) {
+                r = (uint)((l0 * v0->r) + (l1 * v1->r) + (l2 * v2->r) + 0.5f);
+                g = (uint)((l0 * v0->g) + (l1 * v1->g) + (l2 * v2->g) + 0.5f);
+                b = (uint)((l0 * v0->b) + (l1 * v1->b) + (l2 * v2->b) + 0.5f);
+            }
+            uint u = 0;
+            uint v = 0;
+            if (prim.textured) {
+                u = (uint)std::max(0.0f, (l0 * v0->u) + (l1 * v1->u) + (l2 * v2->u) + (1.0f / 256.0f));
+                v = (uint)std::max(0.0f, (l0 * v0->v) + (l1 * v1->v) + (l2 * v2->v) + (1.0f / 256.0f));
+            }
+            ShadePixel(prim, x, y, std::min(r, 255u), std::min(g, 255u), std::min(b, 255u), u & 0xFF, v & 0xFF);
+        }
+    }
+}
+
+
+
+/**
+ * Rasterizes a rectangle within a range of rows.
+ *
+ * @param prim: Rectangle to draw
+ * @param band_top: First row that may be written
+ * @param band_bottom: Last row that may be written
+ *
+ */
+void GpuEmulator::DrawRect(const GpuPrimitive& prim, int band_top, int band_bottom) {
+
+    int left, top, right, bottom;
+    if (!GetBounds(prim, &left, &top, &right, &bottom)) {
+        return;
+    }
+    top = std::max(top, band_top);
+    bottom = std::min(bottom, band_bottom);
+
+    // Texture coordinates step backwards when the rectangle is flipped
+    const GpuVertex& vertex = prim.vertices[0];
+    for (int y = top; y <= bottom; y++) {
+        int dv = y - vertex.y;
+        uint v = (uint)(prim.state.flip_y ? vertex.v - dv : vertex.v + dv) & 0xFF;
+        for (int x = left; x <= right; x++) {
+            int du = x - vertex.x;
+            uint u = (uint)(prim.state.flip_x ? vertex.u - du : vertex.u + du) & 0xFF;
+            ShadePixel(prim, x, y, vertex.r, vertex.g, vertex.b, u, v);
+        }
+    }
+}
+
+
+
+/**
+ * Rasterizes a line within a range of rows.
+ *
+ * @param prim: Line to draw
+ * @param band_top: First row that may be written
+ * @param band_bottom: Last row that may be written
+ *
+ */
+void GpuEmulator::DrawLine(const GpuPrimitive& prim, int band_top, int band_bottom) {
+
+    int left, top, right, bottom;
+    if (!GetBounds(prim, &left, &top, &right, &bottom)) {
+        return;
+    }
+    top = std::max(top, band_top);
+    bottom = std::min(bottom, band_bottom);
+
+    // Step one pixel at a time along the major axis
+    const GpuVertex& start = prim.vertices[0];
+    const GpuVertex& end = prim.vertices[1];
+    int dx = end.x - start.x;
+    int dy = end.y - start.y;
+    int num_steps = std::max(abs(dx), abs(dy));
+    for (int i = 0; i <= num_steps; i++) {
+        float progress = (num_steps > 0 ? (float)i / num_steps : 0.0f);
+        int x = start.x + (int)floorf((dx * progress) + 0.5f);
+        int y = start.y + (int)floorf((dy * progress) + 0.5f);
+        if (x < left || x > right || y < top || y > bottom) {
+            continue;
+        }
+        uint r = start.r;
+        uint g = start.g;
+        uint b = start.b;
+        if (prim.gouraud) {
+            r = (uint)(start.r + ((end.r - start.r) * progress) + 0.5f);
+            g = (uint)(start.g + ((end.g - start.g) * progress) + 0.5f);
+            b = (uint)(start.b + ((end.b - start.b) * progress) + 0.5f);
+        }
+        ShadePixel(prim, x, y, r, g, b, 0, 0);
+    }
+}
+
+
+
+/**
+ * Fills an area of VRAM within a range of rows.
+ *
+ * @param prim: Fill to draw
+ * @param band_top: First row that may be written
+ * @param band_bottom: Last row that may be written
+ *
+ */
+void GpuEmulator::DrawFill(const GpuPrimitive& prim, int band_top, int band_bottom) {
+
+    int left, top, right, bottom;
+    if (!GetBounds(prim, &left, &top, &right, &bottom)) {
+        return;
+    }
+    top = std::max(top, band_top);
+    bottom = std::min(bottom, band_bottom);
+
+    const GpuVertex& vertex = prim.vertices[0];
+    ushort color = (vertex.r >> 3) | ((vertex.g >> 3) << 5) | ((vertex.b >> 3) << 10);
+    for (int y = top; y <= bottom; y++) {
+        std::fill(vram.begin() + (y * GPU_VRAM_WIDTH) + left, vram.begin() + (y * GPU_VRAM_WIDTH) + right + 1, color);
+    }
+}
+
+
+
+/**
+ * Samples a primitive's texture.
+ *
+ * @param prim: Textured primitive
+ * @param u: Horizontal texture coordinate (0-255)
+ * @param v: Vertical texture coordinate (0-255)
+ *
+ * @return RGB1555 texel (0 is fully transparent)
+ *
+ */
+ushort GpuEmulator::GetTexel(const GpuPrimitive& prim, uint u, uint v) {
+
+    // Apply the texture window
+    u = ((u & ~(prim.state.tw_mask_x * 8)) | ((prim.state.tw_offset_x & prim.state.tw_mask_x) * 8)) & 0xFF;
+    v = ((v & ~(prim.state.tw_mask_y * 8)) | ((prim.state.tw_offset_y & prim.state.tw_mask_y) * 8)) & 0xFF;
+
+    // Locate the texture page and CLUT
+    uint page_x = (prim.texpage & 0xF) * 64;
+    uint page_y = ((prim.texpage >> 4) & 1) * 256;
+    uint clut_x = (prim.clut & 0x3F) * 16;
+    uint clut_y = (prim.clut >> 6) & (GPU_VRAM_HEIGHT - 1);
+    const ushort* row = vram.data() + (((page_y + v) & (GPU_VRAM_HEIGHT - 1)) * GPU_VRAM_WIDTH);
+    const ushort* clut = vram.data() + (clut_y * GPU_VRAM_WIDTH);
+
+    switch ((prim.texpage >> 7) & 3) {
+
+        // 4-bit CLUT
+        case 0: {
+            ushort indices = row[(page_x + (u / 4)) & (GPU_VRAM_WIDTH - 1)];
+            return clut[(clut_x + ((indices >> ((u & 3) * 4)) & 0xF)) & (GPU_VRAM_WIDTH - 1)];
+        }
+
+        // 8-bit CLUT
+        case 1: {
+            ushort indices = row[(page_x + (u / 2)) & (GPU_VRAM_WIDTH - 1)];
+            return clut[(clut_x + ((indices >> ((u & 1) * 8)) & 0xFF)) & (GPU_VRAM_WIDTH - 1)];
+        }
+
+        // 15-bit direct
+        default:
+            return row[(page_x + u) & (GPU_VRAM_WIDTH - 1)];
+    }
+}
+
+
+
+/**
+ * Works out the final color of a pixel and writes it.
+ *
+ * @param prim: Primitive being drawn
+ * @param x: Column of the pixel
+ * @param y: Row of the pixel
+ * @param r: Red component of the vertex color (0x80 leaves texels unchanged)
+ * @param g: Green component of the vertex color
+ * @param b: Blue component of the vertex color
+ * @param u: Horizontal texture coordinate
+ * @param v: Vertical texture coordinate
+ *
+ */
+void GpuEmulator::ShadePixel(const GpuPrimitive& prim, int x, int y, uint r, uint g, uint b, uint u, uint v) {
+
+    // Untextured primitives are always blended when semi-transparent
+    if (!prim.textured) {
+        WritePixel(prim, x, y, (r >> 3) | ((g >> 3) << 5) | ((b >> 3) << 10), prim.semi_transparent);
+        return;
+    }
+
+    // Textured primitives skip transparent texels and only blend texels with bit 15 set
+    ushort texel = GetTexel(prim, u, v);
+    if (texel == 0) {
+        return;
+    }
+    ushort color = texel;
+    if (!prim.raw_texture) {
+        uint tex_r = std::min<uint>(((texel & 0x1F) * r) >> 7, 0x1F);
+        uint tex_g = std::min<uint>((((texel >> 5) & 0x1F) * g) >> 7, 0x1F);
+        uint tex_b = std::min<uint>((((texel >> 10) & 0x1F) * b) >> 7, 0x1F);
+        color = (texel & 0x8000) | tex_r | (tex_g << 5) | (tex_b << 10);
+    }
+    WritePixel(prim, x, y, color, prim.semi_transparent && (texel & 0x8000));
+}
+
+
+
+/**
+ * Writes a pixel to VRAM (or the offscreen target), blending it and applying the mask settings.
+ *
+ * @param prim: Primitive being drawn (its texture page holds the blend rate)
+ * @param x: Column of the pixel
+ * @param y: Row of the pixel
+ * @param color: RGB1555 color to write
+ * @param blend: Whether the color should be blended with the pixel already in VRAM
+ *
+ * @note Target pixels are expanded to 8 bits per channel. A blended pixel drawn where nothing was drawn yet keeps its
+ *       blend mode in the alpha (see GPU_TARGET_BLEND), so that it can be blended with what ends up behind the target.
+ *
+ */
+void GpuEmulator::WritePixel(const GpuPrimitive& prim, int x, int y, ushort color, bool blend) {
+
+    uint blend_mode = (prim.texpage >> 5) & 3;
+    if (target != nullptr) {
+        uint* dst = &target->pixels[(y * target->width) + x];
+        uint alpha = *dst >> 24;
+        uint pixel = 0;
+        for (uint i = 0; i < 3; i++) {
+            int front = (color >> (i * 5)) & 0x1F;
+            front = (front << 3) | (front >> 2);
+            int channel = (blend && alpha != 0 ? BlendChannel((*dst >> (i * 8)) & 0xFF, front, blend_mode, 0xFF) : front);
+            pixel |= channel << (i * 8);
+        }
+        if (!blend) {
+            alpha = 0xFF;
+        }
+        else if (alpha == 0) {
+            alpha = GPU_TARGET_BLEND | blend_mode;
+        }
+        *dst = pixel | (alpha << 24);
+        return;
+    }
+
+    ushort* dst = &vram[(y * GPU_VRAM_WIDTH) + x];
+    if (prim.state.check_mask && (*dst & 0x8000)) {
+        return;
+    }
+
+    if (blend) {
+        ushort blended = color & 0x8000;
+        for (uint shift = 0; shift < 15; shift += 5) {
+            blended |= BlendChannel((*dst >> shift) & 0x1F, (color >> shift) & 0x1F, blend_mode, 0x1F) << shift;
+        }
+        color = blended;
+    }
+    *dst = color | (prim.state.set_mask ? 0x8000 : 0);
+}
+
+
+
+/**
+ * Applies a PSX blend equation to one color channel.
+ *
+ * @param back: Channel of the pixel being drawn onto
+ * @param front: Channel of the pixel being drawn
+ * @param blend_mode: Equation to use (PSX_BLEND_*)
+ * @param max_value: Largest value of a channel (0x1F for VRAM, 0xFF for RGBA images)
+ *
+ * @return Blended channel
+ *
+ * @note The compositor blends with this as well, so rooms and VRAM use the same equations.
+ *
+ */
+int GpuEmulator::BlendChannel(int back, int front, uint blend_mode, int max_value) {
+    switch (blend_mode) {
+        case PSX_BLEND_ADD:
+            return std::min(back + front, max_value);
+        case PSX_BLEND_SUBTRACT:
+            return std::max(back - front, 0);
+        case PSX_BLEND_ADD_QUARTER:
+            return std::min(back + (front / 4), max_value);
+        default:
+            return (back + front) / 2;
+    }
+}
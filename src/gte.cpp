@@ -44,6 +44,60 @@ uint GteEmulator::FLAG;
 
 
 
+// Every register in the order used by snapshots
+#define GTE_STATE_FIELDS(X) \
+    X(VX) X(RGBC) X(OTZ) X(IR) X(SXY_FIFO) X(SZ_FIFO) X(RGBC_FIFO) X(RES1) X(MAC) X(IRGB) X(ORGB) X(LZCS) X(LZCR) \
+    X(ROT_MTX) X(TRANS_VEC) X(LIGHT_MTX) X(BG_COLOR_VEC) X(LIGHT_COLOR_MTX) X(FAR_COLOR_VEC) X(GARBAGE_MTX) \
+    X(OFX) X(OFY) X(H) X(DQA) X(DQB) X(ZSF3) X(ZSF4) X(FLAG)
+
+
+
+/**
+ * Gets the number of bytes needed to store the state of every GTE register.
+ *
+ * @return Size of the GTE state in bytes
+ *
+ */
+uint GteEmulator::GetStateSize() {
+    uint size = 0;
+#define X(field) size += sizeof(field);
+    GTE_STATE_FIELDS(X)
+#undef X
+    return size;
+}
+
+
+
+/**
+ * Copies the state of every GTE register into a buffer.
+ *
+ * @param dst: Buffer of at least GetStateSize() bytes
+ *
+ */
+void GteEmulator::SaveState(byte* dst) {
+#define X(field) memcpy(dst, &field, sizeof(field)); dst += sizeof(field);
+    GTE_STATE_FIELDS(X)
+#undef X
+}
+
+
+
+/**
+ * Restores the state of every GTE register from a buffer written by SaveState().
+ *
+ * @param src: Buffer of at least GetStateSize() bytes
+ *
+ * @note Registers are copied directly so none of the side effects of register writes are triggered.
+ *
+ */
+void GteEmulator::LoadState(const byte* src) {
+#define X(field) memcpy(&field, src, sizeof(field)); src += sizeof(field);
+    GTE_STATE_FIELDS(X)
+#undef X
+}
+
+
+
 /**
  * Initializes the GTE emulator.
  */
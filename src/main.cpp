@@ -5,11 +5,13 @@
 #include "imgui_impl_opengl3.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <functional>
 #include <thread>
 #include <cstdarg>
 #include <algorithm>
+#include <chrono>
 
 // Include this for MSVC since it doesn't like M_PI
 #ifndef M_PI
@@ -33,7 +35,12 @@
 #include "compression.h"
 #include "entities.h"
 #include "map.h"
+#include "cluts.h"
 #include "utils.h"
+#include "disc.h"
+#include "game_loader.h"
+#include "frame_profiler.h"
+#include "trace.h"
 #include "log.h"
 
 
@@ -63,8 +70,9 @@ static void glfw_error_callback(int error, const char* description)
 // Shortcuts currently pressed
 static struct shortcuts {
     bool open = false;
+    bool save = false;
     bool quit = false;
-    bool activated() {return open | quit;}
+    bool activated() {return open | save | quit;}
 } shortcuts;
 
 
@@ -75,6 +83,7 @@ static struct shortcuts {
 static char* psx_path;
 static char* bin_path;
 static char* gfx_path;
+static char* disc_path;
 Map map;
 
 // Any errors that might appear
@@ -126,18 +135,21 @@ static int vtx_idx;
 // Just to keep track of SotN data load status
 static bool sotn_data_loaded = false;
 
+// Whether the main viewport shows one composite texture per room instead of every layer and sprite
+static bool composite_rooms = false;
+
+// Texture mirroring the emulated VRAM and the VRAM version it was last uploaded from
+static GLuint framebuffer_texture = 0;
+static uint framebuffer_version = 0;
+
 // Main window
 GLFWwindow* window;
 GLFWwindow* buffer_window;
 
 // Define globals
-byte* generic_rgba_cluts;
-GLuint generic_cluts_texture;
 GLuint fgame_texture;
 std::vector<GLuint> fgame_textures;
 std::vector<GLuint> item_textures;
-byte* item_cluts;
-GLuint item_cluts_texture;
 std::vector<std::vector<Sprite>> generic_sprite_banks;
 GLuint generic_powerup_texture;
 GLuint generic_saveroom_texture;
@@ -164,6 +176,7 @@ static void SotN_ReadLine(ImGuiContext* ctx, ImGuiSettingsHandler*, void*, const
     if (sscanf(line, "PsxPath=%2047[^\n]", s) == 1)                 { psx_path = ImStrdup(s); }
     else if (sscanf(line, "BinPath=%2047[^\n]", s) == 1)            { bin_path = ImStrdup(s); }
     else if (sscanf(line, "GfxPath=%2047[^\n]", s) == 1)            { gfx_path = ImStrdup(s); }
+    else if (sscanf(line, "DiscPath=%2047[^\n]", s) == 1)           { disc_path = ImStrdup(s); }
 }
 
 /**
@@ -178,6 +191,7 @@ static void SotN_WriteAll(ImGuiContext* ctx, ImGuiSettingsHandler* handler, ImGu
     buf->appendf("PsxPath=%s\n", psx_path);
     buf->appendf("BinPath=%s\n", bin_path);
     buf->appendf("GfxPath=%s\n", gfx_path);
+    buf->appendf("DiscPath=%s\n", disc_path);
     buf->append("\n");
 }
 
@@ -228,6 +242,38 @@ static void blend_default(const ImDrawList* draw_list, const ImDrawCmd* cmd) {
 
 
 
+/**
+ * Gets a texture of the emulated VRAM for display.
+ *
+ * @return Texture of the emulated VRAM (uploaded again only when the VRAM changed)
+ *
+ */
+static GLuint get_framebuffer_texture() {
+
+    // Bail if the VRAM didn't change since the last upload
+    if (framebuffer_texture != 0 && framebuffer_version == MipsEmulator::vram_version) {
+        return framebuffer_texture;
+    }
+
+    // Convert the VRAM to RGBA pixels
+    RECT vram_rect = {0, 0, 1024, 512};
+    byte* vram_pixels = (byte*)calloc(1024 * 512 * 4, sizeof(byte));
+    MipsEmulator::gpu.GetRGBA(&vram_rect, vram_pixels);
+
+    // Create the texture the first time, otherwise overwrite it
+    if (framebuffer_texture == 0) {
+        framebuffer_texture = Utils::CreateTexture(vram_pixels, 1024, 512);
+    }
+    else {
+        Utils::SetPixels(framebuffer_texture, 0, 0, 1024, 512, vram_pixels);
+    }
+    free(vram_pixels);
+    framebuffer_version = MipsEmulator::vram_version;
+    return framebuffer_texture;
+}
+
+
+
 /**
  * Prompts the user to select a file from their filesystem.
  *
@@ -254,128 +300,148 @@ static nfdchar_t* open_file(nfdfilteritem_t filters[]) {
 }
 
 
+
 /**
- * Loads common data from the binary files and initializes the MIPS emulator.
+ * Prompts the user to choose where a file should be saved.
+ *
+ * @param filters: Array of file extension filters
+ * @param default_name: Filename suggested to the user
+ *
+ * @return Pointer to a string if a location was chosen
+ * @return Null pointer if the dialog was canceled
+ *
  */
-void load_sotn_data() {
+static nfdchar_t* save_file(nfdfilteritem_t filters[], const char* default_name) {
+    nfdchar_t* out_path;
+    nfdresult_t result = NFD_SaveDialog(&out_path, filters, 1, nullptr, default_name);
+    if (result == NFD_OKAY) {
+        return out_path;
+    }
+    else if (result == NFD_CANCEL) {
+        // User pressed the cancel button
+        error = "File selection canceled.";
+    }
+    else {
+        error = NFD_GetError();
+    }
+    return nullptr;
+}
 
-    // Swap to the buffer context
-    glfwMakeContextCurrent(buffer_window);
 
-    MipsEmulator::Initialize();
 
-    // Load binaries
-    MipsEmulator::SetPSXBinary(psx_path);
-    MipsEmulator::SetSotNBinary(bin_path);
+/**
+ * Mounts a disc image and points the game binary paths at the files on the disc.
+ *
+ * @param filename: Filename of the disc image (.cue, .bin or .iso)
+ *
+ * @return True if the disc was mounted and contains the game binaries
+ *
+ */
+static bool mount_disc(const char* filename) {
 
-    // Initial reset
-    MipsEmulator::Reset();
+    // Mount the image
+    if (!Disc::Mount(filename)) {
+        error = "Could not read disc image.";
+        return false;
+    }
 
+    // Find the game binaries on the disc
+    std::string disc_psx_path = Disc::FindExecutable();
+    std::string disc_bin_path = Disc::GetPath("DRA.BIN");
+    std::string disc_gfx_path = Disc::GetPath("F_GAME.BIN");
+    if (disc_psx_path.empty() || !Disc::Contains(disc_bin_path.c_str()) || !Disc::Contains(disc_gfx_path.c_str())) {
+        error = "Disc image does not contain the SotN game files.";
+        Disc::Unmount();
+        return false;
+    }
 
+    // Read everything from the disc from now on
+    disc_path = ImStrdup(filename);
+    psx_path = ImStrdup(disc_psx_path.c_str());
+    bin_path = ImStrdup(disc_bin_path.c_str());
+    gfx_path = ImStrdup(disc_gfx_path.c_str());
 
-    // Get generic sprite data
-    generic_sprite_banks = Sprite::ReadSpriteBanks(MipsEmulator::ram, GENERIC_SPRITE_BANKS_ADDR, RAM_BASE_OFFSET);
+    // Swap the binaries of an already running emulator
+    if (MipsEmulator::initialized) {
+        MipsEmulator::SetPSXBinary(psx_path);
+        MipsEmulator::SetSotNBinary(bin_path);
+    }
 
+    error.clear();
+    return true;
+}
 
 
-    // Read the generic CLUT data
-    byte* fgame_pixels = (byte*)calloc(256 * 512 * 2, sizeof(byte));
-    byte* generic_cluts = (byte*)calloc(256 * 16 * 2, sizeof(byte));
-    FILE* f_game = fopen(gfx_path, "rb");
+/**
+ * Loads common data from the binary files and initializes the MIPS emulator.
+ */
+void load_sotn_data() {
 
-    // Read the pixels
-    fread(fgame_pixels, sizeof(byte), 256 * 512 * 2, f_game);
-    byte* fgame_pixeldata = Utils::Indexed_to_RGBA(fgame_pixels, 256 * 512);
+    TraceZone zone("load_sotn_data");
 
-    // Read the texture data
-    for (int i = 0; i < (256 * 512 * 2) / 8192; i++) {
+    // Swap to the buffer context
+    glfwMakeContextCurrent(buffer_window);
 
-        GLuint chunk_texture = Utils::CreateTexture(fgame_pixeldata + (i * 8192 * 2), 32, 128);
+    // Load the binaries and restore (or create) the post-boot snapshot, the same way the headless tools do
+    GameFiles files;
+    files.psx_path = psx_path;
+    files.bin_path = bin_path;
+    files.gfx_path = gfx_path;
+    GameLoader::BootEmulator(files);
 
-        // Add the texture pointer to the list of map textures
-        fgame_textures.push_back(chunk_texture);
-    }
-    free(fgame_pixeldata);
 
-    fseek(f_game, 256 * 512 * 2, SEEK_SET);
-    fread(generic_cluts, sizeof(byte), 256 * 16 * 2, f_game);
-    fclose(f_game);
-    free(fgame_pixels);
 
-    // Convert all generic CLUTs to their RGBA equivalents
-    generic_rgba_cluts = (byte*)calloc(256 * 16 * 4, sizeof(byte));
+    // Get generic sprite data
+    generic_sprite_banks = Sprite::ReadSpriteBanks(MipsEmulator::ram, GENERIC_SPRITE_BANKS_ADDR, RAM_BASE_OFFSET);
 
-    // Convert RGB1555 CLUT to RGBA CLUT
-    Utils::CLUT_to_RGBA(generic_cluts, generic_rgba_cluts, 256, false);
 
-    // Free the allocated bytes since they're no longer needed
-    free(generic_cluts);
 
-    // Create a texture for the RGBA CLUTs
-    generic_cluts_texture = Utils::CreateTexture(generic_rgba_cluts, 256, 16);
+    // Read the generic CLUT data
+    byte* generic_cluts = (byte*)calloc(256 * 16 * 2, sizeof(byte));
 
     // Allocate data for a full VRAM texture
-    byte* vram_data = (byte*)calloc(256 * 512 * 2 * 4 * 2, sizeof(byte));
-
-    // Keep track of offset into VRAM
-    uint cur_offset = 0;
-
-    // Create a new framebuffer
-    glewInit();
-    GLuint tmpfbo;
-    glGenFramebuffers(1, &tmpfbo);
-
-    // Bind to the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, tmpfbo);
+    byte* vram_data = (byte*)calloc(512 * 256 * 4, sizeof(byte));
 
-    // Loop through each line of all 32 textures
-    for (int k = 0; k < 128; k++) {
-        for (int i = 0; i < 32; i++) {
-
-            // Only process if this is within the TOP half of VRAM
-            if (i % 4 < 2) {
+    // Convert the pixels straight from the mapping into VRAM
+    std::shared_ptr<const MappedFile> f_game = MappedFile::Share(gfx_path);
+    if (f_game != nullptr && f_game->size >= (256 * 512 * 2) + (256 * 16 * 2)) {
+        Utils::Chunks_to_VRAM(f_game->data, 256 * 512 * 2, vram_data);
+        memcpy(generic_cluts, f_game->data + (256 * 512 * 2), 256 * 16 * 2);
+    }
 
-                // Attach to the target texture and read the pixels into VRAM
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fgame_textures[i], 0);
-                glReadPixels(0, k, 32, 1, GL_RGBA, GL_UNSIGNED_BYTE, vram_data + cur_offset);
-                cur_offset += 32 * 4;
-            }
-        }
+    // Fall back to blank graphics if the file is unusable
+    else {
+        Log::Error("Invalid F_GAME.BIN file: %s\n", gfx_path);
+        byte* fgame_pixels = (byte*)calloc(256 * 512 * 2, sizeof(byte));
+        Utils::Chunks_to_VRAM(fgame_pixels, 256 * 512 * 2, vram_data);
+        free(fgame_pixels);
     }
+    f_game.reset();
 
-    // Loop through each line of all 32 textures
-    for (int k = 0; k < 128; k++) {
-        for (int i = 0; i < 32; i++) {
+    // Hand the generic CLUTs to the CLUT manager
+    Clut::Reset(CLUT_BANK_GENERIC, 256);
+    Clut::Set(CLUT_BANK_GENERIC, 0, 256, generic_cluts);
 
-            // Only process if this is within the BOTTOM half of VRAM
-            if (i % 4 > 1) {
+    // Free the allocated bytes since they're no longer needed
+    free(generic_cluts);
 
-                // Attach to the target texture and read the pixels into VRAM
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fgame_textures[i], 0);
-                glReadPixels(0, k, 32, 1, GL_RGBA, GL_UNSIGNED_BYTE, vram_data + cur_offset);
-                cur_offset += 32 * 4;
-
-            }
-        }
-    }
+    // Create a texture for the RGBA CLUTs (this also expands every CLUT up front)
+    Clut::GetTexture(CLUT_BANK_GENERIC, CLUT_FORMAT_OPAQUE);
 
+    // Upload the whole of VRAM at once
     fgame_texture = Utils::CreateTexture(vram_data, 512, 256);
 
     // Clear out the F_GAME texture list
     fgame_textures.clear();
 
-    // Free up allocated VRAM data
-    free(vram_data);
-
-    // Bind to the F_GAME texture
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fgame_texture, 0);
-
     // Collect all of the tilesets
     for (int i = 0; i < 8; i++) {
 
-        // Read a block of pixels from VRAM
+        // Copy a block of pixels from VRAM
         byte* tileset_data = (byte*)calloc(64 * 256 * 4, sizeof(byte));
-        glReadPixels(i * 64, 0, 64, 256, GL_RGBA, GL_UNSIGNED_BYTE, tileset_data);
+        for (int y = 0; y < 256; y++) {
+            memcpy(tileset_data + (y * 64 * 4), vram_data + (((y * 512) + (i * 64)) * 4), 64 * 4);
+        }
 
         // Create a texture from each VRAM block
         GLuint tileset_texture = Utils::CreateTexture(tileset_data, 64, 256);
@@ -387,11 +453,14 @@ void load_sotn_data() {
         fgame_textures.push_back(tileset_texture);
     }
 
-    // Reset the framebuffer target to the main window
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Keep the VRAM for decoding tiles that use the F_GAME.BIN tilesets
+    Map::fgame_vram.assign(vram_data, vram_data + (512 * 256 * 4));
 
-    // Delete the framebuffer
-    glDeleteFramebuffers(1, &tmpfbo);
+    // Free up allocated VRAM data
+    free(vram_data);
+
+    // Make sure the GL extensions are loaded
+    glewInit();
 
 
 
@@ -402,7 +471,7 @@ void load_sotn_data() {
     byte* compressed_data = (byte*)calloc(data_size, sizeof(byte));
     byte* tileset_data = (byte*)calloc(data_size, sizeof(byte));
     MipsEmulator::CopyFromRAM(COMPRESSED_GENERIC_POWERUP_TILESET_ADDR, compressed_data, data_size);
-    Compression::Decompress(tileset_data, compressed_data);
+    Compression::Decompress(tileset_data, data_size, compressed_data, data_size);
     byte* pixel_data = Utils::Indexed_to_RGBA(tileset_data, data_size / 4);
     generic_powerup_texture = Utils::CreateTexture(pixel_data, 0x80 / 4, 0x80);
     free(pixel_data);
@@ -421,7 +490,7 @@ void load_sotn_data() {
         exit(1);
     }
     MipsEmulator::CopyFromRAM(COMPRESSED_GENERIC_SAVEROOM_TILESET_ADDR, compressed_data, data_size);
-    Compression::Decompress(tileset_data, compressed_data);
+    Compression::Decompress(tileset_data, data_size, compressed_data, data_size);
     pixel_data = Utils::Indexed_to_RGBA(tileset_data, data_size / 4);
     generic_saveroom_texture = Utils::CreateTexture(pixel_data, 0x80 / 4, 0x80);
     free(pixel_data);
@@ -440,7 +509,7 @@ void load_sotn_data() {
         exit(1);
     }
     MipsEmulator::CopyFromRAM(COMPRESSED_GENERIC_LOADROOM_TILESET_ADDR, compressed_data, data_size);
-    Compression::Decompress(tileset_data, compressed_data);
+    Compression::Decompress(tileset_data, data_size, compressed_data, data_size);
     pixel_data = Utils::Indexed_to_RGBA(tileset_data, data_size / 4);
     generic_loadroom_texture = Utils::CreateTexture(pixel_data, 0x80 / 4, 0x80);
     free(pixel_data);
@@ -454,14 +523,17 @@ void load_sotn_data() {
     // Read item and relic stuff
     byte* dra_bin_pixels = (byte*)calloc(((16 * 16) / 2) * 275, sizeof(byte));
     byte* dra_bin_cluts = (byte*)calloc(320 * 16 * 2, sizeof(byte));
-    FILE* dra_bin = fopen(bin_path, "rb");
+    std::shared_ptr<const MappedFile> dra_bin = MappedFile::Share(bin_path);
 
     // Read the item sprites and CLUTs
-    fseek(dra_bin, ITEM_SPRITES_ADDR - SOTN_RAM_OFFSET, SEEK_SET);
-    fread(dra_bin_pixels, sizeof(byte), ((16 * 16) / 2) * 275, dra_bin);
-    fseek(dra_bin, ITEM_CLUTS_ADDR - SOTN_RAM_OFFSET, SEEK_SET);
-    fread(dra_bin_cluts, sizeof(byte), 320 * 16 * 2, dra_bin);
-    fclose(dra_bin);
+    if (dra_bin != nullptr && dra_bin->size >= (ITEM_CLUTS_ADDR - SOTN_RAM_OFFSET) + (320 * 16 * 2)) {
+        memcpy(dra_bin_pixels, dra_bin->data + (ITEM_SPRITES_ADDR - SOTN_RAM_OFFSET), ((16 * 16) / 2) * 275);
+        memcpy(dra_bin_cluts, dra_bin->data + (ITEM_CLUTS_ADDR - SOTN_RAM_OFFSET), 320 * 16 * 2);
+    }
+    else {
+        Log::Error("Could not read item graphics from DRA.BIN: %s\n", bin_path);
+    }
+    dra_bin.reset();
 
     // Get the pixel data for the items
     byte* item_pixel_data = Utils::Indexed_to_RGBA(dra_bin_pixels, (((16 * 16) / 2) * 275) / 2);
@@ -476,14 +548,12 @@ void load_sotn_data() {
     }
     free(item_pixel_data);
 
-    // Convert all item CLUTs to their RGBA equivalents
-    item_cluts = (byte*)calloc(320 * 16 * 4, sizeof(byte));
+    // Hand the item CLUTs to the CLUT manager
+    Clut::Reset(CLUT_BANK_ITEM, 320);
+    Clut::Set(CLUT_BANK_ITEM, 0, 320, dra_bin_cluts);
 
-    // Convert RGB1555 CLUT to RGBA CLUT
-    Utils::CLUT_to_RGBA(dra_bin_cluts, item_cluts, 320, false);
-
-    // Create a texture for the RGBA CLUTs
-    item_cluts_texture = Utils::CreateTexture(item_cluts, 320, 16);
+    // Create a texture for the RGBA CLUTs (this also expands every CLUT up front)
+    Clut::GetTexture(CLUT_BANK_ITEM, CLUT_FORMAT_OPAQUE);
 
     // Free temporary allocations
     free(dra_bin_pixels);
@@ -504,6 +574,8 @@ void load_sotn_data() {
  */
 void load_map_data(const std::filesystem::path& map_path) {
 
+    TraceZone zone("load_map_data");
+
     // Reset map loaded flag
     map.loaded = false;
     map.load_status_msg = "Starting ...";
@@ -526,11 +598,24 @@ void load_map_data(const std::filesystem::path& map_path) {
         return;
     }
 
+    // List the map directory (either on disk or inside the mounted disc image)
+    std::vector<std::filesystem::path> map_dir_entries;
+    if (Disc::Contains(map_dir.c_str())) {
+        for (const auto& entry : Disc::ListDirectory(map_dir.c_str())) {
+            map_dir_entries.emplace_back(entry);
+        }
+    }
+    else {
+        for (const auto& entry : std::filesystem::directory_iterator(map_dir)) {
+            map_dir_entries.push_back(entry.path());
+        }
+    }
+
     // Try and find the map graphics file, setting the map_gfx_file variable if it was found
-    for (const auto& entry : std::filesystem::directory_iterator(map_dir)) {
-        std::string f = map_dir + "/" + Utils::toLowerCase(entry.path().filename().string());
+    for (const auto& entry : map_dir_entries) {
+        std::string f = map_dir + "/" + Utils::toLowerCase(entry.filename().string());
         if (f == map_dir + "/f_" + Utils::toLowerCase(map_filename)) {
-            map_gfx_file = entry.path().string();
+            map_gfx_file = entry.string();
             break;
         }
     }
@@ -551,6 +636,12 @@ void load_map_data(const std::filesystem::path& map_path) {
             load_sotn_data();
         }
 
+        // Check whether the processed map is already in the cache
+        map.load_status_msg = "Checking Map Cache ...";
+        auto decode_start = std::chrono::steady_clock::now();
+        map.cache_key = Cache::GetKey({map_path.string(), map_gfx_file, gfx_path});
+        map.cache_hit = Cache::LoadMap(map.cache_key, &map.cache);
+
         // Load and process the map file
         map.load_status_msg = "Loading Map File Data ...";
         map.LoadMapFile(map_path.string().c_str());
@@ -563,11 +654,28 @@ void load_map_data(const std::filesystem::path& map_path) {
         map.load_status_msg = "Loading Map Graphics ...";
         map.LoadMapGraphics(map_gfx_file.c_str());
 
+        // Report the cache status and store newly decoded maps
+        double decode_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decode_start).count();
+        if (map.cache_hit) {
+            Log::Info(
+                "Map cache hit [%016llX]: decoded in %.1f ms (saved %.1f ms)\n",
+                (unsigned long long)map.cache_key,
+                decode_time,
+                std::max(map.cache.decode_time - decode_time, 0.0)
+            );
+        }
+        else {
+            map.cache.decode_time = decode_time;
+            Cache::SaveMap(map.cache_key, &map.cache);
+            Log::Info("Map cache miss [%016llX]: decoded in %.1f ms\n", (unsigned long long)map.cache_key, decode_time);
+        }
+
+        // Keep the cache entry, as room VRAM views are built from its entity graphics later on
 
         // Store map tile CLUTs in MIPS RAM
         map.load_status_msg = "Storing Map CLUTs ...";
         for (int i = 0; i < 256; i++) {
-            MipsEmulator::StoreMapCLUT(i * 32, 32, map.map_tile_cluts[i]);
+            MipsEmulator::StoreMapCLUT(i * 32, 32, (byte*)Clut::GetColors(CLUT_BANK_MAP, i));
         }
 
         // Store map entity CLUTs in MIPS RAM
@@ -588,6 +696,7 @@ void load_map_data(const std::filesystem::path& map_path) {
 
         // Load the map entities
         map.load_status_msg = "Loading Entities ...";
+        map.entity_cache_key = Cache::GetKey({psx_path, bin_path, map_path.string(), map_gfx_file, gfx_path});
         map.LoadMapEntities();
 
         // Clear out any errors
@@ -713,8 +822,15 @@ static int IMGUI_CDECL entity_sort_func(const void* lhs, const void* rhs) {
 /**
  * Do the things.
  */
-int main(int, char**)
+int main(int argc, char** argv)
 {
+    // Record a trace of everything that gets loaded until the editor is closed
+    std::string trace_path;
+    if (argc > 2 && strcmp(argv[1], "--trace") == 0) {
+        trace_path = argv[2];
+        Trace::Start();
+    }
+
     // Setup window
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
@@ -843,6 +959,9 @@ int main(int, char**)
     // Main loop
     while (!glfwWindowShouldClose(window))
     {
+        // Start timing the frame (for the profiler overlay)
+        FrameProfiler::BeginFrame();
+
         // Poll and handle events (inputs, window resize, etc.)
         glfwPollEvents();
 
@@ -865,8 +984,14 @@ int main(int, char**)
 
         // Define shortcuts
         shortcuts.open = CTRL && KEY(ImGuiKey_O);
+        shortcuts.save = CTRL && KEY(ImGuiKey_S) && map.loaded;
         shortcuts.quit = ALT && KEY(ImGuiKey_F4);
 
+        // Toggle the frame profiler
+        if (ImGui::IsKeyPressed(ImGuiKey_F3, false)) {
+            FrameProfiler::enabled = !FrameProfiler::enabled;
+        }
+
         // Main menu bar
         if (ImGui::BeginMainMenuBar()) {
             if (ImGui::BeginMenu("File") || shortcuts.activated()) {
@@ -906,13 +1031,67 @@ int main(int, char**)
                     }
                 }
 
+                // Utilize NFD to open a disc image
+                if (ImGui::MenuItem("Open Disc Image...")) {
+                    nfdfilteritem_t filters[1] = {
+                        {
+                            "Disc images",
+                            "cue,CUE,bin,BIN,iso,ISO"
+                        }
+                    };
+                    nfdchar_t* out_path = open_file(filters);
+                    if (out_path != nullptr) {
+                        mount_disc(out_path);
+                    }
+                }
+
+                // List every map on the mounted disc
+                if (ImGui::BeginMenu("Open Map From Disc", Disc::IsMounted() && MipsEmulator::initialized)) {
+                    for (const auto& disc_map : Disc::FindMaps()) {
+                        std::filesystem::path map_path = std::filesystem::path(disc_map);
+                        std::string map_label = map_path.parent_path().parent_path().filename().string() + "/" + map_path.filename().string();
+                        if (ImGui::MenuItem(map_label.c_str()) && !ImGui::IsPopupOpen("any", ImGuiPopupFlags_AnyPopupId)) {
+
+                            // Deselect the currently-selected entity
+                            selected_entity = nullptr;
+
+                            // Set a status popup
+                            popup.text = "Loading map data for [" + map_path.filename().string() + "] ...";
+                            popup.flags = PopupFlag_Ephemeral;
+
+                            // Set the map loading function as a callback to the status popup
+                            popup.callback = [map_path] { return load_map_data(map_path); };
+                            popup.status = PopupStatus_Init;
+                        }
+                    }
+                    ImGui::EndMenu();
+                }
+
                 ImGui::Separator();
 
-                if (ImGui::MenuItem("Save", "Ctrl+S", false, false)) {
-                    // Disabled for now
+                // Write the edits back over the loaded map file
+                if (ImGui::MenuItem("Save", "Ctrl+S", false, map.loaded) || shortcuts.save) {
+                    if (!map.SaveMapFile(map.map_filename.c_str())) {
+                        error = "Could not save map file.";
+                    }
                 }
-                if (ImGui::MenuItem("Save As..", nullptr, false, false)) {
-                    // Disabled for now
+
+                // Write the edited map to a new file
+                if (ImGui::MenuItem("Save As..", nullptr, false, map.loaded)) {
+                    nfdfilteritem_t filters[1] = {
+                        {
+                            "Map files",
+                            "bin,BIN"
+                        }
+                    };
+                    std::string default_name = map.map_id + ".BIN";
+                    nfdchar_t* out_path = save_file(filters, default_name.c_str());
+                    if (out_path != nullptr) {
+                        if (!map.SaveMapFile(out_path)) {
+                            error = "Could not save map file.";
+                        }
+                        NFD_FreePath(out_path);
+                    }
                 }
 
                 ImGui::Separator();
@@ -926,6 +1105,11 @@ int main(int, char**)
                     ImGui::EndMenu();
                 }
             }
+            if (ImGui::BeginMenu("View")) {
+                ImGui::MenuItem("Composite Rooms", nullptr, &composite_rooms, map.loaded);
+                ImGui::MenuItem("Frame Profiler", "F3", &FrameProfiler::enabled);
+                ImGui::EndMenu();
+            }
             ImGui::EndMainMenuBar();
         }
 
@@ -959,7 +1143,8 @@ int main(int, char**)
                 ImGui::TextColored(ImVec4(255, 0, 0, 255), "%s", error.c_str());
             }
             ImGui::Text("PSX file path was not found.");
-            ImGui::Text("Press \"Open...\" to select the PSX file.");
+            ImGui::Text("Press \"Open...\" to select the PSX file,");
+            ImGui::Text("or \"Open Disc...\" to read everything from a disc image.");
             ImGui::NewLine();
             ImGui::Text("Note: This may be a file named");
             ImGui::SameLine();
@@ -989,6 +1174,20 @@ int main(int, char**)
             }
             ImGui::SetItemDefaultFocus();
             ImGui::SameLine();
+            if (ImGui::Button("Open Disc...", ImVec2(120, 0))) {
+                nfdfilteritem_t filters[1] = {
+                    {
+                        "Disc images",
+                        "cue,CUE,bin,BIN,iso,ISO"
+                    }
+                };
+                nfdchar_t* out_path = open_file(filters);
+                if (out_path != nullptr) {
+                    mount_disc(out_path);
+                }
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::SameLine();
             if (ImGui::Button("Cancel", ImVec2(120, 0))) {
                 exit = true;
                 ImGui::CloseCurrentPopup();
@@ -1081,6 +1280,11 @@ int main(int, char**)
 
         // Check if the emulator hasn't been initialized yet
         if (!MipsEmulator::initialized && ImGui::IsWindowAppearing()) {
+            // Remount the disc image the game files were read from last time
+            if (disc_path != nullptr && strcmp(disc_path, "(null)") != 0 && !Disc::IsMounted()) {
+                Disc::Mount(disc_path);
+            }
+
             // Make sure all configuration items exist before initialization
             if (psx_path != nullptr && bin_path != nullptr && gfx_path != nullptr) {
 
@@ -1182,6 +1386,7 @@ int main(int, char**)
 
 // -- Properties -----------------------------------------------------------------------------------------------
 
+        FrameProfiler::BeginSection(ProfilerSection_Properties);
         if (ImGui::Begin("Properties")) {
 
             if (!map.map_id.empty()) {
@@ -1474,6 +1679,7 @@ int main(int, char**)
             }
         }
         ImGui::End();
+        FrameProfiler::EndSection(ProfilerSection_Properties);
 
 
 
@@ -1481,10 +1687,14 @@ int main(int, char**)
 
 // -- Main Viewport --------------------------------------------------------------------------------------------
 
+        FrameProfiler::BeginSection(ProfilerSection_MainViewport);
         if (ImGui::Begin("Main Viewport")) {
 
             if (map.loaded) {
 
+                // Redraw anything whose CLUT was edited since the last frame
+                map.RefreshCluts();
+
                 // No padding for main scrolling viewport
                 ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
 
@@ -1591,11 +1801,26 @@ int main(int, char**)
                     // TODO: Create a draw_layer() function
 
 
+                    // Draw the cached composite of each room (redrawing only the rooms that changed)
+                    if (composite_rooms) {
+                        map.UpdateComposites();
+                        for (int i = 0; i < map.rooms.size(); i++) {
+                            Room* cur_room = &map.rooms[i];
+                            if (cur_room->load_flags == 0xFF || cur_room->composite_texture == 0) {
+                                continue;
+                            }
+                            uint x_coord = (cur_room->x_start - x_min) * 256 * main_view.zoom;
+                            uint y_coord = (cur_room->y_start - y_min) * 256 * main_view.zoom;
+                            ImGui::SetCursorPos(ImVec2(main_view.camera.x + (float)x_coord, main_view.camera.y + (float)y_coord));
+                            ImGui::Image((void*)(intptr_t)cur_room->composite_texture, ImVec2(cur_room->fg_layer.width * 16 * main_view.zoom, cur_room->fg_layer.height * 16 * main_view.zoom));
+                        }
+                    }
+
                     // Draw backgrounds
                     for (int i = 0; i < map.rooms.size(); i++) {
                         Room* cur_room = &map.rooms[i];
 
-                        if (cur_room->load_flags == 0xFF) {
+                        if (cur_room->load_flags == 0xFF || composite_rooms) {
                             continue;
                         }
 
@@ -1636,6 +1861,7 @@ int main(int, char**)
 
                                 // Set the cursor position to the target item
                                 ImGui::SetCursorPos(ImVec2(sprite_x, sprite_y));
+                                FrameProfiler::CountSprite(ImGui::IsRectVisible(ImVec2((float)cur_sprite->width * main_view.zoom, (float)cur_sprite->height * main_view.zoom)));
 
                                 // Set default UV coords
                                 ImVec2 uv0 = ImVec2(cur_sprite->flip_x, cur_sprite->flip_y);
@@ -1682,7 +1908,7 @@ int main(int, char**)
                     for (int i = 0; i < map.rooms.size(); i++) {
                         Room* cur_room = &map.rooms[i];
 
-                        if (cur_room->load_flags == 0xFF) {
+                        if (cur_room->load_flags == 0xFF || composite_rooms) {
                             continue;
                         }
 
@@ -1725,6 +1951,7 @@ int main(int, char**)
 
                                 // Set the cursor position to the target item
                                 ImGui::SetCursorPos(ImVec2(sprite_x, sprite_y));
+                                FrameProfiler::CountSprite(ImGui::IsRectVisible(ImVec2((float)cur_sprite->width * main_view.zoom, (float)cur_sprite->height * main_view.zoom)));
 
                                 // Set default UV coords
                                 ImVec2 uv0 = ImVec2(cur_sprite->flip_x, cur_sprite->flip_y);
@@ -1913,7 +2140,7 @@ int main(int, char**)
                     for (int i = 0; i < map.rooms.size(); i++) {
                         Room* cur_room = &map.rooms[i];
 
-                        if (cur_room->load_flags == 0xFF) {
+                        if (cur_room->load_flags == 0xFF || composite_rooms) {
                             continue;
                         }
 
@@ -1959,6 +2186,7 @@ int main(int, char**)
 
                                 // Set the cursor position to the target item
                                 ImGui::SetCursorPos(ImVec2(sprite_x, sprite_y));
+                                FrameProfiler::CountSprite(ImGui::IsRectVisible(ImVec2((float)cur_sprite->width * main_view.zoom, (float)cur_sprite->height * main_view.zoom)));
 
                                 // Set default UV coords
                                 ImVec2 uv0 = ImVec2(cur_sprite->flip_x, cur_sprite->flip_y);
@@ -2251,6 +2479,7 @@ int main(int, char**)
             }
         }
         ImGui::End();
+        FrameProfiler::EndSection(ProfilerSection_MainViewport);
 
 
 
@@ -2258,6 +2487,7 @@ int main(int, char**)
 
 // -- VRAM -----------------------------------------------------------------------------------------------------
 
+        FrameProfiler::BeginSection(ProfilerSection_VRAMViewer);
         if (ImGui::Begin("VRAM Viewer")) {
 
             if (map.loaded) {
@@ -2352,7 +2582,7 @@ int main(int, char**)
 
                     cursor_pos = ImGui::GetCursorPos();
                     ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x, cursor_pos.y));
-                    ImGui::Image((void*)(intptr_t)generic_cluts_texture, ImVec2(256 * vram_view.zoom, 16 * vram_view.zoom));
+                    ImGui::Image((void*)(intptr_t)Clut::GetTexture(CLUT_BANK_GENERIC, CLUT_FORMAT_OPAQUE), ImVec2(256 * vram_view.zoom, 16 * vram_view.zoom));
 
                     cursor_pos = ImGui::GetCursorPos();
                     ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x, cursor_pos.y + 5));
@@ -2360,7 +2590,7 @@ int main(int, char**)
 
                     cursor_pos = ImGui::GetCursorPos();
                     ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x, cursor_pos.y));
-                    ImGui::Image((void*)(intptr_t)item_cluts_texture, ImVec2(320 * vram_view.zoom, 16 * vram_view.zoom));
+                    ImGui::Image((void*)(intptr_t)Clut::GetTexture(CLUT_BANK_ITEM, CLUT_FORMAT_OPAQUE), ImVec2(320 * vram_view.zoom, 16 * vram_view.zoom));
 
                     cursor_pos = ImGui::GetCursorPos();
                     ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x, cursor_pos.y + 5));
@@ -2392,7 +2622,7 @@ int main(int, char**)
 
                     cursor_pos = ImGui::GetCursorPos();
                     ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x, cursor_pos.y));
-                    ImGui::Image((void*)(intptr_t)MipsEmulator::framebuffer, ImVec2(1024 * vram_view.zoom, 512 * vram_view.zoom));
+                    ImGui::Image((void*)(intptr_t)get_framebuffer_texture(), ImVec2(1024 * vram_view.zoom, 512 * vram_view.zoom));
 
                     // Show VRAM additions
                     cursor_pos = ImGui::GetCursorPos();
@@ -2407,7 +2637,7 @@ int main(int, char**)
 
                         cursor_pos = ImGui::GetCursorPos();
                         ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x + 20, cursor_pos.y));
-                        ImGui::Image((void*)(intptr_t)cur_room->vram, ImVec2(512 * vram_view.zoom, 256 * vram_view.zoom));
+                        ImGui::Image((void*)(intptr_t)map.GetRoomVRAM(cur_room, false), ImVec2(512 * vram_view.zoom, 256 * vram_view.zoom));
                     }
 
                     cursor_pos = ImGui::GetCursorPos();
@@ -2422,7 +2652,7 @@ int main(int, char**)
 
                         cursor_pos = ImGui::GetCursorPos();
                         ImGui::SetCursorPos(ImVec2(cursor_pos.x + vram_view.camera.x + 20, cursor_pos.y));
-                        ImGui::Image((void*)(intptr_t)cur_room->expanded_vram, ImVec2(2048 * vram_view.zoom, 256 * vram_view.zoom));
+                        ImGui::Image((void*)(intptr_t)map.GetRoomVRAM(cur_room, true), ImVec2(2048 * vram_view.zoom, 256 * vram_view.zoom));
                     }
 
 
@@ -2452,6 +2682,7 @@ int main(int, char**)
             }
         }
         ImGui::End();
+        FrameProfiler::EndSection(ProfilerSection_VRAMViewer);
 
 
 
@@ -2559,7 +2790,11 @@ int main(int, char**)
         // End DockSpace
         ImGui::End();
 
+        // Frame profiler overlay (on top of everything)
+        FrameProfiler::DrawOverlay();
+
         // Rendering
+        FrameProfiler::BeginSection(ProfilerSection_Render);
         ImGui::Render();
         int display_w, display_h;
         glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -2577,6 +2812,8 @@ int main(int, char**)
             ImGui::RenderPlatformWindowsDefault();
             glfwMakeContextCurrent(backup_current_context);
         }
+        FrameProfiler::EndSection(ProfilerSection_Render);
+        FrameProfiler::EndFrame(ImGui::GetDrawData());
 
         glfwSwapBuffers(window);
     }
@@ -2595,5 +2832,11 @@ int main(int, char**)
     map.Cleanup();
     MipsEmulator::Cleanup();
 
+    // Write the trace once nothing is being loaded anymore
+    if (!trace_path.empty()) {
+        Trace::Stop();
+        Trace::Write(trace_path);
+    }
+
     return 0;
 }
@@ -1,5 +1,7 @@
 #include <filesystem>
+#include <chrono>
 #include <map>
+#include <set>
 #include <algorithm>
 #include <iterator>
 #include <math.h>
@@ -14,10 +16,11 @@
 #include "rooms.h"
 #include "sprites.h"
 #include "cluts.h"
+#include "compositor.h"
 #include "tiles.h"
 #include "utils.h"
-#include "compression.h"
 #include "mips.h"
+#include "trace.h"
 #include "log.h"
 
 
@@ -49,435 +52,35 @@ static inline byte lerp(byte a, byte b, float c) {
  */
 void Map::LoadMapFile(const char* filename) {
 
+    TraceZone zone("Map::LoadMapFile");
+
     // Create a new framebuffer
     glGenFramebuffers(1, &fbo);
 
     // Bind to the framebuffer
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
-    // Set the map ID name
-    map_id = std::filesystem::path(filename).stem().string();
-
-    // Temporary buffer for optimized reads
-    byte* map_data;
-
-    // Open the file
-    FILE* fp = fopen(filename, "rb");
-
-    // Read file to the temporary buffer
-    fseek(fp, 0, SEEK_END);
-    uint num_bytes = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    map_data = (byte*)calloc(num_bytes, sizeof(byte));
-    fread(map_data, sizeof(byte), num_bytes, fp);
-    fclose(fp);
-
-    // Get the function addresses
-    update_entities_func = *(uint*)(map_data) - MAP_BIN_OFFSET;
-    process_entity_collision_func = *(uint*)(map_data + 0x04) - MAP_BIN_OFFSET;
-    spawn_onscreen_entities_func = *(uint*)(map_data + 0x08) - MAP_BIN_OFFSET;
-    init_room_entities_func = *(uint*)(map_data + 0x0C) - MAP_BIN_OFFSET;
-    pause_entities_func = *(uint*)(map_data + 0x28) - MAP_BIN_OFFSET;
-
-    // Get the data pointers
-    uint room_list_addr = *(uint*)(map_data + 0x10);
-    uint sprite_banks_addr = *(uint*)(map_data + 0x14);
-    uint cluts_addr = *(uint*)(map_data + 0x18);
-    uint entity_layouts_addr = *(uint*)(map_data + 0x1C);
-    uint tile_layers_addr = *(uint*)(map_data + 0x20);
-    uint entity_graphics_addr = *(uint*)(map_data + 0x24);
-
-    // Modify relative function addresses as needed
-    room_list_addr -= (room_list_addr > 0 ? MAP_BIN_OFFSET : 0);
-    sprite_banks_addr -= (sprite_banks_addr > 0 ? MAP_BIN_OFFSET : 0);
-    cluts_addr -= (cluts_addr > 0 ? MAP_BIN_OFFSET : 0);
-    entity_layouts_addr -= (entity_layouts_addr > 0 ? MAP_BIN_OFFSET : 0);
-    tile_layers_addr -= (tile_layers_addr > 0 ? MAP_BIN_OFFSET : 0);
-    entity_graphics_addr -= (entity_graphics_addr > 0 ? MAP_BIN_OFFSET : 0);
-
-    // Get backup entity layout address (usually referenced from the InitRoomEntities() function)
-    if (entity_layouts_addr == 0) {
-        entity_layouts_addr = *(uint *)(map_data + init_room_entities_func + 0x1C) & 0x0000FFFF;
-        // Fallback to zero if this was invalid
-        if (entity_layouts_addr == 1) {
-            entity_layouts_addr = 0;
-        }
-    }
-
-    // Entity function list address
-    uint entity_functions_addr = 0;
-
-    // Check if entity layout address was defined
-    if (entity_layouts_addr > 0) {
-        // Set entity function list address to immediately after the X/Y entity layouts
-        entity_functions_addr = entity_layouts_addr + (4 * 53) + (4 * 52);
-    }
-
-    // Otherwise search for it the hard way
-    else {
-
-        // Get the location of the function in memory
-        unsigned char* match_location = std::search(
-            map_data,
-            map_data + num_bytes,
-            std::begin(entity_create_search),
-            std::end(entity_create_search)
-        );
-
-        // Found a match
-        if (match_location < map_data + num_bytes)
-        {
-            entity_functions_addr = *(ushort*)(match_location + 0x40);
-        }
-    }
-
-
-
-
-// -- Rooms ----------------------------------------------------------------------------------------------------
-
-    // Read the room list
-    load_status_msg = "Reading Room Data ...";
-    if (room_list_addr > 0) {
-        uint i = 0;
-        while (*(uint *)(map_data + room_list_addr + i) != 0x00000040) {
-
-            // Create a new room
-            Room room;
-
-            // Allocate VRAM for the room
-            byte* tmp = (byte*)calloc(512 * 256 * 4, sizeof(byte));
-            room.vram = Utils::CreateTexture(tmp, 512, 256);
-            free(tmp);
-
-            // Read the room's properties
-            room.x_start = *(map_data + room_list_addr + i++);
-            room.y_start = *(map_data + room_list_addr + i++);
-            room.x_end = *(map_data + room_list_addr + i++);
-            room.y_end = *(map_data + room_list_addr + i++);
-            room.tile_layer_id = *(map_data + room_list_addr + i++);
-            room.load_flags = *(map_data + room_list_addr + i++);
-            room.entity_graphics_id = *(map_data + room_list_addr + i++);
-            room.entity_layout_id = *(map_data + room_list_addr + i++);
-
-            // Check if entity graphics ID needs to be fixed up
-            if (room.entity_graphics_id == 0) {
-                room.entity_graphics_id++;
-            }
-
-            // Calculate room dimensions
-            room.width = ((room.x_end + 1) - room.x_start);
-            room.height = ((room.y_end + 1) - room.y_start);
-
-            // Add the room to the room list
-            rooms.push_back(room);
-        }
-
-        Log::Info("Rooms Loaded! Total rooms: %zu\n", rooms.size());
-    }
-
-
-
-
-// -- Sprite Banks ---------------------------------------------------------------------------------------------
-
-    // Check if any sprite banks were defined
-    load_status_msg = "Reading Sprite Banks ...";
-    if (sprite_banks_addr > 0) {
-
-        // Read the sprite banks
-        sprite_banks = Sprite::ReadSpriteBanks(map_data, sprite_banks_addr, MAP_BIN_OFFSET);
-
-        Log::Info("Sprites loaded! Total banks: %d\n", sprite_banks.size());
-    }
-
-
-
-
-// -- CLUTs ----------------------------------------------------------------------------------------------------
-
-    // Get the address of the CLUT data
-    load_status_msg = "Reading CLUT Data ...";
-    if (cluts_addr > 0) {
-        uint clut_list_addr = *(uint*)(map_data + cluts_addr) - MAP_BIN_OFFSET;
-
-        // Skip the first 4 bytes (0x00000005)
-        clut_list_addr += 4;
-
-        // Loop through each CLUT entry
-        uint i = 0;
-        while (*(int*)(map_data + clut_list_addr + i) != -1) {
-
-            // Create a CLUT entry
-            ClutEntry clut_entry;
-
-            // Get the data for each entry in the CLUT list
-            clut_entry.offset = *(int*)(map_data + clut_list_addr + i) * 2;
-            clut_entry.count = *(int*)(map_data + clut_list_addr + i + 4) * 2;
-            uint clut_addr = *(uint*)(map_data + clut_list_addr + i + 8) - MAP_BIN_OFFSET;
-
-            // Allocate data for the CLUT
-            clut_entry.clut_data = (byte*)calloc(clut_entry.count, sizeof(byte));
-
-            // Get the CLUT data
-            memcpy(clut_entry.clut_data, (map_data + clut_addr), clut_entry.count);
-
-            /*
-             * NOTE:
-             * Offset >> 3 = CLUT index offset
-             * Offset << 1 = Offset from CLUT base address
-             */
-
-            // Append the entry to the CLUT list
-            entity_cluts.push_back(clut_entry);
-
-            // Go to the next entry
-            i += 12;
-        }
-
-        Log::Info("CLUTs loaded! Total CLUTs: %d\n", entity_cluts.size());
-    }
-
-
-
-
-// -- Entity Layouts -------------------------------------------------------------------------------------------
-
-    // Loop through all 53 entries
-    load_status_msg = "Reading Entity Layout Data ...";
-    if (entity_layouts_addr > 0) {
-        for (int i = 0; i < 53; i++) {
-
-            // Get the address of the entity layout
-            uint entity_list_addr = *(uint*)(map_data + entity_layouts_addr + (i * 4)) - MAP_BIN_OFFSET;
-
-            // Initialize a new list of entity init data
-            std::vector<EntityInitData> entity_init_list;
-
-            // Get the X/Y coords of the first entity (should both be -2)
-            short x_coord = *(short*)(map_data + entity_list_addr);
-            short y_coord = *(short*)(map_data + entity_list_addr + 2);
-
-            // Collect entity init data until X/Y both equal -1
-            int k = 0;
-            while (x_coord != -1 && y_coord != -1) {
-
-                // Create a new entity init data struct
-                EntityInitData init_data;
-
-                // Collect the init data
-                init_data.x_coord = x_coord;
-                init_data.y_coord = y_coord;
-                init_data.entity_id = *(ushort*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 4);
-                init_data.slot = *(ushort*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 6);
-                init_data.initial_state = *(ushort*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 8);
-
-                // Add the entity init data to the list
-                entity_init_list.push_back(init_data);
-
-                // Get the next entry
-                k++;
-                x_coord = *(short*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k));
-                y_coord = *(short*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 2);
-            }
-
-            // Add the init data list to the layout list
-            entity_layouts.push_back(entity_init_list);
-        }
-
-        Log::Info("Entity layouts loaded! Total layouts: %zu\n", entity_layouts.size());
+    // Read everything that doesn't need a texture
+    if (!ParseMapFile(filename)) {
+        return;
     }
 
 
 
 
-// -- Tile Layers ----------------------------------------------------------------------------------------------
-
-    // Check if tile layers exist
-    load_status_msg = "Reading Tile Layer Data ...";
-    if (tile_layers_addr > 0) {
-
-        // Loop through layers until no more exist
-        uint i = 0;
-        uint layer_pair_addr = *(uint*)(map_data + tile_layers_addr + (i * 8));
-        while (layer_pair_addr > 0x80180000 && layer_pair_addr < RAM_MAX_OFFSET) {
-
-            // Create a new tile layer pair
-            std::pair<TileLayer, TileLayer> tile_pair;
-
-            // Process layers in pairs
-            for (int k = 0; k < 2; k++) {
-
-                // Create a new layer
-                TileLayer* cur_layer;
-
-                // Check which layer to process
-                if (k == 0) {
-                    cur_layer = &tile_pair.first;
-                }
-                else {
-                    cur_layer = &tile_pair.second;
-                }
-
-                // Get the address of the layer data
-                uint layer_addr = *(uint*)(map_data + tile_layers_addr + (i * 8) + (k * 4)) - MAP_BIN_OFFSET;
-
-                // Get the address of the tile indices
-                cur_layer->tile_indices_addr = *(uint*)(map_data + layer_addr);
-
-                // Skip null pointers
-                if (cur_layer->tile_indices_addr == 0) {
-                    continue;
-                }
-
-                // Adjust tile index address
-                cur_layer->tile_indices_addr -= MAP_BIN_OFFSET;
-
-                // Get the layer dimensions (3-byte value, ignores highest byte)
-                uint dimension_data = *(uint*)(map_data + layer_addr + 8);
-                cur_layer->x_start = dimension_data & 0x3F;
-                cur_layer->y_start = (dimension_data >> 6) & 0x3F;
-                cur_layer->x_end = (dimension_data >> 12) & 0x3F;
-                cur_layer->y_end = (dimension_data >> 18) & 0x3F;
-
-                // Calculate dimensions in terms of tiles
-                cur_layer->width = (cur_layer->x_end - cur_layer->x_start + 1) * 16;
-                cur_layer->height = (cur_layer->y_end - cur_layer->y_start + 1) * 16;
-
-                // Get the rest of the non-pointer data
-                cur_layer->load_flags = *(byte*)(map_data + layer_addr + 11);
-                cur_layer->z_index = *(ushort*)(map_data + layer_addr + 12);
-                cur_layer->drawing_flags = *(ushort*)(map_data + layer_addr + 14);
-
-                // Calculate width and height of the layer in tiles
-                uint num_tiles = cur_layer->width * cur_layer->height;
-
-                // Read the tile indices into a newly-allocated buffer
-                cur_layer->tile_indices = (ushort*)calloc(num_tiles, sizeof(ushort));
-                memcpy(cur_layer->tile_indices, map_data + cur_layer->tile_indices_addr, num_tiles * sizeof(ushort));
-
-                // Get the address of the tile data
-                cur_layer->tile_data_addr = *(uint*)(map_data + layer_addr + 4) - MAP_BIN_OFFSET;
-
-                // Check if the tile data pointer is not currently in the map
-                if (tile_data_pointers.count(cur_layer->tile_data_addr) == 0) {
-
-                    // Create a new tile data object
-                    TileData tile_data;
-
-                    // Get the addresses of all tile data elements
-                    uint tile_ids_addr = *(uint*)(map_data + cur_layer->tile_data_addr) - MAP_BIN_OFFSET;
-                    uint tile_positions_addr = *(uint*)(map_data + cur_layer->tile_data_addr + 4) - MAP_BIN_OFFSET;
-                    uint tile_cluts_addr = *(uint*)(map_data + cur_layer->tile_data_addr + 8) - MAP_BIN_OFFSET;
-                    uint tile_collision_addr = *(uint*)(map_data + cur_layer->tile_data_addr + 12) - MAP_BIN_OFFSET;
-
-                    // Allocate memory for all elements
-                    tile_data.tileset_ids = (byte*)calloc(4096, sizeof(byte));
-                    tile_data.tile_positions = (byte*)calloc(4096, sizeof(byte));
-                    tile_data.clut_ids = (byte*)calloc(4096, sizeof(byte));
-                    tile_data.collision_ids = (byte*)calloc(4096, sizeof(byte));
-
-                    // Read all element data
-                    memcpy(tile_data.tileset_ids, map_data + tile_ids_addr, 4096);
-                    memcpy(tile_data.tile_positions, map_data + tile_positions_addr, 4096);
-                    memcpy(tile_data.clut_ids, map_data + tile_cluts_addr, 4096);
-                    memcpy(tile_data.collision_ids, map_data + tile_collision_addr, 4096);
-
-                    // Add the tile data to the tile data map using the address of the data as the key
-                    tile_data_pointers[cur_layer->tile_data_addr] = tile_data;
-                }
-
-                // Set the tile data pointer for the layer
-                cur_layer->tile_data = tile_data_pointers.at(cur_layer->tile_data_addr);
-            }
-
-            // Move to the next layer pair
-            i++;
-            layer_pair_addr = *(uint*)(map_data + tile_layers_addr + (i * 8));
-
-            // Add the layer pair to the list of layers
-            tile_layers.push_back(tile_pair);
-        }
-
-        Log::Info("Tile layers loaded! Total layers: %zu\n", tile_layers.size());
-    }
-
-
-
-
-// -- Entity Graphics ------------------------------------------------------------------------------------------
-
-    // Check if entity graphics exist
-    load_status_msg = "Reading Entity Graphics Data ...";
-    if (entity_graphics_addr > 0) {
-
-        // Loop until the beginning of the Entity Layouts section is hit (indicating end of graphics section)
-        uint i = 0;
-        while (entity_graphics_addr + (i * 4) != entity_layouts_addr) {
-
-            // Get the address for the next list of entity graphics entries
-            uint graphics_list_addr = *(uint*)(map_data + entity_graphics_addr + (i * 4));
-
-            // Initialize a new list of entity init data
-            std::vector<EntityGraphicsData> entity_graphics_data_list;
-
-            // Skip any null entries
-            if (graphics_list_addr == 0) {
-                entity_graphics.push_back(entity_graphics_data_list);
-                i++;
-                continue;
-            }
-
-            // Adjust graphics list address
-            graphics_list_addr -= MAP_BIN_OFFSET;
-
-            // Get the first identifier
-            int marker = *(int*)(map_data + graphics_list_addr);
-
-            // Only process if this wasn't an ending marker
-            if (marker > 0) {
-
-                // Skip the first 4 bytes
-                graphics_list_addr += 4;
-
-                // Loop through each entry until the end of the list (-1) was encountered
-                uint k = 0;
-                while (marker != -1) {
-
-                    // Create a new entity graphic entry
-                    EntityGraphicsData graphics_data;
-
-                    // Read the data
-                    graphics_data.vram_y = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)));
-                    graphics_data.vram_x = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 2);
-                    graphics_data.height = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 4);
-                    graphics_data.width = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 6);
-                    graphics_data.compressed_graphics_addr = *(uint*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 8);
-
-                    // Add the entry to the entity graphics list
-                    entity_graphics_data_list.push_back(graphics_data);
-
-                    // Move to the next entry
-                    k++;
-                    marker = *(int*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)));
-                }
-            }
-
-            // Add the entity graphics data to the graphics list
-            entity_graphics.push_back(entity_graphics_data_list);
+// -- Populate Room Data ---------------------------------------------------------------------------------------
 
-            // Move to the next list address
-            i++;
-        }
+    // Decompress every entity graphics block the rooms load
+    DecompressEntityGraphics();
 
-        Log::Info("Entity graphics loaded! Total entries: %zu\n", entity_graphics.size());
+    // Create one texture per block (shared by every room that loads it)
+    for (const auto& block : entity_graphics_blocks) {
+        const std::vector<byte>& tileset_data = cache.entity_graphics.at(block.first);
+        byte* pixel_data = Utils::Indexed_to_RGBA(tileset_data.data(), tileset_data.size() / 4);
+        entity_graphics_textures[block.first] = Utils::CreateTexture(pixel_data, block.second.width / 4, block.second.height);
+        free(pixel_data);
     }
 
-
-
-
-// -- Populate Room Data ---------------------------------------------------------------------------------------
-
     // Loop through each room
     load_status_msg = "Populating Room Data ...";
     for (auto& room : rooms) {
@@ -485,157 +88,59 @@ void Map::LoadMapFile(const char* filename) {
         Room* cur_room = &room;
 
         // Get the layer data only if this is not a transition room
-        if (cur_room->load_flags == 0xFF) {
-            continue;
-        }
-
-        // Get the layer data for the room
-        cur_room->fg_layer = tile_layers[cur_room->tile_layer_id].first;
-        cur_room->bg_layer = tile_layers[cur_room->tile_layer_id].second;
-
-        // Check whether to modify entity graphics ID
-        uint gfx_id = cur_room->entity_graphics_id;
-        if (gfx_id > 0) {
-            gfx_id -= 1;
-        }
-
-        // Get the list of entity graphics for the room
-        std::vector<EntityGraphicsData> entity_graphics_list = entity_graphics[gfx_id];
+        if (cur_room->load_flags != 0xFF) {
 
-        // Loop through each graphics list entry
-        for (auto graphics_data : entity_graphics_list) {
-
-            // Skip this entry if no data address was defined
-            if (graphics_data.compressed_graphics_addr == 0) {
-                continue;
+            // Check whether to modify entity graphics ID
+            uint gfx_id = cur_room->entity_graphics_id;
+            if (gfx_id > 0) {
+                gfx_id -= 1;
             }
 
-            // Adjust compressed graphics address
-            graphics_data.compressed_graphics_addr -= MAP_BIN_OFFSET;
-
-            // Determine the size of the decompressed data (index bytes [1], not pixels [4])
-            uint data_size = graphics_data.width * graphics_data.height;
-
-            // Allocate space for decompression and decompress the data
-            byte* tileset_data = (byte*)calloc(data_size, sizeof(byte));
-            Compression::Decompress(tileset_data, (map_data + graphics_data.compressed_graphics_addr));
-
-            // Get RGBA bytes from the tileset data
-            byte* pixel_data = Utils::Indexed_to_RGBA(tileset_data, data_size / 4);
-
-            // Create a texture from the data
-            GLuint entity_tileset_texture = Utils::CreateTexture(pixel_data, graphics_data.width / 4, graphics_data.height);
-
-            // Write the texture data to the room's VRAM
-            glBindTexture(GL_TEXTURE_2D, cur_room->vram);
-            glTexSubImage2D(
-                GL_TEXTURE_2D,
-                0,
-                graphics_data.vram_x,
-                graphics_data.vram_y - 256,
-                graphics_data.width / 4,
-                graphics_data.height,
-                GL_RGBA,
-                GL_UNSIGNED_BYTE,
-                pixel_data
-            );
-            glBindTexture(GL_TEXTURE_2D, 0);
-
-            // Free data
-            free(tileset_data);
-            free(pixel_data);
-
-            // Calculate chunk coords
-            uint chunk_x = graphics_data.vram_x >> 6;
-            uint chunk_y = 3 - (graphics_data.vram_y >> 8);
-
-            // Convert chunk coords to VRAM index
-            uint vram_idx = (((chunk_y * 8) + chunk_x) << 2);
-
-            // Calculate subchunk
-            vram_idx |= ((graphics_data.vram_x << 2) & 0x80) >> 7;
-            vram_idx |= (graphics_data.vram_y & 0x80) >> 6;
-
-            // Set entity tileset ID
-            cur_room->entity_tilesets[vram_idx] = entity_tileset_texture;
-
-            // Calculate texture page
-            /*
-            uint tpage_x = graphics_data.vram_x / 64;
-            uint tpage_y = graphics_data.vram_y / 256;
-            uint tpage_idx = (tpage_y << 4) + tpage_x;
-            cur_room->texture_pages[tpage_idx] = entity_tileset_texture;
-            */
-        }
-
-        // Attach to the target texture and read the pixels into VRAM
-        //glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cur_room->vram, 0);
-
-        // Convert VRAM to texture pages
-        for (int k = 0; k < 8; k++) {
-
-            byte* pixels = Utils::GetPixels(cur_room->vram, 64 * k, 0, 64, 256);
-
-            // Create page texture from VRAM section
-            GLuint page_texture = Utils::CreateTexture(pixels, 64, 256);
-            cur_room->texture_pages.push_back(page_texture);
-            free(pixels);
-        }
+            // Get the list of entity graphics for the room
+            static const std::vector<EntityGraphicsData> no_graphics;
+            const std::vector<EntityGraphicsData>& entity_graphics_list = (gfx_id < entity_graphics.size() ? entity_graphics[gfx_id] : no_graphics);
 
-        // Expand VRAM additions to better show
-        const byte greyscale_clut[16 * 4] = {
-            0x00, 0x00, 0x00, 0x00,
-            0x11, 0x11, 0x11, 0xFF,
-            0x22, 0x22, 0x22, 0xFF,
-            0x33, 0x33, 0x33, 0xFF,
-            0x44, 0x44, 0x44, 0xFF,
-            0x55, 0x55, 0x55, 0xFF,
-            0x66, 0x66, 0x66, 0xFF,
-            0x77, 0x77, 0x77, 0xFF,
-            0x88, 0x88, 0x88, 0xFF,
-            0x99, 0x99, 0x99, 0xFF,
-            0xAA, 0xAA, 0xAA, 0xFF,
-            0xBB, 0xBB, 0xBB, 0xFF,
-            0xCC, 0xCC, 0xCC, 0xFF,
-            0xDD, 0xDD, 0xDD, 0xFF,
-            0xEE, 0xEE, 0xEE, 0xFF,
-            0xFF, 0xFF, 0xFF, 0xFF
-        };
-        byte *pixels = Utils::GetPixels(cur_room->vram, 0, 0, 512, 256);
-        byte *rgba_pixels = (byte *) calloc(2048 * 256 * 4, sizeof(byte));
-        Utils::VRAM_to_RGBA(pixels, greyscale_clut, 512, 256, rgba_pixels);
-        cur_room->expanded_vram = Utils::CreateTexture(rgba_pixels, 2048, 256);
-        free(pixels);
-        free(rgba_pixels);
-    }
+            // Loop through each graphics list entry
+            for (auto graphics_data : entity_graphics_list) {
 
+                // Skip this entry if no data address was defined
+                if (graphics_data.compressed_graphics_addr == 0) {
+                    continue;
+                }
 
+                // Adjust compressed graphics address
+                graphics_data.compressed_graphics_addr -= MAP_BIN_OFFSET;
 
+                // Calculate chunk coords
+                uint chunk_x = graphics_data.vram_x >> 6;
+                uint chunk_y = 3 - (graphics_data.vram_y >> 8);
 
-// -- Entity Functions -----------------------------------------------------------------------------------------
+                // Convert chunk coords to VRAM index
+                uint vram_idx = (((chunk_y * 8) + chunk_x) << 2);
 
-    // Make sure entity functions exist
-    load_status_msg = "Reading Entity Functions ...";
-    if (entity_functions_addr > 0) {
+                // Calculate subchunk
+                vram_idx |= ((graphics_data.vram_x << 2) & 0x80) >> 7;
+                vram_idx |= (graphics_data.vram_y & 0x80) >> 6;
 
-        // Get the first function pointer (should point to dummy data)
-        uint func_addr = *(uint*)(map_data + entity_functions_addr);
+                // Set entity tileset ID
+                cur_room->entity_tilesets[vram_idx] = entity_graphics_textures.at(graphics_data.compressed_graphics_addr);
+            }
+        }
 
-        // Loop until a non-pointer is found
-        uint i = 1;
-        while (func_addr >= MAP_BIN_OFFSET && func_addr < RAM_MAX_OFFSET) {
-            entity_functions.push_back(func_addr - MAP_BIN_OFFSET);
-            func_addr = *(uint*)(map_data + entity_functions_addr + (i++ * 4));
+        // Build the room's texture pages, reusing any page with the same contents (usually most of them)
+        for (int k = 0; k < 8; k++) {
+            std::vector<uint> page_key = GetPatchKey(cur_room->vram_patches, 64 * k, 64);
+            auto page = room_page_textures.find(page_key);
+            if (page == room_page_textures.end()) {
+                byte* pixels = ComposeRoomVRAM(cur_room->vram_patches, 64 * k, 64);
+                page = room_page_textures.emplace(page_key, Utils::CreateTexture(pixels, 64, 256)).first;
+                free(pixels);
+            }
+            cur_room->texture_pages.push_back(page->second);
         }
     }
 
-    Log::Info("Entity functions: %zu\n", entity_functions.size());
-
-
-
-
-    // Free the temporary memory
-    free(map_data);
+    Log::Info("Room VRAM pages: %zu distinct for %zu rooms\n", room_page_textures.size(), rooms.size());
 }
 
 
@@ -650,100 +155,16 @@ void Map::LoadMapFile(const char* filename) {
  */
 void Map::LoadMapGraphics(const char* filename) {
 
-    // Bind to the framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-
-    // Open the graphics file (F_*.BIN)
-    FILE* fp = fopen(filename, "rb");
-
-    // Get the file size
-    fseek(fp, 0, SEEK_END);
-    uint num_bytes = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    // Allocate space for the data
-    byte* file_data = (byte*)calloc(num_bytes, sizeof(byte));
-
-    // Read the data and close the file
-    fread(file_data, sizeof(byte), num_bytes, fp);
-    fclose(fp);
-
-
-
-
-
-    // Convert file data to RGBA pixels
-    byte* pixel_data = Utils::Indexed_to_RGBA(file_data, num_bytes / 2);
-
-
-
-
-    /*
-    // Create a new framebuffer
-    GLuint fbo;
-    glGenFramebuffers(1, &fbo);
+    TraceZone zone("Map::LoadMapGraphics");
 
     // Bind to the framebuffer
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    */
 
-
-
-
-
-    // Loop through each slice of the data
-    for (int i = 0; i < (num_bytes) / 8192; i++) {
-
-        GLuint chunk_texture = Utils::CreateTexture(pixel_data + (i * 8192 * 2), 32, 128);
-
-        // Add the texture pointer to the list of map textures
-        map_textures.push_back(chunk_texture);
-    }
-
-
-
-
-
-
-
-    load_status_msg = "Reading Map Textures Into VRAM ...";
-
-    // Allocate data for a full VRAM texture
-    byte* vram_data = (byte*)calloc(num_bytes * 4 * 2, sizeof(byte));
-
-    // Keep track of offset into VRAM
-    uint cur_offset = 0;
-
-    // Loop through each line of all 32 textures
-    for (int k = 0; k < 128; k++) {
-        for (int i = 0; i < 32; i++) {
-
-            // Only process if this is within the TOP half of VRAM
-            if (i % 4 < 2) {
-
-                // Attach to the target texture and read the pixels into VRAM
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, map_textures[i], 0);
-                glReadPixels(0, k, 32, 1, GL_RGBA, GL_UNSIGNED_BYTE, vram_data + cur_offset);
-                cur_offset += 32 * 4;
-            }
-        }
-    }
-
-    // Loop through each line of all 32 textures
-    for (int k = 0; k < 128; k++) {
-        for (int i = 0; i < 32; i++) {
-
-            // Only process if this is within the BOTTOM half of VRAM
-            if (i % 4 > 1) {
-
-                // Attach to the target texture and read the pixels into VRAM
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, map_textures[i], 0);
-                glReadPixels(0, k, 32, 1, GL_RGBA, GL_UNSIGNED_BYTE, vram_data + cur_offset);
-                cur_offset += 32 * 4;
-
-            }
-        }
+    // Build the map's VRAM and tile CLUTs
+    if (!BuildMapVRAM(filename)) {
+        return;
     }
+    byte* vram_data = cache.vram.data();
 
 
 
@@ -786,26 +207,15 @@ void Map::LoadMapGraphics(const char* filename) {
 
 
 
-    load_status_msg = "Loading Map Tile CLUTs ...";
-
-    // Bind to the VRAM texture
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vram_texture, 0);
-
-    // Read all of the CLUT data from the VRAM texture to skip any further processing
-    byte* map_rgba_cluts = (byte*)calloc(256 * 16 * 4, sizeof(byte));
-    glReadPixels(0, 240, 256, 16, GL_RGBA, GL_UNSIGNED_BYTE, map_rgba_cluts);
-    byte* indexed_cluts = Utils::RGBA_to_Indexed(map_rgba_cluts, 256 * 16);
-    memcpy(map_tile_cluts[0], indexed_cluts, 256 * 16 * 2);
-    free(map_rgba_cluts);
-    free(indexed_cluts);
-
     // Collect all of the tilesets
     load_status_msg = "Creating Tileset Textures ...";
     for (int i = 0; i < 8; i++) {
 
-        // Read a block of pixels from VRAM
+        // Copy a block of pixels from VRAM
         byte* tileset_data = (byte*)calloc(64 * 256 * 4, sizeof(byte));
-        glReadPixels(i * 64, 0, 64, 256, GL_RGBA, GL_UNSIGNED_BYTE, tileset_data);
+        for (int y = 0; y < 256; y++) {
+            memcpy(tileset_data + (y * 64 * 4), vram_data + (((y * 512) + (i * 64)) * 4), 64 * 4);
+        }
 
         // Create a texture from each VRAM block
         GLuint tileset_texture = Utils::CreateTexture(tileset_data, 64, 256);
@@ -837,6 +247,13 @@ void Map::LoadMapGraphics(const char* filename) {
 
 
 
+    // Decode every unique tile
+    load_status_msg = "Decoding Tiles ...";
+    DecodeTiles();
+
+    // Texture for each unique tile (created on first use)
+    unique_tile_textures.assign(cache.tile_empty.size(), 0);
+
     // Loop through all of the layers
     load_status_msg = "Creating Tile Textures ...";
     for (size_t i = 0; i < tile_layers.size(); i++) {
@@ -848,80 +265,37 @@ void Map::LoadMapGraphics(const char* filename) {
 
             // Get the current FG or BG tile layer
             TileLayer* cur_layer = (k == 0 ? &tile_layers[i].first : &tile_layers[i].second);
+            const std::vector<uint>& layer_tiles = cache.layer_tiles[(i * 2) + k];
 
-            // Loop through each tile
-            for (int idx = 0; idx < cur_layer->width * cur_layer->height; idx++) {
-
-                // Get the tile
-                ushort tile_idx = cur_layer->tile_indices[idx];
-                byte tileset_id = cur_layer->tile_data.tileset_ids[tile_idx];
-                byte tile_position = cur_layer->tile_data.tile_positions[tile_idx];
-                byte clut_id = cur_layer->tile_data.clut_ids[tile_idx];
-                byte tile_collision = cur_layer->tile_data.collision_ids[tile_idx];
-
-                // Get the tileset to use for the lookup
-                GLuint tileset = map_tilesets[tileset_id];
-
-                // Get the X/Y offset of the tile within the tileset
-                uint offset_x = (tile_position & 0xF) * 16;
-                uint offset_y = ((tile_position >> 4) & 0xF) * 16;
-
-                // Adjust the offsets as needed for room types 0x20 and 0x40
-                if ((cur_layer->load_flags & 0x20) == 0x20) {
-                    offset_x %= 128;
-                    offset_y -= 16 * (offset_y % 32 != 0);
-                }
-
-                // Attach to the tileset
-                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileset, 0);
+            // Skip layers that couldn't be decoded
+            if (layer_tiles.size() != cur_layer->width * cur_layer->height) {
+                continue;
+            }
 
-                // Get the pixels from the tileset
-                uint tile_width = 16;
-                uint tile_height = 16;
-                byte* pixels = (byte*)calloc((tile_width / 4) * tile_height * 4, sizeof(byte));
-                glReadBuffer(GL_COLOR_ATTACHMENT0);
-                glReadPixels(offset_x / 4, offset_y, tile_width / 4, tile_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            // Loop through each tile
+            for (uint idx = 0; idx < layer_tiles.size(); idx++) {
 
-                // Allocate space for the tile
-                byte* tile_output = (byte*)calloc(tile_width * tile_height * 4, sizeof(byte));
+                // Index of the tile within the unique tile list
+                uint unique_idx = layer_tiles[idx];
 
-                // Select the appropriate CLUT
-                uint num_pixels = 0;
-                if ((cur_layer->drawing_flags & 0x200) == 0x200) {
-                    uint clut_offset = (clut_id % 256) * 16 * 4;
-                    num_pixels = Utils::VRAM_to_RGBA(pixels, generic_rgba_cluts + clut_offset, tile_width / 4, tile_height, tile_output);
-                }
-                else {
-                    byte* clut = Utils::Indexed_to_RGBA(map_tile_cluts[clut_id], 32);
-                    num_pixels = Utils::VRAM_to_RGBA(pixels, clut, tile_width / 4, tile_height, tile_output);
-                    free(clut);
+                // Create the texture the first time the unique tile is used
+                if (unique_tile_textures[unique_idx] == 0) {
+                    unique_tile_textures[unique_idx] = Utils::CreateTexture(cache.tiles.data() + (unique_idx * 16 * 16 * 4), 16, 16);
                 }
 
                 // Create a new tile object for management
                 Tile tile;
 
                 // Set the tile's texture
-                tile.texture = Utils::CreateTexture(tile_output, 16, 16);
+                tile.texture = unique_tile_textures[unique_idx];
 
                 // Check if tile was empty
-                if (num_pixels == 0) {
+                if (cache.tile_empty[unique_idx]) {
                     tile.empty = true;
                 }
 
                 // Add the tile to the layer
-                /*
-                if (k == 0) {
-                    tile_layers[i].first.tiles.push_back(tile);
-                }
-                else {
-                    tile_layers[i].second.tiles.push_back(tile);
-                }
-                */
                 cur_layer->tiles.push_back(tile);
-
-                // Free the data
-                free(tile_output);
-                free(pixels);
             }
         }
     }
@@ -955,80 +329,23 @@ void Map::LoadMapGraphics(const char* filename) {
 
         Room* cur_room = &rooms[i];
 
-        byte* bg_blank = (byte*)calloc(cur_room->bg_layer.width * 16 * cur_room->bg_layer.height * 16 * 4, sizeof(byte));
-        byte* fg_blank = (byte*)calloc(cur_room->fg_layer.width * 16 * cur_room->fg_layer.height * 16 * 4, sizeof(byte));
-        cur_room->bg_texture = Utils::CreateTexture(bg_blank, cur_room->bg_layer.width * 16, cur_room->bg_layer.height * 16);
-        cur_room->fg_texture = Utils::CreateTexture(fg_blank, cur_room->fg_layer.width * 16, cur_room->fg_layer.height * 16);
-
-        // Check if BG exists
-        if (cur_room->bg_layer.tiles.size() > 0) {
-
-            // Loop through each BG tile row
-            for (uint y = 0; y < cur_room->bg_layer.height; y++) {
-
-                // Loop through each tile
-                for (uint x = 0; x < cur_room->bg_layer.width; x++) {
-
-                    // Get the index of the tile
-                    uint idx = (y * cur_room->bg_layer.width) + x;
-
-                    GLuint cur_tex = cur_room->bg_layer.tiles[idx].texture;
-                    byte* pixels = Utils::GetPixels(cur_tex, 0, 0, 16, 16);
-
-                    glBindTexture(GL_TEXTURE_2D, cur_room->bg_texture);
-                    glTexSubImage2D(
-                        GL_TEXTURE_2D,
-                        0,
-                        x * 16,
-                        y * 16,
-                        16,
-                        16,
-                        GL_RGBA,
-                        GL_UNSIGNED_BYTE,
-                        pixels
-                    );
-                    glBindTexture(GL_TEXTURE_2D, 0);
-                    free(pixels);
-
-                }
-            }
-        }
-
-        // Check if FG exists
-        if (cur_room->fg_layer.tiles.size() > 0) {
-
-            // Loop through each FG tile row
-            for (uint y = 0; y < cur_room->fg_layer.height; y++) {
-
-                // Loop through each tile
-                for (uint x = 0; x < cur_room->fg_layer.width; x++) {
-
-                    // Get the index of the tile
-                    uint idx = (y * cur_room->fg_layer.width) + x;
-
-                    GLuint cur_tex = cur_room->fg_layer.tiles[idx].texture;
-                    byte* pixels = Utils::GetPixels(cur_tex, 0, 0, 16, 16);
+        // Compose each layer from the decoded tiles in CPU memory before uploading it
+        for (int k = 0; k < 2; k++) {
 
-                    glBindTexture(GL_TEXTURE_2D, cur_room->fg_texture);
-                    glTexSubImage2D(
-                        GL_TEXTURE_2D,
-                        0,
-                        x * 16,
-                        y * 16,
-                        16,
-                        16,
-                        GL_RGBA,
-                        GL_UNSIGNED_BYTE,
-                        pixels
-                    );
-                    glBindTexture(GL_TEXTURE_2D, 0);
-                    free(pixels);
+            TileLayer* cur_layer = (k == 0 ? &cur_room->bg_layer : &cur_room->fg_layer);
+            uint layer_width = cur_layer->width * 16;
+            byte* layer_pixels = ComposeLayer(cur_room, k == 1);
 
-                }
+            // Create the layer texture
+            GLuint layer_texture = Utils::CreateTexture(layer_pixels, layer_width, cur_layer->height * 16);
+            if (k == 0) {
+                cur_room->bg_texture = layer_texture;
             }
+            else {
+                cur_room->fg_texture = layer_texture;
+            }
+            free(layer_pixels);
         }
-        free(bg_blank);
-        free(fg_blank);
     }
 
 
@@ -1046,14 +363,6 @@ void Map::LoadMapGraphics(const char* filename) {
     */
 
 
-    // Free the file data
-    free(file_data);
-
-    // Free the pixels
-    free(pixel_data);
-
-    // Free VRAM data
-    free(vram_data);
 
 
 
@@ -1125,6 +434,8 @@ void Map::LoadMapGraphics(const char* filename) {
  */
 void Map::LoadMapEntities() {
 
+    TraceZone zone("Map::LoadMapEntities");
+
     /*
     // Create a new framebuffer
     GLuint fbo;
@@ -1134,91 +445,28 @@ void Map::LoadMapEntities() {
     // Bind to the framebuffer
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
+    // Restore or start recording the emulation results
+    EntityEmulationState emulation;
+    BeginEntityEmulation(&emulation);
+
+    // Start tracking the emulated CLUT table
+    Clut::Reset(CLUT_BANK_RAM, CLUT_DATA_SIZE / 32);
+
     // Process all entity functions
     for (auto & room : rooms) {
 
         // Get the current room
         Room* cur_room = &room;
 
-        // Get the entity init data
-        uint layout_id = cur_room->entity_layout_id;
-        std::vector<EntityInitData> init_data_list = entity_layouts[layout_id];
-
-        // Reset the emulator
-        //MipsEmulator::Reset();
-        MipsEmulator::LoadState();
-        MipsEmulator::ClearEntities();
-
-        // Populate CLUT stuff
-        //load_status_msg = "Populating CLUT Data in MIPS RAM ...";
-        MipsEmulator::ProcessFunction(0x000EAD7C);
-
-        // Loop through each entry in the init list
-        load_status_msg = "Copying Entity Data to MIPS RAM ...";
-        for (auto init_data : init_data_list) {
-
-            // Create initial entities
-            EntityData entity_data;
+        // Run (or restore) the room's entities
+        std::vector<Entity> entities = EmulateRoom(cur_room - rooms.data(), &emulation);
 
-            // Populate initial entity data
-            entity_data.object_id = init_data.entity_id & 0x03FF;
-            entity_data.update_function = entity_functions[entity_data.object_id] + MAP_BIN_OFFSET;
-            entity_data.pos_x = init_data.x_coord;
-            entity_data.pos_y = init_data.y_coord;
-            entity_data.initial_state = init_data.initial_state;
-            entity_data.room_slot = init_data.slot >> 8;
-            entity_data.unk68 = (init_data.slot >> 10) & 7;
+        // Pick up any CLUTs the room's entities modified (only the ones that changed are expanded again)
+        Clut::Set(CLUT_BANK_RAM, 0, CLUT_DATA_SIZE / 32, MipsEmulator::ram + CLUT_BASE_ADDR);
 
-            // Fetch entity function address
-            uint entity_func_id = init_data.entity_id & 0x03FF;
-            uint entity_func = entity_functions[entity_func_id] + MAP_BIN_OFFSET - RAM_BASE_OFFSET;
-
-            // Determine entity location in RAM
-            uint entity_ram_location = ENTITY_ALLOCATION_START + ((init_data.slot & 0xFF) * sizeof(entity_data));
-
-            // Copy the entity structure into the emulator's RAM
-            MipsEmulator::CopyToRAM(entity_ram_location, &entity_data, sizeof(entity_data));
-        }
-
-        // Write current room dimensions to RAM
-        MipsEmulator::WriteIntToRAM(ROOM_WIDTH_ADDR, cur_room->width);
-        MipsEmulator::WriteIntToRAM(ROOM_HEIGHT_ADDR, cur_room->width);
-
-        // Write current room coordinates to RAM
-        MipsEmulator::WriteIntToRAM(ROOM_X_COORD_START_ADDR, cur_room->x_start);
-        MipsEmulator::WriteIntToRAM(ROOM_Y_COORD_START_ADDR, cur_room->y_start);
-        MipsEmulator::WriteIntToRAM(ROOM_X_COORD_END_ADDR, cur_room->x_end);
-        MipsEmulator::WriteIntToRAM(ROOM_Y_COORD_END_ADDR, cur_room->y_end);
-
-        // Write tile layout to RAM
-        MipsEmulator::WriteIntToRAM(ROOM_TILE_INDICES_ADDR, cur_room->fg_layer.tile_indices_addr + MAP_RAM_OFFSET);
-        MipsEmulator::WriteIntToRAM(ROOM_TILE_DATA_ADDR, cur_room->fg_layer.tile_data_addr + MAP_RAM_OFFSET);
-
-        // Process all of the entities in RAM
-        load_status_msg = "Running Entity Functions ...";
-        std::vector<Entity> entities = MipsEmulator::ProcessEntities();
-
-        // Commit any framebuffer changes
-        load_status_msg = "Committing Framebuffer Changes ...";
-        byte* fb_pixels = Utils::GetPixels(MipsEmulator::framebuffer, 0, 240, 768, 16);
-        byte* indexed_pixels = Utils::RGBA_to_Indexed(fb_pixels, 768 * 16);
-        free(fb_pixels);
-        for (int k = 0; k < 768 * 16 * 2; k++) {
-            byte val = indexed_pixels[k];
-            if (val > 0) {
-                *(byte*)(MipsEmulator::ram + CLUT_BASE_ADDR + k) = val;
-            }
-        }
-        free(indexed_pixels);
-
-        // Regenerate entity CLUT textures just in case an entity modified the CLUTs
-        byte* entity_rgba_cluts = (byte*)calloc(0x6000 * 4, sizeof(byte));
-        Utils::CLUT_to_RGBA(MipsEmulator::ram + CLUT_BASE_ADDR + 0x4000, entity_rgba_cluts, 256, false);
-        entity_cluts_texture = Utils::CreateTexture(entity_rgba_cluts, 256, 16);
-        free(entity_rgba_cluts);
-
-        // Associate entities with the room
+        // Associate entities with the room and draw their polygons while RAM still holds them
         cur_room->entities = entities;
+        RenderPolygons(cur_room - rooms.data());
 
         load_status_msg = "Processing Entity Graphics ...";
         for (auto& entity_entry : entities) {
@@ -1293,42 +541,10 @@ void Map::LoadMapEntities() {
                                 texture = cur_room->texture_pages[tpage - 0x10];
                             }
 
-                            byte *pixels = Utils::GetPixels(texture, polygon.u0 / 4, polygon.v0, tex_width / 4, tex_height);
-
-                            // Default to generic CLUT
-                            byte* clut;
-
-                            // Get the CLUT's location in VRAM
-                            uint clut_vram_addr = *(ushort*)(MipsEmulator::ram + CLUT_INDEX_ADDR + (polygon.clut * 2)) << 5;
-                            uint clut_y = (clut_vram_addr / 2048) - 240;
-                            uint clut_x = (clut_vram_addr % 2048) / 32;
-
-                            // Check which CLUT to use
-                            if (clut_x < 0x10) {
-                                clut = Utils::GetPixels(generic_cluts_texture, clut_x * 16, clut_y, 16, 1);
-                            }
-                            else if (clut_x < 0x20) {
-                                clut_x = (polygon.clut & 0x0F);
-                                clut = Utils::GetPixels(entity_cluts_texture, clut_x * 16, clut_y, 16, 1);
-                            }
-                            else {
-                                clut_x = (polygon.clut & 0x0F);
-                                clut = Utils::GetPixels(map_vram, clut_x * 16, clut_y + 240, 16, 1);
-                            }
-
-                            // Allocate space for the RGBA image
-                            byte *rgba_pixels = (byte *)calloc(tex_width * tex_height * 4, sizeof(byte));
-
-                            // Expand all pixels by their CLUT components
-                            Utils::VRAM_to_RGBA(pixels, clut, tex_width / 4, tex_height, rgba_pixels);
-                            Utils::HexDump(pixels, tex_width * tex_height * 4);
-                            free(pixels);
-                            free(clut);
-
-                            // Create texture from thingo
-                            GLuint part_texture = Utils::CreateTexture(rgba_pixels, tex_width, tex_height);
-                            entity_subsprite.texture = part_texture;
-                            free(rgba_pixels);
+                            // Decode the part with the CLUT the primitive references (or reuse an identical part)
+                            SpriteSource source = {texture, polygon.u0 / 4u, polygon.v0, tex_width, tex_height};
+                            SelectPolygonClut(polygon.clut, &source);
+                            entity_subsprite.texture = AcquireSpritePart(FindSpritePart(source));
 
                             // Determine polygon offsets
                             entity_subsprite.offset_x = polygon.x0;
@@ -1430,52 +646,21 @@ void Map::LoadMapEntities() {
                                 // Get the entity texture via the texture page
                                 GLuint texture = 0;
                                 if (polygon.tpage < 0x10) {
-                                    if (polygon.tpage >= 8) {
-                                        texture = map_tilesets[polygon.tpage - 8];
-                                    }
-                                    else {
-                                        texture = map_tilesets[polygon.tpage];
-                                    }
-                                }
-                                else {
-                                    texture = cur_room->texture_pages[polygon.tpage - 0x10];
-                                }
-
-                                byte *pixels = Utils::GetPixels(texture, floor(left / 4), top, tex_width / 4, tex_height);
-
-                                // Default to generic CLUT
-                                byte* clut;
-
-                                // Get the CLUT's location in VRAM
-                                uint clut_vram_addr = *(ushort*)(MipsEmulator::ram + CLUT_INDEX_ADDR + (polygon.clut * 2)) << 5;
-                                uint clut_y = (clut_vram_addr / 2048) - 240;
-                                uint clut_x = (clut_vram_addr % 2048) / 32;
-
-                                // Check which CLUT to use
-                                if (clut_x < 0x10) {
-                                    clut = Utils::GetPixels(generic_cluts_texture, clut_x * 16, clut_y, 16, 1);
-                                }
-                                else if (clut_x < 0x20) {
-                                    clut_x = (polygon.clut & 0x0F);
-                                    clut = Utils::GetPixels(entity_cluts_texture, clut_x * 16, clut_y, 16, 1);
+                                    if (polygon.tpage >= 8) {
+                                        texture = map_tilesets[polygon.tpage - 8];
+                                    }
+                                    else {
+                                        texture = map_tilesets[polygon.tpage];
+                                    }
                                 }
                                 else {
-                                    clut_x = (polygon.clut & 0x0F);
-                                    clut = Utils::GetPixels(map_vram, clut_x * 16, clut_y + 240, 16, 1);
+                                    texture = cur_room->texture_pages[polygon.tpage - 0x10];
                                 }
 
-                                // Allocate space for the RGBA image
-                                byte *rgba_pixels = (byte *) calloc(tex_width * tex_height * 4, sizeof(byte));
-
-                                // Expand all pixels by their CLUT components
-                                Utils::VRAM_to_RGBA(pixels, clut, tex_width / 4, tex_height, rgba_pixels);
-                                free(pixels);
-                                free(clut);
-
-                                // Create texture from thingo
-                                GLuint part_texture = Utils::CreateTexture(rgba_pixels, tex_width, tex_height);
-                                entity_subsprite.texture = part_texture;
-                                free(rgba_pixels);
+                                // Decode the part with the CLUT the primitive references (or reuse an identical part)
+                                SpriteSource source = {texture, left / 4, top, tex_width, tex_height};
+                                SelectPolygonClut(polygon.clut, &source);
+                                entity_subsprite.texture = AcquireSpritePart(FindSpritePart(source));
                             }
 
                             // Otherwise this was a POLY_G4 primitive
@@ -1687,41 +872,10 @@ void Map::LoadMapEntities() {
                                 texture = cur_room->texture_pages[polygon.tpage - 0x10];
                             }
 
-                            byte *pixels = Utils::GetPixels(texture, floor(left / 4), top, right / 4, bottom);
-
-                            // Default to generic CLUT
-                            byte* clut;
-
-                            // Get the CLUT's location in VRAM
-                            uint clut_vram_addr = *(ushort*)(MipsEmulator::ram + CLUT_INDEX_ADDR + (polygon.clut * 2)) << 5;
-                            uint clut_y = (clut_vram_addr / 2048) - 240;
-                            uint clut_x = (clut_vram_addr % 2048) / 32;
-
-                            // Check which CLUT to use
-                            if (clut_x < 0x10) {
-                                clut = Utils::GetPixels(generic_cluts_texture, clut_x * 16, clut_y, 16, 1);
-                            }
-                            else if (clut_x < 0x20) {
-                                clut_x = (polygon.clut & 0x0F);
-                                clut = Utils::GetPixels(entity_cluts_texture, clut_x * 16, clut_y, 16, 1);
-                            }
-                            else {
-                                clut_x = (polygon.clut & 0x0F);
-                                clut = Utils::GetPixels(map_vram, clut_x * 16, clut_y + 240, 16, 1);
-                            }
-
-                            // Allocate space for the RGBA image
-                            byte *rgba_pixels = (byte *) calloc(tex_width * tex_height * 4, sizeof(byte));
-
-                            // Expand all pixels by their CLUT components
-                            Utils::VRAM_to_RGBA(pixels, clut, tex_width / 4, tex_height, rgba_pixels);
-                            free(pixels);
-                            free(clut);
-
-                            // Create texture from thingo
-                            GLuint part_texture = Utils::CreateTexture(rgba_pixels, tex_width, tex_height);
-                            entity_subsprite.texture = part_texture;
-                            free(rgba_pixels);
+                            // Decode the part with the CLUT the primitive references (or reuse an identical part)
+                            SpriteSource source = {texture, left / 4u, top, tex_width, tex_height};
+                            SelectPolygonClut(polygon.clut, &source);
+                            entity_subsprite.texture = AcquireSpritePart(FindSpritePart(source));
                         }
 
 
@@ -1819,44 +973,14 @@ void Map::LoadMapEntities() {
                     entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                     entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                    // Read the candle image from VRAM
-                    byte* pixels = Utils::GetPixels(fgame_textures[6], 0x80 / 4, 0x80, image.width / 4, image.height);
-                    /*
-                    byte* pixels = (byte*)calloc((image.width / 4) * image.height * 4, sizeof(byte));
-                    glReadBuffer(GL_COLOR_ATTACHMENT0);
-                    glReadPixels(
-                            0x80 / 4, 0x80,
-                            image.width / 4, image.height,
-                            GL_RGBA, GL_UNSIGNED_BYTE, pixels
-                    );
-                    */
-
-                    // Get the CLUT offset
-                    uint clut_offset = CANDLE_CLUT * 16 * 4;
-
-                    // Get the appropriate RGBA CLUT
-                    byte* rgba_clut = generic_rgba_cluts + clut_offset;
-
-                    // Allocate space for the RGBA image
-                    byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
-
-                    // Expand all pixels by their CLUT components
-                    Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                    free(pixels);
-
-                    // Check if pixels have any transparency
-                    for (int z = 0; z < image.width * image.height; z++) {
-                        byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                        // Flag the sprite as being blendable
-                        if (alpha == 0x80) {
-                            entity_subsprite.blend = true;
-                        }
-                    }
+                    // Decode the image (or reuse an identical one)
+                    uint part_id = FindSpritePart({fgame_textures[6], 0x80 / 4, 0x80, image.width, image.height, CLUT_BANK_GENERIC, CANDLE_CLUT, CLUT_FORMAT_OPAQUE, false});
 
-                    // Create texture from thingo
-                    GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                    entity_subsprite.texture = part_texture;
-                    free(rgba_pixels);
+                    // Flag the sprite as being blendable if it has any transparency
+                    if (sprite_parts[part_id].semi_transparent) {
+                        entity_subsprite.blend = true;
+                    }
+                    entity_subsprite.texture = AcquireSpritePart(part_id);
 
                     // Determine any texture flipping
                     entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -1911,12 +1035,6 @@ void Map::LoadMapEntities() {
                             entity->name = "Heart Max Up";
                         }
 
-                        byte* pixels = Utils::GetPixels(
-                            fgame_textures[6],
-                            (0x80 + x_coord) / 4, (0x80 + y_coord),
-                            image.width / 4, image.height
-                        );
-
                         // Set entity sprite part data
                         entity_subsprite.offset_x = image.offset_x;
                         entity_subsprite.offset_y = image.offset_y;
@@ -1927,32 +1045,14 @@ void Map::LoadMapEntities() {
                         entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                         entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                        // Get the CLUT offset
-                        uint clut_offset = clut * 16 * 4;
-
-                        // Get the appropriate RGBA CLUT
-                        byte* rgba_clut = generic_rgba_cluts + clut_offset;
-
-                        // Allocate space for the RGBA image
-                        byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
+                        // Decode the image (or reuse an identical one)
+                        uint part_id = FindSpritePart({fgame_textures[6], (0x80 + x_coord) / 4, (0x80 + y_coord), image.width, image.height, CLUT_BANK_GENERIC, clut, CLUT_FORMAT_OPAQUE, false});
 
-                        // Expand all pixels by their CLUT components
-                        Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                        free(pixels);
-
-                        // Check if pixels have any transparency
-                        for (int z = 0; z < image.width * image.height; z++) {
-                            byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                            // Flag the sprite as being blendable
-                            if (alpha == 0x80) {
-                                entity_subsprite.blend = true;
-                            }
+                        // Flag the sprite as being blendable if it has any transparency
+                        if (sprite_parts[part_id].semi_transparent) {
+                            entity_subsprite.blend = true;
                         }
-
-                        // Create texture from thingo
-                        GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                        entity_subsprite.texture = part_texture;
-                        free(rgba_pixels);
+                        entity_subsprite.texture = AcquireSpritePart(part_id);
 
                         // Determine any texture flipping
                         entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -2015,12 +1115,6 @@ void Map::LoadMapEntities() {
                         uint clut_id = (data >> 16) & 0xFFFF;
                         uint item_id = data & 0xFFFF;
 
-                        byte* pixels = Utils::GetPixels(
-                            item_textures[item_id],
-                            0, 0,
-                            image.width / 4, image.height
-                        );
-
                         // Set entity sprite part data
                         entity_subsprite.offset_x = image.offset_x;
                         entity_subsprite.offset_y = image.offset_y;
@@ -2031,32 +1125,14 @@ void Map::LoadMapEntities() {
                         entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                         entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                        // Get the CLUT offset
-                        uint clut_offset = clut_id * 16 * 4;
-
-                        // Get the appropriate RGBA CLUT
-                        byte* rgba_clut = item_cluts + clut_offset;
-
-                        // Allocate space for the RGBA image
-                        byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
+                        // Decode the image (or reuse an identical one)
+                        uint part_id = FindSpritePart({item_textures[item_id], 0, 0, image.width, image.height, CLUT_BANK_ITEM, clut_id, CLUT_FORMAT_OPAQUE, false});
 
-                        // Expand all pixels by their CLUT components
-                        Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                        free(pixels);
-
-                        // Check if pixels have any transparency
-                        for (int z = 0; z < image.width * image.height; z++) {
-                            byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                            // Flag the sprite as being blendable
-                            if (alpha == 0x80) {
-                                entity_subsprite.blend = true;
-                            }
+                        // Flag the sprite as being blendable if it has any transparency
+                        if (sprite_parts[part_id].semi_transparent) {
+                            entity_subsprite.blend = true;
                         }
-
-                        // Create texture from thingo
-                        GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                        entity_subsprite.texture = part_texture;
-                        free(rgba_pixels);
+                        entity_subsprite.texture = AcquireSpritePart(part_id);
 
                         // Determine any texture flipping
                         entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -2125,44 +1201,14 @@ void Map::LoadMapEntities() {
                     entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                     entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                    // Read the candle image from VRAM
-                    byte* pixels = Utils::GetPixels(item_textures[relic_id], 0, 0, image.width / 4, image.height);
-                    /*
-                    byte* pixels = (byte*)calloc((image.width / 4) * image.height * 4, sizeof(byte));
-                    glReadBuffer(GL_COLOR_ATTACHMENT0);
-                    glReadPixels(
-                            0, 0,
-                            image.width / 4, image.height,
-                            GL_RGBA, GL_UNSIGNED_BYTE, pixels
-                    );
-                    */
-
-                    // Get the CLUT offset
-                    uint clut_offset = clut_id * 16 * 4;
-
-                    // Get the appropriate RGBA CLUT
-                    byte* rgba_clut = item_cluts + clut_offset;
-
-                    // Allocate space for the RGBA image
-                    byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
-
-                    // Expand all pixels by their CLUT components
-                    Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                    free(pixels);
-
-                    // Check if pixels have any transparency
-                    for (int z = 0; z < image.width * image.height; z++) {
-                        byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                        // Flag the sprite as being blendable
-                        if (alpha == 0x80) {
-                            entity_subsprite.blend = true;
-                        }
-                    }
+                    // Decode the image (or reuse an identical one)
+                    uint part_id = FindSpritePart({item_textures[relic_id], 0, 0, image.width, image.height, CLUT_BANK_ITEM, clut_id, CLUT_FORMAT_OPAQUE, false});
 
-                    // Create texture from thingo
-                    GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                    entity_subsprite.texture = part_texture;
-                    free(rgba_pixels);
+                    // Flag the sprite as being blendable if it has any transparency
+                    if (sprite_parts[part_id].semi_transparent) {
+                        entity_subsprite.blend = true;
+                    }
+                    entity_subsprite.texture = AcquireSpritePart(part_id);
 
                     // Determine any texture flipping
                     entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -2253,85 +1299,21 @@ void Map::LoadMapEntities() {
                             entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                             entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                            // Read the image from VRAM
-
-                            byte* pixels = Utils::GetPixels(entity_tileset, image.texture_start_x / 4, image.texture_start_y, image.width / 4, image.height);
-                            /*
-                            byte* pixels = (byte*)calloc((image.width / 4) * image.height * 4, sizeof(byte));
-                            glReadBuffer(GL_COLOR_ATTACHMENT0);
-                            glReadPixels(
-                                    image.texture_start_x / 4, image.texture_start_y,
-                                    image.width / 4, image.height,
-                                    GL_RGBA, GL_UNSIGNED_BYTE, pixels
-                            );
-                            */
-
-                            // Calculate the CLUT coordinates in VRAM
-                            uint clut_offset_x = (image.clut_offset & 0x0F) * 16;
-                            uint clut_offset_y = (image.clut_offset >> 4) & 0x0F;
-
-                            // Directly pull the RGBA CLUT data from VRAM
-                            byte* rgba_clut = Utils::GetPixels(map_vram, clut_offset_x, 240 + clut_offset_y, 16, 1);
-                            /*
-                            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, map_vram, 0);
-                            byte* rgba_clut = (byte*)calloc(16 * 4, sizeof(byte));
-                            glReadBuffer(GL_COLOR_ATTACHMENT0);
-                            glReadPixels(
-                                    clut_offset_x, 240 + clut_offset_y,
-                                    16, 1,
-                                    GL_RGBA, GL_UNSIGNED_BYTE, rgba_clut
-                            );
-                            */
-
-
-                            // Allocate space for the RGBA image
-                            byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
-
-                            // Expand all pixels by their CLUT components
-                            Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                            free(pixels);
-                            free(rgba_clut);
-
-                            // Check if pixels should be filled
-                            bool r_fill, g_fill, b_fill;
-                            if (entity->data.transform_flags & EntityTransform_Fill) {
-                                // Get RGB values
-                                r_fill = (entity->data.transform_flags & EntityTransform_Red) == EntityTransform_Red;
-                                g_fill = (entity->data.transform_flags & EntityTransform_Green) == EntityTransform_Green;
-                                b_fill = (entity->data.transform_flags & EntityTransform_Blue) == EntityTransform_Blue;
-                            }
+                            // Decode the image (or reuse an identical one)
+                            SpriteSource source = {entity_tileset, image.texture_start_x / 4u, image.texture_start_y, image.width, image.height, CLUT_BANK_MAP, image.clut_offset & 0xFFu, CLUT_FORMAT_SEMI, false};
+                            uint part_id = FindSpritePart(source);
 
-                            // Check if pixels have any transparency or fill
-                            for (int z = 0; z < image.width * image.height; z++) {
-                                byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                                // Flag the sprite as being blendable
-                                if (alpha == 0x80 && entity->data.blend_mode > 0) {
-                                    entity_subsprite.blend = true;
-                                }
+                            // Flag the sprite as being blendable if it has any transparency
+                            if (sprite_parts[part_id].semi_transparent && entity->data.blend_mode > 0) {
+                                entity_subsprite.blend = true;
                             }
 
-                            // Loop through each pixel
-                            for (int z = 0; z < image.width * image.height; z++) {
-                                // Destroy any partial alpha values if no blending is enabled
-                                if (!entity_subsprite.blend) {
-                                    if (*(byte*)(rgba_pixels + (z * 4) + 3) == 0x80) {
-                                        *(byte*)(rgba_pixels + (z * 4) + 3) = 0xFF;
-                                    }
-                                }
-                                /*
-                                // Otherwise apply fill data if any exists
-                                else if ((entity->data.transform_flags & EntityTransform_Fill) == EntityTransform_Fill) {
-                                    *(byte*)(rgba_pixels + (z * 4) + 0) = r_fill * 0xFF;
-                                    *(byte*)(rgba_pixels + (z * 4) + 1) = g_fill * 0xFF;
-                                    *(byte*)(rgba_pixels + (z * 4) + 2) = b_fill * 0xFF;
-                                }
-                                */
+                            // Otherwise destroy any partial alpha values
+                            else if (sprite_parts[part_id].semi_transparent) {
+                                source.force_opaque = true;
+                                part_id = FindSpritePart(source);
                             }
-
-                            // Create texture from thingo
-                            GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                            entity_subsprite.texture = part_texture;
-                            free(rgba_pixels);
+                            entity_subsprite.texture = AcquireSpritePart(part_id);
 
                             // Determine any texture flipping
                             entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -2387,18 +1369,6 @@ void Map::LoadMapEntities() {
                             entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                             entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                            // Read the image from VRAM
-                            byte* pixels = Utils::GetPixels(entity_tileset, image.texture_start_x / 4, image.texture_start_y, image.width / 4, image.height);
-                            /*
-                            byte* pixels = (byte*)calloc((image.width / 4) * image.height * 4, sizeof(byte));
-                            glReadBuffer(GL_COLOR_ATTACHMENT0);
-                            glReadPixels(
-                                image.texture_start_x / 4, image.texture_start_y,
-                                image.width / 4, image.height,
-                                GL_RGBA, GL_UNSIGNED_BYTE, pixels
-                            );
-                            */
-
                             // Select the appropriate CLUT
                             uint clut_offset = entity->data.clut_index;
                             if (clut_offset < 0x8000) {
@@ -2407,64 +1377,22 @@ void Map::LoadMapEntities() {
                             else {
                                 clut_offset &= 0x7FFF;
                             }
-                            byte* clut = (byte*)calloc(32, sizeof(byte));
-                            MipsEmulator::CopyFromRAM(CLUT_BASE_ADDR + (clut_offset * 32), clut, 32);
-
-                            // Allocate space for the RGBA image
-                            byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
-
-                            // Allocate space for RGBA CLUT
-                            byte* rgba_clut = (byte*)calloc(16 * 4, sizeof(byte));
-
-                            // Convert RGB1555 CLUT to RGBA CLUT
-                            Utils::CLUT_to_RGBA(clut, rgba_clut, 1, true);
-                            free(clut);
-
-                            // Expand all pixels by their CLUT components
-                            Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                            free(pixels);
-                            free(rgba_clut);
-
-                            // Check if pixels should be filled
-                            bool r_fill, g_fill, b_fill;
-                            if (entity->data.transform_flags & EntityTransform_Fill) {
-                                // Get RGB values
-                                r_fill = (entity->data.transform_flags & EntityTransform_Red) == EntityTransform_Red;
-                                g_fill = (entity->data.transform_flags & EntityTransform_Green) == EntityTransform_Green;
-                                b_fill = (entity->data.transform_flags & EntityTransform_Blue) == EntityTransform_Blue;
-                            }
 
-                            // Check if pixels have any transparency or fill
-                            for (int z = 0; z < image.width * image.height; z++) {
-                                byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                                // Flag the sprite as being blendable
-                                if (alpha == 0x80 && entity->data.blend_mode > 0) {
-                                    entity_subsprite.blend = true;
-                                }
-                            }
+                            // Decode the image (or reuse an identical one)
+                            SpriteSource source = {entity_tileset, image.texture_start_x / 4u, image.texture_start_y, image.width, image.height, CLUT_BANK_RAM, clut_offset, CLUT_FORMAT_SEMI, false};
+                            uint part_id = FindSpritePart(source);
 
-                            // Loop through each pixel
-                            for (int z = 0; z < image.width * image.height; z++) {
-                                // Destroy any partial alpha values if no blending is enabled
-                                if (!entity_subsprite.blend) {
-                                    if (*(byte*)(rgba_pixels + (z * 4) + 3) == 0x80) {
-                                        *(byte*)(rgba_pixels + (z * 4) + 3) = 0xFF;
-                                    }
-                                }
-                                /*
-                                // Otherwise apply fill data if any exists
-                                else if ((entity->data.transform_flags & EntityTransform_Fill) == EntityTransform_Fill) {
-                                    *(byte*)(rgba_pixels + (z * 4) + 0) = r_fill * 0xFF;
-                                    *(byte*)(rgba_pixels + (z * 4) + 1) = g_fill * 0xFF;
-                                    *(byte*)(rgba_pixels + (z * 4) + 2) = b_fill * 0xFF;
-                                }
-                                */
+                            // Flag the sprite as being blendable if it has any transparency
+                            if (sprite_parts[part_id].semi_transparent && entity->data.blend_mode > 0) {
+                                entity_subsprite.blend = true;
                             }
 
-                            // Create texture from thingo
-                            GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                            entity_subsprite.texture = part_texture;
-                            free(rgba_pixels);
+                            // Otherwise destroy any partial alpha values
+                            else if (sprite_parts[part_id].semi_transparent) {
+                                source.force_opaque = true;
+                                part_id = FindSpritePart(source);
+                            }
+                            entity_subsprite.texture = AcquireSpritePart(part_id);
 
                             // Determine any texture flipping
                             entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -2571,71 +1499,14 @@ void Map::LoadMapEntities() {
                         entity_subsprite.x = entity_subsprite.offset_x + entity->data.pos_x;
                         entity_subsprite.y = entity_subsprite.offset_y + entity->data.pos_y;
 
-                        // Read the image from VRAM
-                        byte* pixels = Utils::GetPixels(entity_tileset, tex_start_x / 4, tex_start_y, image.width / 4, image.height);
-                        /*
-                        byte* pixels = (byte*)calloc((image.width / 4) * image.height * 4, sizeof(byte));
-                        glReadBuffer(GL_COLOR_ATTACHMENT0);
-                        glReadPixels(
-                            tex_start_x / 4, tex_start_y,
-                            image.width / 4, image.height,
-                            GL_RGBA, GL_UNSIGNED_BYTE, pixels
-                        );
-                        */
-
-                        // Get the CLUT offset from the generic clut address
-                        uint clut_offset = (image.clut_offset % 256) * 16 * 4;
-
-                        // Get the appropriate RGBA CLUT
-                        byte* rgba_clut = generic_rgba_cluts + clut_offset;
-
-                        // Allocate space for the RGBA image
-                        byte* rgba_pixels = (byte*)calloc(image.width * image.height * 4, sizeof(byte));
-
-                        // Expand all pixels by their CLUT components
-                        Utils::VRAM_to_RGBA(pixels, rgba_clut, image.width / 4, image.height, rgba_pixels);
-                        free(pixels);
-
-                        // Check if pixels should be filled
-                        bool r_fill, g_fill, b_fill;
-                        if (entity->data.transform_flags & EntityTransform_Fill) {
-                            // Get RGB values
-                            r_fill = (entity->data.transform_flags & EntityTransform_Red) == EntityTransform_Red;
-                            g_fill = (entity->data.transform_flags & EntityTransform_Green) == EntityTransform_Green;
-                            b_fill = (entity->data.transform_flags & EntityTransform_Blue) == EntityTransform_Blue;
-                        }
-
-                        // Check if pixels have any transparency
-                        for (int z = 0; z < image.width * image.height; z++) {
-                            byte alpha = *(byte*)(rgba_pixels + (z * 4) + 3);
-                            // Flag the sprite as being blendable
-                            if (alpha == 0x80) {
-                                entity_subsprite.blend = true;
-                            }
-                        }
+                        // Decode the image (or reuse an identical one)
+                        uint part_id = FindSpritePart({entity_tileset, tex_start_x / 4, tex_start_y, image.width, image.height, CLUT_BANK_GENERIC, image.clut_offset % 256u, CLUT_FORMAT_OPAQUE, false});
 
-                        // Loop through each pixel
-                        for (int z = 0; z < image.width * image.height; z++) {
-                            // Destroy any partial alpha values if no blending is enabled
-                            if (!entity_subsprite.blend) {
-                                if (*(byte*)(rgba_pixels + (z * 4) + 3) == 0x80) {
-                                    *(byte*)(rgba_pixels + (z * 4) + 3) = 0xFF;
-                                }
-                            }
-                            /*
-                            // Otherwise apply fill data if any exists
-                            else if ((entity->data.transform_flags & EntityTransform_Fill) == EntityTransform_Fill) {
-                                *(byte*)(rgba_pixels + (z * 4) + 0) = r_fill * 0xFF;
-                                *(byte*)(rgba_pixels + (z * 4) + 1) = g_fill * 0xFF;
-                                *(byte*)(rgba_pixels + (z * 4) + 2) = b_fill * 0xFF;
-                            }
-                            */
+                        // Flag the sprite as being blendable if it has any transparency
+                        if (sprite_parts[part_id].semi_transparent) {
+                            entity_subsprite.blend = true;
                         }
-
-                        // Create texture from thingo
-                        GLuint part_texture = Utils::CreateTexture(rgba_pixels, image.width, image.height);
-                        entity_subsprite.texture = part_texture;
-                        free(rgba_pixels);
+                        entity_subsprite.texture = AcquireSpritePart(part_id);
 
                         // Determine any texture flipping
                         entity_subsprite.flip_y = ((image.flags & 1) == 1);
@@ -2690,6 +1561,16 @@ void Map::LoadMapEntities() {
         std::reverse(cur_room->entities.begin(), cur_room->entities.end());
     }
 
+    // Store the emulation results
+    EndEntityEmulation(&emulation);
+
+    // Report how many entity sprite parts shared a decoded part
+    uint num_part_refs = 0;
+    for (const auto& part : sprite_parts) {
+        num_part_refs += part.ref_count;
+    }
+    Log::Info("Sprite parts: %zu decoded for %u entity sprite parts\n", sprite_parts.size(), num_part_refs);
+
     // Reset the framebuffer target to the main window
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -2701,6 +1582,403 @@ void Map::LoadMapEntities() {
 
 
 
+/**
+ * Writes the edited map data back to a map file.
+ *
+ * @param filename: Filename to save the map to (may be a file on the mounted disc)
+ *
+ * @return True if the map was saved
+ *
+ * @note Only the byte ranges that changed since the last save are written when saving over the loaded file.
+ *
+ */
+bool Map::SaveMapFile(const char* filename) {
+
+    if (!loaded || map_file == nullptr) {
+        Log::Error("No map loaded to save\n");
+        return false;
+    }
+
+    auto save_start = std::chrono::steady_clock::now();
+
+    // Start from the file that was loaded
+    if (writer == nullptr) {
+        writer = std::make_shared<MapWriter>();
+        if (!writer->Open(map_filename.c_str(), map_file->data, map_file->size)) {
+            writer.reset();
+            return false;
+        }
+    }
+
+    // Serialize the map and write out whatever changed
+    if (!writer->Update(this)) {
+        Log::Error("Could not serialize map: %s\n", map_id.c_str());
+        return false;
+    }
+    uint num_dirty = writer->GetDirtyBytes();
+    if (!writer->Save(filename)) {
+        return false;
+    }
+
+    double save_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - save_start).count();
+    Log::Info("Map saved to %s (%u bytes changed, %zu bytes total) in %.1f ms\n", filename, num_dirty, writer->data.size(), save_time);
+    return true;
+}
+
+
+
+/**
+ * Selects the CLUT a primitive references through the CLUT index table in RAM.
+ *
+ * @param clut: CLUT ID of the primitive
+ * @param source: Sprite source to set the CLUT of
+ *
+ */
+void Map::SelectPolygonClut(ushort clut, SpriteSource* source) {
+
+    // Get the CLUT's location in VRAM
+    uint clut_vram_addr = *(ushort*)(MipsEmulator::ram + CLUT_INDEX_ADDR + (clut * 2)) << 5;
+    uint clut_y = (clut_vram_addr / 2048) - 240;
+    uint clut_x = (clut_vram_addr % 2048) / 32;
+
+    // Generic CLUTs
+    if (clut_x < 0x10) {
+        source->clut_bank = CLUT_BANK_GENERIC;
+        source->clut_index = (clut_y * 16) + clut_x;
+    }
+
+    // Entity CLUTs (as left by the room's entities)
+    else if (clut_x < 0x20) {
+        source->clut_bank = CLUT_BANK_RAM;
+        source->clut_index = CLUT_RAM_ENTITY_OFFSET + (clut_y * 16) + (clut & 0x0F);
+    }
+
+    // Map tile CLUTs
+    else {
+        source->clut_bank = CLUT_BANK_MAP;
+        source->clut_index = (clut_y * 16) + (clut & 0x0F);
+    }
+    source->clut_format = (source->clut_bank == CLUT_BANK_MAP ? CLUT_FORMAT_SEMI : CLUT_FORMAT_OPAQUE);
+}
+
+
+
+/**
+ * Decodes the pixels of a sprite part.
+ *
+ * @param source: Where the part's pixels come from
+ *
+ * @return Buffer of RGBA pixels (source.width x source.height)
+ *
+ */
+byte* Map::DecodeSprite(const SpriteSource& source) {
+
+    byte* pixels = Utils::GetPixels(source.source, source.x, source.y, source.width / 4, source.height);
+
+    // Expand all pixels by their CLUT components
+    byte* rgba_pixels = (byte*)calloc(source.width * source.height * 4, sizeof(byte));
+    Utils::VRAM_to_RGBA(pixels, Clut::GetRGBA(source.clut_bank, source.clut_index, source.clut_format), source.width / 4, source.height, rgba_pixels);
+    free(pixels);
+
+    // Destroy any partial alpha values if the part isn't blended
+    if (source.force_opaque) {
+        for (uint i = 0; i < source.width * source.height; i++) {
+            if (rgba_pixels[(i * 4) + 3] == 0x80) {
+                rgba_pixels[(i * 4) + 3] = 0xFF;
+            }
+        }
+    }
+    return rgba_pixels;
+}
+
+
+
+/**
+ * Finds the decoded sprite part for a source, decoding it the first time it's seen.
+ *
+ * @param source: Where the part's pixels come from
+ *
+ * @return Index of the part in the sprite part list
+ *
+ * @note Parts using the emulated CLUT table are told apart by the CLUT's version, since its colors can differ per room.
+ *
+ */
+uint Map::FindSpritePart(const SpriteSource& source) {
+
+    // Tell apart parts that use different states of the emulated CLUT table
+    SpriteSource key = source;
+    key.clut_version = (source.clut_bank == CLUT_BANK_RAM ? Clut::GetVersion(CLUT_BANK_RAM, source.clut_index) : 0);
+
+    // Check if the part was already decoded
+    auto part = sprite_part_ids.find(key);
+    if (part != sprite_part_ids.end()) {
+        return part->second;
+    }
+
+    // Decode the part and check if it has any transparency
+    SpritePartEntry entry;
+    entry.source = key;
+    byte* rgba_pixels = DecodeSprite(key);
+    entry.pixels.assign(rgba_pixels, rgba_pixels + (key.width * key.height * 4));
+    free(rgba_pixels);
+    for (uint i = 0; i < key.width * key.height; i++) {
+        if (entry.pixels[(i * 4) + 3] == 0x80) {
+            entry.semi_transparent = true;
+            break;
+        }
+    }
+
+    // Add the part to the list
+    uint part_id = sprite_parts.size();
+    sprite_parts.push_back(std::move(entry));
+    sprite_part_ids[key] = part_id;
+    return part_id;
+}
+
+
+
+/**
+ * Gets the texture of a decoded sprite part and adds a reference to it.
+ *
+ * @param part_id: Index of the part in the sprite part list
+ *
+ * @return Texture of the sprite part (shared by every entity sprite using the part)
+ *
+ */
+GLuint Map::AcquireSpritePart(uint part_id) {
+
+    SpritePartEntry* part = &sprite_parts[part_id];
+
+    // Create the texture the first time the part is used
+    if (part->texture == 0) {
+        part->texture = Utils::CreateTexture(part->pixels.data(), part->source.width, part->source.height);
+        sprite_part_textures[part->texture] = part_id;
+
+        // Redecode the part whenever its CLUT changes
+        if (part->source.clut_bank != CLUT_BANK_RAM) {
+            Clut::AddUser(part->source.clut_bank, part->source.clut_index, {CLUT_USER_SPRITE_PART, part_id});
+        }
+    }
+    part->ref_count++;
+    return part->texture;
+}
+
+
+
+/**
+ * Removes a reference to the texture of a sprite part, deleting the texture once nothing uses it.
+ *
+ * @param texture: Texture of the sprite part
+ *
+ * @return Whether the texture belonged to a sprite part (anything else is left alone)
+ *
+ */
+bool Map::ReleaseSpritePart(GLuint texture) {
+
+    auto part_texture = sprite_part_textures.find(texture);
+    if (part_texture == sprite_part_textures.end()) {
+        return false;
+    }
+
+    // Delete the texture once the last user is gone
+    SpritePartEntry* part = &sprite_parts[part_texture->second];
+    if (part->ref_count > 0 && --part->ref_count == 0) {
+        glDeleteTextures(1, &part->texture);
+        part->texture = 0;
+        sprite_part_textures.erase(part_texture);
+    }
+    return true;
+}
+
+
+
+/**
+ * Redraws every tile, layer and sprite part that uses a CLUT which changed since the last call.
+ *
+ * @return Number of tiles and sprite parts that were redrawn
+ *
+ */
+uint Map::RefreshCluts() {
+
+    std::vector<ClutUser> users = Clut::TakeDirtyUsers();
+    if (users.empty()) {
+        return 0;
+    }
+
+    // Use a temporary framebuffer to read the source pixels (framebuffers aren't shared between contexts)
+    GLuint refresh_fbo;
+    glGenFramebuffers(1, &refresh_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, refresh_fbo);
+
+    // Decode each affected surface again
+    std::map<uint, std::vector<byte>> changed_tiles;
+    std::set<GLuint> changed_parts;
+    for (const auto& user : users) {
+
+        // Update the unique tile texture and remember the pixels for the layers
+        if (user.type == CLUT_USER_TILE && user.index < unique_tile_keys.size()) {
+            uint num_pixels = 0;
+            byte* tile_pixels = DecodeTile(unique_tile_keys[user.index], &num_pixels);
+            if (unique_tile_textures[user.index] != 0) {
+                Utils::SetPixels(unique_tile_textures[user.index], 0, 0, 16, 16, tile_pixels);
+            }
+            if ((user.index + 1) * 16 * 16 * 4 <= cache.tiles.size()) {
+                memcpy(cache.tiles.data() + (user.index * 16 * 16 * 4), tile_pixels, 16 * 16 * 4);
+            }
+            changed_tiles[user.index].assign(tile_pixels, tile_pixels + (16 * 16 * 4));
+            free(tile_pixels);
+        }
+
+        // Overwrite the sprite part texture (every copy of the part shares it)
+        else if (user.type == CLUT_USER_SPRITE_PART && user.index < sprite_parts.size() && sprite_parts[user.index].texture != 0) {
+            SpritePartEntry* part = &sprite_parts[user.index];
+            byte* rgba_pixels = DecodeSprite(part->source);
+            Utils::SetPixels(part->texture, 0, 0, part->source.width, part->source.height, rgba_pixels);
+            part->pixels.assign(rgba_pixels, rgba_pixels + (part->source.width * part->source.height * 4));
+            changed_parts.insert(part->texture);
+            free(rgba_pixels);
+        }
+    }
+
+    // Patch the changed tiles into every room layer that uses them
+    for (size_t i = 0; i < rooms.size() && !changed_tiles.empty(); i++) {
+        Room* cur_room = &rooms[i];
+        for (int k = 0; k < 2; k++) {
+            TileLayer* cur_layer = (k == 0 ? &cur_room->bg_layer : &cur_room->fg_layer);
+            uint layer_idx = (cur_room->tile_layer_id * 2) + (k == 0 ? 1 : 0);
+            if (cur_layer->tiles.size() == 0 || layer_idx >= layer_unique_tiles.size()) {
+                continue;
+            }
+            const std::vector<uint>& tiles = layer_unique_tiles[layer_idx];
+            for (uint idx = 0; idx < tiles.size(); idx++) {
+                auto tile = changed_tiles.find(tiles[idx]);
+                if (tile != changed_tiles.end()) {
+                    Utils::SetPixels(k == 0 ? cur_room->bg_texture : cur_room->fg_texture, (idx % cur_layer->width) * 16, (idx / cur_layer->width) * 16, 16, 16, tile->second.data());
+                    cur_room->composite_dirty = true;
+                }
+            }
+        }
+    }
+
+    // Redraw the composite of every room showing a changed sprite part
+    for (size_t i = 0; i < rooms.size() && !changed_parts.empty(); i++) {
+        Room* cur_room = &rooms[i];
+        for (const auto* table : {&cur_room->bg_ordering_table, &cur_room->mid_ordering_table, &cur_room->fg_ordering_table}) {
+            for (const auto& layer : *table) {
+                for (const auto& sprite : layer.second) {
+                    if (changed_parts.count(sprite.texture) != 0) {
+                        cur_room->composite_dirty = true;
+                    }
+                }
+            }
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &refresh_fbo);
+    return users.size();
+}
+
+
+
+/**
+ * Redraws the composite texture of every room that changed since it was last drawn.
+ *
+ * @return Number of rooms that were redrawn
+ *
+ * @note Rooms are drawn in parallel on the CPU (see Compositor), only the uploads happen on the calling thread.
+ *
+ */
+uint Map::UpdateComposites() {
+
+    // Collect the rooms that need to be redrawn
+    std::vector<uint> room_ids;
+    for (uint i = 0; i < rooms.size(); i++) {
+        if (rooms[i].composite_dirty && rooms[i].load_flags != 0xFF) {
+            room_ids.push_back(i);
+        }
+    }
+    if (room_ids.empty()) {
+        return 0;
+    }
+
+    // Draw them and upload the results
+    std::vector<CompositeImage> images = Compositor::RenderRooms(this, room_ids);
+    for (uint i = 0; i < room_ids.size(); i++) {
+        Room* cur_room = &rooms[room_ids[i]];
+        CompositeImage* image = &images[i];
+        if (image->width > 0 && image->height > 0) {
+            if (cur_room->composite_texture == 0) {
+                cur_room->composite_texture = Utils::CreateTexture((byte*)image->pixels.data(), image->width, image->height);
+            }
+            else {
+                Utils::SetPixels(cur_room->composite_texture, 0, 0, image->width, image->height, (byte*)image->pixels.data());
+            }
+        }
+        cur_room->composite_dirty = false;
+    }
+    return room_ids.size();
+}
+
+
+
+/**
+ * Gets the full 1/4 VRAM chunk of a room, building it on first use.
+ *
+ * @param room: Room to get the VRAM of
+ * @param expanded: Whether to get the 4bpp greyscale expansion (2048 x 256) instead of the raw VRAM (512 x 256)
+ *
+ * @return Texture of the room's VRAM
+ *
+ * @note Rooms that load the same entity graphics share the same textures.
+ *
+ */
+GLuint Map::GetRoomVRAM(Room* room, bool expanded) {
+
+    if (room->vram == 0) {
+
+        // Reuse the textures of a room with the same graphics
+        std::vector<uint> vram_key = GetPatchKey(room->vram_patches, 0, 512);
+        auto textures = room_vram_textures.find(vram_key);
+        if (textures == room_vram_textures.end()) {
+
+            // Expand VRAM additions to better show
+            const byte greyscale_clut[16 * 4] = {
+                0x00, 0x00, 0x00, 0x00,
+                0x11, 0x11, 0x11, 0xFF,
+                0x22, 0x22, 0x22, 0xFF,
+                0x33, 0x33, 0x33, 0xFF,
+                0x44, 0x44, 0x44, 0xFF,
+                0x55, 0x55, 0x55, 0xFF,
+                0x66, 0x66, 0x66, 0xFF,
+                0x77, 0x77, 0x77, 0xFF,
+                0x88, 0x88, 0x88, 0xFF,
+                0x99, 0x99, 0x99, 0xFF,
+                0xAA, 0xAA, 0xAA, 0xFF,
+                0xBB, 0xBB, 0xBB, 0xFF,
+                0xCC, 0xCC, 0xCC, 0xFF,
+                0xDD, 0xDD, 0xDD, 0xFF,
+                0xEE, 0xEE, 0xEE, 0xFF,
+                0xFF, 0xFF, 0xFF, 0xFF
+            };
+            byte* pixels = ComposeRoomVRAM(room->vram_patches, 0, 512);
+            byte* rgba_pixels = (byte*)calloc(2048 * 256 * 4, sizeof(byte));
+            Utils::VRAM_to_RGBA(pixels, greyscale_clut, 512, 256, rgba_pixels);
+            GLuint vram_texture = Utils::CreateTexture(pixels, 512, 256);
+            GLuint expanded_texture = Utils::CreateTexture(rgba_pixels, 2048, 256);
+            free(pixels);
+            free(rgba_pixels);
+            textures = room_vram_textures.emplace(vram_key, std::make_pair(vram_texture, expanded_texture)).first;
+        }
+        room->vram = textures->second.first;
+        room->expanded_vram = textures->second.second;
+    }
+
+    return expanded ? room->expanded_vram : room->vram;
+}
+
+
+
 /**
  * Cleans up the object and frees allocated memory.
  */
@@ -2709,17 +1987,20 @@ void Map::Cleanup() {
     // Delete all room layer textures
     for (int i = 0; i < rooms.size(); i++) {
         Room* cur_room = &rooms[i];
-        for(const auto& data : cur_room->entity_tilesets) {
-            glDeleteTextures(1, &cur_room->entity_tilesets[data.first]);
-        }
         glDeleteTextures(1, &cur_room->fg_texture);
         glDeleteTextures(1, &cur_room->bg_texture);
+        if (cur_room->composite_texture != 0) {
+            glDeleteTextures(1, &cur_room->composite_texture);
+            cur_room->composite_texture = 0;
+        }
 
         // Delete all entity textures
         for (int k = 0; k < cur_room->entities.size(); k++) {
             Entity* cur_entity = &cur_room->entities[k];
             for (int m = 0; m < cur_entity->sprites.size(); m++) {
-                glDeleteTextures(1, &cur_entity->sprites[m].texture);
+                if (!ReleaseSpritePart(cur_entity->sprites[m].texture)) {
+                    glDeleteTextures(1, &cur_entity->sprites[m].texture);
+                }
             }
         }
 
@@ -2727,11 +2008,31 @@ void Map::Cleanup() {
         free(cur_room->fg_layer.tile_indices);
         free(cur_room->bg_layer.tile_indices);
 
-        // Delete VRAM stuff
+        // Forget the room's VRAM (the textures are shared and deleted below)
+        cur_room->vram_patches.clear();
         cur_room->texture_pages.clear();
-        glDeleteTextures(1, &cur_room->vram);
-        glDeleteTextures(1, &cur_room->expanded_vram);
+        cur_room->entity_tilesets.clear();
+        cur_room->vram = 0;
+        cur_room->expanded_vram = 0;
+    }
+
+    // Delete the shared room VRAM textures
+    for (auto& entry : room_page_textures) {
+        glDeleteTextures(1, &entry.second);
     }
+    room_page_textures.clear();
+    for (auto& entry : room_vram_textures) {
+        glDeleteTextures(1, &entry.second.first);
+        glDeleteTextures(1, &entry.second.second);
+    }
+    room_vram_textures.clear();
+
+    // Delete the shared entity graphics textures
+    for (auto& entry : entity_graphics_textures) {
+        glDeleteTextures(1, &entry.second);
+    }
+    entity_graphics_textures.clear();
+    entity_graphics_blocks.clear();
 
     // Free all tile data pointers
     for (auto const& entry : tile_data_pointers) {
@@ -2767,6 +2068,15 @@ void Map::Cleanup() {
     // Clear map ID
     map_id = "";
 
+    // Release the processed map cache entry
+    cache = MapCacheEntry();
+    cache_hit = false;
+
+    // Release the map file mapping and any unsaved edits
+    map_file.reset();
+    writer.reset();
+    map_filename = "";
+
     // Reset function pointers
     update_entities_func = 0;
     process_entity_collision_func = 0;
@@ -2802,12 +2112,27 @@ void Map::Cleanup() {
     entity_graphics.clear();
 
 
-    // Clear out map tile CLUTs
-    memset(map_tile_cluts[0], 256 * 16 * 2, sizeof(byte));
+    // Clear out map tile CLUTs and everything that referenced a CLUT
+    Clut::Reset(CLUT_BANK_MAP, 0);
+    Clut::Reset(CLUT_BANK_RAM, 0);
+    Clut::ClearUsers(CLUT_USER_TILE);
+    Clut::ClearUsers(CLUT_USER_SPRITE_PART);
+    unique_tile_keys.clear();
+    unique_tile_textures.clear();
+    layer_unique_tiles.clear();
+
+    // Delete any sprite parts that are still referenced
+    for (auto& part : sprite_parts) {
+        if (part.texture != 0) {
+            glDeleteTextures(1, &part.texture);
+        }
+    }
+    sprite_parts.clear();
+    sprite_part_ids.clear();
+    sprite_part_textures.clear();
 
 
     // Delete everything else
-    map_textures.clear();
     map_tilesets.clear();
     entity_functions.clear();
 
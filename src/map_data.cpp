@@ -0,0 +1,766 @@
+#include <filesystem>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include "common.h"
+#include "map.h"
+#include "rooms.h"
+#include "sprites.h"
+#include "tiles.h"
+#include "cache.h"
+#include "cluts.h"
+#include "utils.h"
+#include "mips.h"
+#include "stage_timer.h"
+#include "trace.h"
+#include "log.h"
+
+
+
+/**
+ * Reads the rooms, sprite banks, CLUTs, entity layouts, tile layers, entity graphics and entity functions of a map.
+ *
+ * @param filename: Filename of the map to read
+ *
+ * @return True if the file could be mapped
+ *
+ * @note Nothing here needs a GL context, LoadMapFile() builds the textures afterwards.
+ *
+ */
+bool Map::ParseMapFile(const char* filename) {
+
+    TraceZone zone("Map::ParseMapFile");
+
+    // Set the map ID name
+    map_id = std::filesystem::path(filename).stem().string();
+    map_filename = filename;
+
+    // Map the file (the emulator shares this mapping when it loads the same file)
+    StageTimer timer(LoadStage_FileRead);
+    map_file = MappedFile::Share(filename);
+    if (map_file == nullptr || map_file->size < 0x40) {
+        Log::Error("Invalid map file: %s\n", filename);
+        map_file.reset();
+        return false;
+    }
+
+    // Parse directly from the mapping
+    const byte* map_data = map_file->data;
+    uint num_bytes = map_file->size;
+
+    // Get the function addresses
+    timer.Switch(LoadStage_Header);
+    update_entities_func = *(uint*)(map_data) - MAP_BIN_OFFSET;
+    process_entity_collision_func = *(uint*)(map_data + 0x04) - MAP_BIN_OFFSET;
+    spawn_onscreen_entities_func = *(uint*)(map_data + 0x08) - MAP_BIN_OFFSET;
+    init_room_entities_func = *(uint*)(map_data + 0x0C) - MAP_BIN_OFFSET;
+    pause_entities_func = *(uint*)(map_data + 0x28) - MAP_BIN_OFFSET;
+
+    // Get the data pointers
+    uint room_list_addr = *(uint*)(map_data + 0x10);
+    uint sprite_banks_addr = *(uint*)(map_data + 0x14);
+    uint cluts_addr = *(uint*)(map_data + 0x18);
+    uint entity_layouts_addr = *(uint*)(map_data + 0x1C);
+    uint tile_layers_addr = *(uint*)(map_data + 0x20);
+    uint entity_graphics_addr = *(uint*)(map_data + 0x24);
+
+    // Modify relative function addresses as needed
+    room_list_addr -= (room_list_addr > 0 ? MAP_BIN_OFFSET : 0);
+    sprite_banks_addr -= (sprite_banks_addr > 0 ? MAP_BIN_OFFSET : 0);
+    cluts_addr -= (cluts_addr > 0 ? MAP_BIN_OFFSET : 0);
+    entity_layouts_addr -= (entity_layouts_addr > 0 ? MAP_BIN_OFFSET : 0);
+    tile_layers_addr -= (tile_layers_addr > 0 ? MAP_BIN_OFFSET : 0);
+    entity_graphics_addr -= (entity_graphics_addr > 0 ? MAP_BIN_OFFSET : 0);
+
+    // Get backup entity layout address (usually referenced from the InitRoomEntities() function)
+    if (entity_layouts_addr == 0) {
+        entity_layouts_addr = *(uint *)(map_data + init_room_entities_func + 0x1C) & 0x0000FFFF;
+        // Fallback to zero if this was invalid
+        if (entity_layouts_addr == 1) {
+            entity_layouts_addr = 0;
+        }
+    }
+
+    // Entity function list address
+    uint entity_functions_addr = 0;
+
+    // Check if entity layout address was defined
+    if (entity_layouts_addr > 0) {
+        // Set entity function list address to immediately after the X/Y entity layouts
+        entity_functions_addr = entity_layouts_addr + (4 * 53) + (4 * 52);
+    }
+
+    // Otherwise search for it the hard way
+    else {
+
+        // Get the location of the function in memory
+        const byte* match_location = std::search(
+            map_data,
+            map_data + num_bytes,
+            std::begin(entity_create_search),
+            std::end(entity_create_search)
+        );
+
+        // Found a match
+        if (match_location < map_data + num_bytes)
+        {
+            entity_functions_addr = *(ushort*)(match_location + 0x40);
+        }
+    }
+
+
+
+
+// -- Rooms ----------------------------------------------------------------------------------------------------
+
+    // Read the room list
+    load_status_msg = "Reading Room Data ...";
+    if (room_list_addr > 0) {
+        uint i = 0;
+        while (*(uint *)(map_data + room_list_addr + i) != 0x00000040) {
+
+            // Create a new room
+            Room room;
+
+            // Read the room's properties
+            room.x_start = *(map_data + room_list_addr + i++);
+            room.y_start = *(map_data + room_list_addr + i++);
+            room.x_end = *(map_data + room_list_addr + i++);
+            room.y_end = *(map_data + room_list_addr + i++);
+            room.tile_layer_id = *(map_data + room_list_addr + i++);
+            room.load_flags = *(map_data + room_list_addr + i++);
+            room.entity_graphics_id = *(map_data + room_list_addr + i++);
+            room.entity_layout_id = *(map_data + room_list_addr + i++);
+
+            // Check if entity graphics ID needs to be fixed up
+            if (room.entity_graphics_id == 0) {
+                room.entity_graphics_id++;
+            }
+
+            // Calculate room dimensions
+            room.width = ((room.x_end + 1) - room.x_start);
+            room.height = ((room.y_end + 1) - room.y_start);
+
+            // Add the room to the room list
+            rooms.push_back(room);
+        }
+
+        Log::Info("Rooms Loaded! Total rooms: %zu\n", rooms.size());
+    }
+
+
+
+
+// -- Sprite Banks ---------------------------------------------------------------------------------------------
+
+    // Check if any sprite banks were defined
+    load_status_msg = "Reading Sprite Banks ...";
+    timer.Switch(LoadStage_SpriteBanks);
+    if (sprite_banks_addr > 0) {
+
+        // Read the sprite banks
+        sprite_banks = Sprite::ReadSpriteBanks(map_data, sprite_banks_addr, MAP_BIN_OFFSET);
+
+        Log::Info("Sprites loaded! Total banks: %d\n", sprite_banks.size());
+    }
+
+
+
+
+// -- CLUTs ----------------------------------------------------------------------------------------------------
+
+    // Get the address of the CLUT data
+    load_status_msg = "Reading CLUT Data ...";
+    timer.Switch(LoadStage_Cluts);
+    if (cluts_addr > 0) {
+        uint clut_list_addr = *(uint*)(map_data + cluts_addr) - MAP_BIN_OFFSET;
+
+        // Skip the first 4 bytes (0x00000005)
+        clut_list_addr += 4;
+
+        // Loop through each CLUT entry
+        uint i = 0;
+        while (*(int*)(map_data + clut_list_addr + i) != -1) {
+
+            // Create a CLUT entry
+            ClutEntry clut_entry;
+
+            // Get the data for each entry in the CLUT list
+            clut_entry.offset = *(int*)(map_data + clut_list_addr + i) * 2;
+            clut_entry.count = *(int*)(map_data + clut_list_addr + i + 4) * 2;
+            uint clut_addr = *(uint*)(map_data + clut_list_addr + i + 8) - MAP_BIN_OFFSET;
+
+            // Allocate data for the CLUT
+            clut_entry.clut_data = (byte*)calloc(clut_entry.count, sizeof(byte));
+
+            // Get the CLUT data
+            memcpy(clut_entry.clut_data, (map_data + clut_addr), clut_entry.count);
+
+            /*
+             * NOTE:
+             * Offset >> 3 = CLUT index offset
+             * Offset << 1 = Offset from CLUT base address
+             */
+
+            // Append the entry to the CLUT list
+            entity_cluts.push_back(clut_entry);
+
+            // Go to the next entry
+            i += 12;
+        }
+
+        Log::Info("CLUTs loaded! Total CLUTs: %d\n", entity_cluts.size());
+    }
+
+
+
+
+// -- Entity Layouts -------------------------------------------------------------------------------------------
+
+    // Loop through all 53 entries
+    load_status_msg = "Reading Entity Layout Data ...";
+    timer.Switch(LoadStage_Header);
+    if (entity_layouts_addr > 0) {
+        for (int i = 0; i < 53; i++) {
+
+            // Get the address of the entity layout
+            uint entity_list_addr = *(uint*)(map_data + entity_layouts_addr + (i * 4)) - MAP_BIN_OFFSET;
+
+            // Initialize a new list of entity init data
+            std::vector<EntityInitData> entity_init_list;
+
+            // Get the X/Y coords of the first entity (should both be -2)
+            short x_coord = *(short*)(map_data + entity_list_addr);
+            short y_coord = *(short*)(map_data + entity_list_addr + 2);
+
+            // Collect entity init data until X/Y both equal -1
+            int k = 0;
+            while (x_coord != -1 && y_coord != -1) {
+
+                // Create a new entity init data struct
+                EntityInitData init_data;
+
+                // Collect the init data
+                init_data.x_coord = x_coord;
+                init_data.y_coord = y_coord;
+                init_data.entity_id = *(ushort*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 4);
+                init_data.slot = *(ushort*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 6);
+                init_data.initial_state = *(ushort*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 8);
+
+                // Add the entity init data to the list
+                entity_init_list.push_back(init_data);
+
+                // Get the next entry
+                k++;
+                x_coord = *(short*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k));
+                y_coord = *(short*)(map_data + entity_list_addr + (sizeof(EntityInitData) * k) + 2);
+            }
+
+            // Add the init data list to the layout list
+            entity_layouts.push_back(entity_init_list);
+        }
+
+        Log::Info("Entity layouts loaded! Total layouts: %zu\n", entity_layouts.size());
+    }
+
+
+
+
+// -- Tile Layers ----------------------------------------------------------------------------------------------
+
+    // Check if tile layers exist
+    load_status_msg = "Reading Tile Layer Data ...";
+    timer.Switch(LoadStage_TileLayers);
+    if (tile_layers_addr > 0) {
+        ReadTileLayers(map_data, tile_layers_addr);
+        Log::Info("Tile layers loaded! Total layers: %zu\n", tile_layers.size());
+    }
+
+
+
+
+// -- Entity Graphics ------------------------------------------------------------------------------------------
+
+    // Check if entity graphics exist
+    load_status_msg = "Reading Entity Graphics Data ...";
+    timer.Switch(LoadStage_Header);
+    if (entity_graphics_addr > 0) {
+
+        // Loop until the beginning of the Entity Layouts section is hit (indicating end of graphics section)
+        uint i = 0;
+        while (entity_graphics_addr + (i * 4) != entity_layouts_addr) {
+
+            // Get the address for the next list of entity graphics entries
+            uint graphics_list_addr = *(uint*)(map_data + entity_graphics_addr + (i * 4));
+
+            // Initialize a new list of entity init data
+            std::vector<EntityGraphicsData> entity_graphics_data_list;
+
+            // Skip any null entries
+            if (graphics_list_addr == 0) {
+                entity_graphics.push_back(entity_graphics_data_list);
+                i++;
+                continue;
+            }
+
+            // Adjust graphics list address
+            graphics_list_addr -= MAP_BIN_OFFSET;
+
+            // Get the first identifier
+            int marker = *(int*)(map_data + graphics_list_addr);
+
+            // Only process if this wasn't an ending marker
+            if (marker > 0) {
+
+                // Skip the first 4 bytes
+                graphics_list_addr += 4;
+
+                // Loop through each entry until the end of the list (-1) was encountered
+                uint k = 0;
+                while (marker != -1) {
+
+                    // Create a new entity graphic entry
+                    EntityGraphicsData graphics_data;
+
+                    // Read the data
+                    graphics_data.vram_y = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)));
+                    graphics_data.vram_x = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 2);
+                    graphics_data.height = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 4);
+                    graphics_data.width = *(ushort*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 6);
+                    graphics_data.compressed_graphics_addr = *(uint*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)) + 8);
+
+                    // Add the entry to the entity graphics list
+                    entity_graphics_data_list.push_back(graphics_data);
+
+                    // Move to the next entry
+                    k++;
+                    marker = *(int*)(map_data + graphics_list_addr + (k * sizeof(EntityGraphicsData)));
+                }
+            }
+
+            // Add the entity graphics data to the graphics list
+            entity_graphics.push_back(entity_graphics_data_list);
+
+            // Move to the next list address
+            i++;
+        }
+
+        Log::Info("Entity graphics loaded! Total entries: %zu\n", entity_graphics.size());
+    }
+
+
+
+
+// -- Room Layers ----------------------------------------------------------------------------------------------
+
+    // Get the layer data only if this is not a transition room
+    for (auto& room : rooms) {
+        if (room.load_flags != 0xFF) {
+            room.fg_layer = tile_layers[room.tile_layer_id].first;
+            room.bg_layer = tile_layers[room.tile_layer_id].second;
+        }
+    }
+
+
+
+
+// -- Entity Functions -----------------------------------------------------------------------------------------
+
+    // Make sure entity functions exist
+    load_status_msg = "Reading Entity Functions ...";
+    if (entity_functions_addr > 0) {
+
+        // Get the first function pointer (should point to dummy data)
+        uint func_addr = *(uint*)(map_data + entity_functions_addr);
+
+        // Loop until a non-pointer is found
+        uint i = 1;
+        while (func_addr >= MAP_BIN_OFFSET && func_addr < RAM_MAX_OFFSET) {
+            entity_functions.push_back(func_addr - MAP_BIN_OFFSET);
+            func_addr = *(uint*)(map_data + entity_functions_addr + (i++ * 4));
+        }
+    }
+
+    Log::Info("Entity functions: %zu\n", entity_functions.size());
+
+    return true;
+}
+
+
+
+/**
+ * Reads every tile layer pair of a map (stops at the first entry that doesn't point into the map).
+ *
+ * @param map_data: Contents of the map file
+ * @param tile_layers_addr: Offset of the tile layer table within the map file
+ *
+ * @note Layers sharing tile data share the same TileData object (see tile_data_pointers).
+ *
+ */
+void Map::ReadTileLayers(const byte* map_data, uint tile_layers_addr) {
+
+    // Loop through layers until no more exist
+    uint i = 0;
+    uint layer_pair_addr = *(uint*)(map_data + tile_layers_addr + (i * 8));
+    while (layer_pair_addr > 0x80180000 && layer_pair_addr < RAM_MAX_OFFSET) {
+
+        // Create a new tile layer pair
+        std::pair<TileLayer, TileLayer> tile_pair;
+
+        // Process layers in pairs
+        for (int k = 0; k < 2; k++) {
+
+            // Create a new layer
+            TileLayer* cur_layer;
+
+            // Check which layer to process
+            if (k == 0) {
+                cur_layer = &tile_pair.first;
+            }
+            else {
+                cur_layer = &tile_pair.second;
+            }
+
+            // Get the address of the layer data
+            uint layer_addr = *(uint*)(map_data + tile_layers_addr + (i * 8) + (k * 4)) - MAP_BIN_OFFSET;
+
+            // Get the address of the tile indices
+            cur_layer->tile_indices_addr = *(uint*)(map_data + layer_addr);
+
+            // Skip null pointers
+            if (cur_layer->tile_indices_addr == 0) {
+                continue;
+            }
+
+            // Adjust tile index address
+            cur_layer->tile_indices_addr -= MAP_BIN_OFFSET;
+
+            // Get the layer dimensions (3-byte value, ignores highest byte)
+            uint dimension_data = *(uint*)(map_data + layer_addr + 8);
+            cur_layer->x_start = dimension_data & 0x3F;
+            cur_layer->y_start = (dimension_data >> 6) & 0x3F;
+            cur_layer->x_end = (dimension_data >> 12) & 0x3F;
+            cur_layer->y_end = (dimension_data >> 18) & 0x3F;
+
+            // Calculate dimensions in terms of tiles
+            cur_layer->width = (cur_layer->x_end - cur_layer->x_start + 1) * 16;
+            cur_layer->height = (cur_layer->y_end - cur_layer->y_start + 1) * 16;
+
+            // Get the rest of the non-pointer data
+            cur_layer->load_flags = *(byte*)(map_data + layer_addr + 11);
+            cur_layer->z_index = *(ushort*)(map_data + layer_addr + 12);
+            cur_layer->drawing_flags = *(ushort*)(map_data + layer_addr + 14);
+
+            // Calculate width and height of the layer in tiles
+            uint num_tiles = cur_layer->width * cur_layer->height;
+
+            // Read the tile indices into a newly-allocated buffer
+            cur_layer->tile_indices = (ushort*)calloc(num_tiles, sizeof(ushort));
+            memcpy(cur_layer->tile_indices, map_data + cur_layer->tile_indices_addr, num_tiles * sizeof(ushort));
+
+            // Get the address of the tile data
+            cur_layer->tile_data_addr = *(uint*)(map_data + layer_addr + 4) - MAP_BIN_OFFSET;
+
+            // Check if the tile data pointer is not currently in the map
+            if (tile_data_pointers.count(cur_layer->tile_data_addr) == 0) {
+
+                // Create a new tile data object
+                TileData tile_data;
+
+                // Get the addresses of all tile data elements
+                uint tile_ids_addr = *(uint*)(map_data + cur_layer->tile_data_addr) - MAP_BIN_OFFSET;
+                uint tile_positions_addr = *(uint*)(map_data + cur_layer->tile_data_addr + 4) - MAP_BIN_OFFSET;
+                uint tile_cluts_addr = *(uint*)(map_data + cur_layer->tile_data_addr + 8) - MAP_BIN_OFFSET;
+                uint tile_collision_addr = *(uint*)(map_data + cur_layer->tile_data_addr + 12) - MAP_BIN_OFFSET;
+
+                // Allocate memory for all elements
+                tile_data.tileset_ids = (byte*)calloc(4096, sizeof(byte));
+                tile_data.tile_positions = (byte*)calloc(4096, sizeof(byte));
+                tile_data.clut_ids = (byte*)calloc(4096, sizeof(byte));
+                tile_data.collision_ids = (byte*)calloc(4096, sizeof(byte));
+
+                // Read all element data
+                memcpy(tile_data.tileset_ids, map_data + tile_ids_addr, 4096);
+                memcpy(tile_data.tile_positions, map_data + tile_positions_addr, 4096);
+                memcpy(tile_data.clut_ids, map_data + tile_cluts_addr, 4096);
+                memcpy(tile_data.collision_ids, map_data + tile_collision_addr, 4096);
+
+                // Add the tile data to the tile data map using the address of the data as the key
+                tile_data_pointers[cur_layer->tile_data_addr] = tile_data;
+            }
+
+            // Set the tile data pointer for the layer
+            cur_layer->tile_data = tile_data_pointers.at(cur_layer->tile_data_addr);
+        }
+
+        // Move to the next layer pair
+        i++;
+        layer_pair_addr = *(uint*)(map_data + tile_layers_addr + (i * 8));
+
+        // Add the layer pair to the list of layers
+        tile_layers.push_back(tile_pair);
+    }
+}
+
+
+
+/**
+ * Loads the map and its CLUTs into the emulator and saves the state every room starts from.
+ *
+ * @return True if the map was loaded into RAM
+ *
+ * @note The map tile CLUTs are taken from the CLUT manager, so BuildMapVRAM() has to run first.
+ *
+ */
+bool Map::LoadIntoEmulator() {
+
+    TraceZone zone("Map::LoadIntoEmulator");
+    StageTimer timer(LoadStage_EmulatorReset);
+    if (!MipsEmulator::LoadMapFile(map_filename.c_str())) {
+        return false;
+    }
+
+    // Store map tile and entity CLUTs in MIPS RAM
+    for (int i = 0; i < 256; i++) {
+        MipsEmulator::StoreMapCLUT(i * 32, 32, (byte*)Clut::GetColors(CLUT_BANK_MAP, i));
+    }
+    for (const ClutEntry& clut : entity_cluts) {
+        MipsEmulator::StoreMapCLUT(clut.offset, clut.count, clut.clut_data);
+    }
+
+    // Create a save state for quick MIPS emulator resetting
+    MipsEmulator::SaveState();
+    return true;
+}
+
+
+
+/**
+ * Prepares to emulate the entities of every room, restoring any cached results.
+ *
+ * @param state: Emulation progress to initialize
+ *
+ * @note The emulator must hold the map and its CLUTs (see MipsEmulator::SaveState) before this is called.
+ *
+ */
+void Map::BeginEntityEmulation(EntityEmulationState* state) {
+
+    // Check whether the emulation results for this map are already cached
+    *state = EntityEmulationState();
+    state->cache_hit = Cache::LoadEntities(entity_cache_key, &state->cache) && state->cache.rooms.size() == rooms.size();
+    if (!state->cache_hit) {
+        state->cache = EntityCacheEntry();
+        state->cache.rooms.resize(rooms.size());
+    }
+}
+
+
+
+/**
+ * Puts the emulator back into the state every room starts from (the map with its CLUTs).
+ *
+ * @param state: Emulation progress from Map::BeginEntityEmulation()
+ *
+ * @note Only the first room copies the whole save state (and keeps all of RAM as the base that changes are recorded
+ *       against), every room after that only writes back the pages that differ from that base. Cached rooms and
+ *       emulated rooms start from the same RAM either way.
+ *
+ */
+static void restore_save_state(EntityEmulationState* state) {
+    if (!state->save_state_loaded) {
+        MipsEmulator::LoadState();
+        state->base_ram.assign(MipsEmulator::ram, MipsEmulator::ram + RAM_SIZE);
+        state->save_state_loaded = true;
+    }
+    else {
+        state->state_pages_restored += MipsEmulator::LoadDirtyState(state->base_ram.data());
+    }
+}
+
+
+
+/**
+ * Runs the entities of a room in the emulator (or restores them from the cache).
+ *
+ * @param room_id: Index of the room within the map
+ * @param state: Emulation progress from BeginEntityEmulation()
+ *
+ * @return Entities the room ended up with
+ *
+ * @note MIPS RAM is left as the room's entities left it, so their polygons can be read back right after.
+ *
+ */
+std::vector<Entity> Map::EmulateRoom(uint room_id, EntityEmulationState* state) {
+
+    TraceZone zone("Map::EmulateRoom", "room", room_id);
+
+    // Get the current room
+    Room* cur_room = &rooms[room_id];
+    RoomEntityCacheEntry* room_cache = &state->cache.rooms[room_id];
+
+    // Get the entity init data
+    static const std::vector<EntityInitData> no_layout;
+    uint layout_id = cur_room->entity_layout_id;
+    const std::vector<EntityInitData>& init_data_list = (layout_id < entity_layouts.size() ? entity_layouts[layout_id] : no_layout);
+
+    // Hash everything about the room that gets written to RAM
+    uint room_params[] = {
+        cur_room->width,
+        cur_room->height,
+        cur_room->x_start,
+        cur_room->y_start,
+        cur_room->x_end,
+        cur_room->y_end,
+        cur_room->fg_layer.tile_indices_addr,
+        cur_room->fg_layer.tile_data_addr
+    };
+    uint64_t params_hash = Utils::Hash(init_data_list.data(), init_data_list.size() * sizeof(EntityInitData), layout_id);
+    params_hash = Utils::Hash(room_params, sizeof(room_params), params_hash);
+
+    // Entities and framebuffer CLUT rows produced by the room
+    std::vector<Entity> entities;
+    byte* indexed_pixels = (byte*)calloc(768 * 16 * 2, sizeof(byte));
+
+    // Cached results are applied over the save state
+    bool cached = state->cache_hit && room_cache->params_hash == params_hash;
+    StageTimer timer(LoadStage_EmulatorReset);
+    if (cached) {
+        restore_save_state(state);
+    }
+    timer.Switch(LoadStage_Emulation);
+
+    // Restore the results of a previous emulation run
+    if (cached && Cache::ApplyDeltas(MipsEmulator::ram, RAM_SIZE, room_cache->ram_deltas)) {
+        load_status_msg = "Restoring Cached Entity Data ...";
+        entities = MipsEmulator::CollectEntities();
+        memcpy(indexed_pixels, room_cache->framebuffer_cluts.data(), 768 * 16 * 2);
+    }
+
+    // Otherwise run the emulator
+    else {
+
+        // Populate CLUT stuff and keep the resulting machine state for the remaining rooms
+        if (!state->setup_state_saved) {
+            timer.Switch(LoadStage_EmulatorReset);
+            restore_save_state(state);
+            timer.Switch(LoadStage_Emulation);
+            //load_status_msg = "Populating CLUT Data in MIPS RAM ...";
+            MipsEmulator::ClearEntities();
+            TraceZone setup_zone("CLUT setup");
+            MipsEmulator::ProcessFunction(CLUT_SETUP_FUNC_ADDR);
+            state->setup_instructions = MipsEmulator::num_executed;
+            MipsEmulator::SaveSetupState();
+            state->setup_state_saved = true;
+        }
+
+        // Otherwise start straight from the state the CLUT setup left behind (only its dirty pages are written back)
+        else {
+            timer.Switch(LoadStage_EmulatorReset);
+            state->setup_pages_restored += MipsEmulator::LoadSetupState();
+            timer.Switch(LoadStage_Emulation);
+        }
+
+        // Loop through each entry in the init list
+        load_status_msg = "Copying Entity Data to MIPS RAM ...";
+        for (auto init_data : init_data_list) {
+
+            // Create initial entities
+            EntityData entity_data;
+
+            // Populate initial entity data
+            entity_data.object_id = init_data.entity_id & 0x03FF;
+            entity_data.update_function = entity_functions[entity_data.object_id] + MAP_BIN_OFFSET;
+            entity_data.pos_x = init_data.x_coord;
+            entity_data.pos_y = init_data.y_coord;
+            entity_data.initial_state = init_data.initial_state;
+            entity_data.room_slot = init_data.slot >> 8;
+            entity_data.unk68 = (init_data.slot >> 10) & 7;
+
+            // Fetch entity function address
+            uint entity_func_id = init_data.entity_id & 0x03FF;
+            uint entity_func = entity_functions[entity_func_id] + MAP_BIN_OFFSET - RAM_BASE_OFFSET;
+
+            // Determine entity location in RAM
+            uint entity_ram_location = ENTITY_ALLOCATION_START + ((init_data.slot & 0xFF) * sizeof(entity_data));
+
+            // Copy the entity structure into the emulator's RAM
+            MipsEmulator::CopyToRAM(entity_ram_location, &entity_data, sizeof(entity_data));
+        }
+
+        // Write current room dimensions to RAM
+        MipsEmulator::WriteIntToRAM(ROOM_WIDTH_ADDR, cur_room->width);
+        MipsEmulator::WriteIntToRAM(ROOM_HEIGHT_ADDR, cur_room->width);
+
+        // Write current room coordinates to RAM
+        MipsEmulator::WriteIntToRAM(ROOM_X_COORD_START_ADDR, cur_room->x_start);
+        MipsEmulator::WriteIntToRAM(ROOM_Y_COORD_START_ADDR, cur_room->y_start);
+        MipsEmulator::WriteIntToRAM(ROOM_X_COORD_END_ADDR, cur_room->x_end);
+        MipsEmulator::WriteIntToRAM(ROOM_Y_COORD_END_ADDR, cur_room->y_end);
+
+        // Write tile layout to RAM
+        MipsEmulator::WriteIntToRAM(ROOM_TILE_INDICES_ADDR, cur_room->fg_layer.tile_indices_addr + MAP_RAM_OFFSET);
+        MipsEmulator::WriteIntToRAM(ROOM_TILE_DATA_ADDR, cur_room->fg_layer.tile_data_addr + MAP_RAM_OFFSET);
+
+        // Process all of the entities in RAM
+        load_status_msg = "Running Entity Functions ...";
+        entities = MipsEmulator::ProcessEntities();
+
+        // Read back any framebuffer changes
+        RECT fb_rect = {0, 240, 768, 16};
+        MipsEmulator::StoreImage(&fb_rect, indexed_pixels);
+
+        // Record the results for the cache
+        room_cache->params_hash = params_hash;
+        room_cache->ram_deltas = Cache::DiffRAM(state->base_ram.data(), MipsEmulator::ram, RAM_SIZE);
+        room_cache->framebuffer_cluts.assign(indexed_pixels, indexed_pixels + (768 * 16 * 2));
+        state->rooms_emulated++;
+    }
+
+    // Commit any framebuffer changes
+    load_status_msg = "Committing Framebuffer Changes ...";
+    for (int k = 0; k < 768 * 16 * 2; k++) {
+        byte val = indexed_pixels[k];
+        if (val > 0) {
+            *(byte*)(MipsEmulator::ram + CLUT_BASE_ADDR + k) = val;
+        }
+    }
+    free(indexed_pixels);
+
+    return entities;
+}
+
+
+
+/**
+ * Finishes emulating the entities of every room and stores the results in the cache.
+ *
+ * @param state: Emulation progress from BeginEntityEmulation()
+ *
+ */
+void Map::EndEntityEmulation(EntityEmulationState* state) {
+
+    // Free the room starting state
+    state->base_ram.clear();
+    state->base_ram.shrink_to_fit();
+    MipsEmulator::ClearSetupState();
+
+    // Report how much emulation the shared CLUT setup avoided
+    if (state->rooms_emulated > 1) {
+        Log::Info(
+            "CLUT setup ran once for %u rooms: %llu instructions saved, %u dirty pages restored (%u for the save state)\n",
+            state->rooms_emulated,
+            (unsigned long long)state->setup_instructions * (state->rooms_emulated - 1),
+            state->setup_pages_restored,
+            state->state_pages_restored
+        );
+    }
+
+    // Store the results of any rooms that had to be emulated
+    if (state->rooms_emulated > 0) {
+        Cache::SaveEntities(entity_cache_key, &state->cache);
+        Log::Info("Entity cache miss [%016llX]: emulated %u / %zu rooms\n", (unsigned long long)entity_cache_key, state->rooms_emulated, rooms.size());
+    }
+    else {
+        Log::Info("Entity cache hit [%016llX]: skipped emulation for %zu rooms\n", (unsigned long long)entity_cache_key, rooms.size());
+    }
+}
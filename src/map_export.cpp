@@ -0,0 +1,269 @@
+#include <cstring>
+#include <type_traits>
+#include "map_export.h"
+#include "map.h"
+#include "utils.h"
+
+
+
+
+// -- JSON -----------------------------------------------------------------------------------------------------
+
+/**
+ * Converts a map into JSON.
+ *
+ * @param map: Map that has been parsed (and optionally had its entities emulated)
+ *
+ * @return JSON document containing the rooms, tile layers and entity layouts of the map
+ *
+ * @note Entity fields are written in the same order and with the same names as Entity::PopulateDataMap.
+ *
+ */
+std::string MapExport::ToJSON(const Map* map) {
+
+    std::string out;
+    out.append("{\n");
+    out.append("    \"map_id\": \"" + EscapeJSON(map->map_id) + "\",\n");
+    out.append("    \"version\": " + std::to_string(MAP_EXPORT_VERSION) + ",\n");
+
+    // Rooms and the entities they contain
+    out.append("    \"rooms\": [");
+    for (size_t i = 0; i < map->rooms.size(); i++) {
+        const Room& room = map->rooms[i];
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append(Utils::FormatString(
+            "        {\"id\": %zu, \"x_start\": %u, \"y_start\": %u, \"x_end\": %u, \"y_end\": %u, "
+            "\"tile_layer_id\": %u, \"load_flags\": %u, \"entity_graphics_id\": %u, \"entity_layout_id\": %u, "
+            "\"entities\": [",
+            i, room.x_start, room.y_start, room.x_end, room.y_end,
+            room.tile_layer_id, room.load_flags, room.entity_graphics_id, room.entity_layout_id
+        ));
+        for (size_t j = 0; j < room.entities.size(); j++) {
+            out.append(j > 0 ? ",\n" : "\n");
+            WriteEntityJSON(&out, room.entities[j]);
+        }
+        out.append(room.entities.empty() ? "]}" : "\n        ]}");
+    }
+    out.append(map->rooms.empty() ? "],\n" : "\n    ],\n");
+
+    // Foreground and background layer of every tile layer entry
+    out.append("    \"tile_layers\": [");
+    for (size_t i = 0; i < map->tile_layers.size(); i++) {
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append("        {\"fg\": ");
+        WriteLayerJSON(&out, map->tile_layers[i].first);
+        out.append(", \"bg\": ");
+        WriteLayerJSON(&out, map->tile_layers[i].second);
+        out.append("}");
+    }
+    out.append(map->tile_layers.empty() ? "],\n" : "\n    ],\n");
+
+    // Entity layouts (terminator entries are skipped during parsing)
+    out.append("    \"entity_layouts\": [");
+    for (size_t i = 0; i < map->entity_layouts.size(); i++) {
+        out.append(i > 0 ? ",\n" : "\n");
+        out.append("        [");
+        for (size_t j = 0; j < map->entity_layouts[i].size(); j++) {
+            const EntityInitData& init = map->entity_layouts[i][j];
+            out.append(Utils::FormatString(
+                "%s{\"x\": %d, \"y\": %d, \"entity_id\": %u, \"slot\": %u, \"initial_state\": %u}",
+                j > 0 ? ", " : "", init.x_coord, init.y_coord, init.entity_id, init.slot, init.initial_state
+            ));
+        }
+        out.append("]");
+    }
+    out.append(map->entity_layouts.empty() ? "]\n" : "\n    ]\n");
+
+    out.append("}\n");
+    return out;
+}
+
+
+
+/**
+ * Appends a tile layer as a JSON object (or null if the layer doesn't exist).
+ *
+ * @param out: String to append to
+ * @param layer: Layer to write
+ *
+ */
+void MapExport::WriteLayerJSON(std::string* out, const TileLayer& layer) {
+
+    // Layers with a null tile index pointer are never allocated
+    if (layer.tile_indices == nullptr) {
+        out->append("null");
+        return;
+    }
+
+    out->append(Utils::FormatString(
+        "{\"tile_indices_addr\": %u, \"tile_data_addr\": %u, \"x_start\": %u, \"y_start\": %u, \"x_end\": %u, \"y_end\": %u, "
+        "\"width\": %u, \"height\": %u, \"load_flags\": %u, \"z_index\": %u, \"drawing_flags\": %u, \"tile_indices\": [",
+        layer.tile_indices_addr, layer.tile_data_addr, layer.x_start, layer.y_start, layer.x_end, layer.y_end,
+        layer.width, layer.height, layer.load_flags, layer.z_index, layer.drawing_flags
+    ));
+    uint num_tiles = layer.width * layer.height;
+    for (uint i = 0; i < num_tiles; i++) {
+        if (i > 0) {
+            out->push_back(',');
+        }
+        out->append(std::to_string(layer.tile_indices[i]));
+    }
+    out->append("]}");
+}
+
+
+
+/**
+ * Appends an emulated entity as a JSON object.
+ *
+ * @param out: String to append to
+ * @param entity: Entity to write
+ *
+ */
+void MapExport::WriteEntityJSON(std::string* out, const Entity& entity) {
+
+    out->append(Utils::FormatString(
+        "            {\"id\": %u, \"slot\": %u, \"address\": %u, ",
+        entity.data.object_id, entity.slot, entity.address + RAM_BASE_OFFSET
+    ));
+    if (!entity.name.empty()) {
+        out->append("\"name\": \"" + EscapeJSON(entity.name) + "\", ");
+    }
+    out->append("\"data\": {");
+
+    // Write every field with its own signedness
+    for (size_t i = 0; i < entity.data_vec.size(); i++) {
+        const EntityDataEntry& entry = entity.data_vec[i];
+        std::string value = std::visit([](auto field) {
+            if constexpr (std::is_signed<decltype(field)>::value) {
+                return std::to_string((long long)field);
+            }
+            else {
+                return std::to_string((unsigned long long)field);
+            }
+        }, entry.value);
+        out->append((i > 0 ? ", \"" : "\"") + entry.name + "\": " + value);
+    }
+    out->append("}}");
+}
+
+
+
+/**
+ * Escapes quotes, backslashes and control characters for use within a JSON string.
+ *
+ * @param str: String to escape
+ *
+ * @return Escaped string (without surrounding quotes)
+ *
+ */
+std::string MapExport::EscapeJSON(const std::string& str) {
+    std::string escaped;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped.push_back('\\');
+            escaped.push_back(c);
+        }
+        else if ((byte)c < 0x20) {
+            escaped.append(Utils::FormatString("\\u%04X", (byte)c));
+        }
+        else {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+
+
+
+// -- Binary ---------------------------------------------------------------------------------------------------
+
+/**
+ * Converts a map into the compact binary export format (see map_export.h for the layout).
+ *
+ * @param map: Map that has been parsed (and optionally had its entities emulated)
+ *
+ * @return Bytes of the binary export
+ *
+ */
+std::vector<byte> MapExport::ToBinary(const Map* map) {
+
+    std::vector<byte> out;
+
+    // Header
+    uint header[5] = {
+        MAP_EXPORT_MAGIC,
+        MAP_EXPORT_VERSION,
+        (uint)map->rooms.size(),
+        (uint)map->tile_layers.size(),
+        (uint)map->entity_layouts.size()
+    };
+    Append(&out, header, sizeof(header));
+
+    // Rooms (header bytes in file order, then the emulated entities)
+    for (const Room& room : map->rooms) {
+        byte room_header[8] = {
+            room.x_start, room.y_start, room.x_end, room.y_end,
+            room.tile_layer_id, room.load_flags, room.entity_graphics_id, room.entity_layout_id
+        };
+        Append(&out, room_header, sizeof(room_header));
+
+        uint num_entities = room.entities.size();
+        Append(&out, &num_entities, sizeof(uint));
+        for (const Entity& entity : room.entities) {
+            uint address = entity.address + RAM_BASE_OFFSET;
+            Append(&out, &entity.slot, sizeof(uint));
+            Append(&out, &address, sizeof(uint));
+            Append(&out, &entity.data, sizeof(EntityData));
+        }
+    }
+
+    // Tile layers
+    for (const auto& layer_pair : map->tile_layers) {
+        for (const TileLayer* layer : {&layer_pair.first, &layer_pair.second}) {
+            byte present = layer->tile_indices != nullptr;
+            Append(&out, &present, sizeof(byte));
+            if (!present) {
+                continue;
+            }
+            Append(&out, &layer->tile_indices_addr, sizeof(uint));
+            Append(&out, &layer->tile_data_addr, sizeof(uint));
+            byte bounds[5] = {layer->x_start, layer->y_start, layer->x_end, layer->y_end, layer->load_flags};
+            Append(&out, bounds, sizeof(bounds));
+            Append(&out, &layer->z_index, sizeof(ushort));
+            Append(&out, &layer->drawing_flags, sizeof(ushort));
+            Append(&out, &layer->width, sizeof(uint));
+            Append(&out, &layer->height, sizeof(uint));
+            Append(&out, layer->tile_indices, layer->width * layer->height * sizeof(ushort));
+        }
+    }
+
+    // Entity layouts
+    for (const auto& layout : map->entity_layouts) {
+        uint num_entries = layout.size();
+        Append(&out, &num_entries, sizeof(uint));
+        Append(&out, layout.data(), num_entries * sizeof(EntityInitData));
+    }
+
+    return out;
+}
+
+
+
+/**
+ * Appends raw bytes to a binary export.
+ *
+ * @param out: Buffer to append to
+ * @param data: Bytes to append
+ * @param num_bytes: Number of bytes to append
+ *
+ */
+void MapExport::Append(std::vector<byte>* out, const void* data, size_t num_bytes) {
+    if (num_bytes == 0) {
+        return;
+    }
+    size_t offset = out->size();
+    out->resize(offset + num_bytes);
+    memcpy(out->data() + offset, data, num_bytes);
+}
@@ -0,0 +1,862 @@
+#include <algorithm>
+#include <filesystem>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include "common.h"
+#include "map_generator.h"
+#include "map_writer.h"
+#include "entities.h"
+#include "sprites.h"
+#include "compression.h"
+#include "mips.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+// Layout of the extracted disc written by WriteGameFiles()
+const char* const MAPGEN_PSX_NAME = "SLUS_000.67";
+const char* const MAPGEN_SOTN_NAME = "DRA.BIN";
+const char* const MAPGEN_GAME_GRAPHICS_NAME = "BIN/F_GAME.BIN";
+
+// Size of the synthetic binaries (DRA.BIN reaches just past the CLUT setup routine)
+const uint MAPGEN_PSX_SIZE = 0x800;
+const uint MAPGEN_SOTN_SIZE = 0x000EB000 - SOTN_RAM_OFFSET;
+
+// Name every synthetic enemy shows up with
+const uint MAPGEN_ENEMY_NAME_ADDR = 0x000EAF00;
+
+// Number of entity layouts a map has (the Y-sorted table has one less)
+const uint MAPGEN_NUM_LAYOUTS = ENTITY_LAYOUT_COUNT;
+
+// Entity layout markers
+const short MAPGEN_LAYOUT_START = -2;
+const short MAPGEN_LAYOUT_END = -1;
+
+
+
+
+// -- Helpers --------------------------------------------------------------------------------------------------
+
+/**
+ * Appends data to the end of a file being built (aligned to 4 bytes, like every table in a map overlay).
+ *
+ * @param out: File being built
+ * @param data: Data to append
+ * @param num_bytes: Number of bytes to append
+ *
+ * @return Offset of the data within the file
+ *
+ */
+static uint append_bytes(std::vector<byte>* out, const void* data, size_t num_bytes) {
+    out->resize((out->size() + 3) & ~3);
+    uint offset = out->size();
+    out->insert(out->end(), (const byte*)data, (const byte*)data + num_bytes);
+    return offset;
+}
+
+
+
+/**
+ * Appends a list of 32-bit words to the end of a file being built.
+ *
+ * @param out: File being built
+ * @param words: Words to append
+ *
+ * @return Offset of the first word within the file
+ *
+ */
+static uint append_words(std::vector<byte>* out, const std::vector<uint>& words) {
+    return append_bytes(out, words.data(), words.size() * sizeof(uint));
+}
+
+
+
+/**
+ * Overwrites a 32-bit word of a file being built.
+ *
+ * @param out: File being built
+ * @param offset: Offset of the word within the file
+ * @param value: Value to write
+ *
+ */
+static void write_word(std::vector<byte>* out, uint offset, uint value) {
+    memcpy(out->data() + offset, &value, sizeof(uint));
+}
+
+
+
+/**
+ * Encodes an I-type MIPS instruction.
+ */
+static uint mips_i(uint op, uint rs, uint rt, int imm) {
+    return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF);
+}
+
+
+
+/**
+ * Encodes an R-type MIPS instruction.
+ */
+static uint mips_r(uint rs, uint rt, uint rd, uint shamt, uint funct) {
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+
+
+/**
+ * Small deterministic random number generator (xorshift32) so every seed always produces the same data.
+ *
+ * @param state: Generator state (must not be zero)
+ *
+ * @return Next random value
+ *
+ */
+uint MapGenerator::NextRandom(uint* state) {
+    uint x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+
+/**
+ * Writes a file, creating its directory if needed.
+ *
+ * @param filename: File to write
+ * @param data: Contents of the file
+ *
+ * @return True if the whole file was written
+ *
+ */
+bool MapGenerator::WriteFile(const std::string& filename, const std::vector<byte>& data) {
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(filename).parent_path(), ec);
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr) {
+        Log::Error("Could not write %s\n", filename.c_str());
+        return false;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    if (fclose(fp) != 0 || !written) {
+        Log::Error("Could not write %s\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+
+
+// -- Graphics -------------------------------------------------------------------------------------------------
+
+/**
+ * Creates a VRAM image whose tilesets are filled with 16 x 16 tiles of 4-bit pixels.
+ *
+ * @param seed: Seed of the tile patterns
+ * @param num_tilesets: Number of tilesets (64 VRAM words wide columns) to fill, the rest stays blank
+ *
+ * @return 512 x 256 VRAM words
+ *
+ * @note The first tile of the first tileset is left blank (tile definition 0 of every layer points at it).
+ * @note The bottom 16 rows are left for the CLUTs.
+ *
+ */
+std::vector<byte> MapGenerator::MakeTilesetVRAM(uint seed, uint num_tilesets) {
+
+    std::vector<byte> vram(512 * 256 * 2, 0);
+    ushort* words = (ushort*)vram.data();
+
+    for (uint tileset = 0; tileset < num_tilesets && tileset < 8; tileset++) {
+        for (uint tile = (tileset == 0 ? 1 : 0); tile < 15 * 16; tile++) {
+
+            // Pick the look of the tile (bands, stripes with see-through gaps or a solid fill)
+            uint shape = NextRandom(&seed) % 3;
+            uint color_a = 1 + (NextRandom(&seed) % 15);
+            uint color_b = (shape == 1 ? 0 : 1 + (NextRandom(&seed) % 15));
+            uint run = 2 + (NextRandom(&seed) % 6);
+
+            // Draw the tile 4 pixels (1 VRAM word) at a time
+            uint tile_x = (tileset * 64) + ((tile % 16) * 4);
+            uint tile_y = (tile / 16) * 16;
+            for (uint y = 0; y < 16; y++) {
+                for (uint x = 0; x < 4; x++) {
+                    ushort word = 0;
+                    for (uint i = 0; i < 4; i++) {
+                        uint px = (x * 4) + i;
+                        uint r = NextRandom(&seed);
+                        uint color;
+                        switch (shape) {
+                            case 0: color = (((px / run) + (y / run)) & 1) ? color_a : color_b; break;
+                            case 1: color = (((px + y) / run) & 1) ? color_a : color_b; break;
+                            default: color = color_a; break;
+                        }
+                        if ((r & 0x1F) == 0) {
+                            color = (r >> 8) & 0xF;
+                        }
+                        word |= color << (i * 4);
+                    }
+                    words[((tile_y + y) * 512) + tile_x + x] = word;
+                }
+            }
+        }
+    }
+
+    return vram;
+}
+
+
+
+/**
+ * Creates a set of 16 color CLUTs.
+ *
+ * @param seed: Random number generator state
+ * @param cluts: Where to store the CLUTs (count * 16 RGB1555 colors)
+ * @param count: Number of CLUTs to create
+ *
+ * @note Color 0 of every CLUT is transparent and some colors have the semi-transparency bit set.
+ *
+ */
+void MapGenerator::MakeCLUTs(uint* seed, ushort* cluts, uint count) {
+    for (uint i = 0; i < count; i++) {
+        cluts[i * 16] = 0;
+        for (uint k = 1; k < 16; k++) {
+            uint r = NextRandom(seed);
+            ushort color = (r & 0x7FFF) | (((r >> 16) % 8) == 0 ? 0x8000 : 0);
+            if ((color & 0x7FFF) == 0) {
+                color |= 0x0421;
+            }
+            cluts[(i * 16) + k] = color;
+        }
+    }
+}
+
+
+
+/**
+ * Splits a VRAM image into the 32 chunks a graphics file stores it as (the reverse of Utils::Chunks_to_VRAM).
+ *
+ * @param vram: 512 x 256 VRAM words
+ *
+ * @return 32 chunks of 32 x 128 VRAM words
+ *
+ */
+std::vector<byte> MapGenerator::VRAM_to_Chunks(const std::vector<byte>& vram) {
+
+    std::vector<byte> chunks(32 * 8192);
+    for (uint i = 0; i < 32; i++) {
+        uint x = (((i / 4) * 2) + (i % 2)) * 32;
+        uint y = ((i % 4) / 2) * 128;
+        for (uint k = 0; k < 128; k++) {
+            memcpy(chunks.data() + (i * 8192) + (k * 32 * 2), vram.data() + ((((y + k) * 512) + x) * 2), 32 * 2);
+        }
+    }
+    return chunks;
+}
+
+
+
+/**
+ * Creates an entity graphics block: a 128 x 128 sheet of 4-bit sprites on a transparent background.
+ *
+ * @param seed: Random number generator state
+ *
+ * @return 32 x 128 VRAM words (the data a compressed entity graphics block expands to)
+ *
+ */
+std::vector<byte> MapGenerator::MakeSpriteSheet(uint* seed) {
+
+    std::vector<byte> sheet((MAPGEN_BLOCK_SIZE / 4) * MAPGEN_BLOCK_SIZE * 2, 0);
+    ushort* words = (ushort*)sheet.data();
+
+    // One blob per 32 x 32 cell
+    for (uint cell = 0; cell < 16; cell++) {
+        int radius_x = 8 + (NextRandom(seed) % 8);
+        int radius_y = 8 + (NextRandom(seed) % 8);
+        uint color_a = 1 + (NextRandom(seed) % 15);
+        uint color_b = 1 + (NextRandom(seed) % 15);
+        uint band = 2 + (NextRandom(seed) % 4);
+        uint cell_x = (cell % 4) * 32;
+        uint cell_y = (cell / 4) * 32;
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 32; x++) {
+                int dx = x - 16;
+                int dy = y - 16;
+                if ((dx * dx * radius_y * radius_y) + (dy * dy * radius_x * radius_x) > radius_x * radius_x * radius_y * radius_y) {
+                    continue;
+                }
+                uint color = ((y / band) & 1) ? color_a : color_b;
+                if ((NextRandom(seed) & 0xF) == 0) {
+                    color = 1 + (NextRandom(seed) % 15);
+                }
+                uint px = cell_x + x;
+                words[((cell_y + y) * (MAPGEN_BLOCK_SIZE / 4)) + (px / 4)] |= color << ((px % 4) * 4);
+            }
+        }
+    }
+
+    return sheet;
+}
+
+
+
+
+// -- Code -----------------------------------------------------------------------------------------------------
+
+/**
+ * Creates a synthetic entity update routine.
+ *
+ * @param sprite_bank: Sprite bank the entity draws from (0x8000 | map sprite bank)
+ * @param sprite_image: Sprite within the bank
+ * @param tileset: Tileset of the entity (0 for the map tilesets)
+ * @param clut_index: Base CLUT of the entity
+ * @param num_loops: Number of times the busy loop runs on every call
+ *
+ * @return Instructions of the routine
+ *
+ * @note The first call sets up the sprite and state like an entity's init step does, every call then picks the
+ *       sprite frame and runs a loop that reads the position and velocity, branches on the result and writes to
+ *       the entity's timers (15 instructions per iteration, about 16 more around it).
+ *
+ */
+std::vector<uint> MapGenerator::MakeEntityRoutine(uint sprite_bank, uint sprite_image, uint tileset, uint clut_index, uint num_loops) {
+
+    const uint T1 = T0 + 1, T2 = T0 + 2, T3 = T0 + 3, T4 = T0 + 4, T5 = T0 + 5;
+    const int state = offsetof(EntityData, current_state);
+    return {
+        mips_i(0x25, A0, T1, state),                                    // lhu   t1, current_state(a0)
+        mips_i(0x05, T1, ZERO, 9),                                      // bne   t1, zero, update
+        0,                                                              // nop
+        mips_i(0x0D, ZERO, T1, sprite_bank),                            // ori   t1, zero, sprite_bank
+        mips_i(0x29, A0, T1, offsetof(EntityData, sprite_bank)),        // sh    t1, sprite_bank(a0)
+        mips_i(0x0D, ZERO, T1, tileset),                                // ori   t1, zero, tileset
+        mips_i(0x29, A0, T1, offsetof(EntityData, tileset)),            // sh    t1, tileset(a0)
+        mips_i(0x0D, ZERO, T1, clut_index),                             // ori   t1, zero, clut_index
+        mips_i(0x29, A0, T1, offsetof(EntityData, clut_index)),         // sh    t1, clut_index(a0)
+        mips_i(0x0D, ZERO, T1, 1),                                      // ori   t1, zero, 1
+        mips_i(0x29, A0, T1, state),                                    // sh    t1, current_state(a0)
+        // update:
+        mips_i(0x0D, ZERO, T1, sprite_image),                           // ori   t1, zero, sprite_image
+        mips_i(0x29, A0, T1, offsetof(EntityData, sprite_image)),       // sh    t1, sprite_image(a0)
+        mips_i(0x09, ZERO, T0, num_loops),                              // addiu t0, zero, num_loops
+        // loop:
+        mips_i(0x21, A0, T1, offsetof(EntityData, pos_x)),              // lh    t1, pos_x(a0)
+        mips_i(0x21, A0, T2, offsetof(EntityData, pos_y)),              // lh    t2, pos_y(a0)
+        mips_i(0x23, A0, T3, offsetof(EntityData, acceleration_x)),     // lw    t3, acceleration_x(a0)
+        mips_r(0, T3, T3, 16, 0x03),                                    // sra   t3, t3, 16
+        mips_r(T1, T3, T1, 0, 0x21),                                    // addu  t1, t1, t3
+        mips_i(0x29, A0, T1, offsetof(EntityData, unk80)),              // sh    t1, unk80(a0)
+        mips_i(0x0C, T1, T4, 0xFF),                                     // andi  t4, t1, 0xFF
+        mips_i(0x0B, T4, T5, 0x80),                                     // sltiu t5, t4, 0x80
+        mips_i(0x04, T5, ZERO, 2),                                      // beq   t5, zero, skip
+        0,                                                              // nop
+        mips_i(0x09, T2, T2, 1),                                        // addiu t2, t2, 1
+        // skip:
+        mips_i(0x29, A0, T2, offsetof(EntityData, unk82)),              // sh    t2, unk82(a0)
+        mips_i(0x09, T0, T0, -1),                                       // addiu t0, t0, -1
+        mips_i(0x05, T0, ZERO, -14),                                    // bne   t0, zero, loop
+        0,                                                              // nop
+        mips_r(RA, 0, 0, 0, 0x08),                                      // jr    ra
+        0                                                               // nop
+    };
+}
+
+
+
+
+// -- Maps -----------------------------------------------------------------------------------------------------
+
+/**
+ * Scales up a map the way a bigger real map grows: more rooms, more entities in each room and more entity types.
+ *
+ * @param config: Map to scale
+ * @param factor: How many times bigger the map should be
+ *
+ * @return Scaled map
+ *
+ * @note Layers, tiles, sprites and graphics stay shared between the rooms, so the overlay keeps fitting in RAM.
+ *
+ */
+MapGenConfig MapGenerator::Scale(const MapGenConfig& config, uint factor) {
+    MapGenConfig scaled = config;
+    factor = std::max(factor, 1u);
+    scaled.num_rooms = config.num_rooms * factor;
+    scaled.entities_per_room = std::min(config.entities_per_room * factor, MAPGEN_MAX_ENTITIES);
+    scaled.num_entity_types = std::min(config.num_entity_types * factor, 0x3FEu);
+    return scaled;
+}
+
+
+
+/**
+ * Generates a synthetic map overlay (<ID>.BIN) and its graphics file (F_<ID>.BIN).
+ *
+ * @param in_config: Shape of the map (counts are clamped to what the map format can address)
+ * @param map_data: Where to store the map overlay
+ * @param gfx_data: Where to store the map graphics file
+ * @param stats: (Optional) Where to store what ended up in the map
+ *
+ * @return True if the map fits in the overlay's part of RAM
+ *
+ * @note The overlay uses the same header and table layout Map::ParseMapFile() reads (and MapWriter updates).
+ *
+ */
+bool MapGenerator::GenerateMap(const MapGenConfig& in_config, std::vector<byte>* map_data, std::vector<byte>* gfx_data, MapGenStats* stats) {
+
+    // Keep every count within what the map format can address
+    MapGenConfig config = in_config;
+    config.num_rooms = std::max(config.num_rooms, 1u);
+    config.room_width = std::clamp(config.room_width, 1u, 64u);
+    config.room_height = std::clamp(config.room_height, 1u, 64u);
+    config.num_layer_pairs = std::clamp(config.num_layer_pairs, 1u, std::min(config.num_rooms, 255u));
+    config.num_tile_data = std::clamp(config.num_tile_data, 1u, config.num_layer_pairs);
+    config.tile_variety = std::clamp(config.tile_variety, 2u, 4096u);
+    config.num_tilesets = std::clamp(config.num_tilesets, 1u, 8u);
+    config.fg_empty_percent = std::min(config.fg_empty_percent, 100u);
+    config.entities_per_room = std::min(config.entities_per_room, MAPGEN_MAX_ENTITIES);
+    config.num_entity_types = std::clamp(config.num_entity_types, 1u, 0x3FEu);
+    config.num_sprite_banks = std::clamp(config.num_sprite_banks, 1u, 0x7FFEu);
+    config.sprites_per_bank = std::max(config.sprites_per_bank, 1u);
+    config.parts_per_sprite = std::max(config.parts_per_sprite, 1u);
+    config.num_graphics_blocks = std::max(config.num_graphics_blocks, 1u);
+    config.num_graphics_lists = std::clamp(config.num_graphics_lists, 1u, 254u);
+    config.blocks_per_room = std::clamp(config.blocks_per_room, 1u, MAPGEN_MAX_BLOCKS_PER_ROOM);
+    config.num_entity_cluts = std::clamp(config.num_entity_cluts, 2u, (CLUT_DATA_SIZE / 32) - MAPGEN_ENTITY_CLUT_BASE);
+
+    // Lay the rooms out in rows (room coordinates are bytes, layer coordinates are 6 bits)
+    uint rooms_per_row = 64 / config.room_width;
+    uint num_rows = (config.num_rooms + rooms_per_row - 1) / rooms_per_row;
+    if (num_rows * config.room_height > 256) {
+        Log::Error("%u rooms of %u x %u cells do not fit on the 256 x 64 cell map grid\n", config.num_rooms, config.room_width, config.room_height);
+        return false;
+    }
+
+    uint seed = (config.seed * 0x9E3779B9) | 1;
+    std::vector<byte>* out = map_data;
+    out->assign(0x40, 0);
+
+
+
+
+// -- Code -----------------------------------------------------------------------------------------------------
+
+    // Entity function 0 is dummy data and the room functions do nothing
+    uint dummy_addr = append_words(out, {0xFFFEFFFE, 0});
+    uint stub_addr = append_words(out, {INST_JR_RA, 0});
+    for (uint offset : {0x00, 0x04, 0x08, 0x0C, 0x28}) {
+        write_word(out, offset, stub_addr + MAP_BIN_OFFSET);
+    }
+
+    // Entity update routines (odd sprite banks draw from the map tilesets, even ones from the entity graphics blocks)
+    uint num_loops = std::max<int>(1, ((int)config.routine_instructions - 16) / 15);
+    std::vector<uint> routine_addrs;
+    for (uint i = 0; i < config.num_entity_types; i++) {
+        uint bank = 1 + (i % config.num_sprite_banks);
+        bool uses_blocks = (bank % 2) == 0;
+        uint clut_index = uses_blocks ? MAPGEN_ENTITY_CLUT_BASE + (i % (config.num_entity_cluts - 1)) : 0;
+        std::vector<uint> routine = MakeEntityRoutine(0x8000 | bank, 1 + (i % config.sprites_per_bank), uses_blocks ? MAPGEN_ENTITY_TILESET : 0, clut_index, num_loops);
+        routine_addrs.push_back(append_words(out, routine));
+    }
+
+
+
+
+// -- Rooms ----------------------------------------------------------------------------------------------------
+
+    uint rooms_addr = append_bytes(out, nullptr, 0);
+    for (uint i = 0; i < config.num_rooms; i++) {
+        byte room[8];
+        room[0] = (i % rooms_per_row) * config.room_width;
+        room[1] = (i / rooms_per_row) * config.room_height;
+        room[2] = room[0] + config.room_width - 1;
+        room[3] = room[1] + config.room_height - 1;
+        room[4] = i % config.num_layer_pairs;
+        room[5] = 0;
+        room[6] = 1 + (i % config.num_graphics_lists);
+        room[7] = i % MAPGEN_NUM_LAYOUTS;
+        append_bytes(out, room, sizeof(room));
+    }
+    append_words(out, {0x00000040});
+    write_word(out, 0x10, rooms_addr + MAP_BIN_OFFSET);
+
+
+
+
+// -- Sprite Banks ---------------------------------------------------------------------------------------------
+
+    // Bank 0 and sprite 0 of every bank are null, like in the game's maps
+    uint banks_addr = append_words(out, std::vector<uint>(config.num_sprite_banks + 2, 0));
+    write_word(out, banks_addr + ((config.num_sprite_banks + 1) * 4), 0xFFFFFFFF);
+    for (uint bank = 1; bank <= config.num_sprite_banks; bank++) {
+
+        bool uses_blocks = (bank % 2) == 0;
+        uint sprites_addr = append_words(out, std::vector<uint>(config.sprites_per_bank + 2, 0));
+        write_word(out, sprites_addr + ((config.sprites_per_bank + 1) * 4), 0xFFFFFFFF);
+        write_word(out, banks_addr + (bank * 4), sprites_addr + MAP_BIN_OFFSET);
+
+        for (uint sprite = 1; sprite <= config.sprites_per_bank; sprite++) {
+            std::vector<byte> sprite_data(2 + (config.parts_per_sprite * sizeof(SpritePart)));
+            *(ushort*)sprite_data.data() = config.parts_per_sprite;
+            for (uint i = 0; i < config.parts_per_sprite; i++) {
+
+                // Parts are cut out of a map tileset (256 x 240) or a graphics block loaded by the room (128 x 128)
+                SpritePart part;
+                part.width = 16 * (1 + (NextRandom(&seed) % 4));
+                part.height = 16 * (1 + (NextRandom(&seed) % 4));
+                uint source_width = (uses_blocks ? MAPGEN_BLOCK_SIZE : 256);
+                uint source_height = (uses_blocks ? MAPGEN_BLOCK_SIZE : 240);
+                part.tileset_offset = (uses_blocks ? NextRandom(&seed) % config.blocks_per_room : 4 * (NextRandom(&seed) % config.num_tilesets));
+                part.clut_offset = (uses_blocks ? NextRandom(&seed) % 2 : NextRandom(&seed) % 256);
+                part.texture_start_x = 4 * (NextRandom(&seed) % (((source_width - part.width) / 4) + 1));
+                part.texture_start_y = NextRandom(&seed) % (source_height - part.height + 1);
+                part.texture_end_x = part.texture_start_x + part.width;
+                part.texture_end_y = part.texture_start_y + part.height;
+                part.offset_x = (short)(NextRandom(&seed) % 32) - 16 - (part.width / 2);
+                part.offset_y = (short)(NextRandom(&seed) % 16) - part.height;
+                memcpy(sprite_data.data() + 2 + (i * sizeof(SpritePart)), &part, sizeof(SpritePart));
+            }
+            uint sprite_addr = append_bytes(out, sprite_data.data(), sprite_data.size());
+            write_word(out, sprites_addr + (sprite * 4), sprite_addr + MAP_BIN_OFFSET);
+        }
+    }
+    write_word(out, 0x14, banks_addr + MAP_BIN_OFFSET);
+
+
+
+
+// -- CLUTs ----------------------------------------------------------------------------------------------------
+
+    // A single entry loading every entity CLUT after the map tile CLUTs (offsets and counts are in colors)
+    std::vector<ushort> entity_cluts(config.num_entity_cluts * 16);
+    MakeCLUTs(&seed, entity_cluts.data(), config.num_entity_cluts);
+    uint clut_data_addr = append_bytes(out, entity_cluts.data(), entity_cluts.size() * sizeof(ushort));
+    uint clut_list_addr = append_words(out, {
+        0x00000005,
+        MAPGEN_ENTITY_CLUT_BASE * 16,
+        config.num_entity_cluts * 16,
+        clut_data_addr + MAP_BIN_OFFSET,
+        0xFFFFFFFF
+    });
+    uint cluts_addr = append_words(out, {clut_list_addr + MAP_BIN_OFFSET, 0});
+    write_word(out, 0x18, cluts_addr + MAP_BIN_OFFSET);
+
+
+
+
+// -- Tile Layers ----------------------------------------------------------------------------------------------
+
+    // Tile definitions (definition 0 is the blank first tile of the first tileset)
+    std::vector<uint> tile_data_addrs;
+    for (uint i = 0; i < config.num_tile_data; i++) {
+        std::vector<byte> tile_data(4 * 4096, 0);
+        byte* tileset_ids = tile_data.data();
+        byte* tile_positions = tileset_ids + 4096;
+        byte* clut_ids = tile_positions + 4096;
+        byte* collision_ids = clut_ids + 4096;
+        for (uint k = 1; k < config.tile_variety; k++) {
+            tileset_ids[k] = NextRandom(&seed) % config.num_tilesets;
+            tile_positions[k] = ((NextRandom(&seed) % 15) << 4) | (NextRandom(&seed) % 16);
+            if (tileset_ids[k] == 0 && tile_positions[k] == 0) {
+                tile_positions[k] = 1;
+            }
+            clut_ids[k] = NextRandom(&seed) % 256;
+            uint collision = NextRandom(&seed);
+            collision_ids[k] = ((collision % 8) == 0 ? (collision >> 8) % 0x80 : 0);
+        }
+        uint arrays_addr = append_bytes(out, tile_data.data(), tile_data.size());
+        tile_data_addrs.push_back(append_words(out, {
+            arrays_addr + MAP_BIN_OFFSET,
+            arrays_addr + 4096 + MAP_BIN_OFFSET,
+            arrays_addr + (2 * 4096) + MAP_BIN_OFFSET,
+            arrays_addr + (3 * 4096) + MAP_BIN_OFFSET
+        }));
+    }
+
+    // Layer pairs (placed where the first room using them is, each has its own tile indices)
+    uint num_tiles = (config.room_width * 16) * (config.room_height * 16);
+    std::vector<uint> layer_addrs;
+    for (uint i = 0; i < config.num_layer_pairs; i++) {
+        uint x_start = std::min((i % rooms_per_row) * config.room_width, 64 - config.room_width);
+        uint y_start = std::min(((i / rooms_per_row) * config.room_height) & 0x3F, 64 - config.room_height);
+        uint dimensions = x_start | (y_start << 6) | ((x_start + config.room_width - 1) << 12) | ((y_start + config.room_height - 1) << 18);
+        for (uint k = 0; k < 2; k++) {
+
+            // Foreground layers are partly empty, background layers are filled
+            std::vector<ushort> tile_indices(num_tiles);
+            for (ushort& tile_index : tile_indices) {
+                bool empty = (k == 0) && (NextRandom(&seed) % 100) < config.fg_empty_percent;
+                tile_index = (empty ? 0 : 1 + (NextRandom(&seed) % (config.tile_variety - 1)));
+            }
+            uint indices_addr = append_bytes(out, tile_indices.data(), tile_indices.size() * sizeof(ushort));
+            layer_addrs.push_back(append_words(out, {
+                indices_addr + MAP_BIN_OFFSET,
+                tile_data_addrs[i % config.num_tile_data] + MAP_BIN_OFFSET,
+                dimensions,
+                (k == 0 ? 0x20u : 0x10u)
+            }));
+        }
+    }
+    std::vector<uint> layer_table;
+    for (uint addr : layer_addrs) {
+        layer_table.push_back(addr + MAP_BIN_OFFSET);
+    }
+    layer_table.push_back(0);
+    uint tile_layers_addr = append_words(out, layer_table);
+    write_word(out, 0x20, tile_layers_addr + MAP_BIN_OFFSET);
+
+
+
+
+// -- Entity Graphics ------------------------------------------------------------------------------------------
+
+    // Compressed sprite sheets
+    std::vector<uint> block_addrs;
+    uint compressed_bytes = 0;
+    for (uint i = 0; i < config.num_graphics_blocks; i++) {
+        std::vector<byte> sheet = MakeSpriteSheet(&seed);
+        std::vector<byte> compressed = Compression::Compress(sheet.data(), sheet.size());
+        block_addrs.push_back(append_bytes(out, compressed.data(), compressed.size()));
+        compressed_bytes += compressed.size();
+    }
+
+    // Lists of the blocks each room loads into the quarters of its VRAM chunks (tileset 0x40 + quarter)
+    std::vector<uint> graphics_table;
+    for (uint i = 0; i < config.num_graphics_lists; i++) {
+        std::vector<byte> list(4 + ((config.blocks_per_room + 1) * sizeof(EntityGraphicsData)), 0xFF);
+        *(uint*)list.data() = 4;
+        for (uint k = 0; k < config.blocks_per_room; k++) {
+            EntityGraphicsData graphics_data;
+            graphics_data.vram_x = ((k / 4) * 64) + ((k % 2) * 32);
+            graphics_data.vram_y = 256 + (((k % 4) / 2) * 128);
+            graphics_data.width = MAPGEN_BLOCK_SIZE;
+            graphics_data.height = MAPGEN_BLOCK_SIZE;
+            graphics_data.compressed_graphics_addr = block_addrs[((i * config.blocks_per_room) + k) % config.num_graphics_blocks] + MAP_BIN_OFFSET;
+            memcpy(list.data() + 4 + (k * sizeof(EntityGraphicsData)), &graphics_data, sizeof(EntityGraphicsData));
+        }
+        graphics_table.push_back(append_bytes(out, list.data(), list.size()) + MAP_BIN_OFFSET);
+    }
+
+
+
+
+// -- Entity Layouts -------------------------------------------------------------------------------------------
+
+    // The graphics table runs up to the layout tables, which are followed by the entity functions
+    uint graphics_table_addr = append_words(out, graphics_table);
+    uint layouts_addr = append_words(out, std::vector<uint>(MAPGEN_NUM_LAYOUTS + ENTITY_LAYOUT_Y_COUNT, 0));
+    std::vector<uint> function_table = {dummy_addr + MAP_BIN_OFFSET};
+    for (uint addr : routine_addrs) {
+        function_table.push_back(addr + MAP_BIN_OFFSET);
+    }
+    function_table.push_back(0);
+    append_words(out, function_table);
+    write_word(out, 0x1C, layouts_addr + MAP_BIN_OFFSET);
+    write_word(out, 0x24, graphics_table_addr + MAP_BIN_OFFSET);
+
+    // Layouts no room uses point at an empty list
+    EntityInitData start_marker = {MAPGEN_LAYOUT_START, MAPGEN_LAYOUT_START, 0, 0, 0};
+    EntityInitData end_marker = {MAPGEN_LAYOUT_END, MAPGEN_LAYOUT_END, 0, 0, 0};
+    std::vector<EntityInitData> empty_list = {start_marker, end_marker};
+    uint empty_list_addr = append_bytes(out, empty_list.data(), empty_list.size() * sizeof(EntityInitData));
+
+    // Each layout is stored sorted by X and (except for the last one) sorted by Y
+    uint num_layouts = std::min(config.num_rooms, MAPGEN_NUM_LAYOUTS);
+    uint num_entities = 0;
+    for (uint i = 0; i < MAPGEN_NUM_LAYOUTS; i++) {
+
+        uint x_list_addr = empty_list_addr;
+        uint y_list_addr = empty_list_addr;
+        if (i < num_layouts) {
+            std::vector<EntityInitData> entities;
+            for (uint k = 0; k < config.entities_per_room; k++) {
+                EntityInitData init_data;
+                init_data.x_coord = 16 + (NextRandom(&seed) % ((config.room_width * 256) - 32));
+                init_data.y_coord = 16 + (NextRandom(&seed) % ((config.room_height * 256) - 32));
+                init_data.entity_id = 1 + (NextRandom(&seed) % config.num_entity_types);
+                init_data.slot = k + 1;
+                init_data.initial_state = NextRandom(&seed) % 4;
+                entities.push_back(init_data);
+            }
+
+            std::vector<EntityInitData> list = {start_marker};
+            std::sort(entities.begin(), entities.end(), [](const EntityInitData& a, const EntityInitData& b) { return a.x_coord < b.x_coord; });
+            list.insert(list.end(), entities.begin(), entities.end());
+            list.push_back(end_marker);
+            x_list_addr = append_bytes(out, list.data(), list.size() * sizeof(EntityInitData));
+
+            list = {start_marker};
+            std::sort(entities.begin(), entities.end(), [](const EntityInitData& a, const EntityInitData& b) { return a.y_coord < b.y_coord; });
+            list.insert(list.end(), entities.begin(), entities.end());
+            list.push_back(end_marker);
+            y_list_addr = append_bytes(out, list.data(), list.size() * sizeof(EntityInitData));
+        }
+
+        write_word(out, layouts_addr + (i * 4), x_list_addr + MAP_BIN_OFFSET);
+        if (i < ENTITY_LAYOUT_Y_COUNT) {
+            write_word(out, layouts_addr + ((MAPGEN_NUM_LAYOUTS + i) * 4), y_list_addr + MAP_BIN_OFFSET);
+        }
+    }
+    for (uint i = 0; i < config.num_rooms; i++) {
+        num_entities += (i % MAPGEN_NUM_LAYOUTS) < num_layouts ? config.entities_per_room : 0;
+    }
+    out->resize((out->size() + 3) & ~3);
+
+    // The overlay has to fit between its load address and the end of RAM
+    if (out->size() > MAP_FILE_MAX_SIZE) {
+        Log::Error("Synthetic map is %zu bytes, more than the %u bytes an overlay can hold\n", out->size(), MAP_FILE_MAX_SIZE);
+        return false;
+    }
+
+
+
+
+// -- Map Graphics ---------------------------------------------------------------------------------------------
+
+    // Tilesets with the map tile CLUTs in the bottom 16 rows (16 CLUTs per row)
+    std::vector<byte> vram = MakeTilesetVRAM(seed, config.num_tilesets);
+    std::vector<ushort> tile_cluts(256 * 16);
+    MakeCLUTs(&seed, tile_cluts.data(), 256);
+    for (uint y = 0; y < 16; y++) {
+        memcpy(vram.data() + (((240 + y) * 512) * 2), tile_cluts.data() + (y * 256), 256 * 2);
+    }
+    *gfx_data = VRAM_to_Chunks(vram);
+
+    if (stats != nullptr) {
+        stats->map_size = out->size();
+        stats->gfx_size = gfx_data->size();
+        stats->num_rooms = config.num_rooms;
+        stats->num_entities = num_entities;
+        stats->num_layouts = num_layouts;
+        stats->compressed_bytes = compressed_bytes;
+        stats->routine_loops = num_loops;
+    }
+    return true;
+}
+
+
+
+
+// -- Game Files -----------------------------------------------------------------------------------------------
+
+/**
+ * Generates a stand-in for the PSX executable (SLUS_000.67).
+ *
+ * @return Executable header with no code (nothing in it runs while maps are loaded)
+ *
+ */
+std::vector<byte> MapGenerator::GeneratePSXBinary() {
+    std::vector<byte> data(MAPGEN_PSX_SIZE, 0);
+    memcpy(data.data(), "PS-X EXE", 8);
+    return data;
+}
+
+
+
+/**
+ * Generates a stand-in for the main game binary (DRA.BIN).
+ *
+ * @return Binary holding only what loading a map reads or runs
+ *
+ * @note The boot routine and the CLUT setup routine return straight away, the generic sprite bank table is empty,
+ *       the generic tilesets are blank and every enemy has the same name.
+ *
+ */
+std::vector<byte> MapGenerator::GenerateSotNBinary() {
+
+    std::vector<byte> data(MAPGEN_SOTN_SIZE, 0);
+    auto word_at = [&data](uint addr) { return (uint*)(data.data() + addr - SOTN_RAM_OFFSET); };
+
+    // Routines the emulator runs
+    *word_at(MAIN_FUNC_ADDR + 4) = INST_JR_RA;
+    *word_at(CLUT_SETUP_FUNC_ADDR) = INST_JR_RA;
+
+    // No generic sprite banks
+    *word_at(GENERIC_SPRITE_BANKS_ADDR) = 0xFFFFFFFF;
+
+    // Blank generic tilesets
+    std::vector<byte> blank((0x80 * 0x80) / 2, 0);
+    std::vector<byte> compressed = Compression::Compress(blank.data(), blank.size());
+    for (uint addr : {COMPRESSED_GENERIC_POWERUP_TILESET_ADDR, COMPRESSED_GENERIC_SAVEROOM_TILESET_ADDR, COMPRESSED_GENERIC_LOADROOM_TILESET_ADDR}) {
+        memcpy(word_at(addr), compressed.data(), compressed.size());
+    }
+
+    // Enemy name (SotN strings are offset by 0x20 and end with 0xFF)
+    *word_at(ENEMY_DATA_ADDR) = MAPGEN_ENEMY_NAME_ADDR + RAM_BASE_OFFSET;
+    std::string name = "Synthetic";
+    byte* name_data = (byte*)word_at(MAPGEN_ENEMY_NAME_ADDR);
+    for (size_t i = 0; i < name.size(); i++) {
+        name_data[i] = name[i] - 0x20;
+    }
+    name_data[name.size()] = 0xFF;
+
+    return data;
+}
+
+
+
+/**
+ * Generates a stand-in for the common graphics file (F_GAME.BIN).
+ *
+ * @param seed: Seed of the tile patterns and CLUTs
+ *
+ * @return 8 tilesets followed by 256 generic CLUTs
+ *
+ */
+std::vector<byte> MapGenerator::GenerateGameGraphics(uint seed) {
+    seed = (seed * 0x85EBCA6B) | 1;
+    std::vector<byte> data = VRAM_to_Chunks(MakeTilesetVRAM(seed, 8));
+    std::vector<ushort> cluts(256 * 16);
+    MakeCLUTs(&seed, cluts.data(), 256);
+    data.insert(data.end(), (const byte*)cluts.data(), (const byte*)(cluts.data() + cluts.size()));
+    return data;
+}
+
+
+
+/**
+ * Writes the synthetic game binaries laid out like an extracted disc (maps are added with WriteMap()).
+ *
+ * @param dirname: Directory to write the files to
+ * @param seed: Seed of the common graphics
+ *
+ * @return True if every file was written
+ *
+ */
+bool MapGenerator::WriteGameFiles(const char* dirname, uint seed) {
+    std::filesystem::path dir(dirname);
+    std::string system_cnf = Utils::FormatString("BOOT = cdrom:\\%s;1\r\nTCB = 4\r\nEVENT = 10\r\nSTACK = 801FFFF0\r\n", MAPGEN_PSX_NAME);
+    return (
+        WriteFile((dir / "SYSTEM.CNF").string(), std::vector<byte>(system_cnf.begin(), system_cnf.end())) &&
+        WriteFile((dir / MAPGEN_PSX_NAME).string(), GeneratePSXBinary()) &&
+        WriteFile((dir / MAPGEN_SOTN_NAME).string(), GenerateSotNBinary()) &&
+        WriteFile((dir / MAPGEN_GAME_GRAPHICS_NAME).string(), GenerateGameGraphics(seed))
+    );
+}
+
+
+
+/**
+ * Generates a synthetic map and writes it to ST/<ID>/ like the maps on the disc.
+ *
+ * @param dirname: Directory the game files were written to
+ * @param map_id: ID of the map (e.g. "SY00")
+ * @param config: Shape of the map
+ * @param stats: (Optional) Where to store what ended up in the map
+ *
+ * @return True if the map was generated and written
+ *
+ */
+bool MapGenerator::WriteMap(const char* dirname, const std::string& map_id, const MapGenConfig& config, MapGenStats* stats) {
+    std::vector<byte> map_data;
+    std::vector<byte> gfx_data;
+    if (!GenerateMap(config, &map_data, &gfx_data, stats)) {
+        return false;
+    }
+    std::filesystem::path map_dir = std::filesystem::path(dirname) / "ST" / map_id;
+    return WriteFile((map_dir / (map_id + ".BIN")).string(), map_data) && WriteFile((map_dir / ("F_" + map_id + ".BIN")).string(), gfx_data);
+}
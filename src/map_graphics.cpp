@@ -0,0 +1,581 @@
+#include <thread>
+#include <atomic>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include "common.h"
+#include "map.h"
+#include "rooms.h"
+#include "tiles.h"
+#include "cluts.h"
+#include "utils.h"
+#include "compression.h"
+#include "gpu.h"
+#include "mips.h"
+#include "mapped_file.h"
+#include "stage_timer.h"
+#include "trace.h"
+#include "log.h"
+
+
+
+// Deswizzled F_GAME.BIN VRAM shared by every map (set once the game data is loaded)
+std::vector<byte> Map::fgame_vram;
+
+
+
+/**
+ * Decompresses every entity graphics block loaded by a room and records where each room loads them into VRAM.
+ *
+ * @note Blocks already in the map cache are reused, the rest are decompressed in parallel.
+ *
+ */
+void Map::DecompressEntityGraphics() {
+
+    TraceZone zone("Map::DecompressEntityGraphics");
+    StageTimer timer(LoadStage_Decompress);
+
+    // Collect every distinct entity graphics block used by a room and the rectangles they're loaded into
+    load_status_msg = "Decompressing Entity Graphics ...";
+    entity_graphics_blocks.clear();
+    for (auto& room : rooms) {
+        uint gfx_id = (room.entity_graphics_id > 0 ? room.entity_graphics_id - 1 : 0);
+        if (room.load_flags == 0xFF || gfx_id >= entity_graphics.size()) {
+            continue;
+        }
+        for (const auto& graphics_data : entity_graphics[gfx_id]) {
+
+            // Skip this entry if no data address was defined
+            if (graphics_data.compressed_graphics_addr == 0) {
+                continue;
+            }
+            uint graphics_addr = graphics_data.compressed_graphics_addr - MAP_BIN_OFFSET;
+            entity_graphics_blocks.emplace(graphics_addr, graphics_data);
+
+            // Record the rectangle the graphics are loaded into
+            VramPatch patch;
+            patch.x = graphics_data.vram_x;
+            patch.y = graphics_data.vram_y - 256;
+            patch.width = graphics_data.width / 4;
+            patch.height = graphics_data.height;
+            patch.graphics_addr = graphics_addr;
+            if (graphics_data.vram_y >= 256 && patch.x < 512 && patch.y < 256) {
+                room.vram_patches.push_back(patch);
+            }
+        }
+    }
+
+    // Decompress the blocks that aren't cached yet (the decompressor is reentrant, so this is spread over every core)
+    const byte* map_data = map_file->data;
+    std::vector<std::pair<uint, uint>> pending_blocks;
+    for (const auto& block : entity_graphics_blocks) {
+        uint data_size = block.second.width * block.second.height;
+        auto cached_graphics = cache.entity_graphics.find(block.first);
+        if (!cache_hit || cached_graphics == cache.entity_graphics.end() || cached_graphics->second.size() != data_size) {
+            cache.entity_graphics[block.first].assign(data_size, 0);
+            pending_blocks.push_back({block.first, data_size});
+        }
+    }
+    std::atomic<uint> next_block(0);
+    auto decompress_worker = [&] {
+        for (uint i = next_block++; i < pending_blocks.size(); i = next_block++) {
+            uint graphics_addr = pending_blocks[i].first;
+            TraceZone zone("Decompress", "addr", graphics_addr);
+            byte* tileset_data = cache.entity_graphics.at(graphics_addr).data();
+            if (graphics_addr >= map_file->size || !Compression::Decompress(tileset_data, pending_blocks[i].second, map_data + graphics_addr, map_file->size - graphics_addr)) {
+                Log::Warn("Entity graphics at 0x%X did not decompress cleanly\n", graphics_addr);
+            }
+        }
+    };
+    uint num_threads = std::min<uint>(std::max(1u, std::thread::hardware_concurrency()), pending_blocks.size());
+    std::vector<std::thread> decompress_threads;
+    for (uint i = 1; i < num_threads; i++) {
+        decompress_threads.emplace_back(decompress_worker);
+    }
+    decompress_worker();
+    for (auto& thread : decompress_threads) {
+        thread.join();
+    }
+
+    Log::Info("Entity graphics decompressed: %zu blocks (%zu new)\n", entity_graphics_blocks.size(), pending_blocks.size());
+}
+
+
+
+/**
+ * Builds the map's VRAM from its graphics file (or the cache) and loads the map tile CLUTs.
+ *
+ * @param filename: Filename of the map graphics file (F_*.BIN)
+ *
+ * @return True if the VRAM was built (the VRAM is left in cache.vram)
+ *
+ */
+bool Map::BuildMapVRAM(const char* filename) {
+
+    TraceZone zone("Map::BuildMapVRAM");
+
+    // Make sure the cached tile data lines up with the map's layers
+    if (cache_hit && cache.layer_tiles.size() != tile_layers.size() * 2) {
+        Log::Warn("Map cache layer count mismatch, decoding graphics from scratch\n");
+        cache_hit = false;
+    }
+
+    // Restore the deswizzled VRAM from the cache
+    if (cache_hit) {
+        StageTimer timer(LoadStage_VRAM);
+        load_status_msg = "Reading Map Textures From Cache ...";
+        Clut::Reset(CLUT_BANK_MAP, 256);
+        Clut::Set(CLUT_BANK_MAP, 0, 256, cache.tile_cluts[0]);
+        return true;
+    }
+
+    // Map the graphics file (F_*.BIN)
+    StageTimer timer(LoadStage_FileRead);
+    std::shared_ptr<const MappedFile> gfx_file = MappedFile::Share(filename);
+    if (gfx_file == nullptr) {
+        Log::Error("Could not read map graphics file: %s\n", filename);
+        return false;
+    }
+    const byte* file_data = gfx_file->data;
+    uint num_bytes = gfx_file->size;
+
+    // Convert the file's chunks straight into VRAM
+    timer.Switch(LoadStage_VRAM);
+    load_status_msg = "Reading Map Textures Into VRAM ...";
+    if (num_bytes < 32 * 8192) {
+        Log::Warn("Map graphics file is smaller than expected (%u bytes): %s\n", num_bytes, filename);
+    }
+    cache.vram.assign(512 * 256 * 4, 0);
+    Utils::Chunks_to_VRAM(file_data, num_bytes, cache.vram.data());
+
+    // Release the file mapping
+    gfx_file.reset();
+
+    // Read all of the CLUT data from the bottom 16 rows of VRAM to skip any further processing
+    load_status_msg = "Loading Map Tile CLUTs ...";
+    byte* map_rgba_cluts = (byte*)calloc(256 * 16 * 4, sizeof(byte));
+    for (int y = 0; y < 16; y++) {
+        memcpy(map_rgba_cluts + (y * 256 * 4), cache.vram.data() + (((240 + y) * 512) * 4), 256 * 4);
+    }
+    byte* indexed_cluts = Utils::RGBA_to_Indexed(map_rgba_cluts, 256 * 16);
+    Clut::Reset(CLUT_BANK_MAP, 256);
+    Clut::Set(CLUT_BANK_MAP, 0, 256, indexed_cluts);
+    free(map_rgba_cluts);
+
+    // Remember the CLUTs for the cache
+    memcpy(cache.tile_cluts[0], indexed_cluts, 256 * 16 * 2);
+    free(indexed_cluts);
+
+    return true;
+}
+
+
+
+/**
+ * Decodes every unique tile of every tile layer (or looks them up in the cache).
+ *
+ * @note Fills in cache.tiles, cache.tile_empty, cache.layer_tiles, unique_tile_keys and layer_unique_tiles.
+ *
+ */
+void Map::DecodeTiles() {
+
+    TraceZone zone("Map::DecodeTiles");
+    StageTimer timer(LoadStage_TileDecode);
+
+    // Unique tiles decoded so far (key -> index into the cached tile list)
+    std::map<uint, uint> unique_tile_ids;
+
+    // Key for each unique tile (filled in on first use)
+    unique_tile_keys.assign(cache_hit ? cache.tile_empty.size() : 0, UINT32_MAX);
+
+    // Start a fresh tile list when decoding
+    if (!cache_hit) {
+        cache.tiles.clear();
+        cache.tile_empty.clear();
+        cache.layer_tiles.assign(tile_layers.size() * 2, std::vector<uint>());
+    }
+
+    // Loop through all of the layers
+    for (size_t i = 0; i < tile_layers.size(); i++) {
+
+        load_status_msg = Utils::FormatString("Decoding Tiles ( %zu / %zu ) ...", i, tile_layers.size());
+
+        // Loop through each FG/BG layer
+        for (int k = 0; k < 2; k++) {
+
+            // Get the current FG or BG tile layer
+            const TileLayer* cur_layer = (k == 0 ? &tile_layers[i].first : &tile_layers[i].second);
+            std::vector<uint>* layer_tiles = &cache.layer_tiles[(i * 2) + k];
+            uint num_tiles = cur_layer->width * cur_layer->height;
+
+            // Make sure the cached layer matches the layer dimensions
+            if (cache_hit && layer_tiles->size() != num_tiles) {
+                Log::Error("Map cache layer %zu has %zu tiles (expected %u)\n", (i * 2) + k, layer_tiles->size(), num_tiles);
+                continue;
+            }
+
+            // Loop through each tile
+            for (uint idx = 0; idx < num_tiles; idx++) {
+
+                // Index of the tile within the unique tile list
+                uint unique_idx;
+
+                // Get the tile
+                ushort tile_idx = cur_layer->tile_indices[idx];
+                byte tileset_id = cur_layer->tile_data.tileset_ids[tile_idx];
+                byte tile_position = cur_layer->tile_data.tile_positions[tile_idx];
+                byte clut_id = cur_layer->tile_data.clut_ids[tile_idx];
+
+                // Identify the tile by everything that affects its pixels
+                bool generic_clut = (cur_layer->drawing_flags & 0x200) == 0x200;
+                bool half_tileset = (cur_layer->load_flags & 0x20) == 0x20;
+                uint tile_key = (generic_clut << 25) | (half_tileset << 24) | (tileset_id << 16) | (tile_position << 8) | clut_id;
+
+                // Get the tile from the cache
+                if (cache_hit) {
+                    unique_idx = (*layer_tiles)[idx];
+                }
+
+                // Otherwise decode the tile
+                else {
+
+                    // Check if the tile was already decoded
+                    auto unique_tile = unique_tile_ids.find(tile_key);
+                    if (unique_tile != unique_tile_ids.end()) {
+                        unique_idx = unique_tile->second;
+                    }
+                    else {
+
+                        // Decode the tile
+                        uint num_pixels = 0;
+                        byte* tile_output = DecodeTile(tile_key, &num_pixels);
+
+                        // Add the tile to the unique tile list
+                        unique_idx = cache.tile_empty.size();
+                        unique_tile_ids[tile_key] = unique_idx;
+                        cache.tiles.insert(cache.tiles.end(), tile_output, tile_output + (16 * 16 * 4));
+                        cache.tile_empty.push_back(num_pixels == 0);
+                        unique_tile_keys.push_back(UINT32_MAX);
+
+                        // Free the data
+                        free(tile_output);
+                    }
+
+                    // Remember which unique tile this was
+                    layer_tiles->push_back(unique_idx);
+                }
+
+                // Remember how the unique tile was decoded and which CLUT it uses
+                if (unique_tile_keys[unique_idx] == UINT32_MAX) {
+                    unique_tile_keys[unique_idx] = tile_key;
+                    Clut::AddUser(generic_clut ? CLUT_BANK_GENERIC : CLUT_BANK_MAP, clut_id, {CLUT_USER_TILE, unique_idx});
+                }
+            }
+        }
+    }
+
+    // Keep the unique tile of every layer position so layers can be patched when a CLUT changes
+    layer_unique_tiles = cache.layer_tiles;
+}
+
+
+
+/**
+ * Decodes a unique map tile.
+ *
+ * @param tile_key: Everything that affects the tile's pixels (generic CLUT flag << 25 | half tileset flag << 24 |
+ *                  tileset ID << 16 | tile position << 8 | CLUT ID)
+ * @param num_pixels: Where the number of visible pixels of the tile should be stored
+ *
+ * @return Buffer of 16 x 16 RGBA pixels
+ *
+ * @note Tilesets 0x00 - 0x07 are the map's VRAM, 0x08 - 0x0F repeat the first of them and 0x10 - 0x17 are F_GAME.BIN.
+ *
+ */
+byte* Map::DecodeTile(uint tile_key, uint* num_pixels) {
+
+    // Split the key back into its parts
+    bool generic_clut = (tile_key >> 25) & 1;
+    bool half_tileset = (tile_key >> 24) & 1;
+    byte tileset_id = (tile_key >> 16) & 0xFF;
+    byte tile_position = (tile_key >> 8) & 0xFF;
+    byte clut_id = tile_key & 0xFF;
+
+    // Find the tileset within VRAM
+    const std::vector<byte>* vram = &cache.vram;
+    uint tileset_x = tileset_id * 64;
+    if (tileset_id >= 0x08 && tileset_id < 0x10) {
+        tileset_x = 0;
+    }
+    else if (tileset_id >= 0x10) {
+        vram = &fgame_vram;
+        tileset_x = (tileset_id - 0x10) * 64;
+    }
+
+    // Get the X/Y offset of the tile within the tileset
+    uint offset_x = (tile_position & 0xF) * 16;
+    uint offset_y = ((tile_position >> 4) & 0xF) * 16;
+
+    // Adjust the offsets as needed for room types 0x20 and 0x40
+    if (half_tileset) {
+        offset_x %= 128;
+        offset_y -= 16 * (offset_y % 32 != 0);
+    }
+
+    // Copy the tile's 4 VRAM words per row out of VRAM (tilesets past the end of VRAM stay blank)
+    uint tile_width = 16;
+    uint tile_height = 16;
+    byte pixels[(16 / 4) * 16 * 4] = {};
+    if (tileset_x < 512 && vram->size() == 512 * 256 * 4) {
+        for (uint y = 0; y < tile_height; y++) {
+            memcpy(pixels + (y * (tile_width / 4) * 4), vram->data() + ((((offset_y + y) * 512) + tileset_x + (offset_x / 4)) * 4), (tile_width / 4) * 4);
+        }
+    }
+
+    // Expand the pixels with the appropriate CLUT
+    byte* tile_output = (byte*)calloc(tile_width * tile_height * 4, sizeof(byte));
+    const byte* clut = (generic_clut ? Clut::GetRGBA(CLUT_BANK_GENERIC, clut_id, CLUT_FORMAT_OPAQUE) : Clut::GetRGBA(CLUT_BANK_MAP, clut_id, CLUT_FORMAT_SEMI));
+    *num_pixels = Utils::VRAM_to_RGBA(pixels, clut, tile_width / 4, tile_height, tile_output);
+
+    return tile_output;
+}
+
+
+
+/**
+ * Composes one of a room's tile layers from the decoded tiles.
+ *
+ * @param room: Room the layer belongs to
+ * @param foreground: Whether to compose the FG layer (otherwise the BG layer)
+ *
+ * @return Buffer of RGBA pixels (16 pixels per tile, left blank if the layer has no decoded tiles)
+ *
+ */
+byte* Map::ComposeLayer(const Room* room, bool foreground) {
+
+    TraceZone zone("Map::ComposeLayer", "room", room - rooms.data());
+    StageTimer timer(LoadStage_LayerCompose);
+
+    const TileLayer* cur_layer = (foreground ? &room->fg_layer : &room->bg_layer);
+    uint layer_idx = (room->tile_layer_id * 2) + (foreground ? 0 : 1);
+    uint layer_width = cur_layer->width * 16;
+    byte* layer_pixels = (byte*)calloc(layer_width * cur_layer->height * 16 * 4, sizeof(byte));
+
+    // Check if the layer exists
+    if (layer_idx >= cache.layer_tiles.size() || cache.layer_tiles[layer_idx].size() != cur_layer->width * cur_layer->height) {
+        return layer_pixels;
+    }
+
+    // Loop through each tile row
+    for (uint y = 0; y < cur_layer->height; y++) {
+
+        // Loop through each tile
+        for (uint x = 0; x < cur_layer->width; x++) {
+
+            // Get the decoded pixels of the tile
+            uint idx = (y * cur_layer->width) + x;
+            const byte* tile_pixels = cache.tiles.data() + (cache.layer_tiles[layer_idx][idx] * 16 * 16 * 4);
+
+            // Copy each row of the tile into the layer
+            for (uint row = 0; row < 16; row++) {
+                memcpy(
+                    layer_pixels + ((((y * 16) + row) * layer_width) + (x * 16)) * 4,
+                    tile_pixels + (row * 16 * 4),
+                    16 * 4
+                );
+            }
+        }
+    }
+    return layer_pixels;
+}
+
+
+
+/**
+ * Draws the polygon chains of a room's entities with the emulated GPU, one layer per ordering table.
+ *
+ * @param room_id: Index of the room (its entities must have just been emulated, so RAM still holds their polygons)
+ *
+ * @note Each layer is drawn into a target the size of the room and cropped to the pixels that were drawn. VRAM is
+ *       filled the way the game lays it out: the map's tilesets (texture pages 0x00 - 0x0F), the room's entity
+ *       graphics (0x10 - 0x17), F_GAME.BIN (0x18 - 0x1F) and the CLUT rows at the bottom of the first half.
+ *
+ */
+void Map::RenderPolygons(uint room_id) {
+
+    TraceZone zone("Map::RenderPolygons", "room", room_id);
+    StageTimer timer(LoadStage_SpriteExtract);
+
+    Room* room = &rooms[room_id];
+    for (auto& layer : room->polygon_layers) {
+        layer = PolygonLayer();
+    }
+
+    // Collect the polygon chains of the room's entities
+    std::vector<uint> chains;
+    for (const auto& entity : room->entities) {
+        if (entity.data.unk7C != 0 && (entity.data.unk34 & 0x800000) == 0x800000) {
+            chains.push_back(entity.data.unk7C);
+        }
+    }
+    if (chains.empty() || room->load_flags == 0xFF) {
+        return;
+    }
+
+    // Fill VRAM with the map's tilesets, the room's entity graphics and F_GAME.BIN
+    GpuEmulator gpu;
+    RECT rect;
+    rect.w = 512;
+    rect.h = 256;
+    if (cache.vram.size() == 512 * 256 * 4) {
+        rect.x = 0;
+        gpu.LoadRGBA(&rect, cache.vram.data());
+        rect.x = 512;
+        gpu.LoadRGBA(&rect, cache.vram.data());
+    }
+    byte* room_vram = ComposeRoomVRAM(room->vram_patches, 0, 512);
+    rect.x = 0;
+    rect.y = 256;
+    gpu.LoadRGBA(&rect, room_vram);
+    free(room_vram);
+    if (fgame_vram.size() == 512 * 256 * 4) {
+        rect.x = 512;
+        gpu.LoadRGBA(&rect, fgame_vram.data());
+    }
+
+    // Fill the CLUT rows (generic CLUTs, then the entity CLUTs left in RAM, then the map's tile CLUTs)
+    rect.w = 16;
+    rect.h = 1;
+    for (uint y = 0; y < 16; y++) {
+        for (uint x = 0; x < GPU_VRAM_WIDTH / 16; x++) {
+            ushort colors[16];
+            if (x < 0x10) {
+                memcpy(colors, Clut::GetColors(CLUT_BANK_GENERIC, (y * 16) + x), sizeof(colors));
+            }
+            else if (x < 0x20) {
+                memcpy(colors, MipsEmulator::ram + CLUT_BASE_ADDR + ((CLUT_RAM_ENTITY_OFFSET + (y * 16) + (x & 0x0F)) * 32), sizeof(colors));
+            }
+            else {
+                memcpy(colors, Clut::GetColors(CLUT_BANK_MAP, (y * 16) + (x & 0x0F)), sizeof(colors));
+            }
+            rect.x = x * 16;
+            rect.y = 240 + y;
+            gpu.LoadImage(&rect, colors);
+        }
+    }
+
+    // Draw every chain into a target the size of the room, once per ordering table
+    GpuTarget target;
+    target.width = room->fg_layer.width * 16;
+    target.height = room->fg_layer.height * 16;
+    gpu.target = &target;
+    const uint layer_bounds[4] = {0, room->bg_layer.z_index, room->fg_layer.z_index, UINT32_MAX};
+    for (uint i = 0; i < 3; i++) {
+        target.pixels.assign(target.width * target.height, 0);
+        gpu.state = GpuDrawState();
+        for (uint addr : chains) {
+            gpu.DrawPrimitives(MipsEmulator::ram, RAM_SIZE, addr, layer_bounds[i], layer_bounds[i + 1]);
+        }
+
+        // Crop the layer to the pixels that were drawn
+        uint left = target.width;
+        uint top = target.height;
+        uint right = 0;
+        uint bottom = 0;
+        for (uint y = 0; y < target.height; y++) {
+            for (uint x = 0; x < target.width; x++) {
+                if ((target.pixels[(y * target.width) + x] >> 24) != 0) {
+                    left = std::min(left, x);
+                    top = std::min(top, y);
+                    right = std::max(right, x + 1);
+                    bottom = std::max(bottom, y + 1);
+                }
+            }
+        }
+        if (left >= right) {
+            continue;
+        }
+        PolygonLayer* layer = &room->polygon_layers[i];
+        layer->x = left;
+        layer->y = top;
+        layer->width = right - left;
+        layer->height = bottom - top;
+        layer->pixels.resize(layer->width * layer->height);
+        for (uint y = 0; y < layer->height; y++) {
+            memcpy(layer->pixels.data() + (y * layer->width), target.pixels.data() + ((top + y) * target.width) + left, layer->width * sizeof(uint));
+        }
+    }
+}
+
+
+
+/**
+ * Creates a key identifying the contents of a vertical strip of a room's VRAM.
+ *
+ * @param patches: Entity graphics loaded into the room's VRAM
+ * @param x: Left edge of the strip
+ * @param width: Width of the strip
+ *
+ * @return Position, size and source of every patch overlapping the strip (relative to the strip)
+ *
+ */
+std::vector<uint> Map::GetPatchKey(const std::vector<VramPatch>& patches, uint x, uint width) {
+
+    std::vector<uint> key;
+    for (const auto& patch : patches) {
+        if (patch.x < x + width && patch.x + patch.width > x) {
+            key.push_back(patch.x - x);
+            key.push_back(patch.y);
+            key.push_back(patch.width);
+            key.push_back(patch.height);
+            key.push_back(patch.graphics_addr);
+        }
+    }
+    return key;
+}
+
+
+
+/**
+ * Builds the RGBA pixels of a vertical strip of a room's VRAM from the decompressed entity graphics.
+ *
+ * @param patches: Entity graphics loaded into the room's VRAM (later patches overwrite earlier ones, clipped to the chunk)
+ * @param x: Left edge of the strip
+ * @param width: Width of the strip
+ *
+ * @return Buffer of RGBA pixels (width x 256)
+ *
+ */
+byte* Map::ComposeRoomVRAM(const std::vector<VramPatch>& patches, uint x, uint width) {
+
+    byte* pixels = (byte*)calloc(width * 256 * 4, sizeof(byte));
+    for (const auto& patch : patches) {
+
+        // Skip patches outside of the strip or without graphics
+        uint left = std::max(patch.x, x);
+        uint right = std::min(patch.x + patch.width, x + width);
+        auto graphics = cache.entity_graphics.find(patch.graphics_addr);
+        if (left >= right || graphics == cache.entity_graphics.end()) {
+            continue;
+        }
+
+        // Each 16-bit word of the graphics becomes one RGBA pixel
+        const std::vector<byte>& graphics_data = graphics->second;
+        uint bottom = std::min(patch.y + patch.height, 256u);
+        for (uint y = 0; patch.y + y < bottom; y++) {
+            for (uint px = left; px < right; px++) {
+                uint src_offset = ((y * patch.width) + (px - patch.x)) * 2;
+                if (src_offset + 2 > graphics_data.size()) {
+                    break;
+                }
+                uint color = Utils::RGB1555_to_RGBA(*(ushort*)(graphics_data.data() + src_offset));
+                byte* dst = pixels + ((((patch.y + y) * width) + (px - x)) * 4);
+                dst[0] = (byte)(color >> 24);
+                dst[1] = (byte)(color >> 16);
+                dst[2] = (byte)(color >> 8);
+                dst[3] = (byte)(color);
+            }
+        }
+    }
+    return pixels;
+}
@@ -0,0 +1,852 @@
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <iterator>
+#include <filesystem>
+#include "common.h"
+#include "map.h"
+#include "map_writer.h"
+#include "disc.h"
+#include "log.h"
+
+
+
+
+// -- Interval Allocator ---------------------------------------------------------------------------------------
+
+/**
+ * Forgets every free range and sets the bounds of the file.
+ *
+ * @param file_end: Current size of the file
+ * @param file_limit: Largest size the file may grow to
+ *
+ */
+void IntervalAllocator::Reset(uint file_end, uint file_limit) {
+    free_ranges.clear();
+    end = file_end;
+    limit = file_limit;
+}
+
+
+
+/**
+ * Finds room for a block of data.
+ *
+ * @param size: Number of bytes needed
+ * @param offset: Where the start of the block should be stored
+ *
+ * @return True if the block fits in a free range or at the end of the file
+ *
+ * @note Blocks are word-aligned so pointers and halfwords inside them stay aligned.
+ *
+ */
+bool IntervalAllocator::Allocate(uint size, uint* offset) {
+
+    // Use the first free range that is large enough
+    for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+        uint range_start = it->first;
+        uint range_end = it->first + it->second;
+        uint aligned = (range_start + 3) & ~3;
+        if (aligned + size > range_end) {
+            continue;
+        }
+
+        // Give back whatever is left on either side of the block
+        free_ranges.erase(it);
+        if (aligned > range_start) {
+            free_ranges[range_start] = aligned - range_start;
+        }
+        if (aligned + size < range_end) {
+            free_ranges[aligned + size] = range_end - (aligned + size);
+        }
+        *offset = aligned;
+        return true;
+    }
+
+    // Otherwise grow the file
+    uint aligned = (end + 3) & ~3;
+    if (aligned + size > limit) {
+        return false;
+    }
+    *offset = aligned;
+    end = aligned + size;
+    return true;
+}
+
+
+
+/**
+ * Marks a block of data as reusable.
+ *
+ * @param offset: Start of the block
+ * @param size: Number of bytes in the block
+ *
+ */
+void IntervalAllocator::Free(uint offset, uint size) {
+
+    if (size == 0) {
+        return;
+    }
+    uint range_start = offset;
+    uint range_end = offset + size;
+
+    // Merge with any following ranges that overlap or touch the block
+    auto next = free_ranges.lower_bound(range_start);
+    while (next != free_ranges.end() && next->first <= range_end) {
+        range_end = std::max(range_end, next->first + next->second);
+        next = free_ranges.erase(next);
+    }
+
+    // Merge with the preceding range
+    if (next != free_ranges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second >= range_start) {
+            range_start = prev->first;
+            range_end = std::max(range_end, prev->first + prev->second);
+            free_ranges.erase(prev);
+        }
+    }
+
+    free_ranges[range_start] = range_end - range_start;
+}
+
+
+
+/**
+ * Gets the current size of the file including any blocks appended to it.
+ *
+ * @return End offset of the file
+ *
+ */
+uint IntervalAllocator::GetEnd() {
+    return end;
+}
+
+
+
+/**
+ * Gets the number of bytes available for reuse.
+ *
+ * @return Total size of all free ranges
+ *
+ */
+uint IntervalAllocator::GetFreeBytes() {
+    uint total = 0;
+    for (const auto& range : free_ranges) {
+        total += range.second;
+    }
+    return total;
+}
+
+
+
+
+// -- Map Writer -----------------------------------------------------------------------------------------------
+
+/**
+ * Starts tracking changes to a map overlay.
+ *
+ * @param filename: Filename the overlay was read from
+ * @param map_data: Contents of the overlay
+ * @param num_bytes: Size of the overlay
+ *
+ * @return True if the overlay header could be read
+ *
+ */
+bool MapWriter::Open(const char* filename, const byte* map_data, uint num_bytes) {
+
+    if (num_bytes < 0x40) {
+        Log::Error("Invalid map file: %s\n", filename);
+        return false;
+    }
+
+    data.assign(map_data, map_data + num_bytes);
+    saved_filename = filename;
+    saved_size = num_bytes;
+    dirty_ranges.clear();
+    allocator.Reset(num_bytes, MAP_FILE_MAX_SIZE);
+
+    // Get the data pointers
+    room_list_addr = ReadPointer(0x10);
+    cluts_addr = ReadPointer(0x18);
+    entity_layouts_addr = ReadPointer(0x1C);
+    tile_layers_addr = ReadPointer(0x20);
+
+    // Get backup entity layout address (same fallback as Map::LoadMapFile())
+    if (entity_layouts_addr == 0) {
+        uint init_room_entities_func = ReadPointer(0x0C);
+        entity_layouts_addr = ReadWord(init_room_entities_func + 0x1C) & 0x0000FFFF;
+        if (entity_layouts_addr == 1) {
+            entity_layouts_addr = 0;
+        }
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Serializes the rooms, tile layers, CLUTs and entity layouts of a map into the overlay.
+ *
+ * @param map: Map to serialize
+ *
+ * @return True if everything fit into the overlay
+ *
+ * @note Blocks that grow are moved into a free range (or the end of the file) and every known pointer to them is updated.
+ * @note Sprite banks and entity graphics are left untouched.
+ *
+ */
+bool MapWriter::Update(Map* map) {
+    return WriteRooms(map) && WriteTileLayers(map) && WriteCluts(map) && WriteEntityLayouts(map);
+}
+
+
+
+/**
+ * Writes the changed parts of the overlay to a file.
+ *
+ * @param filename: Filename to write to (may be a file on the mounted disc)
+ *
+ * @return True if the file was written
+ *
+ * @note Only the dirty byte ranges are written when saving over the file that was opened.
+ *
+ */
+bool MapWriter::Save(const char* filename) {
+
+    // Files on the disc are patched sector by sector
+    if (Disc::Contains(filename)) {
+        if (!Disc::PatchFiles({{filename, data}})) {
+            return false;
+        }
+    }
+
+    else {
+
+        // Rewrite the whole file when saving somewhere new or when the file was changed behind our back
+        std::error_code ec;
+        bool incremental = (saved_filename == filename && std::filesystem::file_size(filename, ec) == saved_size && !ec);
+        FILE* fp = fopen(filename, incremental ? "r+b" : "wb");
+        if (fp == nullptr) {
+            Log::Error("Could not open file for writing: %s\n", filename);
+            return false;
+        }
+
+        bool ok = true;
+        if (incremental) {
+            for (const auto& range : dirty_ranges) {
+                ok &= (fseek(fp, range.first, SEEK_SET) == 0);
+                ok &= (fwrite(data.data() + range.first, 1, range.second - range.first, fp) == range.second - range.first);
+            }
+        }
+        else {
+            ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+        }
+        ok &= (fclose(fp) == 0);
+        if (!ok) {
+            Log::Error("Could not write file: %s\n", filename);
+            return false;
+        }
+    }
+
+    // The file on disk now matches the overlay
+    saved_filename = filename;
+    saved_size = data.size();
+    dirty_ranges.clear();
+    return true;
+}
+
+
+
+/**
+ * Gets the number of bytes that differ from the file on disk.
+ *
+ * @return Total size of all dirty ranges
+ *
+ */
+uint MapWriter::GetDirtyBytes() {
+    uint total = 0;
+    for (const auto& range : dirty_ranges) {
+        total += range.second - range.first;
+    }
+    return total;
+}
+
+
+
+/**
+ * Reads a word from the overlay.
+ *
+ * @param offset: Offset of the word
+ *
+ * @return Value of the word (zero if it lies outside the overlay)
+ *
+ */
+uint MapWriter::ReadWord(uint offset) {
+    if (offset + 4 > data.size() || offset + 4 < offset) {
+        return 0;
+    }
+    return *(uint*)(data.data() + offset);
+}
+
+
+
+/**
+ * Reads a pointer from the overlay.
+ *
+ * @param offset: Offset of the pointer
+ *
+ * @return Offset the pointer refers to (zero if it is null or doesn't point into the overlay)
+ *
+ */
+uint MapWriter::ReadPointer(uint offset) {
+    uint value = ReadWord(offset);
+    if (value < MAP_BIN_OFFSET || value - MAP_BIN_OFFSET >= data.size()) {
+        return 0;
+    }
+    return value - MAP_BIN_OFFSET;
+}
+
+
+
+/**
+ * Copies data into the overlay, marking only the bytes that actually changed as dirty.
+ *
+ * @param offset: Where the data should go
+ * @param src: Data to copy
+ * @param size: Number of bytes to copy
+ *
+ */
+void MapWriter::WriteBytes(uint offset, const void* src, uint size) {
+
+    const byte* bytes = (const byte*)src;
+
+    // Grow the overlay if needed (everything past the old end is new)
+    if (offset + size > data.size()) {
+        uint old_size = data.size();
+        data.resize(offset + size, 0);
+        MarkDirty(std::min(offset, old_size), offset + size);
+        memcpy(data.data() + offset, bytes, size);
+        return;
+    }
+
+    // Copy each run of differing bytes
+    uint i = 0;
+    while (i < size) {
+        if (data[offset + i] == bytes[i]) {
+            i++;
+            continue;
+        }
+        uint run_start = i;
+        while (i < size && data[offset + i] != bytes[i]) {
+            i++;
+        }
+        memcpy(data.data() + offset + run_start, bytes + run_start, i - run_start);
+        MarkDirty(offset + run_start, offset + i);
+    }
+}
+
+
+
+/**
+ * Writes a pointer to a block of the overlay.
+ *
+ * @param offset: Where the pointer should go
+ * @param target: Offset of the block within the overlay
+ *
+ */
+void MapWriter::WritePointer(uint offset, uint target) {
+    uint value = target + MAP_BIN_OFFSET;
+    WriteBytes(offset, &value, 4);
+}
+
+
+
+/**
+ * Stores a block of data, reusing its old location if it still fits.
+ *
+ * @param old_offset: Current location of the block
+ * @param old_size: Current size of the block (zero for a new block)
+ * @param bytes: New contents of the block
+ * @param slots: Offsets of the pointers that should refer to the block
+ * @param new_offset: Where the new location of the block should be stored
+ *
+ * @return True if there was room for the block
+ *
+ */
+bool MapWriter::Place(uint old_offset, uint old_size, const std::vector<byte>& bytes, const std::vector<uint>& slots, uint* new_offset) {
+
+    uint size = bytes.size();
+    if (old_offset + old_size > data.size()) {
+        old_size = 0;
+    }
+
+    // Overwrite in place and give back any leftover space
+    if (old_size > 0 && size <= old_size) {
+        WriteBytes(old_offset, bytes.data(), size);
+        allocator.Free(old_offset + size, old_size - size);
+        *new_offset = old_offset;
+    }
+
+    // Otherwise move the block and release its old location
+    else {
+        if (!allocator.Allocate(size, new_offset)) {
+            Log::Error("Not enough free space in the map file for 0x%X bytes\n", size);
+            return false;
+        }
+        WriteBytes(*new_offset, bytes.data(), size);
+        allocator.Free(old_offset, old_size);
+    }
+
+    // Relocate every pointer to the block
+    for (uint slot : slots) {
+        WritePointer(slot, *new_offset);
+    }
+    return true;
+}
+
+
+
+/**
+ * Stores a block of data that may be referenced from several places.
+ *
+ * @param old_offset: Current location of the block
+ * @param old_size: Current size of the block
+ * @param users: Every reference to the block along with the contents it expects
+ *
+ * @return True if there was room for every version of the block
+ *
+ * @note References that no longer agree on the contents get their own copy of the block.
+ *
+ */
+bool MapWriter::PlaceBlock(uint old_offset, uint old_size, std::vector<BlockUser>* users) {
+
+    // Group the references by the contents they expect
+    std::vector<std::vector<BlockUser*>> variants;
+    for (auto& user : *users) {
+        auto variant = std::find_if(variants.begin(), variants.end(), [&user](const std::vector<BlockUser*>& v) {
+            return v[0]->bytes == user.bytes;
+        });
+        if (variant == variants.end()) {
+            variants.push_back({&user});
+        }
+        else {
+            variant->push_back(&user);
+        }
+    }
+
+    // The first version keeps the old location, the rest are new blocks
+    for (uint i = 0; i < variants.size(); i++) {
+        std::vector<uint> slots;
+        for (BlockUser* user : variants[i]) {
+            slots.insert(slots.end(), user->slots.begin(), user->slots.end());
+        }
+
+        uint offset;
+        if (!Place((i == 0 ? old_offset : 0), (i == 0 ? old_size : 0), variants[i][0]->bytes, slots, &offset)) {
+            return false;
+        }
+        for (BlockUser* user : variants[i]) {
+            user->offset = offset;
+        }
+    }
+    return true;
+}
+
+
+
+/**
+ * Gets the size of an entity layout list including its terminator.
+ *
+ * @param offset: Start of the list
+ *
+ * @return Size of the list in bytes
+ *
+ */
+uint MapWriter::GetEntityListSize(uint offset) {
+    uint size = 0;
+    while (offset + size + sizeof(EntityInitData) <= data.size()) {
+        short x_coord = *(short*)(data.data() + offset + size);
+        short y_coord = *(short*)(data.data() + offset + size + 2);
+        size += sizeof(EntityInitData);
+        if (x_coord == -1 || y_coord == -1) {
+            break;
+        }
+    }
+    return size;
+}
+
+
+
+/**
+ * Adds a byte range to the dirty ranges, merging it with any ranges it touches.
+ *
+ * @param start: First dirty byte
+ * @param end: One past the last dirty byte
+ *
+ */
+void MapWriter::MarkDirty(uint start, uint end) {
+
+    auto next = dirty_ranges.lower_bound(start);
+    while (next != dirty_ranges.end() && next->first <= end) {
+        end = std::max(end, next->second);
+        next = dirty_ranges.erase(next);
+    }
+    if (next != dirty_ranges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->second >= start) {
+            start = prev->first;
+            end = std::max(end, prev->second);
+            dirty_ranges.erase(prev);
+        }
+    }
+    dirty_ranges[start] = end;
+}
+
+
+
+
+// -- Rooms ----------------------------------------------------------------------------------------------------
+
+/**
+ * Serializes the room list.
+ *
+ * @param map: Map to serialize
+ *
+ * @return True if the room list fit into the overlay
+ *
+ */
+bool MapWriter::WriteRooms(Map* map) {
+
+    if (room_list_addr == 0 || map->rooms.empty()) {
+        return true;
+    }
+
+    // Count the rooms currently in the overlay
+    uint old_count = 0;
+    while (room_list_addr + (old_count * 8) + 4 <= data.size() && ReadWord(room_list_addr + (old_count * 8)) != 0x00000040) {
+        old_count++;
+    }
+
+    // Build the new room list
+    std::vector<byte> bytes;
+    for (uint i = 0; i < map->rooms.size(); i++) {
+        Room* room = &map->rooms[i];
+
+        // Undo the entity graphics ID fix-up done while loading
+        byte entity_graphics_id = room->entity_graphics_id;
+        if (i < old_count && entity_graphics_id == 1 && data[room_list_addr + (i * 8) + 6] == 0) {
+            entity_graphics_id = 0;
+        }
+
+        bytes.insert(bytes.end(), {
+            room->x_start, room->y_start, room->x_end, room->y_end,
+            room->tile_layer_id, room->load_flags, entity_graphics_id, room->entity_layout_id
+        });
+    }
+    bytes.insert(bytes.end(), {0x40, 0x00, 0x00, 0x00});
+
+    return Place(room_list_addr, (old_count * 8) + 4, bytes, {0x10}, &room_list_addr);
+}
+
+
+
+
+// -- Tile Layers ----------------------------------------------------------------------------------------------
+
+/**
+ * Serializes the tile layer definitions, tile indices and tile data.
+ *
+ * @param map: Map to serialize
+ *
+ * @return True if every layer fit into the overlay
+ *
+ * @note Layer definitions shared by layers that no longer agree are split into separate definitions.
+ *
+ */
+bool MapWriter::WriteTileLayers(Map* map) {
+
+    if (tile_layers_addr == 0) {
+        return true;
+    }
+
+    // One version of a layer definition
+    typedef struct LayerDef {
+        uint addr;                                          // Location of the definition
+        bool is_new;                                        // Whether the definition still has to be allocated
+        std::vector<uint> pair_slots;                       // Layer pair entries that point to the definition
+        std::vector<TileLayer*> layers;                     // Layers described by the definition
+        byte fields[12];                                    // Everything after the tile indices pointer
+        std::vector<byte> indices;                          // Tile indices
+        uint old_indices_addr;                              // Current location of the tile indices
+        uint old_indices_size;                              // Current size of the tile indices
+    } LayerDef;
+
+    // Collect the versions of every layer definition
+    std::map<uint, std::vector<LayerDef>> layer_defs;
+    for (uint i = 0; i < map->tile_layers.size(); i++) {
+        for (int k = 0; k < 2; k++) {
+            TileLayer* cur_layer = (k == 0 ? &map->tile_layers[i].first : &map->tile_layers[i].second);
+            if (cur_layer->tile_indices == nullptr) {
+                continue;
+            }
+
+            // Find the current definition
+            uint slot = tile_layers_addr + (i * 8) + (k * 4);
+            uint layer_addr = ReadPointer(slot);
+            if (layer_addr == 0 || layer_addr + 16 > data.size()) {
+                continue;
+            }
+
+            // Build the new definition
+            LayerDef def = {};
+            def.addr = layer_addr;
+            def.pair_slots = {slot};
+            def.layers = {cur_layer};
+            uint tile_data_ptr = cur_layer->tile_data_addr + MAP_BIN_OFFSET;
+            uint dimension_data = cur_layer->x_start | (cur_layer->y_start << 6) | (cur_layer->x_end << 12) | (cur_layer->y_end << 18) | (cur_layer->load_flags << 24);
+            memcpy(def.fields, &tile_data_ptr, 4);
+            memcpy(def.fields + 4, &dimension_data, 4);
+            memcpy(def.fields + 8, &cur_layer->z_index, 2);
+            memcpy(def.fields + 10, &cur_layer->drawing_flags, 2);
+            def.indices.resize(cur_layer->width * cur_layer->height * sizeof(ushort));
+            memcpy(def.indices.data(), cur_layer->tile_indices, def.indices.size());
+
+            // Get the size of the current tile indices from the current dimensions
+            uint old_dimension_data = ReadWord(layer_addr + 8);
+            uint old_width = (((old_dimension_data >> 12) & 0x3F) - (old_dimension_data & 0x3F) + 1) * 16;
+            uint old_height = (((old_dimension_data >> 18) & 0x3F) - ((old_dimension_data >> 6) & 0x3F) + 1) * 16;
+            def.old_indices_addr = ReadPointer(layer_addr);
+            def.old_indices_size = (def.old_indices_addr > 0 ? old_width * old_height * sizeof(ushort) : 0);
+
+            // Merge with an identical version or add a new one
+            std::vector<LayerDef>* versions = &layer_defs[layer_addr];
+            auto version = std::find_if(versions->begin(), versions->end(), [&def](const LayerDef& v) {
+                return memcmp(v.fields, def.fields, sizeof(def.fields)) == 0 && v.indices == def.indices;
+            });
+            if (version == versions->end()) {
+                def.is_new = !versions->empty();
+                versions->push_back(def);
+            }
+            else {
+                version->pair_slots.push_back(slot);
+                version->layers.push_back(cur_layer);
+            }
+        }
+    }
+
+    // Allocate definitions for layers that split off
+    for (auto& versions : layer_defs) {
+        for (auto& def : versions.second) {
+            if (def.is_new && !allocator.Allocate(16, &def.addr)) {
+                Log::Error("Not enough free space in the map file for a tile layer\n");
+                return false;
+            }
+        }
+    }
+
+    // Store the tile indices, grouped by their current location
+    std::map<uint, std::pair<uint, std::vector<BlockUser>>> index_blocks;
+    for (auto& versions : layer_defs) {
+        for (auto& def : versions.second) {
+            auto* block = &index_blocks[def.old_indices_addr];
+            block->first = std::max(block->first, def.old_indices_size);
+            block->second.push_back({def.indices, {def.addr}, 0});
+        }
+    }
+    for (auto& block : index_blocks) {
+        if (!PlaceBlock(block.first, block.second.first, &block.second.second)) {
+            return false;
+        }
+    }
+
+    // Write the definitions and update the layers with their new tile index addresses
+    for (auto& versions : layer_defs) {
+        for (auto& def : versions.second) {
+            WriteBytes(def.addr + 4, def.fields, sizeof(def.fields));
+            for (uint slot : def.pair_slots) {
+                WritePointer(slot, def.addr);
+            }
+
+            uint indices_addr = ReadPointer(def.addr);
+            for (TileLayer* layer : def.layers) {
+                layer->tile_indices_addr = indices_addr;
+            }
+        }
+    }
+
+    // Keep the copies of the layers held by the rooms in sync
+    for (auto& room : map->rooms) {
+        if (room.tile_layer_id < map->tile_layers.size()) {
+            room.fg_layer.tile_indices_addr = map->tile_layers[room.tile_layer_id].first.tile_indices_addr;
+            room.bg_layer.tile_indices_addr = map->tile_layers[room.tile_layer_id].second.tile_indices_addr;
+        }
+    }
+
+    // Tile data arrays are always 4096 bytes, so they are written in place
+    for (const auto& entry : map->tile_data_pointers) {
+        const byte* arrays[4] = {
+            entry.second.tileset_ids,
+            entry.second.tile_positions,
+            entry.second.clut_ids,
+            entry.second.collision_ids
+        };
+        for (int i = 0; i < 4; i++) {
+            uint array_addr = ReadPointer(entry.first + (i * 4));
+            if (array_addr > 0 && array_addr + 4096 <= data.size()) {
+                WriteBytes(array_addr, arrays[i], 4096);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+
+
+// -- CLUTs ----------------------------------------------------------------------------------------------------
+
+/**
+ * Serializes the entity CLUT list and CLUT data.
+ *
+ * @param map: Map to serialize
+ *
+ * @return True if every CLUT fit into the overlay
+ *
+ */
+bool MapWriter::WriteCluts(Map* map) {
+
+    uint clut_list_addr = ReadPointer(cluts_addr);
+    if (cluts_addr == 0 || clut_list_addr == 0) {
+        return true;
+    }
+
+    // Read the current entries (pointer and size of each CLUT)
+    std::vector<std::pair<uint, uint>> old_entries;
+    uint entry_addr = clut_list_addr + 4;
+    while (entry_addr + 4 <= data.size() && (int)ReadWord(entry_addr) != -1 && entry_addr + 12 <= data.size()) {
+        old_entries.push_back({ReadPointer(entry_addr + 8), ReadWord(entry_addr + 4) * 2});
+        entry_addr += 12;
+    }
+
+    // Build the new list (CLUT data pointers are filled in below)
+    uint num_cluts = map->entity_cluts.size();
+    std::vector<byte> list(4 + (num_cluts * 12) + 4);
+    uint list_header = ReadWord(clut_list_addr);
+    memcpy(list.data(), &list_header, 4);
+    for (uint i = 0; i < num_cluts; i++) {
+        int entry[3] = {
+            map->entity_cluts[i].offset / 2,
+            map->entity_cluts[i].count / 2,
+            (int)(i < old_entries.size() ? ReadWord(clut_list_addr + 4 + (i * 12) + 8) : 0)
+        };
+        memcpy(list.data() + 4 + (i * 12), entry, 12);
+    }
+    memset(list.data() + 4 + (num_cluts * 12), 0xFF, 4);
+    if (!Place(clut_list_addr, 4 + (old_entries.size() * 12) + 4, list, {cluts_addr}, &clut_list_addr)) {
+        return false;
+    }
+
+    // Store the CLUT data, grouped by current location
+    std::map<uint, std::pair<uint, std::vector<BlockUser>>> clut_blocks;
+    for (uint i = 0; i < num_cluts; i++) {
+        ClutEntry* clut = &map->entity_cluts[i];
+        BlockUser user = {std::vector<byte>(clut->clut_data, clut->clut_data + clut->count), {clut_list_addr + 4 + (i * 12) + 8}, 0};
+
+        // New CLUTs get a new block
+        if (i >= old_entries.size() || old_entries[i].first == 0) {
+            if (!Place(0, 0, user.bytes, user.slots, &user.offset)) {
+                return false;
+            }
+            continue;
+        }
+
+        auto* block = &clut_blocks[old_entries[i].first];
+        block->first = std::max(block->first, old_entries[i].second);
+        block->second.push_back(user);
+    }
+    for (auto& block : clut_blocks) {
+        if (!PlaceBlock(block.first, block.second.first, &block.second.second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+
+
+// -- Entity Layouts -------------------------------------------------------------------------------------------
+
+/**
+ * Serializes the X-sorted and Y-sorted entity layout lists.
+ *
+ * @param map: Map to serialize
+ *
+ * @return True if every list fit into the overlay
+ *
+ * @note Both tables are handled together since empty layouts usually share a single list.
+ *
+ */
+bool MapWriter::WriteEntityLayouts(Map* map) {
+
+    if (entity_layouts_addr == 0 || entity_layouts_addr + ((ENTITY_LAYOUT_COUNT + ENTITY_LAYOUT_Y_COUNT) * 4) > data.size()) {
+        return true;
+    }
+
+    // Collect every reference to every list, grouped by current location
+    std::map<uint, std::pair<uint, std::vector<BlockUser>>> list_blocks;
+    auto add_list = [&](uint slot, std::vector<EntityInitData> entities, bool sort_by_y) {
+        uint list_addr = ReadPointer(slot);
+        if (list_addr == 0) {
+            return;
+        }
+        uint old_size = GetEntityListSize(list_addr);
+
+        // The Y-sorted lists keep the -2 entry first
+        if (sort_by_y) {
+            std::stable_sort(entities.begin(), entities.end(), [](const EntityInitData& a, const EntityInitData& b) {
+                int a_key = (a.x_coord == -2 && a.y_coord == -2) ? INT_MIN : a.y_coord;
+                int b_key = (b.x_coord == -2 && b.y_coord == -2) ? INT_MIN : b.y_coord;
+                return a_key < b_key;
+            });
+        }
+
+        // Serialize the entries followed by the current terminator
+        std::vector<byte> bytes;
+        for (const auto& entity : entities) {
+            ushort fields[5] = {(ushort)entity.x_coord, (ushort)entity.y_coord, entity.entity_id, entity.slot, entity.initial_state};
+            bytes.insert(bytes.end(), (byte*)fields, (byte*)fields + sizeof(fields));
+        }
+        if (old_size >= sizeof(EntityInitData)) {
+            const byte* terminator = data.data() + list_addr + old_size - sizeof(EntityInitData);
+            bytes.insert(bytes.end(), terminator, terminator + sizeof(EntityInitData));
+        }
+        else {
+            bytes.insert(bytes.end(), {0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+        }
+
+        auto* block = &list_blocks[list_addr];
+        block->first = std::max(block->first, old_size);
+        block->second.push_back({bytes, {slot}, 0});
+    };
+
+    for (uint i = 0; i < map->entity_layouts.size() && i < ENTITY_LAYOUT_COUNT; i++) {
+        add_list(entity_layouts_addr + (i * 4), map->entity_layouts[i], false);
+        if (i < ENTITY_LAYOUT_Y_COUNT) {
+            add_list(entity_layouts_addr + (ENTITY_LAYOUT_COUNT * 4) + (i * 4), map->entity_layouts[i], true);
+        }
+    }
+
+    for (auto& block : list_blocks) {
+        if (!PlaceBlock(block.first, block.second.first, &block.second.second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
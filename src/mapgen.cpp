@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include "common.h"
+#include "map_generator.h"
+#include "utils.h"
+#include "log.h"
+
+
+
+/**
+ * Prints the usage of the synthetic data generator.
+ */
+static void print_usage() {
+    printf(
+        "Usage: sotn_mapgen <output directory> [options]\n"
+        "\n"
+        "Writes synthetic game files and maps (ST/SY00/SY00.BIN, ...) that load without a disc image.\n"
+        "\n"
+        "Options:\n"
+        "    -n <count>            Number of maps to generate (default: 1)\n"
+        "    -x <factor>           Scale the rooms, entities and entity types of every map\n"
+        "    --seed <value>        Seed of the first map (each map adds 1, default: 1)\n"
+        "    --rooms <count>       Rooms in each map (default: 48)\n"
+        "    --room-size <WxH>     Size of each room in 256 pixel cells (default: 2x1)\n"
+        "    --layers <count>      Distinct FG/BG layer pairs (default: 48)\n"
+        "    --tiles <count>       Tile definitions used by the layers (default: 1024)\n"
+        "    --entities <count>    Entities in each room (default: 16)\n"
+        "    --entity-types <n>    Distinct entity update routines (default: 24)\n"
+        "    --instructions <n>    Instructions each update routine runs per call (default: 300)\n"
+        "    --sprite-banks <n>    Map sprite banks (default: 16)\n"
+        "    --blocks <count>      Compressed entity graphics blocks (default: 16)\n"
+        "    --blocks-per-room <n> Entity graphics blocks loaded by each room (default: 4)\n"
+    );
+}
+
+
+
+/**
+ * Generates the synthetic game files and maps.
+ */
+int main(int argc, char** argv) {
+
+    if (argc < 2 || argv[1][0] == '-') {
+        print_usage();
+        return 1;
+    }
+    const char* output_dir = argv[1];
+
+    MapGenConfig config;
+    uint num_maps = 1;
+    uint factor = 1;
+    for (int i = 2; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-n") == 0 && has_value) {
+            num_maps = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "-x") == 0 && has_value) {
+            factor = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            config.seed = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--rooms") == 0 && has_value) {
+            config.num_rooms = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--room-size") == 0 && has_value) {
+            if (sscanf(argv[++i], "%ux%u", &config.room_width, &config.room_height) != 2) {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--layers") == 0 && has_value) {
+            config.num_layer_pairs = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--tiles") == 0 && has_value) {
+            config.tile_variety = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--entities") == 0 && has_value) {
+            config.entities_per_room = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--entity-types") == 0 && has_value) {
+            config.num_entity_types = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--instructions") == 0 && has_value) {
+            config.routine_instructions = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--sprite-banks") == 0 && has_value) {
+            config.num_sprite_banks = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--blocks") == 0 && has_value) {
+            config.num_graphics_blocks = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--blocks-per-room") == 0 && has_value) {
+            config.blocks_per_room = strtoul(argv[++i], nullptr, 0);
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (num_maps == 0 || num_maps > 100) {
+        Log::Error("Map count must be between 1 and 100\n");
+        return 1;
+    }
+    config = MapGenerator::Scale(config, factor);
+
+    // Keep the output limited to the results
+    Log::level = LOG_ERROR;
+
+    if (!MapGenerator::WriteGameFiles(output_dir, config.seed)) {
+        return 1;
+    }
+
+    printf("%-6s %10s %10s %7s %9s %8s %12s %7s\n", "map", "overlay", "graphics", "rooms", "entities", "layouts", "compressed", "loops");
+    for (uint i = 0; i < num_maps; i++) {
+        MapGenConfig map_config = config;
+        map_config.seed = config.seed + i;
+        std::string map_id = Utils::FormatString("SY%02u", i);
+        MapGenStats stats;
+        if (!MapGenerator::WriteMap(output_dir, map_id, map_config, &stats)) {
+            return 1;
+        }
+        printf(
+            "%-6s %10u %10u %7u %9u %8u %12u %7u\n",
+            map_id.c_str(), stats.map_size, stats.gfx_size, stats.num_rooms, stats.num_entities,
+            stats.num_layouts, stats.compressed_bytes, stats.routine_loops
+        );
+    }
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <map>
+#include <mutex>
+#include "common.h"
+#include "mapped_file.h"
+#include "disc.h"
+#include "log.h"
+
+
+
+// Mappings handed out by Share(), keyed by absolute filename
+static std::map<std::string, std::weak_ptr<MappedFile>> shared_files;
+static std::mutex shared_files_mutex;
+
+
+
+/**
+ * Unmaps the file when the object is destroyed.
+ */
+MappedFile::~MappedFile() {
+    Close();
+}
+
+
+
+/**
+ * Maps a whole file into memory for reading.
+ *
+ * @param filename: Filename of the file to map
+ *
+ * @return True if the file was mapped (empty files are mapped with a null data pointer)
+ *
+ * @note Files inside a mounted disc image (see Disc) are read into memory instead.
+ *
+ */
+bool MappedFile::Open(const char* filename) {
+
+    // Release any previous mapping
+    Close();
+
+    // Files inside a mounted disc image are read through the disc's sector cache
+    size_t disc_size;
+    if (Disc::Stat(filename, &disc_size, &write_time)) {
+        if (!Disc::ReadFile(filename, &buffer)) {
+            return false;
+        }
+        data = buffer.empty() ? nullptr : buffer.data();
+        size = buffer.size();
+        return true;
+    }
+
+    // Remember the modification time so shared mappings can detect changes
+    std::error_code ec;
+    write_time = std::filesystem::last_write_time(filename, ec);
+
+#if defined(_WIN32)
+
+    // Open the file (allow writers so edited maps can be saved over the mapped file)
+    file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        file_handle = nullptr;
+        Log::Error("Could not open file: %s\n", filename);
+        return false;
+    }
+
+    // Get the file size
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size)) {
+        Log::Error("Could not get the size of file: %s\n", filename);
+        Close();
+        return false;
+    }
+    size = (size_t)file_size.QuadPart;
+    if (size == 0) {
+        return true;
+    }
+
+    // Map the file
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle != nullptr) {
+        data = (const byte*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    }
+
+#else
+
+    // Open the file
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        Log::Error("Could not open file: %s\n", filename);
+        return false;
+    }
+
+    // Get the file size
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        Log::Error("Could not get the size of file: %s\n", filename);
+        close(fd);
+        return false;
+    }
+    size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+
+    // Map the file (the mapping stays valid after the descriptor is closed)
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping != MAP_FAILED) {
+        data = (const byte*)mapping;
+    }
+
+#endif
+
+    // Check if the mapping failed
+    if (data == nullptr) {
+        Log::Error("Could not map file: %s\n", filename);
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+
+
+/**
+ * Unmaps the file.
+ */
+void MappedFile::Close() {
+
+    // Release data read from a disc image
+    if (!buffer.empty()) {
+        std::vector<byte>().swap(buffer);
+        data = nullptr;
+        size = 0;
+        return;
+    }
+
+#if defined(_WIN32)
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping_handle != nullptr) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle != nullptr) {
+        CloseHandle(file_handle);
+    }
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+#else
+    if (data != nullptr) {
+        munmap((void*)data, size);
+    }
+#endif
+
+    data = nullptr;
+    size = 0;
+}
+
+
+
+/**
+ * Gets a read-only mapping of a file that is shared with every other user of the same file.
+ *
+ * @param filename: Filename of the file to map
+ *
+ * @return Shared mapping of the file, or nullptr if the file could not be mapped
+ *
+ * @note The file is mapped again if it was modified since the existing mapping was created.
+ *
+ */
+std::shared_ptr<const MappedFile> MappedFile::Share(const char* filename) {
+
+    std::lock_guard<std::mutex> lock(shared_files_mutex);
+
+    // Look up an existing mapping of the file
+    std::error_code ec;
+    std::string key = std::filesystem::absolute(filename, ec).lexically_normal().string();
+    std::shared_ptr<MappedFile> file = shared_files[key].lock();
+
+    // Reuse the mapping if the file hasn't changed since
+    if (file != nullptr) {
+        std::filesystem::file_time_type write_time;
+        size_t file_size;
+        if (!Disc::Stat(filename, &file_size, &write_time)) {
+            write_time = std::filesystem::last_write_time(filename, ec);
+            file_size = ec ? 0 : std::filesystem::file_size(filename, ec);
+        }
+        if (!ec && write_time == file->write_time && file_size == file->size) {
+            return file;
+        }
+    }
+
+    // Otherwise map the file
+    file = std::make_shared<MappedFile>();
+    if (!file->Open(filename)) {
+        shared_files.erase(key);
+        return nullptr;
+    }
+    shared_files[key] = file;
+    return file;
+}
@@ -7,6 +7,7 @@
 #include "entities.h"
 #include "utils.h"
 #include "gte.h"
+#include "trace.h"
 #include "log.h"
 
 
@@ -17,10 +18,20 @@ uint MipsEmulator::pc;
 uint MipsEmulator::num_executed;
 byte* MipsEmulator::ram;
 byte* MipsEmulator::save_state_ram;
+byte* MipsEmulator::setup_state_ram;
+byte* MipsEmulator::setup_state_scratchpad;
+byte* MipsEmulator::setup_state_gte;
+byte* MipsEmulator::setup_state_vram;
+uint MipsEmulator::setup_state_registers[32];
+uint MipsEmulator::setup_state_hi;
+uint MipsEmulator::setup_state_lo;
 byte* MipsEmulator::scratchpad;
-byte* MipsEmulator::psx_bin;
-byte* MipsEmulator::sotn_bin;
-byte* MipsEmulator::map_data;
+const byte* MipsEmulator::psx_bin;
+const byte* MipsEmulator::sotn_bin;
+const byte* MipsEmulator::map_data;
+std::shared_ptr<const MappedFile> MipsEmulator::psx_file;
+std::shared_ptr<const MappedFile> MipsEmulator::sotn_file;
+std::shared_ptr<const MappedFile> MipsEmulator::map_file;
 uint MipsEmulator::psx_bin_size;
 uint MipsEmulator::sotn_bin_size;
 uint MipsEmulator::map_data_size;
@@ -29,7 +40,8 @@ uint MipsEmulator::hi;
 uint MipsEmulator::lo;
 bool MipsEmulator::force_ret;
 bool MipsEmulator::ret_hit;
-GLuint MipsEmulator::framebuffer;
+GpuEmulator MipsEmulator::gpu;
+uint MipsEmulator::vram_version;
 bool MipsEmulator::debug;
 bool MipsEmulator::initialized;
 
@@ -40,25 +52,27 @@ bool MipsEmulator::initialized;
  *
  * @param filename: Filename of the PSX binary to load
  *
+ * @return True if the file could be mapped
+ *
  * @note This file is usually named "SLUS000.67".
  *
  */
-void MipsEmulator::SetPSXBinary(const char* filename) {
-
-    // Open the file
-    FILE* fp = fopen(filename, "rb");
+bool MipsEmulator::SetPSXBinary(const char* filename) {
 
-    // Get the file size
-    fseek(fp, 0, SEEK_END);
-    psx_bin_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    // Create a buffer for the PSX binary
-    psx_bin = (byte*)calloc(psx_bin_size, sizeof(byte));
+    // Map the file
+    psx_file = MappedFile::Share(filename);
+    if (psx_file == nullptr || psx_file->size > RAM_SIZE - PSX_RAM_OFFSET) {
+        Log::Error("Invalid PSX binary: %s\n", filename);
+        psx_file.reset();
+        psx_bin = nullptr;
+        psx_bin_size = 0;
+        return false;
+    }
 
-    // Read the file
-    fread(psx_bin, sizeof(byte), psx_bin_size, fp);
-    fclose(fp);
+    // Read the binary straight from the mapping
+    psx_bin = psx_file->data;
+    psx_bin_size = psx_file->size;
+    return true;
 }
 
 
@@ -68,25 +82,27 @@ void MipsEmulator::SetPSXBinary(const char* filename) {
  *
  * @param filename: Filename of the SotN binary to load
  *
+ * @return True if the file could be mapped
+ *
  * @note This file is usually named "DRA.BIN".
  *
  */
-void MipsEmulator::SetSotNBinary(const char* filename) {
+bool MipsEmulator::SetSotNBinary(const char* filename) {
 
-    // Open the file
-    FILE* fp = fopen(filename, "rb");
-
-    // Get the file size
-    fseek(fp, 0, SEEK_END);
-    sotn_bin_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    // Create a buffer for the SotN binary
-    sotn_bin = (byte*)calloc(sotn_bin_size, sizeof(byte));
+    // Map the file
+    sotn_file = MappedFile::Share(filename);
+    if (sotn_file == nullptr || sotn_file->size > RAM_SIZE - SOTN_RAM_OFFSET) {
+        Log::Error("Invalid SotN binary: %s\n", filename);
+        sotn_file.reset();
+        sotn_bin = nullptr;
+        sotn_bin_size = 0;
+        return false;
+    }
 
-    // Read the file
-    fread(sotn_bin, sizeof(byte), sotn_bin_size, fp);
-    fclose(fp);
+    // Read the binary straight from the mapping
+    sotn_bin = sotn_file->data;
+    sotn_bin_size = sotn_file->size;
+    return true;
 }
 
 
@@ -96,36 +112,32 @@ void MipsEmulator::SetSotNBinary(const char* filename) {
  *
  * @param filename: Filename of the map binary to load
  *
+ * @return True if the file could be mapped
+ *
  * @note These files are usually located in the "ST/" or "BOSS/" directories.
+ * @note The mapping is shared with Map::LoadMapFile(), so the file is only read from disk once.
  *
  */
-void MipsEmulator::LoadMapFile(const char* filename) {
+bool MipsEmulator::LoadMapFile(const char* filename) {
 
-    // Open the file
-    FILE* fp = fopen(filename, "rb");
-
-    // Get the file size
-    fseek(fp, 0, SEEK_END);
-    map_data_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    // Free the previous buffer if one was previously allocated
-    if (initialized) {
-        free(map_data);
+    // Map the file
+    map_file = MappedFile::Share(filename);
+    if (map_file == nullptr || map_file->size > RAM_SIZE - MAP_RAM_OFFSET) {
+        Log::Error("Invalid map file: %s\n", filename);
+        map_file.reset();
+        map_data = nullptr;
+        map_data_size = 0;
+        return false;
     }
-
-    // Create a buffer for the PSX binary
-    map_data = (byte*)calloc(map_data_size, sizeof(byte));
-
-    // Read the file
-    fread(map_data, sizeof(byte), map_data_size, fp);
-    fclose(fp);
+    map_data = map_file->data;
+    map_data_size = map_file->size;
 
     // Copy map data to RAM
     memcpy(ram + MAP_RAM_OFFSET, map_data, map_data_size);
 
     // Copy first 16 pointers of the map file to the pointer table
     memcpy(ram + SOTN_PTR_TBL_ADDR, ram + MAP_RAM_OFFSET, 16 * 4);
+    return true;
 }
 
 
@@ -199,10 +211,9 @@ void MipsEmulator::Initialize() {
     registers[RA] = FUNCTION_RETURN;
     registers[SP] = 0x001FFFC0;
 
-    // Create initial framebuffer
-    byte* tmp = (byte*)calloc(1024 * 512 * 4, sizeof(byte));
-    framebuffer = Utils::CreateTexture(tmp, 1024, 512);
-    free(tmp);
+    // Clear the framebuffer
+    gpu.Reset();
+    vram_version++;
 
     // Initialize the GTE emulator
     GteEmulator::Initialize();
@@ -296,6 +307,341 @@ void MipsEmulator::LoadState() {
 
 
 
+/**
+ * Puts RAM back to a copy taken right after LoadState(), only writing back the pages that differ from it.
+ *
+ * @param base_ram: Copy of the whole RAM (RAM_SIZE bytes)
+ *
+ * @return Number of RAM pages that had to be restored
+ *
+ * @note Cheaper than LoadState() when only a few pages changed since the copy was taken. Unlike LoadState(), the
+ *       area past the save state (SAVE_STATE_SIZE) is restored too, so nothing a previous room wrote there is kept.
+ *
+ */
+uint MipsEmulator::LoadDirtyState(const byte* base_ram) {
+
+    // Restore dirty pages of the base
+    uint num_pages = 0;
+    for (uint offset = 0; offset < RAM_SIZE; offset += SNAPSHOT_PAGE_SIZE) {
+        if (memcmp(ram + offset, base_ram + offset, SNAPSHOT_PAGE_SIZE) != 0) {
+            memcpy(ram + offset, base_ram + offset, SNAPSHOT_PAGE_SIZE);
+            num_pages++;
+        }
+    }
+
+    // Clear out the registers
+    ClearRegisters();
+    return num_pages;
+}
+
+
+
+/**
+ * Appends data to a snapshot buffer.
+ *
+ * @param out: Snapshot buffer
+ * @param data: Data to append
+ * @param num_bytes: Number of bytes to append
+ *
+ */
+static void snapshot_write(std::vector<byte>* out, const void* data, size_t num_bytes) {
+    out->insert(out->end(), (const byte*)data, (const byte*)data + num_bytes);
+}
+
+/**
+ * Reads data from a snapshot buffer.
+ *
+ * @param cur: Current position in the snapshot (advanced past the data)
+ * @param end: End of the snapshot
+ * @param dst: Buffer where the data should be stored
+ * @param num_bytes: Number of bytes to read
+ *
+ * @return False if the snapshot was too short
+ *
+ */
+static bool snapshot_read(const byte** cur, const byte* end, void* dst, size_t num_bytes) {
+    if ((size_t)(end - *cur) < num_bytes) {
+        return false;
+    }
+    memcpy(dst, *cur, num_bytes);
+    *cur += num_bytes;
+    return true;
+}
+
+/**
+ * Appends every page of a buffer that isn't all zeroes to a snapshot buffer.
+ *
+ * @param out: Snapshot buffer
+ * @param src: Buffer to store
+ * @param num_bytes: Size of the buffer (multiple of SNAPSHOT_PAGE_SIZE)
+ *
+ */
+static void snapshot_write_pages(std::vector<byte>* out, const byte* src, uint num_bytes) {
+
+    static const byte zero_page[SNAPSHOT_PAGE_SIZE] = {};
+
+    // Collect the indices of non-zero pages
+    std::vector<uint> pages;
+    for (uint i = 0; i < num_bytes / SNAPSHOT_PAGE_SIZE; i++) {
+        if (memcmp(src + (i * SNAPSHOT_PAGE_SIZE), zero_page, SNAPSHOT_PAGE_SIZE) != 0) {
+            pages.push_back(i);
+        }
+    }
+
+    // Write the page list followed by the page contents
+    uint num_pages = pages.size();
+    snapshot_write(out, &num_pages, sizeof(uint));
+    snapshot_write(out, pages.data(), num_pages * sizeof(uint));
+    for (uint page : pages) {
+        snapshot_write(out, src + (page * SNAPSHOT_PAGE_SIZE), SNAPSHOT_PAGE_SIZE);
+    }
+}
+
+/**
+ * Restores a buffer from pages written by snapshot_write_pages().
+ *
+ * @param cur: Current position in the snapshot (advanced past the pages)
+ * @param end: End of the snapshot
+ * @param dst: Buffer to restore (pages that weren't stored are zeroed)
+ * @param num_bytes: Size of the buffer (multiple of SNAPSHOT_PAGE_SIZE)
+ *
+ * @return False if the snapshot was too short or referenced a page outside of the buffer
+ *
+ */
+static bool snapshot_read_pages(const byte** cur, const byte* end, byte* dst, uint num_bytes) {
+
+    // Read the page list
+    uint num_pages = 0;
+    if (!snapshot_read(cur, end, &num_pages, sizeof(uint)) || num_pages > num_bytes / SNAPSHOT_PAGE_SIZE) {
+        return false;
+    }
+    std::vector<uint> pages(num_pages);
+    if (!snapshot_read(cur, end, pages.data(), num_pages * sizeof(uint))) {
+        return false;
+    }
+
+    // Copy each stored page into place
+    memset(dst, 0, num_bytes);
+    for (uint page : pages) {
+        if (page >= num_bytes / SNAPSHOT_PAGE_SIZE || !snapshot_read(cur, end, dst + (page * SNAPSHOT_PAGE_SIZE), SNAPSHOT_PAGE_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+/**
+ * Serializes the complete machine state (registers, GTE, scratchpad, RAM and VRAM).
+ *
+ * @param out: Buffer where the snapshot should be written
+ *
+ * @return False if the state can't be reused (a map overlay is already loaded)
+ *
+ * @note This is meant to be called right after Reset() so that the DRA.BIN initialization can be skipped next time.
+ *
+ */
+bool MipsEmulator::SaveSnapshot(std::vector<byte>* out) {
+
+    // The snapshot must only depend on the PSX and SotN binaries
+    if (map_data_size > 0) {
+        return false;
+    }
+
+    // Store the CPU registers
+    snapshot_write(out, registers, sizeof(registers));
+    snapshot_write(out, &pc, sizeof(uint));
+    snapshot_write(out, &hi, sizeof(uint));
+    snapshot_write(out, &lo, sizeof(uint));
+
+    // Store the GTE registers
+    std::vector<byte> gte_state(GteEmulator::GetStateSize());
+    GteEmulator::SaveState(gte_state.data());
+    uint gte_size = gte_state.size();
+    snapshot_write(out, &gte_size, sizeof(uint));
+    snapshot_write(out, gte_state.data(), gte_size);
+
+    // Store the scratchpad and RAM
+    snapshot_write(out, scratchpad, 1024);
+    snapshot_write_pages(out, ram, RAM_SIZE);
+
+    // Store the framebuffer (as RGBA pixels, same as the old texture readback)
+    RECT vram_rect = {0, 0, 1024, 512};
+    byte* vram = (byte*)calloc(SNAPSHOT_VRAM_SIZE, sizeof(byte));
+    gpu.GetRGBA(&vram_rect, vram);
+    snapshot_write_pages(out, vram, SNAPSHOT_VRAM_SIZE);
+    free(vram);
+
+    return true;
+}
+
+
+
+/**
+ * Restores the complete machine state from a snapshot written by SaveSnapshot().
+ *
+ * @param data: Snapshot data (usually a memory-mapped cache file)
+ * @param num_bytes: Size of the snapshot
+ *
+ * @return False if the snapshot was invalid or a map overlay is already loaded (the emulator should be reset normally in that case)
+ *
+ */
+bool MipsEmulator::LoadSnapshot(const byte* data, size_t num_bytes) {
+
+    // The snapshot only matches a reset without any map overlay loaded
+    if (map_data_size > 0) {
+        return false;
+    }
+
+    const byte* cur = data;
+    const byte* end = data + num_bytes;
+
+    // Restore the CPU registers
+    bool ok = snapshot_read(&cur, end, registers, sizeof(registers)) &&
+              snapshot_read(&cur, end, &pc, sizeof(uint)) &&
+              snapshot_read(&cur, end, &hi, sizeof(uint)) &&
+              snapshot_read(&cur, end, &lo, sizeof(uint));
+
+    // Restore the GTE registers
+    uint gte_size = 0;
+    ok = ok && snapshot_read(&cur, end, &gte_size, sizeof(uint)) && gte_size == GteEmulator::GetStateSize();
+    ok = ok && (size_t)(end - cur) >= gte_size;
+    if (ok) {
+        GteEmulator::LoadState(cur);
+        cur += gte_size;
+    }
+
+    // Restore the scratchpad and RAM
+    ok = ok && snapshot_read(&cur, end, scratchpad, 1024);
+    ok = ok && snapshot_read_pages(&cur, end, ram, RAM_SIZE);
+
+    // Restore the framebuffer
+    byte* vram = (byte*)calloc(SNAPSHOT_VRAM_SIZE, sizeof(byte));
+    ok = ok && snapshot_read_pages(&cur, end, vram, SNAPSHOT_VRAM_SIZE);
+    if (ok) {
+        RECT vram_rect = {0, 0, 1024, 512};
+        gpu.LoadRGBA(&vram_rect, vram);
+        vram_version++;
+    }
+    free(vram);
+
+    // Bail if anything was missing
+    if (!ok) {
+        Log::Error("Emulator snapshot is invalid\n");
+        return false;
+    }
+
+    // Clear out the save state just like a reset would
+    memset(save_state_ram, 0, SAVE_STATE_SIZE);
+    force_ret = false;
+    ret_hit = false;
+
+    return true;
+}
+
+
+
+/**
+ * Saves the complete machine state so it can be restored cheaply with LoadSetupState().
+ *
+ * @note Used to run setup code once per map and then start every room from its result.
+ *
+ */
+void MipsEmulator::SaveSetupState() {
+
+    // Allocate the buffers on first use
+    if (setup_state_ram == nullptr) {
+        setup_state_ram = (byte*)calloc(RAM_SIZE, sizeof(byte));
+        setup_state_scratchpad = (byte*)calloc(1024, sizeof(byte));
+        setup_state_gte = (byte*)calloc(GteEmulator::GetStateSize(), sizeof(byte));
+        setup_state_vram = (byte*)calloc(1024 * 512, sizeof(ushort));
+    }
+
+    // Backup RAM, scratchpad and the GTE
+    memcpy(setup_state_ram, ram, RAM_SIZE);
+    memcpy(setup_state_scratchpad, scratchpad, 1024);
+    GteEmulator::SaveState(setup_state_gte);
+
+    // Backup the CPU registers
+    memcpy(setup_state_registers, registers, sizeof(registers));
+    setup_state_hi = hi;
+    setup_state_lo = lo;
+
+    // Backup the framebuffer
+    gpu.Flush();
+    memcpy(setup_state_vram, gpu.vram.data(), 1024 * 512 * sizeof(ushort));
+}
+
+
+
+/**
+ * Restores the machine state saved by SaveSetupState().
+ *
+ * @return Number of RAM pages that had to be restored
+ *
+ * @note Only RAM pages that differ from the saved state are written back.
+ *
+ */
+uint MipsEmulator::LoadSetupState() {
+
+    // Bail if no setup state was saved
+    if (setup_state_ram == nullptr) {
+        return 0;
+    }
+
+    // Restore dirty RAM pages
+    uint num_pages = 0;
+    for (uint offset = 0; offset < RAM_SIZE; offset += SNAPSHOT_PAGE_SIZE) {
+        if (memcmp(ram + offset, setup_state_ram + offset, SNAPSHOT_PAGE_SIZE) != 0) {
+            memcpy(ram + offset, setup_state_ram + offset, SNAPSHOT_PAGE_SIZE);
+            num_pages++;
+        }
+    }
+
+    // Restore scratchpad and the GTE
+    memcpy(scratchpad, setup_state_scratchpad, 1024);
+    GteEmulator::LoadState(setup_state_gte);
+
+    // Restore the CPU registers
+    memcpy(registers, setup_state_registers, sizeof(registers));
+    hi = setup_state_hi;
+    lo = setup_state_lo;
+    pc = 0;
+    num_executed = 0;
+    force_ret = false;
+    ret_hit = false;
+
+    // Restore the framebuffer
+    gpu.Flush();
+    if (memcmp(gpu.vram.data(), setup_state_vram, 1024 * 512 * sizeof(ushort)) != 0) {
+        memcpy(gpu.vram.data(), setup_state_vram, 1024 * 512 * sizeof(ushort));
+        vram_version++;
+    }
+
+    return num_pages;
+}
+
+
+
+/**
+ * Discards the machine state saved by SaveSetupState().
+ */
+void MipsEmulator::ClearSetupState() {
+
+    // Free the buffers
+    free(setup_state_ram);
+    free(setup_state_scratchpad);
+    free(setup_state_gte);
+    free(setup_state_vram);
+    setup_state_ram = nullptr;
+    setup_state_scratchpad = nullptr;
+    setup_state_gte = nullptr;
+    setup_state_vram = nullptr;
+}
+
+
+
 /**
  * Frees allocated data when the emulator is destroyed.
  */
@@ -305,9 +651,13 @@ void MipsEmulator::Cleanup() {
     free(ram);
     free(scratchpad);
     free(clut_data);
-    free(sotn_bin);
-    free(psx_bin);
-    free(map_data);
+    psx_file.reset();
+    sotn_file.reset();
+    map_file.reset();
+    psx_bin = nullptr;
+    sotn_bin = nullptr;
+    map_data = nullptr;
+    ClearSetupState();
 }
 
 
@@ -597,9 +947,6 @@ void MipsEmulator::CopyFromRAM(uint addr, void* dst, uint count) {
  */
 std::vector<Entity> MipsEmulator::ProcessEntities() {
 
-    // Initialize vector of entities
-    std::vector<Entity> entities;
-
     // Set Alucard Z depth for entities that use it
     EntityData* ALUCARD = (EntityData*)(ram + ALUCARD_ENTITY_ADDR);
     ALUCARD->z_depth = 0x94;
@@ -619,6 +966,9 @@ std::vector<Entity> MipsEmulator::ProcessEntities() {
         // Check if update function exists
         if (entity_data->update_function > 0x80180000 && entity_data->update_function < RAM_MAX_OFFSET) {
 
+            // Time both passes of the entity's update function
+            TraceZone zone("Entity update", "object_id", entity_data->object_id);
+
             for (int k = 0; k < 2; k++) {
 
                 // Initialize the emulator's registers
@@ -646,7 +996,24 @@ std::vector<Entity> MipsEmulator::ProcessEntities() {
         }
     }
 
-    // Loop through each entity in RAM after processing all entities
+    // Return the entity data
+    return CollectEntities();
+}
+
+
+
+/**
+ * Collects all entities currently present in MIPS RAM without running any of their functions.
+ *
+ * @return Vector of Entity objects.
+ *
+ */
+std::vector<Entity> MipsEmulator::CollectEntities() {
+
+    // Initialize vector of entities
+    std::vector<Entity> entities;
+
+    // Loop through each entity in RAM
     for (int i = 0; i < 0xC0; i++) {
 
         // Get the current entity's location in RAM
@@ -748,9 +1115,11 @@ void MipsEmulator::ClearEntities() {
  */
 void MipsEmulator::LoadImage(RECT* rect, byte* src) {
 
-    byte* rgba_pixels = Utils::Indexed_to_RGBA(src, rect->w * rect->h);
-    Utils::SetPixels(framebuffer, rect->x, rect->y, rect->w, rect->h, rgba_pixels);
-    free(rgba_pixels);
+    ushort* pixels = (ushort*)calloc(rect->w * rect->h, sizeof(ushort));
+    memcpy(pixels, src, rect->w * rect->h * 2);
+    gpu.LoadImage(rect, pixels);
+    free(pixels);
+    vram_version++;
 }
 
 /**
@@ -762,11 +1131,10 @@ void MipsEmulator::LoadImage(RECT* rect, byte* src) {
  */
 void MipsEmulator::StoreImage(RECT* rect, byte* dst) {
 
-    byte* rgba_pixels = Utils::GetPixels(framebuffer, rect->x, rect->y, rect->w, rect->h);
-    byte* indexed_pixels = Utils::RGBA_to_Indexed(rgba_pixels, rect->w * rect->h);
-    memcpy(dst, indexed_pixels, rect->w * rect->h * 2);
-    free(rgba_pixels);
-    free(indexed_pixels);
+    ushort* pixels = (ushort*)calloc(rect->w * rect->h, sizeof(ushort));
+    gpu.StoreImage(rect, pixels);
+    memcpy(dst, pixels, rect->w * rect->h * 2);
+    free(pixels);
 }
 
 /**
@@ -779,9 +1147,12 @@ void MipsEmulator::StoreImage(RECT* rect, byte* dst) {
  */
 void MipsEmulator::MoveImage(RECT* rect, int x, int y) {
 
-    byte* rgba_pixels = Utils::GetPixels(framebuffer, rect->x, rect->y, rect->w, rect->h);
-    Utils::SetPixels(framebuffer, x, y, rect->w, rect->h, rgba_pixels);
-    free(rgba_pixels);
+    ushort* pixels = (ushort*)calloc(rect->w * rect->h, sizeof(ushort));
+    gpu.StoreImage(rect, pixels);
+    RECT dst_rect = {(short)x, (short)y, rect->w, rect->h};
+    gpu.LoadImage(&dst_rect, pixels);
+    free(pixels);
+    vram_version++;
 }
 
 /**
@@ -795,18 +1166,17 @@ void MipsEmulator::MoveImage(RECT* rect, int x, int y) {
  */
 void MipsEmulator::ClearImage(RECT* rect, byte r, byte g, byte b) {
 
-    byte* clear_pixels = (byte*)calloc(rect->w * rect->h * 4, sizeof(byte));
+    ushort* clear_pixels = (ushort*)calloc(rect->w * rect->h, sizeof(ushort));
 
-    // Set all RGBA values within the buffer
-    for (int i = 0; i < rect->w * rect->h * 4; i += 4) {
-        clear_pixels[i] = r;
-        clear_pixels[i+1] = g;
-        clear_pixels[i+2] = b;
-        clear_pixels[i+3] = 0xFF;
+    // Set all RGB1555 values within the buffer
+    ushort color = Utils::RGBA_to_RGB1555(r | (g << 8) | (b << 16) | 0xFF000000);
+    for (int i = 0; i < rect->w * rect->h; i++) {
+        clear_pixels[i] = color;
     }
 
-    Utils::SetPixels(framebuffer, rect->x, rect->y, rect->w, rect->h, clear_pixels);
+    gpu.LoadImage(rect, clear_pixels);
     free(clear_pixels);
+    vram_version++;
 }
 
 
@@ -0,0 +1,175 @@
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include "common.h"
+#include "sprite_decoder.h"
+#include "map.h"
+#include "stage_timer.h"
+#include "trace.h"
+#include "mips.h"
+#include "cluts.h"
+#include "utils.h"
+
+
+
+/**
+ * Copies a rectangle of VRAM texels out of a sprite source.
+ *
+ * @param map: Map the source belongs to
+ * @param extraction: Sprite extraction state (holds the expanded entity graphics blocks)
+ * @param source: Tileset (0x00 - 0x17) or entity graphics block (SPRITE_SOURCE_BLOCK | map offset)
+ * @param x: Left edge within the source (in 16-bit VRAM words)
+ * @param y: Top edge within the source
+ * @param width: Width of the rectangle (in 16-bit VRAM words)
+ * @param height: Height of the rectangle
+ *
+ * @return Texels of the rectangle (anything outside of the source is left blank)
+ *
+ */
+std::vector<byte> SpriteDecoder::ReadSource(const Map* map, SpriteExtraction* extraction, uint source, uint x, uint y, uint width, uint height) {
+
+    std::vector<byte> texels(width * height * 4, 0);
+    const byte* data = nullptr;
+    uint stride = 0;
+    uint source_width = 0;
+    uint source_height = 0;
+
+    // Entity graphics blocks are stored as raw 16-bit words
+    if ((source & SPRITE_SOURCE_BLOCK) != 0) {
+        uint graphics_addr = source & ~SPRITE_SOURCE_BLOCK;
+        auto block = map->entity_graphics_blocks.find(graphics_addr);
+        auto graphics = map->cache.entity_graphics.find(graphics_addr);
+        if (block == map->entity_graphics_blocks.end() || graphics == map->cache.entity_graphics.end()) {
+            return texels;
+        }
+        std::vector<byte>& block_texels = extraction->block_texels[graphics_addr];
+        if (block_texels.empty() && !graphics->second.empty()) {
+            byte* expanded = Utils::Indexed_to_RGBA(graphics->second.data(), graphics->second.size() / 4);
+            block_texels.assign(expanded, expanded + (graphics->second.size() / 4) * 4);
+            free(expanded);
+        }
+        data = block_texels.data();
+        stride = block->second.width / 4;
+        source_width = stride;
+        source_height = block->second.height;
+    }
+
+    // Tilesets are 64 words wide columns of the map's VRAM (0x08 - 0x0F repeat the first, 0x10 - 0x17 are F_GAME.BIN)
+    else {
+        const std::vector<byte>* vram = (source >= 0x10 ? &Map::fgame_vram : &map->cache.vram);
+        uint tileset_x = (source >= 0x10 ? source - 0x10 : (source >= 0x08 ? 0 : source)) * 64;
+        if (tileset_x >= 512 || vram->size() != 512 * 256 * 4) {
+            return texels;
+        }
+        data = vram->data() + (tileset_x * 4);
+        stride = 512;
+        source_width = 64;
+        source_height = 256;
+    }
+
+    // Copy the part of the rectangle that lies within the source
+    for (uint row = 0; row < height && y + row < source_height; row++) {
+        if (x >= source_width) {
+            break;
+        }
+        uint num_words = std::min(width, source_width - x);
+        memcpy(texels.data() + (row * width * 4), data + ((((y + row) * stride) + x) * 4), num_words * 4);
+    }
+    return texels;
+}
+
+
+
+/**
+ * Decodes the sprite parts of every entity in a room that draws from the map's sprite banks.
+ *
+ * @param map: Map the room belongs to
+ * @param room: Room whose entities were just emulated
+ * @param extraction: Sprite extraction state (identical parts are only decoded once per map)
+ *
+ * @note Parts from the generic sprite banks, items and polygons are read from textures built by the editor and are skipped here.
+ *
+ */
+void SpriteDecoder::DecodeRoom(const Map* map, const Room* room, SpriteExtraction* extraction) {
+
+    TraceZone zone("SpriteDecoder::DecodeRoom", "room", room - map->rooms.data());
+    StageTimer timer(LoadStage_SpriteExtract);
+
+    // Pick up any CLUTs the room's entities modified
+    Clut::Set(CLUT_BANK_RAM, 0, CLUT_DATA_SIZE / 32, MipsEmulator::ram + CLUT_BASE_ADDR);
+
+    // Find the entity graphics block loaded into each part of VRAM (same indexing as the entity tilesets)
+    std::map<uint, uint> room_blocks;
+    uint gfx_id = (room->entity_graphics_id > 0 ? room->entity_graphics_id - 1 : 0);
+    if (room->load_flags != 0xFF && gfx_id < map->entity_graphics.size()) {
+        for (const auto& graphics_data : map->entity_graphics[gfx_id]) {
+            if (graphics_data.compressed_graphics_addr == 0) {
+                continue;
+            }
+            uint chunk_x = graphics_data.vram_x >> 6;
+            uint chunk_y = 3 - (graphics_data.vram_y >> 8);
+            uint vram_idx = (((chunk_y * 8) + chunk_x) << 2);
+            vram_idx |= ((graphics_data.vram_x << 2) & 0x80) >> 7;
+            vram_idx |= (graphics_data.vram_y & 0x80) >> 6;
+            room_blocks[vram_idx] = graphics_data.compressed_graphics_addr - MAP_BIN_OFFSET;
+        }
+    }
+
+    for (const Entity& entity : room->entities) {
+
+        // Only entities using the map's sprite banks draw from the map's own graphics
+        uint bank_idx = entity.data.sprite_bank & 0x7FFF;
+        if (entity.data.sprite_bank <= 0x8000 || bank_idx >= map->sprite_banks.size()) {
+            continue;
+        }
+        const std::vector<Sprite>& sprite_bank = map->sprite_banks[bank_idx];
+        uint sprite_idx = (entity.data.sprite_image == 0xFF ? 1 : entity.data.sprite_image);
+        if (sprite_idx >= sprite_bank.size()) {
+            continue;
+        }
+
+        for (const SpritePart& image : sprite_bank[sprite_idx].parts) {
+
+            // Work out where the pixels come from and which CLUT they use
+            uint source;
+            uint clut_bank;
+            uint clut_index;
+            if (entity.data.tileset == 0) {
+                source = (image.tileset_offset % 0x20) / 4;
+                clut_bank = CLUT_BANK_MAP;
+                clut_index = image.clut_offset & 0xFF;
+            }
+            else {
+                auto block = room_blocks.find(entity.data.tileset + image.tileset_offset);
+                if (block == room_blocks.end()) {
+                    continue;
+                }
+                source = SPRITE_SOURCE_BLOCK | block->second;
+                clut_bank = CLUT_BANK_RAM;
+                clut_index = entity.data.clut_index;
+                clut_index = (clut_index < 0x8000 ? clut_index + image.clut_offset : clut_index & 0x7FFF);
+            }
+            extraction->num_part_refs++;
+
+            // Decode the part the first time it's seen
+            uint clut_version = (clut_bank == CLUT_BANK_RAM ? Clut::GetVersion(CLUT_BANK_RAM, clut_index) : 0);
+            SpritePartKey key = {source, image.texture_start_x / 4u, image.texture_start_y, image.width, image.height, clut_bank, clut_index, clut_version};
+            if (extraction->parts.count(key) != 0) {
+                continue;
+            }
+            std::vector<byte> texels = ReadSource(map, extraction, source, image.texture_start_x / 4u, image.texture_start_y, image.width / 4u, image.height);
+            std::vector<byte>& pixels = extraction->parts[key];
+            pixels.assign(image.width * image.height * 4, 0);
+            Utils::VRAM_to_RGBA(texels.data(), Clut::GetRGBA(clut_bank, clut_index, CLUT_FORMAT_SEMI), image.width / 4u, image.height, pixels.data());
+
+            // Destroy any partial alpha values if the entity isn't blended
+            if (entity.data.blend_mode == 0) {
+                for (uint i = 0; i < image.width * image.height; i++) {
+                    if (pixels[(i * 4) + 3] == 0x80) {
+                        pixels[(i * 4) + 3] = 0xFF;
+                    }
+                }
+            }
+        }
+    }
+}
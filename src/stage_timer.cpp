@@ -0,0 +1,126 @@
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "common.h"
+#include "stage_timer.h"
+
+
+
+// Stages aren't timed unless something asks for it (e.g. the load benchmark)
+bool StageTimer::enabled = false;
+StageTotal StageTimer::totals[LoadStage_Count];
+
+// Stage names (same order as LOAD_STAGE)
+const char* const StageTimer::names[LoadStage_Count] = {
+    "file_read",
+    "header_parse",
+    "sprite_banks",
+    "cluts",
+    "tile_layers",
+    "entity_graphics_decompress",
+    "vram_build",
+    "tile_decode",
+    "layer_compose",
+    "emulator_reset",
+    "entity_emulation",
+    "sprite_extract"
+};
+
+
+
+/**
+ * Clears the time spent in every stage.
+ */
+void StageTimer::Reset() {
+    for (auto& total : totals) {
+        total = StageTotal();
+    }
+}
+
+
+
+/**
+ * Gets the CPU time used by the process so far.
+ *
+ * @return CPU time of every thread in the process (user + system) in milliseconds
+ *
+ */
+double StageTimer::GetCPUTime() {
+#if defined(_WIN32)
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart = user_time.dwLowDateTime;
+    user.HighPart = user_time.dwHighDateTime;
+    return (double)(kernel.QuadPart + user.QuadPart) / 10000.0;
+#else
+    timespec now;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) != 0) {
+        return 0;
+    }
+    return (now.tv_sec * 1000.0) + (now.tv_nsec / 1000000.0);
+#endif
+}
+
+
+
+/**
+ * Starts timing a stage.
+ *
+ * @param stage: Stage to add the time to (LoadStage_*)
+ *
+ * @note Timers should only be used on the loading thread and shouldn't be nested (nested time is counted twice).
+ *
+ */
+StageTimer::StageTimer(uint stage) : stage(stage), cpu_start(0) {
+    if (enabled) {
+        wall_start = std::chrono::steady_clock::now();
+        cpu_start = GetCPUTime();
+    }
+}
+
+
+
+/**
+ * Stops timing the stage when the timer goes out of scope.
+ */
+StageTimer::~StageTimer() {
+    Stop();
+}
+
+
+
+/**
+ * Ends the current stage and starts timing the next one (for stages that directly follow each other).
+ *
+ * @param next_stage: Stage to add the time to from now on (LoadStage_*)
+ *
+ */
+void StageTimer::Switch(uint next_stage) {
+    Stop();
+    stage = next_stage;
+    if (enabled) {
+        wall_start = std::chrono::steady_clock::now();
+        cpu_start = GetCPUTime();
+    }
+}
+
+
+
+/**
+ * Adds the time since the timer was started to its stage.
+ */
+void StageTimer::Stop() {
+    if (enabled && stage < LoadStage_Count) {
+        totals[stage].wall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+        totals[stage].cpu_ms += GetCPUTime() - cpu_start;
+        totals[stage].count++;
+    }
+}
@@ -0,0 +1,186 @@
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include "common.h"
+#include "trace.h"
+#include "log.h"
+
+
+
+// Events recorded by a single thread
+typedef struct TraceBuffer {
+    uint thread_id = 0;                                     // Thread ID shown in the trace (in order of first use)
+    std::vector<TraceEvent> events;                         // Finished zones (in the order they ended)
+} TraceBuffer;
+
+
+
+// Zones aren't recorded unless something asks for it (e.g. --trace)
+std::atomic<bool> Trace::enabled(false);
+
+// Start of the trace (every timestamp is relative to this)
+static std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+// Buffer of every thread that recorded a zone (kept after the thread exits so its zones still get written)
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+
+// Buffer of the current thread (only touched by that thread once created)
+static thread_local TraceBuffer* thread_buffer = nullptr;
+
+
+
+/**
+ * Gets the trace buffer of the current thread, creating it on first use.
+ *
+ * @return Buffer of the current thread
+ *
+ */
+static TraceBuffer* get_thread_buffer() {
+    if (thread_buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(std::make_unique<TraceBuffer>());
+        thread_buffer = buffers.back().get();
+        thread_buffer->thread_id = buffers.size();
+        thread_buffer->events.reserve(4096);
+    }
+    return thread_buffer;
+}
+
+
+
+
+// -- Trace ----------------------------------------------------------------------------------------------------
+
+/**
+ * Discards any previously recorded zones and starts recording.
+ *
+ * @note Should be called while no other thread is inside a zone.
+ *
+ */
+void Trace::Start() {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    for (auto& buffer : buffers) {
+        buffer->events.clear();
+    }
+    trace_epoch = std::chrono::steady_clock::now();
+    enabled = true;
+}
+
+
+
+/**
+ * Stops recording zones (zones that are still open are dropped).
+ */
+void Trace::Stop() {
+    enabled = false;
+}
+
+
+
+/**
+ * Writes every recorded zone as a Chrome trace (viewable in Perfetto or about:tracing).
+ *
+ * @param filename: Filename of the JSON file to write
+ *
+ * @return True if the file was written
+ *
+ * @note Should be called once tracing was stopped or every other thread is idle.
+ *
+ */
+bool Trace::Write(const std::string& filename) {
+
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        Log::Error("Could not write trace: %s\n", filename.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    size_t num_events = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"SotN Editor\"}}");
+    for (const auto& buffer : buffers) {
+
+        // Name the thread, then write each of its zones
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}", buffer->thread_id, buffer->thread_id);
+        for (const TraceEvent& event : buffer->events) {
+            fprintf(
+                file, ",\n{\"name\":\"%s\",\"cat\":\"sotn\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                event.name, buffer->thread_id, event.start_ns / 1000.0, event.duration_ns / 1000.0
+            );
+            if (event.arg_name != nullptr) {
+                fprintf(file, ",\"args\":{\"%s\":%u}", event.arg_name, event.arg_value);
+            }
+            fprintf(file, "}");
+        }
+        num_events += buffer->events.size();
+    }
+    fprintf(file, "\n]}\n");
+
+    bool ok = (ferror(file) == 0);
+    ok &= (fclose(file) == 0);
+    if (!ok) {
+        Log::Error("Could not write trace: %s\n", filename.c_str());
+        return false;
+    }
+    Log::Info("Trace written: %s (%zu zones on %zu threads)\n", filename.c_str(), num_events, buffers.size());
+    return true;
+}
+
+
+
+/**
+ * Gets the current time of the trace.
+ *
+ * @return Nanoseconds since tracing started
+ *
+ */
+int64_t Trace::GetTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+
+
+/**
+ * Adds a finished zone to the current thread's trace.
+ *
+ * @param event: Zone to add
+ *
+ */
+void Trace::Record(const TraceEvent& event) {
+    get_thread_buffer()->events.push_back(event);
+}
+
+
+
+
+// -- Trace Zone -----------------------------------------------------------------------------------------------
+
+/**
+ * Starts timing a zone.
+ *
+ * @param zone_name: Name of the zone (must be a string literal, only the pointer is kept)
+ * @param zone_arg_name: Name of the zone's argument shown in the trace (nullptr for none)
+ * @param zone_arg_value: Value of the zone's argument (e.g. a room index)
+ *
+ */
+void TraceZone::Begin(const char* zone_name, const char* zone_arg_name, uint zone_arg_value) {
+    name = zone_name;
+    arg_name = zone_arg_name;
+    arg_value = zone_arg_value;
+    start_ns = Trace::GetTime();
+}
+
+
+
+/**
+ * Records the zone in the current thread's trace (unless tracing was stopped in the meantime).
+ */
+void TraceZone::End() {
+    if (Trace::enabled.load(std::memory_order_relaxed)) {
+        Trace::Record({name, arg_name, arg_value, start_ns, Trace::GetTime() - start_ns});
+    }
+}
@@ -1,18 +1,18 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <GL/glew.h>
 #include <string>
 #include <string.h>
 #include <stdexcept>
 #include <cstdarg>
 #include <algorithm>
 #include <cctype>
-#if defined(IMGUI_IMPL_OPENGL_ES2)
-#include <GLES2/gl2.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOTN_EDITOR_SSE2
 #endif
-#include <GLFW/glfw3.h>
 #include "common.h"
 #include "utils.h"
+#include "mapped_file.h"
 #include "log.h"
 
 
@@ -28,6 +28,18 @@ std::string Utils::toLowerCase(std::string str) {
     return str;
 }
 
+/**
+ * Converts a string to uppercase in-place.
+ *
+ * @param str: Input string
+ *
+ * @return String converted to uppercase in-place
+ */
+std::string Utils::toUpperCase(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::toupper(c); });
+    return str;
+}
+
 /**
  * Returns whether a given string is all in lowercase.
  *
@@ -110,23 +122,90 @@ byte* Utils::Indexed_to_RGBA(const byte* data, uint num_bytes) {
     byte* pixel_data = (byte*)calloc(num_bytes * 4, sizeof(byte));
 
     // Split all of the packed indices into their RGB components
-    for (int i = 0; i < num_bytes; i++) {
+    RGB1555_to_RGBA_Row(data, pixel_data, num_bytes);
 
-        // Get the current index
-        ushort cur_color = *(ushort*)(data + (i * 2));
+    // Return the allocated buffer
+    return pixel_data;
+}
 
-        // Create RGBA color from the indices
-        uint color = RGB1555_to_RGBA(cur_color);
 
-        // Set the RGBA data
-        *(byte*)(pixel_data + (i * 4)) = (byte)(color >> 24);
-        *(byte*)(pixel_data + (i * 4) + 1) = (byte)(color >> 16);
-        *(byte*)(pixel_data + (i * 4) + 2) = (byte)(color >> 8);
-        *(byte*)(pixel_data + (i * 4) + 3) = (byte)(color);
+
+/**
+ * Converts a row of RGB1555 values to RGBA bytes (same output as RGB1555_to_RGBA for each value).
+ *
+ * @param src: Buffer of 16-bit RGB1555 values (may be unaligned)
+ * @param dst: Buffer where the RGBA bytes should be written
+ * @param count: Number of values to convert
+ *
+ */
+void Utils::RGB1555_to_RGBA_Row(const byte* src, byte* dst, uint count) {
+
+    uint i = 0;
+
+#ifdef SOTN_EDITOR_SSE2
+    // Convert 8 values at a time
+    const __m128i mask_5 = _mm_set1_epi16(0x1F);
+    const __m128i alpha_opaque = _mm_set1_epi16(0xFF);
+    const __m128i alpha_step = _mm_set1_epi16(0x7F);
+    for (; i + 8 <= count; i += 8) {
+        __m128i colors = _mm_loadu_si128((const __m128i*)(src + (i * 2)));
+
+        // Split the components and expand them to 8 bits
+        __m128i r = _mm_and_si128(colors, mask_5);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(colors, 5), mask_5);
+        __m128i b = _mm_and_si128(_mm_srli_epi16(colors, 10), mask_5);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+        // Semi-transparent colors get an alpha of 0x80, everything else 0xFF
+        __m128i a = _mm_sub_epi16(alpha_opaque, _mm_mullo_epi16(_mm_srli_epi16(colors, 15), alpha_step));
+
+        // Interleave into R, G, B, A bytes
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+        _mm_storeu_si128((__m128i*)(dst + (i * 4)), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(dst + (i * 4) + 16), _mm_unpackhi_epi16(rg, ba));
     }
+#endif
 
-    // Return the allocated buffer
-    return pixel_data;
+    // Convert whatever is left one value at a time
+    for (; i < count; i++) {
+        uint color = RGB1555_to_RGBA(*(ushort*)(src + (i * 2)));
+        dst[(i * 4)] = (byte)(color >> 24);
+        dst[(i * 4) + 1] = (byte)(color >> 16);
+        dst[(i * 4) + 2] = (byte)(color >> 8);
+        dst[(i * 4) + 3] = (byte)(color);
+    }
+}
+
+
+
+/**
+ * Converts the chunked layout of an F_*.BIN graphics file to linear RGBA VRAM.
+ *
+ * @param data: Contents of the graphics file (RGB1555 values)
+ * @param num_bytes: Size of the graphics file
+ * @param output: Buffer where the RGBA pixels should be written (512 x 256)
+ *
+ * @note The file is made of 32 chunks of 32 x 128 values. Every group of 4 chunks forms a 64 x 256 texture page,
+ *       with chunks 0 and 1 side by side in the top half and chunks 2 and 3 side by side in the bottom half.
+ *       Chunks missing from the file are left untouched.
+ *
+ */
+void Utils::Chunks_to_VRAM(const byte* data, uint num_bytes, byte* output) {
+
+    for (uint i = 0; i < 32 && ((i + 1) * 8192) <= num_bytes; i++) {
+
+        // Get the chunk's position within VRAM
+        uint x = (((i / 4) * 2) + (i % 2)) * 32;
+        uint y = ((i % 4) / 2) * 128;
+
+        // Convert each row straight into place
+        for (uint k = 0; k < 128; k++) {
+            RGB1555_to_RGBA_Row(data + (i * 8192) + (k * 32 * 2), output + ((((y + k) * 512) + x) * 4), 32);
+        }
+    }
 }
 
 
@@ -202,45 +281,6 @@ void Utils::CLUT_to_RGBA(const byte* src, const byte* dst, int num_cluts, bool s
 
 
 
-/**
- * Creates a texture from a buffer of RGBA data.
- *
- * @param data: Buffer of RGBA bytes for the texture
- * @param width: Width of the texture
- * @param height: Height of the texture
- *
- * @return ID of the newly-created texture.
- *
- */
-GLuint Utils::CreateTexture(void* data, int width, int height) {
-
-    // Initialize the texture
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    // Setup filtering parameters for display
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    float borderColor[] = { 1.0f, 1.0f, 0.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    // Upload pixels into texture
-#if defined(GL_UNPACK_ROW_LENGTH) && !defined(__EMSCRIPTEN__)
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-#endif
-
-    // Create the texture from the image data
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-    // Set the map VRAM
-    return texture;
-}
-
-
 /**
  * Applies a CLUT's RGBA values to an indexed pixel buffer to create an RGBA representation of the data.
  *
@@ -345,64 +385,6 @@ void Utils::HexDump(const byte* buf, const uint num_bytes) {
 
 
 
-/**
- * Retrieves the RGBA pixels from a texture.
- *
- * @param texture: ID of the texture to get pixels from
- * @param x: X coordinate of the location within the texture
- * @param y: Y coordinate of the location within the texture
- * @param width: Width of the section to read from the texture
- * @param height: Height of the section to read from the texture
- *
- * @return Buffer of RGBA pixels read from the texture.
- *
- */
-byte* Utils::GetPixels(const GLuint texture, uint x, uint y, uint width, uint height) {
-
-    // Pixels to return
-    byte* pixels = (byte*)calloc(width * height * 4, sizeof(byte));
-
-    // Attach to the texture
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
-    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-
-    // Return the pixels that were read
-    return pixels;
-}
-
-
-
-/**
- * Writes RGBA pixels to a texture.
- *
- * @param texture: ID of the texture to write to
- * @param x: X coordinate of the location within the texture
- * @param y: Y coordinate of the location within the texture
- * @param width: Width of the section to write to the texture
- * @param height: Height of the section to write to the texture
- * @param pixels: Buffer of RGBA pixels to write
- *
- */
-void Utils::SetPixels(const GLuint texture, uint x, uint y, uint width, uint height, byte *pixels) {
-
-    // Bind to the target texture
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    // Overwrite the rectangular region
-    glTexSubImage2D(
-        GL_TEXTURE_2D, 0,
-        x, y,
-        width, height,
-        GL_RGBA, GL_UNSIGNED_BYTE,
-        pixels
-    );
-
-    // Reset target
-    glBindTexture(GL_TEXTURE_2D, 0);
-}
-
-
-
 /**
  * Converts a SotN-format string to a regular ASCII string
  *
@@ -579,3 +561,163 @@ std::string Utils::FormatString(const char* fmt, ...) {
     va_end(args);
     return output;
 }
+
+
+
+// XXH64 prime constants
+static const uint64_t HASH_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t HASH_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t HASH_PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t HASH_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t HASH_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * HASH_PRIME2;
+    acc = hash_rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t val) {
+    acc ^= hash_round(0, val);
+    return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+
+
+/**
+ * Computes a fast 64-bit hash of a buffer.
+ *
+ * @param data: Buffer of bytes to hash
+ * @param num_bytes: Number of bytes to hash
+ * @param seed: (Optional) Seed value used to chain multiple hashes together
+ *
+ * @return 64-bit hash of the data
+ *
+ * @note This is the XXH64 algorithm, which is only used for cache keys and not for anything security related.
+ *
+ */
+uint64_t Utils::Hash(const void* data, size_t num_bytes, uint64_t seed) {
+
+    const byte* cur = (const byte*)data;
+    const byte* end = cur + num_bytes;
+    uint64_t hash;
+
+    // Process 32-byte stripes with four accumulators
+    if (num_bytes >= 32) {
+        uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        uint64_t v2 = seed + HASH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH_PRIME1;
+        const byte* limit = end - 32;
+        do {
+            uint64_t lanes[4];
+            memcpy(lanes, cur, 32);
+            v1 = hash_round(v1, lanes[0]);
+            v2 = hash_round(v2, lanes[1]);
+            v3 = hash_round(v3, lanes[2]);
+            v4 = hash_round(v4, lanes[3]);
+            cur += 32;
+        } while (cur <= limit);
+
+        hash = hash_rotl(v1, 1) + hash_rotl(v2, 7) + hash_rotl(v3, 12) + hash_rotl(v4, 18);
+        hash = hash_merge(hash, v1);
+        hash = hash_merge(hash, v2);
+        hash = hash_merge(hash, v3);
+        hash = hash_merge(hash, v4);
+    }
+    else {
+        hash = seed + HASH_PRIME5;
+    }
+
+    hash += (uint64_t)num_bytes;
+
+    // Process the remaining 8-byte words
+    while (cur + 8 <= end) {
+        uint64_t word;
+        memcpy(&word, cur, 8);
+        hash ^= hash_round(0, word);
+        hash = hash_rotl(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+        cur += 8;
+    }
+
+    // Process the remaining 4-byte word
+    if (cur + 4 <= end) {
+        uint word;
+        memcpy(&word, cur, 4);
+        hash ^= (uint64_t)word * HASH_PRIME1;
+        hash = hash_rotl(hash, 23) * HASH_PRIME2 + HASH_PRIME3;
+        cur += 4;
+    }
+
+    // Process the remaining bytes
+    while (cur < end) {
+        hash ^= (*cur) * HASH_PRIME5;
+        hash = hash_rotl(hash, 11) * HASH_PRIME1;
+        cur++;
+    }
+
+    // Final avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+
+
+/**
+ * Computes a fast 64-bit hash of a file's contents.
+ *
+ * @param filename: Filename of the file to hash
+ * @param seed: (Optional) Seed value used to chain multiple hashes together
+ *
+ * @return 64-bit hash of the file, or 0 if the file could not be read
+ *
+ */
+uint64_t Utils::HashFile(const char* filename, uint64_t seed) {
+
+    // Map the file
+    std::shared_ptr<const MappedFile> file = MappedFile::Share(filename);
+    if (file == nullptr) {
+        Log::Error("Could not open file for hashing: %s\n", filename);
+        return 0;
+    }
+
+    // Hash the contents
+    return Hash(file->data, file->size, seed);
+}
+
+
+
+/**
+ * Wraps an argument in quotes for use on a shell command line.
+ *
+ * @param arg: Argument to quote
+ *
+ * @return Quoted argument
+ *
+ */
+std::string Utils::QuoteArg(const std::string& arg) {
+    std::string quoted = "\"";
+    for (char c : arg) {
+        if (c == '"' || c == '\\' || c == '$' || c == '`') {
+#ifdef _WIN32
+            if (c == '"') {
+                quoted.push_back('\\');
+            }
+#else
+            quoted.push_back('\\');
+#endif
+        }
+        quoted.push_back(c);
+    }
+    quoted.push_back('"');
+    return quoted;
+}
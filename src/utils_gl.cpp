@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+#include <GLES2/gl2.h>
+#endif
+#include <GLFW/glfw3.h>
+#include "common.h"
+#include "utils.h"
+#include "trace.h"
+
+
+
+/**
+ * Creates a texture from a buffer of RGBA data.
+ *
+ * @param data: Buffer of RGBA bytes for the texture
+ * @param width: Width of the texture
+ * @param height: Height of the texture
+ *
+ * @return ID of the newly-created texture.
+ *
+ */
+GLuint Utils::CreateTexture(void* data, int width, int height) {
+
+    TraceZone zone("GL texture upload", "pixels", width * height);
+
+    // Initialize the texture
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // Setup filtering parameters for display
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    float borderColor[] = { 1.0f, 1.0f, 0.0f, 1.0f };
+    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+    // Upload pixels into texture
+#if defined(GL_UNPACK_ROW_LENGTH) && !defined(__EMSCRIPTEN__)
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+
+    // Create the texture from the image data
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+
+    // Set the map VRAM
+    return texture;
+}
+
+
+
+/**
+ * Retrieves the RGBA pixels from a texture.
+ *
+ * @param texture: ID of the texture to get pixels from
+ * @param x: X coordinate of the location within the texture
+ * @param y: Y coordinate of the location within the texture
+ * @param width: Width of the section to read from the texture
+ * @param height: Height of the section to read from the texture
+ *
+ * @return Buffer of RGBA pixels read from the texture.
+ *
+ */
+byte* Utils::GetPixels(const GLuint texture, uint x, uint y, uint width, uint height) {
+
+    // Pixels to return
+    byte* pixels = (byte*)calloc(width * height * 4, sizeof(byte));
+
+    // Attach to the texture
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    // Return the pixels that were read
+    return pixels;
+}
+
+
+
+/**
+ * Writes RGBA pixels to a texture.
+ *
+ * @param texture: ID of the texture to write to
+ * @param x: X coordinate of the location within the texture
+ * @param y: Y coordinate of the location within the texture
+ * @param width: Width of the section to write to the texture
+ * @param height: Height of the section to write to the texture
+ * @param pixels: Buffer of RGBA pixels to write
+ *
+ */
+void Utils::SetPixels(const GLuint texture, uint x, uint y, uint width, uint height, byte *pixels) {
+
+    TraceZone zone("GL texture update", "pixels", width * height);
+
+    // Bind to the target texture
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // Overwrite the rectangular region
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0,
+        x, y,
+        width, height,
+        GL_RGBA, GL_UNSIGNED_BYTE,
+        pixels
+    );
+
+    // Reset target
+    glBindTexture(GL_TEXTURE_2D, 0);
+}